@@ -0,0 +1,277 @@
+#include "arena.h"
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+static ArenaBacking default_backing = ARENA_MALLOC;
+static int default_numa_node = -1;
+
+static const char* BACKING_NAMES[NUM_ARENA_BACKINGS] = { "malloc", "pages", "huge" };
+
+static constexpr const size_t SMALL_PAGE_SIZE = 4096;
+
+static size_t round_up(size_t bytes, size_t to)
+{
+	return (bytes + to - 1) & ~(to - 1);
+}
+
+// mbind(2) without libnuma.
+static bool bind_to_node(void* p, size_t bytes, int numa_node)
+{
+	static constexpr const int MASK_WORDS = 16;
+	unsigned long mask[MASK_WORDS];
+	if( numa_node < 0 || numa_node >= MASK_WORDS * 64 )
+		return false;
+
+	memset(mask, 0, sizeof(mask));
+	mask[numa_node / 64] = 1UL << (numa_node % 64);
+	if( syscall(SYS_mbind, p, bytes, MPOL_BIND, mask, MASK_WORDS * 64, 0) != 0 )
+	{
+		perror("mbind");
+		return false;
+	}
+	return true;
+}
+
+void* Arena::MapPages(size_t bytes, ArenaBacking backing, int numa_node, bool* hugetlb)
+{
+	bool huge = backing == ARENA_HUGE_PAGES;
+	size_t size = round_up(bytes, huge ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE);
+	char* base = 0;
+
+	if( huge )
+	{
+		void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if( p != MAP_FAILED )
+			base = (char*)p;
+	}
+	if( hugetlb )
+		*hugetlb = base != 0;
+
+	if( !base )
+	{
+		// Over-map and trim to a 2MB boundary, so transparent huge pages
+		// can back the whole range.
+		size_t span = huge ? size + HUGE_PAGE_SIZE : size;
+		void* p = mmap(0, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if( p == MAP_FAILED )
+			return 0;
+
+		base = (char*)p;
+		if( huge )
+		{
+			char* aligned = (char*)round_up((size_t)base, HUGE_PAGE_SIZE);
+			if( aligned != base )
+				munmap(base, aligned - base);
+			if( aligned + size != base + span )
+				munmap(aligned + size, base + span - (aligned + size));
+			base = aligned;
+			madvise(base, size, MADV_HUGEPAGE);
+		}
+	}
+
+	// Before the first touch, so every page is allocated on the node.
+	if( numa_node >= 0 )
+		bind_to_node(base, size, numa_node);
+	return base;
+}
+
+void Arena::UnmapPages(void* p, size_t bytes, ArenaBacking backing)
+{
+	if( p )
+		munmap(p, round_up(bytes, backing == ARENA_HUGE_PAGES ? HUGE_PAGE_SIZE : SMALL_PAGE_SIZE));
+}
+
+void* Arena::HeapAllocate(size_t bytes)
+{
+	void* p = malloc(bytes);
+	if( !p )
+		throw std::bad_alloc();
+	return p;
+}
+
+Arena::Arena(ArenaBacking backing, int numa_node)
+	: backing(backing)
+	, numa_node(numa_node)
+	, next(0)
+	, end(0)
+	, current(0)
+	, used(0)
+	, allocations(0)
+{
+	memset(free_lists, 0, sizeof(free_lists));
+}
+
+Arena::~Arena()
+{
+	for(const Mapping& mapping : chunks)
+		UnmapPages(mapping.base, mapping.size, backing);
+	for(const Mapping& mapping : large)
+		UnmapPages(mapping.base, mapping.size, backing);
+}
+
+void Arena::NextChunk()
+{
+	// The rest of the chunk is left unused: every class fits in a fresh one.
+	if( next )
+		++current;
+
+	if( current == chunks.size() )
+	{
+		Mapping mapping;
+		mapping.size = CHUNK_SIZE;
+		mapping.base = (char*)MapPages(CHUNK_SIZE, backing, numa_node, &mapping.hugetlb);
+		if( !mapping.base )
+			throw std::bad_alloc();
+		chunks.push_back(mapping);
+	}
+
+	next = chunks[current].base;
+	end = next + chunks[current].size;
+}
+
+void* Arena::AllocateLarge(size_t bytes)
+{
+	Mapping mapping;
+	mapping.size = bytes;
+	mapping.base = (char*)MapPages(bytes, backing, numa_node, &mapping.hugetlb);
+	if( !mapping.base )
+		throw std::bad_alloc();
+
+	large.push_back(mapping);
+	used += bytes;
+	return mapping.base;
+}
+
+void Arena::FreeLarge(void* p, size_t bytes)
+{
+	auto found = std::find_if(large.begin(), large.end(), [p](const Mapping& mapping){ return mapping.base == p; });
+	if( found == large.end() )
+		return;
+
+	UnmapPages(found->base, found->size, backing);
+	*found = large.back();
+	large.pop_back();
+}
+
+void Arena::Reset()
+{
+	memset(free_lists, 0, sizeof(free_lists));
+	current = 0;
+	next = chunks.empty() ? 0 : chunks[0].base;
+	end = chunks.empty() ? 0 : next + chunks[0].size;
+
+	for(const Mapping& mapping : large)
+		UnmapPages(mapping.base, mapping.size, backing);
+	large.clear();
+
+	used = 0;
+	allocations = 0;
+}
+
+ArenaStats Arena::Stats() const
+{
+	ArenaStats stats;
+	memset(&stats, 0, sizeof(stats));
+	stats.chunks = chunks.size();
+	for(const Mapping& mapping : chunks)
+	{
+		stats.hugetlb_chunks += mapping.hugetlb;
+		stats.mapped += mapping.size;
+	}
+	for(const Mapping& mapping : large)
+		stats.mapped += mapping.size;
+	stats.used = used;
+	stats.allocations = allocations;
+	return stats;
+}
+
+void ConfigureArenas(ArenaBacking backing, int numa_node)
+{
+	default_backing = backing;
+	default_numa_node = numa_node;
+}
+
+ArenaBacking ArenaDefaultBacking()
+{
+	return default_backing;
+}
+
+int ArenaDefaultNumaNode()
+{
+	return default_numa_node;
+}
+
+Arena& ThreadArena()
+{
+	static thread_local Arena arena(default_backing, default_numa_node);
+	return arena;
+}
+
+bool BindThreadToNode(int numa_node)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numa_node);
+	FILE* file = fopen(path, "r");
+	if( !file )
+	{
+		perror(path);
+		return false;
+	}
+
+	// "0-3,8-11"
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	int first, last;
+	char separator;
+	while( fscanf(file, "%d", &first) == 1 )
+	{
+		last = first;
+		separator = '\n';
+		if( fscanf(file, "%c", &separator) == 1 && separator == '-' )
+		{
+			if( fscanf(file, "%d", &last) != 1 )
+				break;
+			if( fscanf(file, "%c", &separator) != 1 )
+				separator = '\n';
+		}
+
+		for(int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+			CPU_SET(cpu, &cpus);
+		if( separator != ',' )
+			break;
+	}
+	fclose(file);
+
+	if( CPU_COUNT(&cpus) == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) != 0 )
+	{
+		fprintf(stderr, "cannot bind to the CPUs of node %d\n", numa_node);
+		return false;
+	}
+	return true;
+}
+
+bool ParseArenaBacking(const char* text, ArenaBacking& backing)
+{
+	for(int b = 0; b < NUM_ARENA_BACKINGS; ++b)
+	{
+		if( strcmp(text, BACKING_NAMES[b]) == 0 )
+		{
+			backing = (ArenaBacking)b;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* ArenaBackingName(ArenaBacking backing)
+{
+	return backing < NUM_ARENA_BACKINGS ? BACKING_NAMES[backing] : "?";
+}
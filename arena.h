@@ -0,0 +1,271 @@
+#pragma once
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <functional>
+#include <map>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Where an arena gets its memory.
+enum ArenaBacking
+{
+	ARENA_MALLOC,		// straight from the heap; the arena only forwards
+	ARENA_PAGES,		// chunks of 4KB pages
+	ARENA_HUGE_PAGES,	// chunks of 2MB pages: reserved hugetlbfs pages if
+						// any are free, else transparent huge pages
+	NUM_ARENA_BACKINGS
+};
+
+struct ArenaStats
+{
+	size_t chunks;
+	size_t hugetlb_chunks;	// of chunks, on reserved huge pages
+	size_t mapped;			// bytes in chunks and large blocks
+	size_t used;			// bytes handed out since the last Reset, freed or not
+	uint64_t allocations;
+};
+
+// Bump allocator over large chunks of memory with a free list per size
+// class, so blocks given back are reused by the next allocation of their
+// class. Classes are 16 to 64 bytes in steps of 16, then four per power of
+// two, so at most a fifth of a block is unused. Meant for the state of one run on one thread:
+// everything in it is dropped at once by Reset(), which rewinds to the first
+// chunk without touching the blocks, so nothing in it may need its
+// destructor run. Chunks are kept mapped for the next run.
+//
+// Chunks are 2MB aligned, so with ARENA_HUGE_PAGES each 2MB of state is one
+// TLB entry. With numa_node >= 0 their pages are bound to that node.
+// Blocks larger than a quarter chunk get their own mapping.
+//
+// Not thread-safe; see ThreadArena().
+class Arena
+{
+public:
+	static constexpr const size_t HUGE_PAGE_SIZE = 2 << 20;
+	static constexpr const size_t CHUNK_SIZE = 4 * HUGE_PAGE_SIZE;
+	static constexpr const size_t MIN_BLOCK = 16;
+	static constexpr const int NUM_CLASSES = 64;		// MIN_BLOCK to CHUNK_SIZE / 4
+
+	Arena(ArenaBacking backing, int numa_node);
+	~Arena();
+
+	void* Allocate(size_t bytes)
+	{
+		if( backing == ARENA_MALLOC )
+			return HeapAllocate(bytes);
+
+		++allocations;
+		int size_class = SizeClass(bytes);
+		if( size_class >= NUM_CLASSES )
+			return AllocateLarge(bytes);
+
+		FreeBlock* block = free_lists[size_class];
+		if( block )
+		{
+			free_lists[size_class] = block->next;
+			return block;
+		}
+
+		size_t size = ClassSize(size_class);
+		if( size > (size_t)(end - next) )
+			NextChunk();
+
+		void* allocated = next;
+		next += size;
+		used += size;
+		return allocated;
+	}
+
+	// bytes as passed to Allocate.
+	void Free(void* p, size_t bytes)
+	{
+		if( backing == ARENA_MALLOC )
+		{
+			free(p);
+			return;
+		}
+
+		int size_class = SizeClass(bytes);
+		if( size_class >= NUM_CLASSES )
+		{
+			FreeLarge(p, bytes);
+			return;
+		}
+
+		FreeBlock* block = (FreeBlock*)p;
+		block->next = free_lists[size_class];
+		free_lists[size_class] = block;
+	}
+
+	// Drops every block. With ARENA_MALLOC the caller must have freed them.
+	void Reset();
+
+	ArenaBacking Backing() const { return backing; }
+	int NumaNode() const { return numa_node; }
+	ArenaStats Stats() const;
+
+	// Maps bytes (rounded up to pages) with backing, bound to numa_node if
+	// >= 0; for buffers that outlive an arena's Reset. 0 on failure.
+	static void* MapPages(size_t bytes, ArenaBacking backing, int numa_node, bool* hugetlb = 0);
+	static void UnmapPages(void* p, size_t bytes, ArenaBacking backing);
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct Mapping
+	{
+		char* base;
+		size_t size;
+		bool hugetlb;
+	};
+
+	static int SizeClass(size_t bytes)
+	{
+		if( bytes <= 4 * MIN_BLOCK )
+			return bytes ? (int)((bytes - 1) / MIN_BLOCK) : 0;
+
+		// The power of two below bytes - 1 and the quarter of it above.
+		size_t n = bytes - 1;
+		int log = 63 - __builtin_clzll((unsigned long long)n);
+		return 4 + (log - 6) * 4 + (int)((n >> (log - 2)) & 3);
+	}
+
+	static size_t ClassSize(int size_class)
+	{
+		if( size_class < 4 )
+			return (size_class + 1) * MIN_BLOCK;
+
+		int log = (size_class - 4) / 4 + 6;
+		return (size_t)(5 + (size_class - 4) % 4) << (log - 2);
+	}
+
+	static void* HeapAllocate(size_t bytes);
+
+	void NextChunk();
+	void* AllocateLarge(size_t bytes);
+	void FreeLarge(void* p, size_t bytes);
+
+	ArenaBacking backing;
+	int numa_node;
+
+	char* next;
+	char* end;
+	size_t current;			// chunk next points into
+	FreeBlock* free_lists[NUM_CLASSES];
+
+	std::vector<Mapping> chunks;
+	std::vector<Mapping> large;
+
+	size_t used;
+	uint64_t allocations;
+};
+
+// Backing and NUMA node of the arenas threads create from now on. Call
+// before parsing starts; ARENA_MALLOC and no node by default.
+void ConfigureArenas(ArenaBacking backing, int numa_node);
+
+ArenaBacking ArenaDefaultBacking();
+int ArenaDefaultNumaNode();
+
+// The calling thread's arena, created on first use with the configured
+// backing. Parser state lives here; ResetState() resets it.
+Arena& ThreadArena();
+
+// Restricts the calling thread, and threads it creates later, to the CPUs
+// of a NUMA node.
+bool BindThreadToNode(int numa_node);
+
+bool ParseArenaBacking(const char* text, ArenaBacking& backing);
+const char* ArenaBackingName(ArenaBacking backing);
+
+// Allocates from the calling thread's arena. Stateless, so containers using
+// it must be created, grown and destroyed on one thread, and must not be
+// used after that thread's arena is Reset.
+template<typename T>
+struct ArenaAllocator
+{
+	typedef T value_type;
+
+	ArenaAllocator() {}
+	template<typename U> ArenaAllocator(const ArenaAllocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		return (T*)ThreadArena().Allocate(n * sizeof(T));
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		ThreadArena().Free(p, n * sizeof(T));
+	}
+
+	template<typename U> bool operator==(const ArenaAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const ArenaAllocator<U>&) const { return false; }
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+template<typename K, typename V, typename Cmp = std::less<K> >
+using ArenaMap = std::map<K, V, Cmp, ArenaAllocator<std::pair<const K, V> > >;
+
+// Whether a T in an arena can be dropped by Reset() without its destructor
+// leaking anything: it is trivially destructible, an arena container of such
+// elements, or a type whose specialization lists its members with
+// ArenaMembers. A std::vector or std::string on the heap is none of these.
+template<typename T>
+struct ArenaResettable : std::is_trivially_destructible<T> {};
+
+template<typename T, size_t N>
+struct ArenaResettable<T[N]> : ArenaResettable<T> {};
+
+template<typename T>
+struct ArenaResettable<std::vector<T, ArenaAllocator<T> > > : ArenaResettable<T> {};
+
+template<typename K, typename V, typename Cmp>
+struct ArenaResettable<std::map<K, V, Cmp, ArenaAllocator<std::pair<const K, V> > > >
+	: std::integral_constant<bool, ArenaResettable<K>::value && ArenaResettable<V>::value> {};
+
+// Lays out Members in order from offset End, as the compiler lays out the
+// members of a class without bases.
+template<size_t End, typename... Members>
+struct ArenaLayout
+{
+	static constexpr const size_t end = End;
+	static constexpr const size_t align = 1;
+	static constexpr const bool resettable = true;
+};
+
+template<size_t End, typename Member, typename... Members>
+struct ArenaLayout<End, Member, Members...>
+{
+	typedef ArenaLayout<(End + alignof(Member) - 1) / alignof(Member) * alignof(Member) + sizeof(Member), Members...> Rest;
+
+	static constexpr const size_t end = Rest::end;
+	static constexpr const size_t align = alignof(Member) > Rest::align ? alignof(Member) : Rest::align;
+	static constexpr const bool resettable = ArenaResettable<Member>::value && Rest::resettable;
+};
+
+// ArenaResettable of a class T given the types of all its data members in
+// declaration order, as decltype(T::member). The members must add up to
+// sizeof(T), so a member left out of the list fails to compile unless it
+// fits in padding, which nothing owning memory does.
+template<typename T, typename... Members>
+struct ArenaMembers : std::integral_constant<bool, ArenaLayout<0, Members...>::resettable>
+{
+	typedef ArenaLayout<0, Members...> Layout;
+	static_assert((Layout::end + Layout::align - 1) / Layout::align * Layout::align == sizeof(T),
+			"ArenaMembers must list every data member of the class, in order");
+};
+
+#endif // _ARENA_H_
@@ -0,0 +1,161 @@
+#include "bar_aggregator.h"
+#include "cme_parser.h"
+
+#include <algorithm>
+
+static constexpr const char* BARS_HEADERS = "interval,start,symbol,open,high,low,close,volume,buy_volume,sell_volume,trades";
+static constexpr const char* VAP_HEADERS = "symbol,price,buy_volume,sell_volume";
+
+static const char* BAR_NAMES[NUM_BAR_INTERVALS] = { "1s", "1m", "5m" };
+
+const int64_t BarAggregator::INTERVAL_NS[NUM_BAR_INTERVALS] =
+{
+	1000000000LL,
+	60 * 1000000000LL,
+	300 * 1000000000LL
+};
+
+bool VolumeAtPrice::Cover(int64_t tick)
+{
+	if( buy.empty() )
+	{
+		base = tick - INITIAL_TICKS / 2;
+		buy.assign(INITIAL_TICKS, 0);
+		sell.assign(INITIAL_TICKS, 0);
+		return true;
+	}
+
+	// Grow to at least twice the size, up to MAX_TICKS, keeping the traded
+	// range centred. The new range holds the old one, so a tick once out of
+	// reach stays an outlier and never has a row in both. The span is
+	// unsigned, so a tick at the far end of the int64_t range cannot
+	// overflow it.
+	uint64_t span = tick < base ? (uint64_t)base - (uint64_t)tick + buy.size() : (uint64_t)tick - (uint64_t)base + 1;
+	if( span > (uint64_t)MAX_TICKS )
+		return false;
+
+	int64_t low = std::min(base, tick);
+	int64_t high = std::max(base + (int64_t)buy.size(), tick + 1);
+	int64_t size = std::min(std::max((int64_t)buy.size() * 2, high - low), (int64_t)MAX_TICKS);
+	int64_t new_base = low - (size - (high - low)) / 2;
+
+	ArenaVector<int64_t> new_buy(size, 0);
+	ArenaVector<int64_t> new_sell(size, 0);
+	std::copy(buy.begin(), buy.end(), new_buy.begin() + (base - new_base));
+	std::copy(sell.begin(), sell.end(), new_sell.begin() + (base - new_base));
+
+	base = new_base;
+	buy.swap(new_buy);
+	sell.swap(new_sell);
+	return true;
+}
+
+void VolumeAtPrice::AddOutlier(int64_t tick, int32_t qty, int aggressor_side)
+{
+	VolumeLevel& level = outliers.insert(std::make_pair(tick, VolumeLevel())).first->second;
+	if( aggressor_side == 1 )
+		level.buy += qty;
+	else if( aggressor_side == 2 )
+		level.sell += qty;
+}
+
+BarAggregator::BarAggregator()
+	: enabled(false)
+{
+	Reset();
+}
+
+void BarAggregator::Open(const char* bars_path, const char* vap_path)
+{
+	if( bars_path )
+	{
+		bars_file.open(bars_path);
+		bars_file << BARS_HEADERS << "\n";
+	}
+	if( vap_path )
+	{
+		vap_file.open(vap_path);
+		vap_file << VAP_HEADERS << "\n";
+	}
+	enabled = bars_path || vap_path;
+}
+
+void BarAggregator::Close()
+{
+	bars_file.close();
+	vap_file.close();
+	enabled = false;
+}
+
+void BarAggregator::Reset()
+{
+	for(int i = 0; i < NUM_BAR_INTERVALS; ++i)
+	{
+		boundary[i] = 0;
+		open_bars[i].clear();
+	}
+	next_boundary = 0;
+}
+
+void BarAggregator::Flush(int64_t ts)
+{
+	next_boundary = INT64_MAX;
+	for(int i = 0; i < NUM_BAR_INTERVALS; ++i)
+	{
+		if( ts >= boundary[i] )
+		{
+			for(const OpenBar& open : open_bars[i])
+				Emit(i, open);
+			open_bars[i].clear();
+			boundary[i] = ts - ts % INTERVAL_NS[i] + INTERVAL_NS[i];
+		}
+		next_boundary = std::min(next_boundary, boundary[i]);
+	}
+}
+
+void BarAggregator::FlushAll()
+{
+	for(int i = 0; i < NUM_BAR_INTERVALS; ++i)
+	{
+		for(const OpenBar& open : open_bars[i])
+			Emit(i, open);
+		open_bars[i].clear();
+	}
+}
+
+void BarAggregator::Emit(int interval, const OpenBar& open)
+{
+	Bar& bar = *open.bar;
+	bar.active = false;
+
+	if( !bars_file.is_open() )
+		return;
+
+	bars_file << BAR_NAMES[interval]
+			  << ',' << time_to_str(bar.start)
+			  << ',' << open.symbol
+			  << ',' << bar.open
+			  << ',' << bar.high
+			  << ',' << bar.low
+			  << ',' << bar.close
+			  << ',' << bar.volume
+			  << ',' << bar.buy_volume
+			  << ',' << bar.sell_volume
+			  << ',' << bar.trades
+			  << '\n';
+}
+
+void BarAggregator::WriteVolumeAtPrice(const char* symbol, const SecurityBars& bars, const PriceScale& scale)
+{
+	if( !vap_file.is_open() )
+		return;
+
+	bars.vap.ForEach([&](int64_t tick, int64_t buy, int64_t sell)
+	{
+		vap_file << symbol
+				 << ',' << scale.FromTick(tick).value
+				 << ',' << buy
+				 << ',' << sell
+				 << '\n';
+	});
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#ifndef _BAR_AGGREGATOR_H_
+#define _BAR_AGGREGATOR_H_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "price_scale.h"
+
+enum BarInterval
+{
+	BAR_1S,
+	BAR_1M,
+	BAR_5M,
+	NUM_BAR_INTERVALS
+};
+
+struct Bar
+{
+	int64_t start;
+	int64_t open;
+	int64_t high;
+	int64_t low;
+	int64_t close;
+	int64_t volume;
+	int64_t buy_volume;		// aggressor buys
+	int64_t sell_volume;	// aggressor sells
+	uint32_t trades;
+	bool active;			// has trades and has not been emitted
+};
+
+// Buy and sell volume at one tick.
+struct VolumeLevel
+{
+	int64_t buy;
+	int64_t sell;
+};
+
+// Traded volume by tick, split by aggressor side. Prices are tick indexes
+// (clean price / tick_size) into arrays that cover the range traded so far;
+// they are reallocated only when a trade falls outside it. The arrays span
+// at most MAX_TICKS: a trade further out, such as a bad print or a price
+// far off the first trade, goes to a sorted map instead.
+struct VolumeAtPrice
+{
+	static constexpr const int INITIAL_TICKS = 256;
+	static constexpr const int64_t MAX_TICKS = 1 << 16;
+
+	int64_t base;
+	ArenaVector<int64_t> buy;
+	ArenaVector<int64_t> sell;
+	ArenaMap<int64_t, VolumeLevel> outliers;
+
+	VolumeAtPrice()
+		: base(0)
+	{
+	}
+
+	void Add(int64_t tick, int32_t qty, int aggressor_side)
+	{
+		uint64_t i = (uint64_t)tick - (uint64_t)base;
+		if( i >= buy.size() )
+		{
+			if( !Cover(tick) )
+			{
+				AddOutlier(tick, qty, aggressor_side);
+				return;
+			}
+			i = (uint64_t)tick - (uint64_t)base;
+		}
+
+		if( aggressor_side == 1 )
+			buy[i] += qty;
+		else if( aggressor_side == 2 )
+			sell[i] += qty;
+	}
+
+	// Calls visit(tick, buy, sell) for every tick traded, in tick order.
+	template<typename Visit>
+	void ForEach(Visit visit) const
+	{
+		auto outlier = outliers.begin();
+		for(; outlier != outliers.end() && outlier->first < base; ++outlier)
+			visit(outlier->first, outlier->second.buy, outlier->second.sell);
+
+		for(size_t i = 0; i < buy.size(); ++i)
+		{
+			if( buy[i] != 0 || sell[i] != 0 )
+				visit(base + (int64_t)i, buy[i], sell[i]);
+		}
+
+		for(; outlier != outliers.end(); ++outlier)
+			visit(outlier->first, outlier->second.buy, outlier->second.sell);
+	}
+
+	// Grows the arrays to cover tick; false if that would take them past
+	// MAX_TICKS.
+	bool Cover(int64_t tick);
+
+	void AddOutlier(int64_t tick, int32_t qty, int aggressor_side);
+};
+
+// Bar state of one security.
+struct SecurityBars
+{
+	Bar bars[NUM_BAR_INTERVALS];
+	VolumeAtPrice vap;
+
+	SecurityBars()
+	{
+		for(int i = 0; i < NUM_BAR_INTERVALS; ++i)
+			bars[i].active = false;
+	}
+};
+
+template<>
+struct ArenaResettable<VolumeAtPrice> : ArenaMembers<VolumeAtPrice,
+	decltype(VolumeAtPrice::base), decltype(VolumeAtPrice::buy), decltype(VolumeAtPrice::sell),
+	decltype(VolumeAtPrice::outliers)> {};
+
+template<>
+struct ArenaResettable<SecurityBars> : ArenaMembers<SecurityBars, decltype(SecurityBars::bars), decltype(SecurityBars::vap)> {};
+
+// Builds 1s, 1m and 5m OHLCV bars and volume-at-price per security from
+// trades, in exchange (transact) time. Each trade is O(1): bars are aligned
+// to interval boundaries shared by all securities, so when a trade's time
+// crosses a boundary every bar still open in that interval is complete and
+// is written out. No memory is allocated per trade once the lists of open
+// bars and the price arrays have grown to size.
+class BarAggregator
+{
+public:
+	static const int64_t INTERVAL_NS[NUM_BAR_INTERVALS];
+
+	BarAggregator();
+
+	// Bars and volume-at-price are only built once opened.
+	void Open(const char* bars_path, const char* vap_path);
+	void Close();
+
+	bool Enabled() const { return enabled; }
+
+	// Emits the bars that ended at or before ts. Call before the trades of
+	// a message with its transact time.
+	void Advance(int64_t ts)
+	{
+		if( ts >= next_boundary )
+			Flush(ts);
+	}
+
+	void Trade(SecurityBars& bars, const char* symbol, int64_t ts,
+			CleanPrice clean, const PriceScale& scale, int32_t qty, int aggressor_side)
+	{
+		int64_t price = clean.value;
+		for(int i = 0; i < NUM_BAR_INTERVALS; ++i)
+		{
+			Bar& bar = bars.bars[i];
+			if( !bar.active )
+			{
+				bar.start = ts - ts % INTERVAL_NS[i];
+				bar.open = bar.high = bar.low = price;
+				bar.volume = bar.buy_volume = bar.sell_volume = 0;
+				bar.trades = 0;
+				bar.active = true;
+
+				OpenBar entry = { &bar, symbol };
+				open_bars[i].push_back(entry);
+			}
+
+			if( price > bar.high )
+				bar.high = price;
+			if( price < bar.low )
+				bar.low = price;
+			bar.close = price;
+			bar.volume += qty;
+			bar.buy_volume += aggressor_side == 1 ? qty : 0;
+			bar.sell_volume += aggressor_side == 2 ? qty : 0;
+			++bar.trades;
+		}
+
+		bars.vap.Add(scale.Tick(clean), qty, aggressor_side);
+	}
+
+	// Writes the bars still open at the end of the run.
+	void FlushAll();
+
+	// Writes the volume-at-price of one security.
+	void WriteVolumeAtPrice(const char* symbol, const SecurityBars& bars, const PriceScale& scale);
+
+	// Forgets open bars, for a new capture on this thread.
+	void Reset();
+
+private:
+	struct OpenBar
+	{
+		Bar* bar;
+		const char* symbol;
+	};
+
+	void Flush(int64_t ts);
+	void Emit(int interval, const OpenBar& open);
+
+	bool enabled;
+	int64_t boundary[NUM_BAR_INTERVALS];	// end of the current period
+	int64_t next_boundary;					// earliest of boundary[]
+	std::vector<OpenBar> open_bars[NUM_BAR_INTERVALS];
+
+	std::ofstream bars_file;
+	std::ofstream vap_file;
+};
+
+#endif // _BAR_AGGREGATOR_H_
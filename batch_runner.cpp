@@ -0,0 +1,304 @@
+#include "batch_runner.h"
+#include "capture_file.h"
+#include "cme_parser.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+static double steady_seconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool make_dir(const std::string& path)
+{
+	if( mkdir(path.c_str(), 0755) == 0 || errno == EEXIST )
+		return true;
+
+	perror(path.c_str());
+	return false;
+}
+
+// Capture name without directory and capture/compression extensions.
+static std::string capture_name(const std::string& path)
+{
+	std::string::size_type slash = path.rfind('/');
+	std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+	static const char* extensions[] = { ".gz", ".zst", ".erf", ".pcap" };
+	for(const char* ext : extensions)
+	{
+		size_t len = strlen(ext);
+		if( name.size() > len && name.compare(name.size() - len, len, ext) == 0 )
+			name.erase(name.size() - len);
+	}
+	return name;
+}
+
+BatchRunner::BatchRunner(const std::string& out_dir, int workers, CaptureIo io)
+	: out_dir(out_dir)
+	, workers(workers > 0 ? workers : 1)
+	, io(io)
+	, wall_seconds(0)
+{
+}
+
+void BatchRunner::SetBarOutputs(const char* bars_name, const char* vap_name)
+{
+	this->bars_name = bars_name ? bars_name : "";
+	this->vap_name = vap_name ? vap_name : "";
+}
+
+void BatchRunner::AddFile(const std::string& path)
+{
+	Job job;
+	job.path = path;
+	job.name = capture_name(path);
+	job.worker = -1;
+	job.ok = false;
+	job.packets = 0;
+	job.seconds = 0;
+
+	struct stat st;
+	job.bytes = stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+
+	// Captures of the same name from different directories get distinct
+	// output partitions.
+	std::string base = job.name;
+	for(int n = 1; ; ++n)
+	{
+		bool taken = false;
+		for(const Job& other : jobs)
+			taken |= other.name == job.name;
+		if( !taken )
+			break;
+		job.name = base + "_" + std::to_string(n);
+	}
+
+	jobs.push_back(job);
+}
+
+bool BatchRunner::AddInput(const char* dir_or_manifest)
+{
+	struct stat st;
+	if( stat(dir_or_manifest, &st) != 0 )
+	{
+		perror(dir_or_manifest);
+		return false;
+	}
+
+	if( S_ISDIR(st.st_mode) )
+	{
+		DIR* dir = opendir(dir_or_manifest);
+		if( !dir )
+		{
+			perror(dir_or_manifest);
+			return false;
+		}
+
+		std::vector<std::string> paths;
+		while( dirent* entry = readdir(dir) )
+		{
+			if( entry->d_name[0] == '.' )
+				continue;
+
+			std::string path = std::string(dir_or_manifest) + "/" + entry->d_name;
+			struct stat file_st;
+			if( stat(path.c_str(), &file_st) == 0 && S_ISREG(file_st.st_mode) )
+				paths.push_back(path);
+		}
+		closedir(dir);
+
+		std::sort(paths.begin(), paths.end());
+		for(const std::string& path : paths)
+			AddFile(path);
+		return true;
+	}
+
+	std::ifstream manifest(dir_or_manifest);
+	std::string line;
+	while( getline(manifest, line) )
+	{
+		std::string::size_type comment = line.find('#');
+		if( comment != std::string::npos )
+			line.erase(comment);
+
+		std::string::size_type first = line.find_first_not_of(" \t\r");
+		if( first == std::string::npos )
+			continue;
+		std::string::size_type last = line.find_last_not_of(" \t\r");
+		AddFile(line.substr(first, last - first + 1));
+	}
+	return true;
+}
+
+bool BatchRunner::Pop(int worker, size_t& job)
+{
+	{
+		WorkQueue& own = *queues[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if( !own.jobs.empty() )
+		{
+			job = own.jobs.front();
+			own.jobs.pop_front();
+			return true;
+		}
+	}
+
+	for(int i = 1; i < workers; ++i)
+	{
+		WorkQueue& victim = *queues[(worker + i) % workers];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if( !victim.jobs.empty() )
+		{
+			job = victim.jobs.back();
+			victim.jobs.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void BatchRunner::RunJob(int worker, Job& job)
+{
+	job.worker = worker;
+
+	std::string dir = out_dir + "/" + job.name;
+	if( !make_dir(dir) )
+		return;
+
+	CaptureReader reader;
+	if( !reader.Open(job.path.c_str(), io) )
+	{
+		perror(job.path.c_str());
+		return;
+	}
+
+	double start = steady_seconds();
+
+	ResetState();
+	OpenOutputs((dir + "/sweeps.csv").c_str(), (dir + "/icebergs.csv").c_str(), (dir + "/stops.csv").c_str());
+	if( !bars_name.empty() || !vap_name.empty() )
+	{
+		std::string bars_path = dir + "/" + bars_name;
+		std::string vap_path = dir + "/" + vap_name;
+		OpenBarOutputs(bars_name.empty() ? 0 : bars_path.c_str(), vap_name.empty() ? 0 : vap_path.c_str());
+	}
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	while( reader.Next(ts, frame, length) )
+	{
+		parse_packet(ts, frame, length);
+		++job.packets;
+	}
+
+	WriteResults();
+	CloseOutputs();
+	ResetState();
+
+	job.seconds = steady_seconds() - start;
+	job.ok = true;
+}
+
+void BatchRunner::Worker(int worker)
+{
+	IsolateDefinitions();
+
+	size_t job;
+	while( Pop(worker, job) )
+		RunJob(worker, jobs[job]);
+}
+
+bool BatchRunner::Run()
+{
+	if( !make_dir(out_dir) )
+		return false;
+
+	if( workers > (int)jobs.size() )
+		workers = jobs.empty() ? 1 : (int)jobs.size();
+
+	std::vector<size_t> order(jobs.size());
+	for(size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [this](size_t lhs, size_t rhs){ return jobs[lhs].bytes > jobs[rhs].bytes; });
+
+	queues.clear();
+	for(int w = 0; w < workers; ++w)
+		queues.emplace_back(new WorkQueue());
+	for(size_t i = 0; i < order.size(); ++i)
+		queues[i % workers]->jobs.push_back(order[i]);
+
+	double start = steady_seconds();
+
+	std::vector<std::thread> threads;
+	for(int w = 0; w < workers; ++w)
+		threads.emplace_back(&BatchRunner::Worker, this, w);
+	for(std::thread& thread : threads)
+		thread.join();
+
+	wall_seconds = steady_seconds() - start;
+
+	for(const Job& job : jobs)
+	{
+		if( !job.ok )
+			return false;
+	}
+	return true;
+}
+
+void BatchRunner::PrintSummary(FILE* out) const
+{
+	std::string summary_path = out_dir + "/summary.csv";
+	FILE* csv = fopen(summary_path.c_str(), "w");
+	if( csv )
+		fprintf(csv, "capture,output,worker,ok,bytes,packets,seconds,mb_per_sec,packets_per_sec\n");
+
+	fprintf(out, "%-40s %6s %10s %10s %8s %9s %12s\n", "capture", "worker", "MB", "packets", "seconds", "MB/s", "packets/s");
+
+	uint64_t total_bytes = 0;
+	uint64_t total_packets = 0;
+	double busy_seconds = 0;
+	int failed = 0;
+
+	for(const Job& job : jobs)
+	{
+		double mb = job.bytes / 1e6;
+		double mb_rate = job.seconds > 0 ? mb / job.seconds : 0.0;
+		double packet_rate = job.seconds > 0 ? job.packets / job.seconds : 0.0;
+
+		fprintf(out, "%-40s %6d %10.1f %10llu %8.3f %9.1f %12.0f%s\n",
+				job.name.c_str(), job.worker, mb, (unsigned long long)job.packets,
+				job.seconds, mb_rate, packet_rate, job.ok ? "" : " FAILED");
+
+		if( csv )
+			fprintf(csv, "%s,%s,%d,%d,%llu,%llu,%.6f,%.3f,%.0f\n",
+					job.path.c_str(), job.name.c_str(), job.worker, job.ok ? 1 : 0,
+					(unsigned long long)job.bytes, (unsigned long long)job.packets,
+					job.seconds, mb_rate, packet_rate);
+
+		total_bytes += job.bytes;
+		total_packets += job.packets;
+		busy_seconds += job.seconds;
+		failed += job.ok ? 0 : 1;
+	}
+
+	fprintf(out, "files=%zu failed=%d workers=%d bytes=%llu packets=%llu wall=%.3fs busy=%.3fs parallelism=%.2f throughput=%.1f MB/s\n",
+			jobs.size(), failed, workers, (unsigned long long)total_bytes, (unsigned long long)total_packets,
+			wall_seconds, busy_seconds, wall_seconds > 0 ? busy_seconds / wall_seconds : 0.0,
+			wall_seconds > 0 ? total_bytes / 1e6 / wall_seconds : 0.0);
+
+	if( csv )
+		fclose(csv);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef _BATCH_RUNNER_H_
+#define _BATCH_RUNNER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "capture_file.h"
+
+// Runs many captures through the parser on a pool of worker threads.
+//
+// Each worker owns a queue of captures, dealt largest first. A worker takes
+// from the front of its own queue and, once that is empty, steals from the
+// back of another worker's queue, so a few large files do not leave the
+// other cores idle. Parser state is thread-local and reset between files,
+// so every capture is processed as if by its own process; outputs go to
+// <out_dir>/<capture name>/{sweeps,icebergs,stops}.csv, and the bar and
+// volume-at-price files named by SetBarOutputs() next to them.
+//
+// The security universe must already be loaded; it is shared read-only.
+// Instrument definitions in a capture are only seen by that capture (see
+// IsolateDefinitions()).
+class BatchRunner
+{
+public:
+	BatchRunner(const std::string& out_dir, int workers, CaptureIo io = CAPTURE_IO_STDIO);
+
+	// Adds every regular file in a directory, or every path listed in a
+	// manifest (one per line, '#' starts a comment).
+	bool AddInput(const char* dir_or_manifest);
+
+	// File names, within each capture's directory, for its bars and
+	// volume-at-price; 0 for none, the default.
+	void SetBarOutputs(const char* bars_name, const char* vap_name);
+
+	bool Run();
+
+	// Per-file throughput and totals; also written to <out_dir>/summary.csv.
+	void PrintSummary(FILE* out) const;
+
+private:
+	struct Job
+	{
+		std::string path;
+		std::string name;
+		uint64_t bytes;
+
+		int worker;
+		bool ok;
+		uint64_t packets;
+		double seconds;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<size_t> jobs;
+	};
+
+	void AddFile(const std::string& path);
+	bool Pop(int worker, size_t& job);
+	void Worker(int worker);
+	void RunJob(int worker, Job& job);
+
+	std::string out_dir;
+	int workers;
+	CaptureIo io;
+	std::string bars_name;
+	std::string vap_name;
+	std::vector<Job> jobs;
+	std::vector<std::unique_ptr<WorkQueue> > queues;
+	double wall_seconds;
+};
+
+#endif // _BATCH_RUNNER_H_
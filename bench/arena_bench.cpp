@@ -0,0 +1,226 @@
+// Parses a capture from memory with the per-thread parser state allocated
+// from each arena backing, and reports the parse time, the time ResetState()
+// takes to drop the state, minor page faults, dTLB load misses and how the
+// state ended up backed. Each backing runs on a new thread, so it starts
+// with a new arena; the first run there pays for faulting its memory in, as
+// a batch worker does for its first capture, and the best of the following
+// --runs is what every later capture costs.
+//
+// dTLB misses need a PMU; without one (most VMs) they are shown as "-" and
+// the page faults, one per 4KB page or one per 2MB page touched, are the
+// indication of the page size. "thp MB" is the process's AnonHugePages,
+// which includes the capture buffer when the kernel gave it huge pages too.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+#include "arena.h"
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+struct Frame
+{
+	int64_t ts;
+	size_t offset;
+	int length;
+};
+
+struct RunResult
+{
+	double parse_ms;
+	double teardown_us;
+	long minor_faults;
+	bool tlb_available;
+	uint64_t tlb_misses;
+	ArenaStats stats;
+	long thp_kb;
+};
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static long thread_minor_faults()
+{
+	rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_minflt;
+}
+
+static long anon_huge_kb()
+{
+	FILE* file = fopen("/proc/self/smaps_rollup", "r");
+	if( !file )
+		return -1;
+
+	char line[256];
+	long kb = -1;
+	while( fgets(line, sizeof(line), file) )
+	{
+		if( sscanf(line, "AnonHugePages: %ld kB", &kb) == 1 )
+			break;
+	}
+	fclose(file);
+	return kb;
+}
+
+// dTLB load misses of the calling thread, user space; -1 without a PMU.
+static int open_tlb_counter()
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static bool load_capture(const char* path, std::vector<char>& data, std::vector<Frame>& frames)
+{
+	CaptureReader reader;
+	if( !reader.Open(path) )
+	{
+		perror(path);
+		return false;
+	}
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	while( reader.Next(ts, frame, length) )
+	{
+		Frame f;
+		f.ts = ts;
+		f.offset = data.size();
+		f.length = length;
+		frames.push_back(f);
+		data.insert(data.end(), frame, frame + length);
+	}
+	return true;
+}
+
+static void run(const std::vector<char>& data, const std::vector<Frame>& frames, RunResult& result)
+{
+	int tlb = open_tlb_counter();
+	result.tlb_available = tlb >= 0;
+	result.tlb_misses = 0;
+
+	ResetState();
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+
+	long faults = thread_minor_faults();
+	if( tlb >= 0 )
+	{
+		ioctl(tlb, PERF_EVENT_IOC_RESET, 0);
+		ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	int64_t start = steady_ns();
+	for(const Frame& f : frames)
+		parse_packet(f.ts, &data[f.offset], f.length);
+	result.parse_ms = (steady_ns() - start) / 1e6;
+
+	if( tlb >= 0 )
+	{
+		ioctl(tlb, PERF_EVENT_IOC_DISABLE, 0);
+		if( read(tlb, &result.tlb_misses, sizeof(result.tlb_misses)) != sizeof(result.tlb_misses) )
+			result.tlb_available = false;
+		close(tlb);
+	}
+	result.minor_faults = thread_minor_faults() - faults;
+
+	CloseOutputs();
+	result.stats = ThreadArena().Stats();
+	result.thp_kb = anon_huge_kb();
+
+	start = steady_ns();
+	ResetState();
+	result.teardown_us = (steady_ns() - start) / 1e3;
+}
+
+static void print_result(const char* backing, const char* run, const RunResult& result, size_t packets)
+{
+	char tlb[32];
+	if( result.tlb_available )
+		snprintf(tlb, sizeof(tlb), "%llu", (unsigned long long)result.tlb_misses);
+	else
+		snprintf(tlb, sizeof(tlb), "-");
+
+	printf("%-8s %-5s %10.1f %10.1f %12.1f %12ld %12s %10.1f %7zu %8zu %8.1f\n", backing, run,
+			result.parse_ms, result.parse_ms * 1e6 / packets, result.teardown_us, result.minor_faults, tlb,
+			result.stats.used / 1048576.0, result.stats.chunks, result.stats.hugetlb_chunks, result.thp_kb / 1024.0);
+}
+
+int main(int argc, char** argv)
+{
+	const char* capture = 0;
+	int runs = 5;
+	for(int i = 1; i < argc; ++i)
+	{
+		if( strcmp(argv[i], "--runs") == 0 && i + 1 < argc )
+			runs = atoi(argv[++i]);
+		else if( !capture )
+			capture = argv[i];
+		else
+			capture = 0, i = argc;
+	}
+	if( !capture || runs <= 0 )
+	{
+		fprintf(stderr, "usage: %s <capture> [--runs <n>]\n", argv[0]);
+		return 1;
+	}
+
+	std::cout.rdbuf(0);
+	LoadSecInfo();
+
+	std::vector<char> data;
+	std::vector<Frame> frames;
+	if( !load_capture(capture, data, frames) )
+		return 1;
+
+	printf("packets=%zu bytes=%zu runs=%d\n", frames.size(), data.size(), runs);
+	printf("%-8s %-5s %10s %10s %12s %12s %12s %10s %7s %8s %8s\n", "backing", "run", "parse ms", "ns/packet", "teardown us",
+			"minor flt", "dtlb miss", "state MB", "chunks", "hugetlb", "thp MB");
+
+	for(int b = 0; b < NUM_ARENA_BACKINGS; ++b)
+	{
+		ConfigureArenas((ArenaBacking)b, -1);
+
+		RunResult first, best;
+		std::thread worker([&]()
+		{
+			run(data, frames, first);
+			for(int r = 0; r < runs; ++r)
+			{
+				RunResult result;
+				run(data, frames, result);
+				if( r == 0 || result.parse_ms < best.parse_ms )
+					best = result;
+			}
+		});
+		worker.join();
+
+		print_result(ArenaBackingName((ArenaBacking)b), "first", first, frames.size());
+		print_result(ArenaBackingName((ArenaBacking)b), "best", best, frames.size());
+	}
+	return 0;
+}
@@ -0,0 +1,159 @@
+// Parses a capture with book sampling off and at a range of sampling rates,
+// and reports the parse time added by sampling, sampled rows per second of
+// wall time, the encoded size per row, and how fast BookSampleReader reads
+// the file back.
+//
+// The capture is loaded into memory first so only parsing is timed; the
+// sample file goes to --out.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+#include "book_sampler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Frame
+{
+	int64_t ts;
+	size_t offset;
+	int length;
+};
+
+struct Setting
+{
+	const char* name;
+	int64_t interval_ns;
+	uint32_t every_events;
+};
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int64_t parse_all(const std::vector<char>& data, const std::vector<Frame>& frames, const Setting* setting, const std::string& path, int depth)
+{
+	ResetState();
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+	if( setting && !OpenBookSamples(path.c_str(), setting->interval_ns, setting->every_events, depth) )
+	{
+		perror(path.c_str());
+		exit(1);
+	}
+
+	int64_t start = steady_ns();
+	for(const Frame& f : frames)
+		parse_packet(f.ts, &data[f.offset], f.length);
+	// Closing writes the last sample.
+	CloseOutputs();
+	int64_t elapsed = steady_ns() - start;
+
+	ResetState();
+	return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+	if( argc < 2 )
+	{
+		fprintf(stderr, "usage: %s <capture> [--out <dir>] [--depth <n>]\n", argv[0]);
+		return 1;
+	}
+
+	std::string out_dir = "/tmp";
+	int depth = 5;
+	for(int i = 2; i + 1 < argc; i += 2)
+	{
+		if( strcmp(argv[i], "--out") == 0 )
+			out_dir = argv[i + 1];
+		else if( strcmp(argv[i], "--depth") == 0 )
+			depth = atoi(argv[i + 1]);
+	}
+
+	std::cout.rdbuf(0);
+	LoadSecInfo();
+
+	std::vector<char> data;
+	std::vector<Frame> frames;
+	{
+		CaptureReader reader;
+		if( !reader.Open(argv[1]) )
+		{
+			perror(argv[1]);
+			return 1;
+		}
+
+		int64_t ts;
+		const char* frame;
+		int length;
+		while( reader.Next(ts, frame, length) )
+		{
+			Frame f;
+			f.ts = ts;
+			f.offset = data.size();
+			f.length = length;
+			frames.push_back(f);
+			data.insert(data.end(), frame, frame + length);
+		}
+	}
+
+	if( frames.empty() )
+		return 0;
+
+	printf("packets=%zu capture span=%.1fs depth=%d\n", frames.size(), (frames.back().ts - frames.front().ts) / 1e9, depth);
+
+	int64_t baseline = parse_all(data, frames, 0, "", depth);
+	printf("%-10s %10s %9s %12s %12s %10s %14s\n", "sampling", "parse ms", "added", "rows", "rows/s", "bytes/row", "read rows/s");
+	printf("%-10s %10.1f\n", "off", baseline / 1e6);
+
+	static const Setting settings[] =
+	{
+		{ "1s", 1000000000LL, 0 },
+		{ "100ms", 100000000LL, 0 },
+		{ "10ms", 10000000LL, 0 },
+		{ "1ms", 1000000LL, 0 },
+		{ "100 events", 0, 100 },
+		{ "10 events", 0, 10 },
+		{ "1 event", 0, 1 },
+	};
+
+	std::string path = out_dir + "/book_sampler_bench.bin";
+	for(const Setting& setting : settings)
+	{
+		int64_t elapsed = parse_all(data, frames, &setting, path, depth);
+
+		BookSampleReader reader;
+		if( !reader.Open(path.c_str()) )
+			return 1;
+
+		uint64_t rows = 0;
+		int64_t start = steady_ns();
+		BookSampleRow row;
+		while( reader.Next(row) )
+			++rows;
+		int64_t read_elapsed = steady_ns() - start;
+
+		FILE* f = fopen(path.c_str(), "rb");
+		fseek(f, 0, SEEK_END);
+		long size = ftell(f);
+		fclose(f);
+
+		printf("%-10s %10.1f %8.1f%% %12llu %12.0f %10.1f %14.0f%s\n",
+				setting.name, elapsed / 1e6, 100.0 * (elapsed - baseline) / baseline,
+				(unsigned long long)rows, rows / (elapsed / 1e9),
+				rows ? (double)(size - sizeof(BookSampleHeader)) / rows : 0.0,
+				read_elapsed ? rows / (read_elapsed / 1e9) : 0.0,
+				reader.Ok() ? "" : " (corrupt)");
+	}
+
+	return 0;
+}
@@ -0,0 +1,201 @@
+// Compares reading an uncompressed capture through CaptureReader with fread,
+// mmap and io_uring read-ahead, from a cold and a warm page cache, reading
+// only and reading plus parse_packet(). Best of --runs for each.
+//
+// Before a cold pass the capture's pages are dropped from the page cache
+// with posix_fadvise(POSIX_FADV_DONTNEED); "cached" is the share of them
+// still resident (mincore) when the pass starts, so a pass that could not
+// be made cold shows. Storage below the guest (a hypervisor's own cache, a
+// NAS) may still hold the data; use a capture larger than that cache, or
+// drop it there, for numbers that reflect the device. io_uring reads with
+// O_DIRECT where the filesystem allows, which leaves the page cache cold:
+// its warm passes read from the device too. "stalls" counts the blocks the
+// parser had to wait for.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+
+static volatile uint64_t checksum;
+
+struct Pass
+{
+	double seconds;
+	double cached;
+	uint64_t packets;
+	uint64_t stalls;
+};
+
+static double steady_seconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Share of the file's pages in the page cache, -1 if unknown.
+static double resident_share(const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if( fd < 0 )
+		return -1;
+
+	struct stat st;
+	if( fstat(fd, &st) != 0 || st.st_size == 0 )
+	{
+		close(fd);
+		return -1;
+	}
+
+	double share = -1;
+	void* mapped = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if( mapped != MAP_FAILED )
+	{
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t pages = ((size_t)st.st_size + page - 1) / page;
+		std::vector<unsigned char> in_core(pages);
+		if( mincore(mapped, st.st_size, &in_core[0]) == 0 )
+		{
+			size_t resident = 0;
+			for(unsigned char c : in_core)
+				resident += c & 1;
+			share = (double)resident / pages;
+		}
+		munmap(mapped, st.st_size);
+	}
+	close(fd);
+	return share;
+}
+
+static void drop_cache(const char* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if( fd < 0 )
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static bool run_pass(const char* path, CaptureIo io, bool cold, bool parse, Pass& pass, bool& direct)
+{
+	if( cold )
+		drop_cache(path);
+	pass.cached = resident_share(path);
+
+	ResetState();
+	pass.packets = 0;
+
+	double start = steady_seconds();
+
+	CaptureReader reader;
+	if( !reader.Open(path, io) )
+	{
+		perror(path);
+		return false;
+	}
+
+	// Touch the end of every frame, as parsing would.
+	int64_t ts;
+	const char* frame;
+	int length;
+	uint64_t sum = 0;
+	while( reader.Next(ts, frame, length) )
+	{
+		if( parse )
+			parse_packet(ts, frame, length);
+		else
+			sum += (unsigned char)frame[length - 1];
+		++pass.packets;
+	}
+
+	pass.seconds = steady_seconds() - start;
+	pass.stalls = reader.Uring() ? reader.Uring()->Stalls() : 0;
+	direct = reader.Uring() && reader.Uring()->Direct();
+	checksum = sum;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const char* capture = 0;
+	int runs = 3;
+	for(int i = 1; i < argc; ++i)
+	{
+		if( strcmp(argv[i], "--runs") == 0 && i + 1 < argc )
+			runs = atoi(argv[++i]);
+		else if( !capture )
+			capture = argv[i];
+		else
+			capture = 0, i = argc;
+	}
+	if( !capture || runs <= 0 )
+	{
+		fprintf(stderr, "usage: %s <uncompressed capture> [--runs <n>]\n", argv[0]);
+		return 1;
+	}
+
+	struct stat st;
+	if( stat(capture, &st) != 0 )
+	{
+		perror(capture);
+		return 1;
+	}
+	double file_mb = st.st_size / 1e6;
+
+	std::cout.rdbuf(0);
+	LoadSecInfo();
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+
+	printf("capture=%s MB=%.1f runs=%d\n", capture, file_mb, runs);
+	printf("%-6s %-5s %-6s %8s %10s %8s %12s %8s\n", "io", "cache", "pass", "ms", "MB/s", "cached", "packets", "stalls");
+
+	for(int parse = 0; parse < 2; ++parse)
+	{
+		for(int cold = 1; cold >= 0; --cold)
+		{
+			for(int io = 0; io < NUM_CAPTURE_IOS; ++io)
+			{
+				Pass best;
+				bool direct = false;
+				for(int r = 0; r < runs; ++r)
+				{
+					// A warm pass starts from a cache the previous pass filled.
+					Pass pass;
+					if( !cold && r == 0 && !run_pass(capture, (CaptureIo)io, false, false, pass, direct) )
+						return 1;
+					if( !run_pass(capture, (CaptureIo)io, cold, parse, pass, direct) )
+						return 1;
+					if( r == 0 || pass.seconds < best.seconds )
+						best = pass;
+				}
+
+				char cached[16];
+				if( best.cached < 0 )
+					snprintf(cached, sizeof(cached), "-");
+				else
+					snprintf(cached, sizeof(cached), "%.0f%%", best.cached * 100);
+
+				printf("%-6s %-5s %-6s %8.1f %10.1f %8s %12llu %8llu%s\n",
+						CaptureIoName((CaptureIo)io), cold ? "cold" : "warm", parse ? "parse" : "read",
+						best.seconds * 1e3, file_mb / best.seconds, cached,
+						(unsigned long long)best.packets, (unsigned long long)best.stalls,
+						direct ? "  O_DIRECT" : "");
+			}
+		}
+	}
+
+	CloseOutputs();
+	return 0;
+}
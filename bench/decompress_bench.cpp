@@ -0,0 +1,202 @@
+// Compares reading a capture uncompressed with reading it gzip and zstd
+// compressed through CaptureReader, where decoding runs on its own thread.
+// The capture is compressed into --out first. Each variant is timed reading
+// only and reading plus parse_packet(); rates are in uncompressed bytes.
+// The decode CPU column is the decoding thread's time: when read+parse wall
+// time is close to the larger of decode CPU and the uncompressed parse time,
+// decoding is overlapped with parsing.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef CME_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef CME_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static double steady_seconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool read_file(const char* path, std::vector<char>& data)
+{
+	FILE* f = fopen(path, "rb");
+	if( !f )
+		return false;
+
+	char buffer[1 << 16];
+	size_t n;
+	while( (n = fread(buffer, 1, sizeof(buffer), f)) > 0 )
+		data.insert(data.end(), buffer, buffer + n);
+	fclose(f);
+	return true;
+}
+
+static bool write_file(const std::string& path, const char* data, size_t length)
+{
+	FILE* f = fopen(path.c_str(), "wb");
+	if( !f )
+		return false;
+	bool ok = fwrite(data, 1, length, f) == length;
+	fclose(f);
+	return ok;
+}
+
+#ifdef CME_HAVE_ZLIB
+static bool write_gzip(const std::string& path, const std::vector<char>& data)
+{
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	// 15 window bits, +16 for a gzip header.
+	if( deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK )
+		return false;
+
+	std::vector<char> out(deflateBound(&z, data.size()));
+	z.next_in = (Bytef*)data.data();
+	z.avail_in = (uInt)data.size();
+	z.next_out = (Bytef*)&out[0];
+	z.avail_out = (uInt)out.size();
+	int ret = deflate(&z, Z_FINISH);
+	size_t length = out.size() - z.avail_out;
+	deflateEnd(&z);
+
+	return ret == Z_STREAM_END && write_file(path, out.data(), length);
+}
+#endif
+
+#ifdef CME_HAVE_ZSTD
+static bool write_zstd(const std::string& path, const std::vector<char>& data)
+{
+	std::vector<char> out(ZSTD_compressBound(data.size()));
+	size_t length = ZSTD_compress(&out[0], out.size(), data.data(), data.size(), 3);
+	return !ZSTD_isError(length) && write_file(path, out.data(), length);
+}
+#endif
+
+struct Pass
+{
+	double seconds;
+	double decode_seconds;
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+static bool run_pass(const std::string& path, bool parse, Pass& pass)
+{
+	CaptureReader reader;
+	if( !reader.Open(path.c_str()) )
+	{
+		perror(path.c_str());
+		return false;
+	}
+
+	ResetState();
+	pass.packets = 0;
+	pass.bytes = 0;
+
+	double start = steady_seconds();
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	while( reader.Next(ts, frame, length) )
+	{
+		if( parse )
+			parse_packet(ts, frame, length);
+		++pass.packets;
+		pass.bytes += length;
+	}
+
+	pass.seconds = steady_seconds() - start;
+	pass.decode_seconds = reader.DecodeSeconds();
+	return true;
+}
+
+static void report(const char* name, const std::string& path, size_t file_bytes, size_t raw_bytes)
+{
+	Pass read_only, parsed;
+	if( !run_pass(path, false, read_only) || !run_pass(path, true, parsed) )
+		return;
+
+	printf("%-6s %8.1f %6.2f %10.1f %10.1f %12.0f %11.3f %11.3f\n",
+			name, file_bytes / 1e6, (double)raw_bytes / file_bytes,
+			raw_bytes / 1e6 / read_only.seconds, raw_bytes / 1e6 / parsed.seconds,
+			parsed.packets / parsed.seconds, parsed.seconds, parsed.decode_seconds);
+}
+
+int main(int argc, char** argv)
+{
+	if( argc < 2 )
+	{
+		fprintf(stderr, "usage: %s <capture> [--out <dir>]\n", argv[0]);
+		return 1;
+	}
+
+	std::string out_dir = "/tmp";
+	for(int i = 2; i + 1 < argc; i += 2)
+	{
+		if( strcmp(argv[i], "--out") == 0 )
+			out_dir = argv[i + 1];
+	}
+
+	std::vector<char> data;
+	if( !read_file(argv[1], data) )
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	std::cout.rdbuf(0);
+	LoadSecInfo();
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+
+	printf("%-6s %8s %6s %10s %10s %12s %11s %11s\n",
+			"codec", "file MB", "ratio", "read MB/s", "parse MB/s", "packets/s", "parse wall", "decode cpu");
+
+	report("none", argv[1], data.size(), data.size());
+
+#ifdef CME_HAVE_ZLIB
+	std::string gzip_path = out_dir + "/decompress_bench.gz";
+	if( write_gzip(gzip_path, data) )
+	{
+		FILE* f = fopen(gzip_path.c_str(), "rb");
+		fseek(f, 0, SEEK_END);
+		size_t size = ftell(f);
+		fclose(f);
+		report("gzip", gzip_path, size, data.size());
+	}
+#else
+	printf("gzip   not supported by this build\n");
+#endif
+
+#ifdef CME_HAVE_ZSTD
+	std::string zstd_path = out_dir + "/decompress_bench.zst";
+	if( write_zstd(zstd_path, data) )
+	{
+		FILE* f = fopen(zstd_path.c_str(), "rb");
+		fseek(f, 0, SEEK_END);
+		size_t size = ftell(f);
+		fclose(f);
+		report("zstd", zstd_path, size, data.size());
+	}
+#else
+	printf("zstd   not supported by this build\n");
+#endif
+
+	CloseOutputs();
+	return 0;
+}
@@ -0,0 +1,398 @@
+// Times ImpliedEngine updates on synthetic product complexes: n outrights,
+// every calendar spread between them (known only by symbol, as from the
+// cache) and a butterfly on each three consecutive outrights (defined with
+// legs, as by template 56). Exchange insides of random instruments move
+// around a random walk; each update is followed by a flush every few
+// updates, as at the end of an event. Reports the cost per update and how
+// many relations it recomputed.
+//
+// --check compares every implied inside with one recomputed from scratch
+// after each update.
+//
+// With a cme_ids.txt in the working directory, it also builds the relations
+// of every spread in it and times updates of random instruments of the
+// whole registry, weighted towards the outrights that are legs.
+
+#include "implied_engine.h"
+#include "instrument_registry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+static constexpr const int64_t TICK = 1000000;
+static constexpr const int EVENT_UPDATES = 4;
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+struct Instrument
+{
+	const InstrumentDef* def;
+	std::vector<int> legs;		// into instruments, empty for outrights
+	std::vector<int> ratios;
+	ImpliedQuote bid;
+	ImpliedQuote ask;
+};
+
+struct Update
+{
+	int instrument;
+	ImpliedQuote bid;
+	ImpliedQuote ask;
+};
+
+struct Complex
+{
+	InstrumentRegistry registry;
+	std::vector<Instrument> instruments;
+	int outrights;
+};
+
+static const InstrumentDef* add(InstrumentRegistry& registry, int32_t sec_id, const std::string& symbol)
+{
+	InstrumentDef def;
+	memset(&def, 0, sizeof(def));
+	def.sec_id = sec_id;
+	strncpy(def.symbol, symbol.c_str(), sizeof(def.symbol) - 1);
+	def.price_shift = TICK;
+	def.tick_size = 1;
+	return registry.Register(def, false);
+}
+
+static void build(Complex& complex, int outrights)
+{
+	complex.outrights = outrights;
+	std::vector<Instrument>& instruments = complex.instruments;
+	int32_t sec_id = 1;
+
+	for(int i = 0; i < outrights; ++i)
+	{
+		Instrument instrument;
+		instrument.def = add(complex.registry, sec_id++, "BN" + std::to_string(i));
+		instruments.push_back(instrument);
+	}
+
+	for(int i = 0; i < outrights; ++i)
+	{
+		for(int j = i + 1; j < outrights; ++j)
+		{
+			Instrument instrument;
+			instrument.def = add(complex.registry, sec_id++, "BN" + std::to_string(i) + "-BN" + std::to_string(j));
+			instrument.legs = { i, j };
+			instrument.ratios = { 1, -1 };
+			instruments.push_back(instrument);
+		}
+	}
+
+	for(int i = 0; i + 2 < outrights; ++i)
+	{
+		InstrumentDef def;
+		memset(&def, 0, sizeof(def));
+		def.sec_id = sec_id++;
+		snprintf(def.symbol, sizeof(def.symbol), "BN:BF %d", i);
+		def.price_shift = TICK;
+		def.tick_size = 1;
+		def.from_definition = true;
+		def.num_legs = 3;
+		static const int ratios[3] = { 1, -2, 1 };
+		Instrument instrument;
+		for(int l = 0; l < 3; ++l)
+		{
+			def.legs[l].sec_id = instruments[i + l].def->sec_id;
+			def.legs[l].ratio = ratios[l];
+			instrument.legs.push_back(i + l);
+			instrument.ratios.push_back(ratios[l]);
+		}
+		instrument.def = complex.registry.Register(def, false);
+		instruments.push_back(instrument);
+	}
+
+	for(Instrument& instrument : instruments)
+		instrument.bid = instrument.ask = ImpliedQuote{ 0, 0 };
+}
+
+// Insides move around a fair value per outright; spreads are quoted around
+// the fair value of their legs, sometimes one-sided or empty.
+static void generate(const Complex& complex, int count, std::vector<Update>& updates, uint32_t seed)
+{
+	std::mt19937 random(seed);
+	std::vector<int64_t> fair(complex.outrights);
+	for(int i = 0; i < complex.outrights; ++i)
+		fair[i] = 10000 + 5 * i;
+
+	int spreads = (int)complex.instruments.size() - complex.outrights;
+	for(int u = 0; u < count; ++u)
+	{
+		Update update;
+		if( random() % 10 < 7 || spreads == 0 )
+		{
+			int i = random() % complex.outrights;
+			fair[i] += (int)(random() % 3) - 1;
+			update.instrument = i;
+		}
+		else
+			update.instrument = complex.outrights + random() % spreads;
+
+		const Instrument& instrument = complex.instruments[update.instrument];
+		int64_t value = instrument.legs.empty() ? fair[update.instrument] : 0;
+		for(size_t l = 0; l < instrument.legs.size(); ++l)
+			value += instrument.ratios[l] * fair[instrument.legs[l]];
+
+		int64_t width = 1 + random() % 3;
+		int64_t offset = (int)(random() % 3) - 1;
+		update.bid = ImpliedQuote{ (value + offset - width) * TICK, (int32_t)(random() % 50) };
+		update.ask = ImpliedQuote{ (value + offset + width) * TICK, (int32_t)(random() % 50) };
+		updates.push_back(update);
+	}
+}
+
+// Implieds of every instrument from scratch, as the engine defines them.
+static void reference(const Complex& complex, std::vector<ImpliedQuote>& bids, std::vector<ImpliedQuote>& asks)
+{
+	const std::vector<Instrument>& instruments = complex.instruments;
+	bids.assign(instruments.size(), ImpliedQuote{ 0, 0 });
+	asks.assign(instruments.size(), ImpliedQuote{ 0, 0 });
+
+	auto merge = [](ImpliedQuote& best, const ImpliedQuote& quote, bool is_bid)
+	{
+		if( quote.quantity == 0 )
+			return;
+		if( best.quantity == 0 || (is_bid ? quote.price > best.price : quote.price < best.price) )
+			best = quote;
+		else if( quote.price == best.price )
+			best.quantity += quote.quantity;
+	};
+
+	// The price and lots of a side of the legs other than skip: bought legs
+	// on side, sold legs on the other.
+	auto sum = [&](const Instrument& spread, int skip, bool bid_side, int64_t& price, int32_t& lots)
+	{
+		price = 0;
+		for(size_t l = 0; l < spread.legs.size(); ++l)
+		{
+			if( (int)l == skip )
+				continue;
+			const Instrument& leg = instruments[spread.legs[l]];
+			int ratio = spread.ratios[l];
+			const ImpliedQuote& quote = (ratio > 0) == bid_side ? leg.bid : leg.ask;
+			if( quote.quantity / abs(ratio) == 0 )
+				return false;
+			price += ratio * quote.price;
+			lots = std::min(lots, quote.quantity / abs(ratio));
+		}
+		return true;
+	};
+
+	for(size_t s = 0; s < instruments.size(); ++s)
+	{
+		const Instrument& spread = instruments[s];
+		if( spread.legs.empty() )
+			continue;
+
+		for(int side = 0; side < 2; ++side)
+		{
+			int64_t price;
+			int32_t lots = INT32_MAX;
+			if( sum(spread, -1, side == 0, price, lots) )
+				merge(side == 0 ? bids[s] : asks[s], ImpliedQuote{ price, lots }, side == 0);
+		}
+
+		for(size_t j = 0; j < spread.legs.size(); ++j)
+		{
+			int ratio = spread.ratios[j];
+			for(int side = 0; side < 2; ++side)
+			{
+				const ImpliedQuote& resting = side == 0 ? spread.bid : spread.ask;
+				int64_t others;
+				int32_t lots = resting.quantity;
+				if( lots == 0 || !sum(spread, (int)j, side != 0, others, lots) || (resting.price - others) % ratio != 0 )
+					continue;
+
+				bool is_bid = (ratio > 0) == (side == 0);
+				ImpliedQuote quote = { (resting.price - others) / ratio, lots * abs(ratio) };
+				merge(is_bid ? bids[spread.legs[j]] : asks[spread.legs[j]], quote, is_bid);
+			}
+		}
+	}
+}
+
+static bool check(const Complex& complex, const ImpliedEngine& engine)
+{
+	std::vector<ImpliedQuote> bids, asks;
+	reference(complex, bids, asks);
+	for(size_t i = 0; i < complex.instruments.size(); ++i)
+	{
+		ImpliedQuote bid, ask;
+		if( !engine.Implied(complex.instruments[i].def->index, bid, ask) )
+			bid = ask = ImpliedQuote{ 0, 0 };
+		if( bid != bids[i] || ask != asks[i] )
+		{
+			fprintf(stderr, "%s: implied %lld x %d / %lld x %d, expected %lld x %d / %lld x %d\n", complex.instruments[i].def->symbol,
+					(long long)bid.price, bid.quantity, (long long)ask.price, ask.quantity,
+					(long long)bids[i].price, bids[i].quantity, (long long)asks[i].price, asks[i].quantity);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A-B from A 100/101 and B 90/91: implied 9/11 for the spread, and with the
+// spread at 8/12, 98/103 for A and 88/93 for B. Quantities are the
+// smallest of the orders each price takes.
+static bool check_example()
+{
+	Complex complex;
+	build(complex, 2);
+	ImpliedEngine engine;
+	engine.Build(complex.registry);
+
+	engine.Update(complex.instruments[0].def->index, ImpliedQuote{ 100 * TICK, 5 }, ImpliedQuote{ 101 * TICK, 6 });
+	engine.Update(complex.instruments[1].def->index, ImpliedQuote{ 90 * TICK, 7 }, ImpliedQuote{ 91 * TICK, 3 });
+	ImpliedQuote bid, ask;
+	engine.Implied(complex.instruments[2].def->index, bid, ask);
+	if( bid != ImpliedQuote{ 9 * TICK, 3 } || ask != ImpliedQuote{ 11 * TICK, 6 } )
+		return false;
+
+	engine.Update(complex.instruments[2].def->index, ImpliedQuote{ 8 * TICK, 2 }, ImpliedQuote{ 12 * TICK, 4 });
+	engine.Implied(complex.instruments[0].def->index, bid, ask);
+	if( bid != ImpliedQuote{ 98 * TICK, 2 } || ask != ImpliedQuote{ 103 * TICK, 3 } )
+		return false;
+	engine.Implied(complex.instruments[1].def->index, bid, ask);
+	return bid == ImpliedQuote{ 88 * TICK, 4 } && ask == ImpliedQuote{ 93 * TICK, 2 };
+}
+
+static void run_registry(int count)
+{
+	InstrumentRegistry registry;
+	if( !registry.LoadCache("cme_ids.txt") )
+		return;
+
+	ImpliedEngine engine;
+	int64_t start = steady_ns();
+	engine.Build(registry);
+	int64_t build = steady_ns() - start;
+
+	std::vector<const InstrumentDef*> defs;
+	registry.Entries(defs);
+	std::vector<uint32_t> outrights, spreads;
+	for(const InstrumentDef* def : defs)
+		(strchr(def->symbol, '-') ? spreads : outrights).push_back(def->index);
+
+	std::mt19937 random(99);
+	std::vector<int64_t> fair(defs.size());
+	for(size_t i = 0; i < fair.size(); ++i)
+		fair[i] = 1000 + random() % 1000;
+
+	std::vector<Update> updates;
+	for(int u = 0; u < count; ++u)
+	{
+		Update update;
+		const std::vector<uint32_t>& pool = random() % 10 < 7 || spreads.empty() ? outrights : spreads;
+		update.instrument = pool[random() % pool.size()];
+		int64_t value = fair[update.instrument] + (int)(random() % 5) - 2;
+		update.bid = ImpliedQuote{ (value - 1) * TICK, (int32_t)(random() % 50) };
+		update.ask = ImpliedQuote{ (value + 1) * TICK, (int32_t)(random() % 50) };
+		updates.push_back(update);
+	}
+
+	start = steady_ns();
+	for(size_t u = 0; u < updates.size(); ++u)
+	{
+		engine.Update(updates[u].instrument, updates[u].bid, updates[u].ask);
+		if( u % EVENT_UPDATES == EVENT_UPDATES - 1 )
+			engine.Flush(0);
+	}
+	int64_t elapsed = steady_ns() - start;
+
+	double changes = std::max<uint64_t>(engine.Updates(), 1);
+	printf("cme_ids.txt: %zu instruments, %zu in relations, %zu relations, built in %.1f ms\n",
+			defs.size(), engine.Nodes(), engine.Relations(), build / 1e6);
+	printf("%10s %10s %10s %12.1f %12.2f %14.1f\n", "registry", "", "", (double)elapsed / updates.size(),
+			updates.size() / (elapsed / 1e3), engine.Recomputes() / changes);
+}
+
+int main(int argc, char** argv)
+{
+	int count = 2000000;
+	bool verify = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		if( strcmp(argv[i], "--check") == 0 )
+			verify = true;
+		else
+			count = atoi(argv[i]);
+	}
+
+	if( verify )
+	{
+		count = std::min(count, 20000);
+		if( !check_example() )
+		{
+			fprintf(stderr, "calendar spread example failed\n");
+			return 1;
+		}
+	}
+
+	printf("%10s %10s %10s %12s %12s %14s\n", "outrights", "relations", "updates", "ns/update", "Mupdates/s", "recomputes/upd");
+
+	static const int sizes[] = { 4, 12, 24, 40, 80 };
+	for(int outrights : sizes)
+	{
+		Complex complex;
+		build(complex, outrights);
+
+		std::vector<Update> updates;
+		generate(complex, count, updates, 1234 + outrights);
+
+		ImpliedEngine engine;
+		engine.Build(complex.registry);
+
+		std::vector<uint32_t> indexes;
+		for(const Instrument& instrument : complex.instruments)
+			indexes.push_back(instrument.def->index);
+
+		int64_t start = steady_ns();
+		for(size_t u = 0; u < updates.size(); ++u)
+		{
+			const Update& update = updates[u];
+			engine.Update(indexes[update.instrument], update.bid, update.ask);
+			if( u % EVENT_UPDATES == EVENT_UPDATES - 1 )
+				engine.Flush(0);
+
+			if( verify )
+			{
+				complex.instruments[update.instrument].bid = update.bid;
+				complex.instruments[update.instrument].ask = update.ask;
+				if( !check(complex, engine) )
+				{
+					fprintf(stderr, "mismatch after update %zu of %d outrights\n", u, outrights);
+					return 1;
+				}
+			}
+		}
+		int64_t elapsed = steady_ns() - start;
+
+		double changes = std::max<uint64_t>(engine.Updates(), 1);
+		printf("%10d %10zu %10llu %12.1f %12.2f %14.1f\n",
+				outrights, engine.Relations(), (unsigned long long)engine.Updates(),
+				(double)elapsed / updates.size(), updates.size() / (elapsed / 1e3),
+				engine.Recomputes() / changes);
+	}
+
+	if( verify )
+		printf("implieds match the reference after every update\n");
+	else
+		run_registry(count);
+	return 0;
+}
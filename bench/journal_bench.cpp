@@ -0,0 +1,135 @@
+// Runs the detectors over a capture by parsing it and by replaying the
+// event journal written from it, best of --runs for each, and reports the
+// speedup of the replay. Outputs go to /dev/null; both passes start from
+// empty parser state. The journal is written by a first, untimed pass (to
+// --journal, default <capture>.journal), whose time with the writer on is
+// reported too; as the first pass it also pays for creating the parser
+// state. The capture is read with mmap and the journal is mapped, so
+// warm passes measure parsing and replay rather than I/O.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <iostream>
+#include <string>
+
+static double steady_seconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool parse_capture(const char* path, uint64_t& packets)
+{
+	CaptureReader reader;
+	if( !reader.Open(path, CAPTURE_IO_MMAP) )
+	{
+		perror(path);
+		return false;
+	}
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	packets = 0;
+	while( reader.Next(ts, frame, length) )
+	{
+		parse_packet(ts, frame, length);
+		++packets;
+	}
+	return true;
+}
+
+static double file_mb(const char* path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_size / 1e6 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* capture = 0;
+	std::string journal_path;
+	int runs = 5;
+	for(int i = 1; i < argc; ++i)
+	{
+		if( strcmp(argv[i], "--journal") == 0 && i + 1 < argc )
+			journal_path = argv[++i];
+		else if( strcmp(argv[i], "--runs") == 0 && i + 1 < argc )
+			runs = atoi(argv[++i]);
+		else if( !capture )
+			capture = argv[i];
+		else
+			capture = 0, i = argc;
+	}
+	if( !capture || runs <= 0 )
+	{
+		fprintf(stderr, "usage: %s <capture> [--journal <file>] [--runs <n>]\n", argv[0]);
+		return 1;
+	}
+	if( journal_path.empty() )
+		journal_path = std::string(capture) + ".journal";
+
+	std::cout.rdbuf(0);
+	LoadSecInfo();
+
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+	if( !OpenJournal(journal_path.c_str()) )
+	{
+		perror(journal_path.c_str());
+		return 1;
+	}
+	uint64_t packets = 0;
+	double start = steady_seconds();
+	if( !parse_capture(capture, packets) )
+		return 1;
+	WriteResults();
+	CloseOutputs();
+	double write_seconds = steady_seconds() - start;
+
+	if( !LoadJournal(journal_path.c_str()) )
+	{
+		perror(journal_path.c_str());
+		return 1;
+	}
+
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+	double parse_best = 0;
+	double replay_best = 0;
+	for(int r = 0; r < runs; ++r)
+	{
+		ResetState();
+		start = steady_seconds();
+		if( !parse_capture(capture, packets) )
+			return 1;
+		WriteResults();
+		double elapsed = steady_seconds() - start;
+		if( r == 0 || elapsed < parse_best )
+			parse_best = elapsed;
+
+		ResetState();
+		start = steady_seconds();
+		ReplayJournal(0);
+		WriteResults();
+		elapsed = steady_seconds() - start;
+		if( r == 0 || elapsed < replay_best )
+			replay_best = elapsed;
+	}
+	CloseOutputs();
+
+	double capture_mb = file_mb(capture);
+	double journal_mb = file_mb(journal_path.c_str());
+	printf("capture=%s MB=%.1f packets=%llu journal MB=%.1f runs=%d\n", capture, capture_mb, (unsigned long long)packets, journal_mb, runs);
+	printf("%-16s %10s %10s %10s\n", "pass", "ms", "MB/s", "ns/packet");
+	printf("%-16s %10.1f %10.1f %10.1f\n", "parse+journal", write_seconds * 1e3, capture_mb / write_seconds, write_seconds * 1e9 / packets);
+	printf("%-16s %10.1f %10.1f %10.1f\n", "parse", parse_best * 1e3, capture_mb / parse_best, parse_best * 1e9 / packets);
+	printf("%-16s %10.1f %10.1f %10.1f  %.2fx\n", "replay", replay_best * 1e3, journal_mb / replay_best, replay_best * 1e9 / packets, parse_best / replay_best);
+	return 0;
+}
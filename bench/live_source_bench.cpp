@@ -0,0 +1,169 @@
+// Compares the recvmmsg socket source with the AF_PACKET TPACKET_V3 ring.
+// The UDP payloads of a capture are blasted over loopback multicast from a
+// sender thread, with sequence numbers rewritten so the feed arbiters accept
+// every copy, while each source in turn receives and parses them. Reported
+// per source: packets received, receive-side CPU per packet, and wakeups
+// (recvmmsg calls or ring polls) per packet. On loopback the kernel receive
+// path runs in the sender's context, so the CPU figure is the user-side cost
+// of each source plus its own syscalls.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+#include "live_source.h"
+#include "packet_ring_source.h"
+
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Payload
+{
+	sockaddr_in dest;
+	std::string data;
+};
+
+static volatile sig_atomic_t stop_receiving = 0;
+
+static double thread_cpu_seconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+		 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void send_payloads(const std::vector<Payload>& payloads, uint64_t count, const char* iface)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	in_addr iface_addr;
+	inet_pton(AF_INET, iface, &iface_addr);
+	unsigned char loop = 1;
+	setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface_addr, sizeof(iface_addr));
+	setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+	std::vector<Payload> packets(payloads);
+	for(uint64_t i = 0; i < count; ++i)
+	{
+		Payload& payload = packets[i % packets.size()];
+		CmeMsgHeader* header = (CmeMsgHeader*)&payload.data[0];
+		header->seq_num = (uint32_t)(i + 1);
+		sendto(fd, payload.data.data(), payload.data.size(), 0, (const sockaddr*)&payload.dest, sizeof(payload.dest));
+	}
+
+	close(fd);
+
+	usleep(300000);
+	stop_receiving = 1;
+}
+
+template<typename Source>
+static void run(const char* name, Source& source, const std::vector<Payload>& payloads, uint64_t count, const char* iface,
+		uint64_t (*wakeups)(const Source&))
+{
+	stop_receiving = 0;
+	double cpu_start = thread_cpu_seconds();
+
+	std::thread sender(send_payloads, std::cref(payloads), count, iface);
+	source.Run(stop_receiving);
+	sender.join();
+
+	double cpu = thread_cpu_seconds() - cpu_start;
+	uint64_t received = source.Packets();
+	printf("%-8s sent=%llu received=%llu (%.1f%%) cpu/packet=%.0fns wakeups/packet=%.3f\n",
+			name, (unsigned long long)count, (unsigned long long)received,
+			count ? 100.0 * received / count : 0.0,
+			received ? cpu * 1e9 / received : 0.0,
+			received ? (double)wakeups(source) / received : 0.0);
+}
+
+static uint64_t live_wakeups(const LiveSource& source) { return source.Batches(); }
+static uint64_t ring_wakeups(const PacketRingSource& source) { return source.Polls(); }
+
+int main(int argc, char** argv)
+{
+	if( argc < 2 )
+	{
+		fprintf(stderr, "usage: %s <capture> [packets] [iface addr] [ifname]\n", argv[0]);
+		return 1;
+	}
+
+	uint64_t count = argc > 2 ? strtoull(argv[2], 0, 10) : 1000000;
+	const char* iface = argc > 3 ? argv[3] : "127.0.0.1";
+	const char* ifname = argc > 4 ? argv[4] : "lo";
+
+	std::vector<Payload> payloads;
+	std::vector<std::pair<uint32_t, uint16_t> > dests;
+
+	CaptureReader reader;
+	if( !reader.Open(argv[1]) )
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	while( reader.Next(ts, frame, length) )
+	{
+		const IpHeader* pkt_header = (const IpHeader*)frame;
+		if( pkt_header->eth.ether_type != 8 || pkt_header->ip.protocol != IPPROTO_UDP )
+			continue;
+
+		Payload payload;
+		memset(&payload.dest, 0, sizeof(payload.dest));
+		payload.dest.sin_family = AF_INET;
+		payload.dest.sin_addr.s_addr = pkt_header->ip.daddr;
+		payload.dest.sin_port = pkt_header->udp.dest;
+		payload.data.assign(frame + sizeof(IpHeader), be16toh(pkt_header->udp.len) - sizeof(pkt_header->udp));
+		payloads.push_back(payload);
+
+		std::pair<uint32_t, uint16_t> dest(pkt_header->ip.daddr, ntohs(pkt_header->udp.dest));
+		if( std::find(dests.begin(), dests.end(), dest) == dests.end() )
+			dests.push_back(dest);
+	}
+
+	if( payloads.empty() )
+	{
+		fprintf(stderr, "no UDP packets in %s\n", argv[1]);
+		return 1;
+	}
+
+	// The sender numbers packets globally, so all destinations form one
+	// arbitrated channel.
+	std::vector<ChannelSpec> channels(1);
+	for(const std::pair<uint32_t, uint16_t>& dest : dests)
+	{
+		FeedSpec feed;
+		feed.group.s_addr = dest.first;
+		feed.port = dest.second;
+		channels[0].feeds.push_back(feed);
+	}
+
+	LoadSecInfo();
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+
+	{
+		LiveSource source;
+		if( source.Open(iface, channels) )
+			run("recvmmsg", source, payloads, count, iface, live_wakeups);
+	}
+
+	{
+		PacketRingSource source;
+		if( source.Open(ifname, channels) )
+			run("ring", source, payloads, count, iface, ring_wakeups);
+	}
+
+	return 0;
+}
@@ -0,0 +1,233 @@
+// Parses a capture from memory one packet at a time with parse_packet(),
+// then in batches of growing size with parse_packets(), and reports ns per
+// book/trade entry with L1D and last-level cache load misses per entry.
+// Each configuration parses the whole capture from empty state, best of
+// --runs.
+//
+// Prefetching pays off once the securities' state no longer fits in cache:
+// a capture over many instruments (cme_capgen --instruments 50000) shows
+// it, one over a few hundred does not. Cache misses need a PMU; without
+// one (most VMs) they are shown as "-".
+
+#include "cme_parser.h"
+#include "capture_file.h"
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+
+enum Counter
+{
+	COUNTER_L1D,
+	COUNTER_LLC,
+	NUM_COUNTERS
+};
+
+struct RunResult
+{
+	int64_t ns;
+	uint64_t misses[NUM_COUNTERS];
+	bool available[NUM_COUNTERS];
+};
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int open_counter(Counter counter)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = (counter == COUNTER_L1D ? PERF_COUNT_HW_CACHE_L1D : PERF_COUNT_HW_CACHE_LL)
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Book (32) and trade (42) entries in a frame.
+static uint64_t count_entries(const char* buffer)
+{
+	const IpHeader* pkt_header = (const IpHeader*)buffer;
+	if( pkt_header->eth.ether_type != 8 )
+		return 0;
+
+	buffer += sizeof(IpHeader);
+	const char* buffer_end = buffer + be16toh(pkt_header->udp.len) - sizeof(pkt_header->udp);
+	buffer += sizeof(CmeMsgHeader);
+
+	uint64_t entries = 0;
+	for(const CmeMessage* msg = (const CmeMessage*)buffer; buffer < buffer_end && msg->msg_length; buffer += msg->msg_length, msg = (const CmeMessage*)buffer)
+	{
+		if( msg->template_id == 32 || msg->template_id == 42 )
+			entries += ((const CmeBookRefresh*)(buffer + sizeof(*msg)))->num_in_group;
+	}
+	return entries;
+}
+
+static bool load_capture(const char* path, std::vector<char>& data, std::vector<PacketRef>& packets)
+{
+	CaptureReader reader;
+	if( !reader.Open(path) )
+	{
+		perror(path);
+		return false;
+	}
+
+	std::vector<size_t> offsets;
+	int64_t ts;
+	const char* frame;
+	int length;
+	while( reader.Next(ts, frame, length) )
+	{
+		PacketRef packet;
+		packet.ts = ts;
+		packet.buffer = 0;
+		packet.length = length;
+		packets.push_back(packet);
+		offsets.push_back(data.size());
+		data.insert(data.end(), frame, frame + length);
+	}
+
+	for(size_t i = 0; i < packets.size(); ++i)
+		packets[i].buffer = &data[offsets[i]];
+	return true;
+}
+
+// batch 0 is parse_packet() per packet.
+static RunResult run(const std::vector<PacketRef>& packets, int batch)
+{
+	RunResult result;
+	int fds[NUM_COUNTERS];
+	for(int c = 0; c < NUM_COUNTERS; ++c)
+	{
+		fds[c] = open_counter((Counter)c);
+		result.available[c] = fds[c] >= 0;
+		result.misses[c] = 0;
+	}
+
+	ResetState();
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+
+	for(int c = 0; c < NUM_COUNTERS; ++c)
+	{
+		if( fds[c] >= 0 )
+		{
+			ioctl(fds[c], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fds[c], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	int64_t start = steady_ns();
+	if( batch == 0 )
+	{
+		for(const PacketRef& packet : packets)
+			parse_packet(packet.ts, packet.buffer, packet.length);
+	}
+	else
+	{
+		for(size_t i = 0; i < packets.size(); i += batch)
+			parse_packets(&packets[i], (int)std::min<size_t>(batch, packets.size() - i));
+	}
+	result.ns = steady_ns() - start;
+
+	for(int c = 0; c < NUM_COUNTERS; ++c)
+	{
+		if( fds[c] < 0 )
+			continue;
+
+		ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+		if( read(fds[c], &result.misses[c], sizeof(result.misses[c])) != sizeof(result.misses[c]) )
+			result.available[c] = false;
+		close(fds[c]);
+	}
+
+	CloseOutputs();
+	ResetState();
+	return result;
+}
+
+static void print_misses(const RunResult& result, Counter counter, uint64_t entries)
+{
+	if( result.available[counter] )
+		printf(" %12.2f", (double)result.misses[counter] / entries);
+	else
+		printf(" %12s", "-");
+}
+
+int main(int argc, char** argv)
+{
+	const char* capture = 0;
+	int runs = 3;
+	for(int i = 1; i < argc; ++i)
+	{
+		if( strcmp(argv[i], "--runs") == 0 && i + 1 < argc )
+			runs = atoi(argv[++i]);
+		else if( !capture )
+			capture = argv[i];
+		else
+			capture = 0, i = argc;
+	}
+	if( !capture || runs <= 0 )
+	{
+		fprintf(stderr, "usage: %s <capture> [--runs <n>]\n", argv[0]);
+		return 1;
+	}
+
+	std::cout.rdbuf(0);
+	LoadSecInfo();
+
+	std::vector<char> data;
+	std::vector<PacketRef> packets;
+	if( !load_capture(capture, data, packets) )
+		return 1;
+
+	uint64_t entries = 0;
+	for(const PacketRef& packet : packets)
+		entries += count_entries(packet.buffer);
+	if( entries == 0 )
+	{
+		fprintf(stderr, "%s: no book or trade entries\n", capture);
+		return 1;
+	}
+
+	printf("packets=%zu entries=%llu runs=%d\n", packets.size(), (unsigned long long)entries, runs);
+	printf("%-8s %10s %10s %12s %12s\n", "batch", "ms", "ns/entry", "l1d/entry", "llc/entry");
+
+	static const int batches[] = { 0, 1, 2, 4, 8, 16, 32, 64, 128 };
+	for(int batch : batches)
+	{
+		RunResult best;
+		for(int r = 0; r < runs; ++r)
+		{
+			RunResult result = run(packets, batch);
+			if( r == 0 || result.ns < best.ns )
+				best = result;
+		}
+
+		if( batch == 0 )
+			printf("%-8s", "single");
+		else
+			printf("%-8d", batch);
+		printf(" %10.1f %10.1f", best.ns / 1e6, (double)best.ns / entries);
+		print_misses(best, COUNTER_L1D, entries);
+		print_misses(best, COUNTER_LLC, entries);
+		printf("\n");
+	}
+	return 0;
+}
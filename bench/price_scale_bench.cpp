@@ -0,0 +1,329 @@
+// Converts streams of trades from wire prices to clean prices and
+// volume-at-price ticks, as the parser does for every trade, and reports ns
+// per trade, best of --runs.
+//
+// The mixed stream draws instruments uniformly from the first --instruments
+// of cme_ids.txt (default 1000, whose scales stay in L1/L2 as a security's
+// do while its trades are parsed), so the mix of price_shifts is about that
+// of the cache. It is converted with the / operator on price_shift and
+// tick_size, with PriceScale, and with PriceScale picking a constant 10^7
+// path per trade when the instrument has that shift. The single-product
+// stream is all on price_shift 10^7 and tick_size 1, converted with /,
+// PriceScale and FixedPriceScale.
+//
+// --check compares Divider and PriceScale with / on the divisors of the
+// cache, every divisor up to 4096 and powers of two and ten, for edge and
+// random dividends of both signs, and exits non-zero on a mismatch.
+
+#include "instrument_registry.h"
+#include "price_scale.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <random>
+#include <set>
+#include <vector>
+
+struct TradeRef
+{
+	int64_t price;			// wire units
+	uint32_t instrument;	// into the scale tables
+};
+
+struct RawScale
+{
+	int64_t price_shift;
+	int64_t tick_size;
+};
+
+// PriceScale with the dominant price_shift special-cased.
+struct DispatchScale
+{
+	PriceScale scale;
+	bool shift_1e7;
+
+	CleanPrice Clean(WirePrice wire) const
+	{
+		return shift_1e7 ? CleanPrice(ConstDivider<10000000>::Divide(wire.value)) : scale.Clean(wire);
+	}
+};
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Best of runs of a conversion loop, with its speedup over the first loop
+// run since the last Baseline().
+class Timing
+{
+public:
+	Timing(int trades, int runs)
+		: trades(trades)
+		, runs(runs)
+		, baseline_ns(0)
+	{
+	}
+
+	void Baseline()
+	{
+		baseline_ns = 0;
+	}
+
+	template<typename Loop>
+	void Run(const char* name, Loop loop)
+	{
+		int64_t best = 0;
+		int64_t checksum = 0;
+		for(int r = 0; r < runs; ++r)
+		{
+			int64_t start = steady_ns();
+			checksum = loop();
+			int64_t elapsed = steady_ns() - start;
+			if( r == 0 || elapsed < best )
+				best = elapsed;
+		}
+
+		double per_trade = (double)best / trades;
+		printf("%-18s %10.1f %10.2f %20lld", name, best / 1e6, per_trade, (long long)checksum);
+		if( baseline_ns == 0 )
+			baseline_ns = per_trade;
+		else
+			printf("  %.2fx", baseline_ns / per_trade);
+		printf("\n");
+	}
+
+private:
+	int trades;
+	int runs;
+	double baseline_ns;
+};
+
+static bool check_divisor(int64_t d, std::mt19937_64& rng, int64_t& failures)
+{
+	Divider divider(d);
+	PriceScale scale(d, d);
+
+	std::vector<int64_t> values = { 0, 1, -1, d, -d, d - 1, 1 - d, d + 1, -d - 1, INT64_MAX, INT64_MIN + 1,
+									INT64_MAX - d, INT64_MIN + d, INT64_MAX / d * d, -(INT64_MAX / d * d) };
+	for(int i = 0; i < 2000; ++i)
+	{
+		values.push_back((int64_t)(rng() >> 1));
+		values.push_back(-(int64_t)(rng() >> 1));
+		values.push_back((int64_t)(rng() % 100000000000ull) - 50000000000ll);
+	}
+
+	bool ok = true;
+	for(int64_t x : values)
+	{
+		// -d - 1 for d = INT64_MAX; outside the range of Divider.
+		if( x == INT64_MIN )
+			continue;
+
+		int64_t expected = x / d;
+		if( divider.Divide(x) != expected || scale.Clean(WirePrice(x)).value != expected || scale.Tick(CleanPrice(x)) != expected )
+		{
+			if( failures++ < 10 )
+				fprintf(stderr, "mismatch: %lld / %lld = %lld, Divider %lld, Clean %lld, Tick %lld\n", (long long)x, (long long)d,
+						(long long)expected, (long long)divider.Divide(x), (long long)scale.Clean(WirePrice(x)).value, (long long)scale.Tick(CleanPrice(x)));
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static int check(const std::vector<const InstrumentDef*>& defs)
+{
+	std::set<int64_t> divisors;
+	for(const InstrumentDef* def : defs)
+	{
+		if( def->price_shift > 0 )
+			divisors.insert(def->price_shift);
+		if( def->tick_size > 0 )
+			divisors.insert(def->tick_size);
+	}
+	for(int64_t d = 1; d <= 4096; ++d)
+		divisors.insert(d);
+	for(int s = 0; s < 63; ++s)
+	{
+		divisors.insert((int64_t)1 << s);
+		divisors.insert(((int64_t)1 << s) + 1);
+		divisors.insert(((int64_t)1 << s) - 1 > 0 ? ((int64_t)1 << s) - 1 : 1);
+	}
+	for(int64_t p = 10; p <= INT64_MAX / 10; p *= 10)
+		divisors.insert(p * 10);
+	divisors.insert(INT64_MAX);
+
+	std::mt19937_64 rng(41);
+	int64_t failures = 0;
+	for(int64_t d : divisors)
+		check_divisor(d, rng, failures);
+
+	// Tick of an instrument without a tick size.
+	PriceScale untick(10000000, 0);
+	if( untick.Tick(CleanPrice(-12345)) != -12345 || untick.FromTick(7).value != 7 )
+		++failures;
+
+	printf("checked %zu divisors: %s\n", divisors.size(), failures ? "MISMATCH" : "ok");
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* ids = "cme_ids.txt";
+	int trades_count = 1 << 22;
+	int runs = 5;
+	size_t instruments = 1000;
+	bool check_only = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		if( strcmp(argv[i], "--ids") == 0 && i + 1 < argc )
+			ids = argv[++i];
+		else if( strcmp(argv[i], "--trades") == 0 && i + 1 < argc )
+			trades_count = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--instruments") == 0 && i + 1 < argc )
+			instruments = strtoul(argv[++i], 0, 10);
+		else if( strcmp(argv[i], "--runs") == 0 && i + 1 < argc )
+			runs = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--check") == 0 )
+			check_only = true;
+		else
+		{
+			fprintf(stderr, "usage: %s [--ids <cme_ids.txt>] [--trades <n>] [--instruments <n>] [--runs <n>] [--check]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	InstrumentRegistry registry;
+	if( !registry.LoadCache(ids) )
+	{
+		perror(ids);
+		return 1;
+	}
+	std::vector<const InstrumentDef*> defs;
+	registry.Entries(defs);
+	if( defs.empty() || trades_count <= 0 || runs <= 0 || instruments == 0 )
+	{
+		fprintf(stderr, "%s: no instruments\n", ids);
+		return 1;
+	}
+
+	if( check_only )
+		return check(defs);
+	if( defs.size() > instruments )
+		defs.resize(instruments);
+
+	std::vector<RawScale> raw(defs.size());
+	std::vector<PriceScale> scales(defs.size());
+	std::vector<DispatchScale> dispatch(defs.size());
+	for(size_t i = 0; i < defs.size(); ++i)
+	{
+		int64_t price_shift = defs[i]->price_shift > 0 ? defs[i]->price_shift : 1;
+		raw[i].price_shift = price_shift;
+		raw[i].tick_size = defs[i]->tick_size;
+		scales[i].Set(price_shift, defs[i]->tick_size);
+		dispatch[i].scale = scales[i];
+		dispatch[i].shift_1e7 = price_shift == 10000000;
+	}
+
+	// Clean prices a few hundred ticks either side of 1000 ticks; spreads
+	// trade negative.
+	std::mt19937_64 rng(41);
+	std::vector<TradeRef> trades(trades_count);
+	for(TradeRef& trade : trades)
+	{
+		trade.instrument = (uint32_t)(rng() % defs.size());
+		int64_t tick = raw[trade.instrument].tick_size > 0 ? raw[trade.instrument].tick_size : 1;
+		int64_t clean = ((int64_t)(rng() % 2600) - 300) * tick;
+		trade.price = clean * raw[trade.instrument].price_shift;
+	}
+
+	std::vector<int64_t> single(trades_count);
+	for(int64_t& price : single)
+		price = ((int64_t)(rng() % 2600) - 300) * 10000000;
+	RawScale single_raw = { 10000000, 1 };
+	PriceScale single_scale(10000000, 1);
+
+	printf("instruments=%zu trades=%d runs=%d\n", defs.size(), trades_count, runs);
+	printf("%-18s %10s %10s %20s\n", "method", "ms", "ns/trade", "checksum");
+
+	Timing timing(trades_count, runs);
+	timing.Run("mixed /", [&]()
+	{
+		int64_t sum = 0;
+		for(const TradeRef& trade : trades)
+		{
+			const RawScale& scale = raw[trade.instrument];
+			int64_t clean = trade.price / scale.price_shift;
+			sum += clean + (scale.tick_size > 0 ? clean / scale.tick_size : clean);
+		}
+		return sum;
+	});
+	timing.Run("mixed PriceScale", [&]()
+	{
+		int64_t sum = 0;
+		for(const TradeRef& trade : trades)
+		{
+			const PriceScale& scale = scales[trade.instrument];
+			CleanPrice clean = scale.Clean(WirePrice(trade.price));
+			sum += clean.value + scale.Tick(clean);
+		}
+		return sum;
+	});
+	timing.Run("mixed dispatch", [&]()
+	{
+		int64_t sum = 0;
+		for(const TradeRef& trade : trades)
+		{
+			const DispatchScale& scale = dispatch[trade.instrument];
+			CleanPrice clean = scale.Clean(WirePrice(trade.price));
+			sum += clean.value + scale.scale.Tick(clean);
+		}
+		return sum;
+	});
+
+	// Through a volatile pointer, so the divisors are not constants.
+	const RawScale* volatile single_raw_ptr = &single_raw;
+	const PriceScale* volatile single_scale_ptr = &single_scale;
+	timing.Baseline();
+	timing.Run("single /", [&]()
+	{
+		const RawScale& scale = *single_raw_ptr;
+		int64_t sum = 0;
+		for(int64_t price : single)
+		{
+			int64_t clean = price / scale.price_shift;
+			sum += clean + (scale.tick_size > 0 ? clean / scale.tick_size : clean);
+		}
+		return sum;
+	});
+	timing.Run("single PriceScale", [&]()
+	{
+		const PriceScale& scale = *single_scale_ptr;
+		int64_t sum = 0;
+		for(int64_t price : single)
+		{
+			CleanPrice clean = scale.Clean(WirePrice(price));
+			sum += clean.value + scale.Tick(clean);
+		}
+		return sum;
+	});
+	timing.Run("single Fixed", [&]()
+	{
+		typedef FixedPriceScale<10000000, 1> Scale;
+		int64_t sum = 0;
+		for(int64_t price : single)
+		{
+			CleanPrice clean = Scale::Clean(WirePrice(price));
+			sum += clean.value + Scale::Tick(clean);
+		}
+		return sum;
+	});
+	return 0;
+}
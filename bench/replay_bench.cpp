@@ -0,0 +1,219 @@
+// Replays a capture through parse_packet() and reports parse throughput and,
+// given the ground truth written by cme_capgen, the precision and recall of
+// the sweep, iceberg and stop detectors. Stops are scored twice: by the
+// order that was triggered, and with the trigger price as well.
+//
+// The capture is loaded into memory first so only parsing is timed. Detector
+// results are read back from the CSV files the run writes, so the check
+// covers the same output the tool produces.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Frame
+{
+	int64_t ts;
+	size_t offset;
+	int length;
+};
+
+struct DetectorScore
+{
+	const char* name;
+	std::set<std::string> truth;
+	std::set<std::string> detected;
+};
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static std::vector<std::string> split_csv(const std::string& line)
+{
+	std::vector<std::string> fields;
+	std::stringstream ss(line);
+	std::string field;
+	while( getline(ss, field, ',') )
+		fields.push_back(field);
+	return fields;
+}
+
+// Calls add(fields) for every data row of a CSV file.
+template<typename Add>
+static void read_csv(const std::string& path, Add add)
+{
+	std::ifstream in(path.c_str());
+	std::string line;
+	getline(in, line);
+	while( getline(in, line) )
+	{
+		if( !line.empty() )
+			add(split_csv(line));
+	}
+}
+
+static uint64_t count_messages(const char* frame, int length)
+{
+	const IpHeader* pkt_header = (const IpHeader*)frame;
+	if( length < (int)sizeof(IpHeader) || pkt_header->eth.ether_type != 8 )
+		return 0;
+
+	const char* buffer = frame + sizeof(IpHeader) + sizeof(CmeMsgHeader);
+	const char* buffer_end = frame + sizeof(IpHeader) + be16toh(pkt_header->udp.len) - sizeof(pkt_header->udp);
+
+	uint64_t messages = 0;
+	for(; buffer < buffer_end; buffer += ((const CmeMessage*)buffer)->msg_length)
+	{
+		if( ((const CmeMessage*)buffer)->msg_length == 0 )
+			break;
+		++messages;
+	}
+	return messages;
+}
+
+static void print_score(const DetectorScore& score)
+{
+	size_t hits = 0;
+	for(const std::string& key : score.detected)
+		hits += score.truth.count(key);
+
+	printf("%-8s truth=%zu detected=%zu tp=%zu precision=%.3f recall=%.3f\n",
+			score.name, score.truth.size(), score.detected.size(), hits,
+			score.detected.empty() ? 0.0 : (double)hits / score.detected.size(),
+			score.truth.empty() ? 0.0 : (double)hits / score.truth.size());
+}
+
+int main(int argc, char** argv)
+{
+	if( argc < 2 )
+	{
+		fprintf(stderr, "usage: %s <capture> [--truth <truth.csv>] [--out <dir>]\n", argv[0]);
+		return 1;
+	}
+
+	const char* truth_path = 0;
+	std::string out_dir = "/tmp";
+	for(int i = 2; i + 1 < argc; i += 2)
+	{
+		if( strcmp(argv[i], "--truth") == 0 )
+			truth_path = argv[i + 1];
+		else if( strcmp(argv[i], "--out") == 0 )
+			out_dir = argv[i + 1];
+	}
+
+	// The iceberg detector also reports to stdout; keep that out of the timing.
+	std::cout.rdbuf(0);
+
+	int64_t start = steady_ns();
+	LoadSecInfo();
+	printf("load ids: %.1fms\n", (steady_ns() - start) / 1e6);
+
+	std::vector<char> data;
+	std::vector<Frame> frames;
+	uint64_t messages = 0;
+	{
+		CaptureReader reader;
+		if( !reader.Open(argv[1]) )
+		{
+			perror(argv[1]);
+			return 1;
+		}
+
+		int64_t ts;
+		const char* frame;
+		int length;
+		while( reader.Next(ts, frame, length) )
+		{
+			Frame f;
+			f.ts = ts;
+			f.offset = data.size();
+			f.length = length;
+			frames.push_back(f);
+			data.insert(data.end(), frame, frame + length);
+			messages += count_messages(frame, length);
+		}
+	}
+
+	std::string sweeps_path = out_dir + "/bench_sweeps.csv";
+	std::string icebergs_path = out_dir + "/bench_icebergs.csv";
+	std::string stops_path = out_dir + "/bench_stops.csv";
+	OpenOutputs(sweeps_path.c_str(), icebergs_path.c_str(), stops_path.c_str());
+
+	start = steady_ns();
+	for(const Frame& f : frames)
+		parse_packet(f.ts, &data[f.offset], f.length);
+	int64_t elapsed = steady_ns() - start;
+
+	WriteResults();
+	CloseOutputs();
+
+	printf("packets=%zu messages=%llu bytes=%zu time=%.3fs\n",
+			frames.size(), (unsigned long long)messages, data.size(), elapsed / 1e9);
+	printf("throughput: %.0f packets/s %.0f messages/s %.1f MB/s %.1f ns/message\n",
+			frames.size() / (elapsed / 1e9), messages / (elapsed / 1e9),
+			data.size() / (elapsed / 1e9) / 1e6, messages ? (double)elapsed / messages : 0.0);
+
+	if( !truth_path )
+		return 0;
+
+	DetectorScore sweeps, icebergs, stops, triggers;
+	sweeps.name = "sweeps";
+	icebergs.name = "icebergs";
+	stops.name = "stops";
+	triggers.name = "triggers";
+
+	read_csv(truth_path, [&](const std::vector<std::string>& f)
+	{
+		if( f.size() < 6 )
+			return;
+		if( f[0] == "sweep" )
+			sweeps.truth.insert(time_to_str(atoll(f[1].c_str())) + "|" + f[2]);
+		else if( f[0] == "iceberg" )
+			icebergs.truth.insert(f[2] + "|" + f[3] + "|" + f[4]);
+		else if( f[0] == "stop" )
+		{
+			stops.truth.insert(f[2] + "|" + f[5]);
+			triggers.truth.insert(f[2] + "|" + f[5] + "|" + f[3]);
+		}
+	});
+
+	read_csv(sweeps_path, [&](const std::vector<std::string>& f)
+	{
+		if( f.size() >= 2 )
+			sweeps.detected.insert(f[0] + "|" + f[1]);
+	});
+	read_csv(icebergs_path, [&](const std::vector<std::string>& f)
+	{
+		if( f.size() >= 6 )
+			icebergs.detected.insert(f[1] + "|" + f[2] + "|" + f[5]);
+	});
+	read_csv(stops_path, [&](const std::vector<std::string>& f)
+	{
+		if( f.size() >= 5 )
+		{
+			stops.detected.insert(f[2] + "|" + f[3]);
+			triggers.detected.insert(f[2] + "|" + f[3] + "|" + f[4]);
+		}
+	});
+
+	print_score(sweeps);
+	print_score(icebergs);
+	print_score(stops);
+	print_score(triggers);
+	return 0;
+}
@@ -0,0 +1,303 @@
+// Times BookPublisher updates over a growing number of securities, first
+// with no readers and then with a forked reader process polling every slot
+// for new versions. The reader reports the snapshots it took, how often a
+// copy raced the writer and was dropped, how many versions it never
+// saw, and the staleness of each snapshot: CLOCK_REALTIME at the copy minus
+// the time the writer published it.
+//
+// The reader spins, so on a single core it only runs when the scheduler
+// takes the core from the writer and staleness is mostly scheduling delay;
+// on a spare core it is the cost of the cache-line transfers.
+//
+// With --capture, the capture is also parsed with and without --shm to show
+// the cost inside the parser.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+#include "book_publisher.h"
+#include "latency_histogram.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern BookPublisher* book_publisher;
+
+static constexpr const int64_t PRICE_SHIFT = 1000000;
+
+struct ReaderResult
+{
+	uint64_t snapshots;
+	uint64_t raced;		// copies dropped because the writer was in the slot
+	uint64_t skipped;	// versions overwritten before the reader saw them
+	int64_t p50;
+	int64_t p99;
+	int64_t p999;
+	int64_t max;
+};
+
+struct Frame
+{
+	int64_t ts;
+	size_t offset;
+	int length;
+};
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int64_t wall_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Polls every published slot until stop_fd is closed, then writes a
+// ReaderResult to result_fd.
+static void run_reader(const char* name, int stop_fd, int result_fd)
+{
+	BookSubscriber subscriber;
+	if( !subscriber.Open(name) )
+		_exit(1);
+
+	LatencyHistogram* staleness = new LatencyHistogram();
+	std::vector<uint32_t> seen;
+	std::vector<uint64_t> updates;
+	ReaderResult result;
+	memset(&result, 0, sizeof(result));
+
+	ShmBook book;
+	for(uint64_t pass = 0; ; ++pass)
+	{
+		uint32_t used = subscriber.Used();
+		if( seen.size() < used )
+		{
+			seen.resize(used, 0);
+			updates.resize(used, 0);
+		}
+
+		for(uint32_t slot = 0; slot < used; ++slot)
+		{
+			if( subscriber.Seq(slot) == seen[slot] )
+				continue;
+
+			// A copy that raced the writer is left for the next pass.
+			uint32_t seq;
+			if( !subscriber.TryRead(slot, book, seq) )
+			{
+				++result.raced;
+				continue;
+			}
+
+			staleness->Record(wall_ns() - book.publish_ns);
+			++result.snapshots;
+			if( updates[slot] && book.updates > updates[slot] + 1 )
+				result.skipped += book.updates - updates[slot] - 1;
+			updates[slot] = book.updates;
+			seen[slot] = seq;
+		}
+
+		char c;
+		if( (pass & 255) == 0 && !(read(stop_fd, &c, 1) < 0 && errno == EAGAIN) )
+			break;
+	}
+
+	result.p50 = staleness->Percentile(0.5);
+	result.p99 = staleness->Percentile(0.99);
+	result.p999 = staleness->Percentile(0.999);
+	result.max = staleness->Max();
+	if( write(result_fd, &result, sizeof(result)) != sizeof(result) )
+		_exit(1);
+	_exit(0);
+}
+
+// Publishes updates books round-robin over the securities of slots;
+// returns ns per update.
+static double publish(BookPublisher& publisher, std::vector<int32_t>& slots, int updates)
+{
+	int securities = (int)slots.size();
+	CmeSide sides[NUM_SHM_SIDES];
+	for(int s = 0; s < NUM_SHM_SIDES; ++s)
+	{
+		int depth = s < SHM_IMPLIED_BIDS ? MAX_LEVELS : 2;
+		for(int i = 0; i < depth; ++i)
+		{
+			int64_t price = (s % 2 == 0 ? 10000 - i : 10001 + i) * PRICE_SHIFT;
+			sides[s].AddLevel(i, price, 10 + i, 1 + i);
+		}
+	}
+	const CmeSide* views[NUM_SHM_SIDES] = { &sides[0], &sides[1], &sides[2], &sides[3] };
+
+	std::vector<std::string> symbols(securities);
+	for(int i = 0; i < securities; ++i)
+		symbols[i] = "BENCH" + std::to_string(i);
+
+	int64_t ts = 1546435800000000000LL;
+	int64_t start = steady_ns();
+	for(int u = 0; u < updates; ++u)
+	{
+		int i = u % securities;
+		sides[SHM_BIDS].levels[0].quantity = 10 + ((u / securities) & 63);
+		publisher.Publish(slots[i], 1000 + i, symbols[i].c_str(), PRICE_SHIFT, 1, ts + u, views);
+	}
+	return (double)(steady_ns() - start) / updates;
+}
+
+static bool load_capture(const char* path, std::vector<char>& data, std::vector<Frame>& frames)
+{
+	CaptureReader reader;
+	if( !reader.Open(path) )
+	{
+		perror(path);
+		return false;
+	}
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	while( reader.Next(ts, frame, length) )
+	{
+		Frame f;
+		f.ts = ts;
+		f.offset = data.size();
+		f.length = length;
+		frames.push_back(f);
+		data.insert(data.end(), frame, frame + length);
+	}
+	return true;
+}
+
+static int64_t parse_all(const std::vector<char>& data, const std::vector<Frame>& frames, BookPublisher* publisher)
+{
+	ResetState();
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+	book_publisher = publisher;
+
+	int64_t start = steady_ns();
+	for(const Frame& f : frames)
+		parse_packet(f.ts, &data[f.offset], f.length);
+	int64_t elapsed = steady_ns() - start;
+
+	book_publisher = 0;
+	CloseOutputs();
+	ResetState();
+	return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+	const char* name = "/shm_publisher_bench";
+	const char* capture = 0;
+	int updates = 2000000;
+	for(int i = 1; i + 1 < argc; i += 2)
+	{
+		if( strcmp(argv[i], "--capture") == 0 )
+			capture = argv[i + 1];
+		else if( strcmp(argv[i], "--updates") == 0 )
+			updates = atoi(argv[i + 1]);
+		else
+		{
+			fprintf(stderr, "usage: %s [--capture <file>] [--updates <n>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("cores=%ld updates=%d slot=%zu bytes\n", sysconf(_SC_NPROCESSORS_ONLN), updates, sizeof(ShmBookSlot));
+	printf("%10s %12s %12s %12s %10s %10s %10s %10s %10s %10s\n", "securities", "ns/update", "+reader ns", "snapshots",
+			"raced", "skipped %", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+
+	static const int counts[] = { 1, 16, 256, 4096 };
+	for(int securities : counts)
+	{
+		BookPublisher publisher;
+		if( !publisher.Open(name, securities) )
+			return 1;
+		std::vector<int32_t> slots(securities, -1);
+		double alone = publish(publisher, slots, updates);
+		publisher.Close();
+		slots.assign(securities, -1);
+
+		if( !publisher.Open(name, securities) )
+			return 1;
+
+		int stop[2], results[2];
+		if( pipe(stop) != 0 || pipe(results) != 0 )
+		{
+			perror("pipe");
+			return 1;
+		}
+		fcntl(stop[0], F_SETFL, O_NONBLOCK);
+
+		// Publish every security once so the reader starts with all slots.
+		publish(publisher, slots, securities);
+
+		pid_t pid = fork();
+		if( pid == 0 )
+		{
+			close(stop[1]);
+			close(results[0]);
+			run_reader(name, stop[0], results[1]);
+		}
+		close(stop[0]);
+		close(results[1]);
+
+		double shared = publish(publisher, slots, updates);
+		close(stop[1]);
+
+		ReaderResult result;
+		memset(&result, 0, sizeof(result));
+		bool ok = read(results[0], &result, sizeof(result)) == sizeof(result);
+		close(results[0]);
+		waitpid(pid, 0, 0);
+		publisher.Close();
+
+		if( !ok )
+		{
+			fprintf(stderr, "reader failed\n");
+			return 1;
+		}
+
+		uint64_t versions = result.snapshots + result.skipped;
+		printf("%10d %12.1f %12.1f %12llu %10llu %9.1f%% %10lld %10lld %10lld %10lld\n",
+				securities, alone, shared, (unsigned long long)result.snapshots,
+				(unsigned long long)result.raced,
+				versions ? 100.0 * result.skipped / versions : 0.0,
+				(long long)result.p50, (long long)result.p99, (long long)result.p999, (long long)result.max);
+	}
+
+	if( capture )
+	{
+		std::cout.rdbuf(0);
+		LoadSecInfo();
+
+		std::vector<char> data;
+		std::vector<Frame> frames;
+		if( !load_capture(capture, data, frames) )
+			return 1;
+
+		BookPublisher publisher;
+		if( !publisher.Open(name, 16384) )
+			return 1;
+
+		int64_t baseline = parse_all(data, frames, 0);
+		int64_t published = parse_all(data, frames, &publisher);
+		printf("capture: packets=%zu parse %.1f ms, with --shm %.1f ms (%+.1f%%), %u securities published\n",
+				frames.size(), baseline / 1e6, published / 1e6, 100.0 * (published - baseline) / baseline, publisher.Used());
+	}
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+// Times stop attribution on synthetic trade events of growing cascade size.
+//
+// Each event is one aggressor followed by `stops` elected stop orders, each
+// filling against a fresh resting order. The event is sent as template 42
+// messages split to fit the one-byte group counts. Each 42 is followed by
+// a template 32 adding the residual of its stops back to the book at the
+// price they traded to. Order ids keep
+// growing, as in a long high-volume session. The total number of order
+// entries is the same for every cascade size, so the time per order entry
+// stays flat when attribution is O(1) and grows with the cascade when it
+// scans the stops found so far.
+//
+// The instrument is defined by a template 54 in the stream, so the bench
+// needs no cme_ids.txt.
+
+#include "cme_parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+static constexpr const int32_t SEC_ID = 990001;
+static constexpr const int64_t PRICE_SHIFT = 1000000;
+static constexpr const int MAX_GROUP = 120;
+
+static int64_t steady_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+struct Packet
+{
+	std::string data;
+	uint32_t seq;
+
+	Packet()
+		: seq(0)
+	{
+	}
+
+	void Begin(uint64_t send_time)
+	{
+		CmeMsgHeader header;
+		header.seq_num = ++seq;
+		header.send_time = send_time;
+		data.assign((const char*)&header, sizeof(header));
+	}
+
+	void Message(uint16_t template_id, uint16_t block_length, const std::string& body)
+	{
+		CmeMessage msg;
+		msg.msg_length = (uint16_t)(sizeof(msg) + body.size());
+		msg.block_length = block_length;
+		msg.template_id = template_id;
+		msg.schema_id = 1;
+		msg.version_id = 9;
+		data.append((const char*)&msg, sizeof(msg));
+		data.append(body);
+	}
+};
+
+template<typename T>
+static void append(std::string& out, const T& value)
+{
+	out.append((const char*)&value, sizeof(value));
+}
+
+static std::string definition()
+{
+	std::string body(224, '\0');
+	CmeInstrumentDefFuture* def = (CmeInstrumentDefFuture*)&body[0];
+	def->update_action = 'A';
+	memcpy(def->symbol, "BENCHZ9", 7);
+	def->sec_id = SEC_ID;
+	def->min_price_increment = PRICE_SHIFT;
+	def->display_factor = 1000000000;
+	return body;
+}
+
+struct Order
+{
+	uint64_t order_id;
+	int32_t qty;
+	int64_t price;
+};
+
+// One trade summary over fills[begin, end), each an aggressor and the
+// resting order it took.
+static std::string trade_message(uint64_t ts, char indicator, const std::vector<Order>& aggressors, const std::vector<Order>& passives, size_t begin, size_t end, bool is_buy)
+{
+	std::string body;
+	CmeTradeSummary summary;
+	memset(&summary, 0, sizeof(summary));
+	summary.transact_time = ts;
+	summary.indicator = indicator;
+	summary.entry_size = sizeof(CmeTradeEntry);
+	summary.num_in_group = (uint8_t)(end - begin);
+	append(body, summary);
+
+	for(size_t i = begin; i < end; ++i)
+	{
+		CmeTradeEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.price = aggressors[i].price;
+		entry.qty = aggressors[i].qty;
+		entry.sec_id = SEC_ID;
+		entry.num_orders = 2;
+		entry.aggressor_side = is_buy ? 1 : 2;
+		entry.entry_type = '2';
+		entry.entry_id = (uint32_t)i;
+		append(body, entry);
+	}
+
+	GroupSize8Bytes group;
+	memset(&group, 0, sizeof(group));
+	group.entry_size = sizeof(CmeOrderEntry);
+	group.num_in_group = (uint8_t)(2 * (end - begin));
+	append(body, group);
+
+	for(size_t i = begin; i < end; ++i)
+	{
+		CmeOrderEntry aggressor = { aggressors[i].order_id, aggressors[i].qty, 0 };
+		CmeOrderEntry passive = { passives[i].order_id, passives[i].qty, 0 };
+		append(body, aggressor);
+		append(body, passive);
+	}
+	return body;
+}
+
+static std::string add_message(uint64_t ts, char indicator, const std::vector<Order>& adds, size_t begin, size_t end, bool is_bid)
+{
+	std::string body;
+	CmeBookRefresh refresh;
+	memset(&refresh, 0, sizeof(refresh));
+	refresh.transact_time = ts;
+	refresh.indicator = indicator;
+	refresh.entry_size = sizeof(CmeBookEntry);
+	refresh.num_in_group = (uint8_t)(end - begin);
+	append(body, refresh);
+
+	for(size_t i = begin; i < end; ++i)
+	{
+		CmeBookEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.price = adds[i].price;
+		entry.size = adds[i].qty;
+		entry.sec_id = SEC_ID;
+		entry.num_orders = 1;
+		entry.price_level = 1;
+		entry.action_type = 0;
+		entry.entry_type = is_bid ? '0' : '1';
+		append(body, entry);
+	}
+	return body;
+}
+
+// Builds the packets of cascades of `stops` stops until about `entries`
+// order entries.
+static void build(int stops, int entries, std::vector<std::string>& packets, uint64_t& orders)
+{
+	uint64_t next_id = 1000000000ULL;
+	uint64_t next_stop_id = 1000000ULL;
+	uint64_t ts = 1546435800000000000ULL;
+	int64_t price = 100000 * PRICE_SHIFT;
+	Packet packet;
+
+	packet.Begin(ts);
+	packet.Message(54, 224, definition());
+	packets.push_back(packet.data);
+
+	int events = std::max(1, entries / (2 * (stops + 1)));
+	orders = 0;
+	for(int e = 0; e < events; ++e)
+	{
+		bool is_buy = e % 2 == 0;
+		std::vector<Order> aggressors, passives, adds;
+		for(int s = 0; s <= stops; ++s)
+		{
+			int64_t fill_price = price + (is_buy ? s : -s) * PRICE_SHIFT;
+			Order aggressor = { s == 0 ? next_id++ : next_stop_id++, 5, fill_price };
+			Order passive = { next_id++, 5, fill_price };
+			aggressors.push_back(aggressor);
+			passives.push_back(passive);
+			if( s > 0 )
+			{
+				Order add = { 0, 3, fill_price };
+				adds.push_back(add);
+			}
+		}
+		orders += 2 * aggressors.size();
+
+		// Each chunk of trades is followed by the adds of its stops'
+		// residuals, all before the event's last trade summary.
+		ts += 1000000;
+		packet.Begin(ts);
+		for(size_t begin = 0; begin < aggressors.size(); begin += MAX_GROUP)
+		{
+			size_t end = std::min(aggressors.size(), begin + MAX_GROUP);
+			bool last = end == aggressors.size();
+			packet.Message(42, sizeof(CmeTradeSummary) - sizeof(GroupSize), trade_message(ts, last ? LAST_TRADE : 0, aggressors, passives, begin, end, is_buy));
+
+			// adds[i] is the residual of aggressors[i + 1].
+			size_t add_begin = begin == 0 ? 0 : begin - 1;
+			size_t add_end = end - 1;
+			packet.Message(32, sizeof(CmeBookRefresh) - sizeof(GroupSize), add_message(ts, last ? LAST_QUOTE | LAST_MSG : 0, adds, add_begin, add_end, is_buy));
+		}
+
+		packets.push_back(packet.data);
+		price += (e % 7 - 3) * PRICE_SHIFT;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int entries = 2000000;
+	if( argc > 1 )
+		entries = atoi(argv[1]);
+
+	std::cout.rdbuf(0);
+	OpenOutputs("/dev/null", "/dev/null", "/dev/null");
+
+	printf("%8s %8s %10s %10s %14s %12s\n", "stops", "events", "orders", "time ms", "ns/order", "ns/event");
+
+	static const int sizes[] = { 1, 4, 16, 64, 256, 1024, 4096 };
+	for(int stops : sizes)
+	{
+		std::vector<std::string> packets;
+		uint64_t orders;
+		build(stops, entries, packets, orders);
+
+		ResetState();
+		int64_t start = steady_ns();
+		for(const std::string& packet : packets)
+			parse_mdp_packet(0, packet.data(), (int)packet.size(), 14310);
+		int64_t elapsed = steady_ns() - start;
+
+		size_t events = packets.size() - 1;
+		printf("%8d %8zu %10llu %10.1f %14.1f %12.0f\n",
+				stops, events, (unsigned long long)orders, elapsed / 1e6,
+				(double)elapsed / orders, (double)elapsed / events);
+	}
+
+	ResetState();
+	CloseOutputs();
+	return 0;
+}
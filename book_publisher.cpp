@@ -0,0 +1,248 @@
+#include "book_publisher.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+
+static int64_t wall_clock_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static_assert(sizeof(ShmLevel) == sizeof(CmeLevel), "levels are copied as they are in the book");
+
+static size_t region_bytes(uint32_t capacity)
+{
+	return sizeof(ShmBookHeader) + (size_t)capacity * sizeof(ShmBookSlot);
+}
+
+BookPublisher::BookPublisher()
+	: region(0)
+	, region_size(0)
+	, header(0)
+	, slots(0)
+	, full_reported(false)
+{
+}
+
+BookPublisher::~BookPublisher()
+{
+	Close();
+}
+
+bool BookPublisher::Open(const char* name, uint32_t capacity)
+{
+	Close();
+
+	// A fresh region, so readers of an old one are not mixed up with this run.
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if( fd < 0 )
+	{
+		perror(name);
+		return false;
+	}
+
+	region_size = region_bytes(capacity);
+	if( ftruncate(fd, region_size) != 0 )
+	{
+		perror(name);
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+
+	region = mmap(0, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if( region == MAP_FAILED )
+	{
+		perror(name);
+		region = 0;
+		shm_unlink(name);
+		return false;
+	}
+
+	this->name = name;
+
+	// ftruncate zero-fills, which is a valid empty state for every field.
+	header = new(region) ShmBookHeader();
+	slots = (ShmBookSlot*)((char*)region + sizeof(ShmBookHeader));
+	header->slot_size = sizeof(ShmBookSlot);
+	header->capacity = capacity;
+	header->used.store(0, std::memory_order_relaxed);
+	header->heartbeat_ns.store(0, std::memory_order_relaxed);
+
+	// Readers check the magic last.
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(header->magic, SHM_BOOK_MAGIC, sizeof(header->magic));
+	return true;
+}
+
+void BookPublisher::Close()
+{
+	if( !region )
+		return;
+
+	munmap(region, region_size);
+	shm_unlink(name.c_str());
+	region = 0;
+	header = 0;
+	slots = 0;
+}
+
+bool BookPublisher::Unchanged(const ShmBook& book, const CmeSide* const sides[NUM_SHM_SIDES])
+{
+	for(int s = 0; s < NUM_SHM_SIDES; ++s)
+	{
+		int count = std::min((int)sides[s]->levels.size(), MAX_LEVELS);
+		if( book.count[s] != count || memcmp(book.levels[s], sides[s]->levels.data(), count * sizeof(ShmLevel)) != 0 )
+			return false;
+	}
+	return true;
+}
+
+bool BookPublisher::Publish(int32_t& slot, int32_t sec_id, const char* symbol, int64_t price_shift, int64_t tick_size,
+		int64_t ts, const CmeSide* const sides[NUM_SHM_SIDES])
+{
+	if( slot < 0 )
+	{
+		uint32_t used = header->used.load(std::memory_order_relaxed);
+		if( used == header->capacity )
+		{
+			if( !full_reported )
+				fprintf(stderr, "shared-memory book region full (%u securities)\n", used);
+			full_reported = true;
+			return false;
+		}
+
+		slot = used;
+		ShmBook& book = slots[slot].book;
+		book.sec_id = sec_id;
+		strncpy(book.symbol, symbol, sizeof(book.symbol) - 1);
+		book.price_shift = price_shift;
+		book.tick_size = tick_size;
+
+		// The identity is in place before the slot is counted, so readers
+		// can index it; the levels below are under the seqlock.
+		header->used.store(used + 1, std::memory_order_release);
+	}
+
+	ShmBookSlot& target = slots[slot];
+
+	// The end of an event publishes every security it touched, most often
+	// with the levels it already has; only the writer changes the slot, so
+	// it can compare without the seqlock and leave readers' copies valid.
+	if( Unchanged(target.book, sides) )
+		return true;
+
+	uint32_t seq = target.seq.load(std::memory_order_relaxed);
+	target.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	ShmBook& book = target.book;
+	for(int s = 0; s < NUM_SHM_SIDES; ++s)
+	{
+		int count = std::min((int)sides[s]->levels.size(), MAX_LEVELS);
+		book.count[s] = (uint8_t)count;
+		memcpy(book.levels[s], sides[s]->levels.data(), count * sizeof(ShmLevel));
+	}
+	int64_t now = wall_clock_ns();
+	book.ts = ts;
+	book.publish_ns = now;
+	++book.updates;
+
+	target.seq.store(seq + 2, std::memory_order_release);
+	header->heartbeat_ns.store(now, std::memory_order_relaxed);
+	return true;
+}
+
+BookSubscriber::BookSubscriber()
+	: region(0)
+	, region_size(0)
+	, header(0)
+	, slots(0)
+	, known(0)
+{
+}
+
+BookSubscriber::~BookSubscriber()
+{
+	Close();
+}
+
+bool BookSubscriber::Open(const char* name)
+{
+	Close();
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmBookHeader) )
+	{
+		close(fd);
+		return false;
+	}
+
+	region_size = st.st_size;
+	region = mmap(0, region_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if( region == MAP_FAILED )
+	{
+		region = 0;
+		return false;
+	}
+
+	header = (const ShmBookHeader*)region;
+	slots = (const ShmBookSlot*)((const char*)region + sizeof(ShmBookHeader));
+
+	if( memcmp(header->magic, SHM_BOOK_MAGIC, sizeof(header->magic)) != 0
+	 || header->slot_size != sizeof(ShmBookSlot)
+	 || region_bytes(header->capacity) > region_size )
+	{
+		fprintf(stderr, "%s: not a book region of this version\n", name);
+		Close();
+		return false;
+	}
+
+	known = 0;
+	index.clear();
+	return true;
+}
+
+void BookSubscriber::Close()
+{
+	if( region )
+		munmap(region, region_size);
+	region = 0;
+	header = 0;
+	slots = 0;
+}
+
+void BookSubscriber::Refresh()
+{
+	uint32_t used = Used();
+	for(; known < used; ++known)
+		index[slots[known].book.sec_id] = known;
+}
+
+int BookSubscriber::Find(int32_t sec_id)
+{
+	auto found = index.find(sec_id);
+	if( found != index.end() )
+		return found->second;
+
+	Refresh();
+	found = index.find(sec_id);
+	return found == index.end() ? -1 : found->second;
+}
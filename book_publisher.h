@@ -0,0 +1,163 @@
+#pragma once
+
+#ifndef _BOOK_PUBLISHER_H_
+#define _BOOK_PUBLISHER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+#include "cme_book.h"
+
+// Layout of the shared-memory book region: a ShmBookHeader, then `capacity`
+// ShmBookSlots. Slots are taken in order as securities are first published
+// and never move; `used` counts the slots in use.
+//
+// Each slot is guarded by a seqlock: the writer makes `seq` odd, writes the
+// slot, and makes it even again. A reader copies the slot between two reads
+// of `seq` and keeps the copy only if both were the same even value, so
+// readers never block the writer or each other.
+
+static constexpr const char SHM_BOOK_MAGIC[8] = { 'C', 'M', 'E', 'S', 'H', 'M', 'B', '1' };
+
+enum ShmBookSide
+{
+	SHM_BIDS,
+	SHM_ASKS,
+	SHM_IMPLIED_BIDS,
+	SHM_IMPLIED_ASKS,
+	NUM_SHM_SIDES
+};
+
+struct ShmLevel
+{
+	int64_t price;		// wire price; divide by ShmBook::price_shift for the clean price
+	int32_t quantity;
+	int32_t orders;
+};
+
+// The part of a slot that is copied out.
+struct ShmBook
+{
+	int32_t sec_id;
+	char symbol[24];
+	uint8_t count[NUM_SHM_SIDES];
+	int64_t price_shift;
+	int64_t tick_size;		// in clean units
+	int64_t ts;				// capture time of the event that last changed the book
+	int64_t publish_ns;		// CLOCK_REALTIME when it was written
+	uint64_t updates;
+	ShmLevel levels[NUM_SHM_SIDES][MAX_LEVELS];
+};
+
+struct alignas(64) ShmBookSlot
+{
+	std::atomic<uint32_t> seq;
+	ShmBook book;
+};
+
+struct alignas(64) ShmBookHeader
+{
+	char magic[8];
+	uint32_t slot_size;
+	uint32_t capacity;
+	std::atomic<uint32_t> used;
+	std::atomic<int64_t> heartbeat_ns;	// last publish that changed a book
+};
+
+// Mirrors books into a POSIX shared-memory region for other processes on
+// the host. There is a single writer; publishing a book is a copy into its
+// slot between two stores of the sequence number.
+class BookPublisher
+{
+public:
+	BookPublisher();
+	~BookPublisher();
+
+	// Creates (or replaces) the region /name with room for capacity books.
+	bool Open(const char* name, uint32_t capacity);
+
+	// Unmaps and removes the region; attached readers keep their mapping.
+	void Close();
+
+	// Publishes one security's sides. slot is the security's slot, -1
+	// until its first publish; returns false if the region is full. Prices
+	// are copied as they are on the wire, so an update is a plain copy of
+	// the levels. Sides equal to the published ones leave the slot, its
+	// sequence number and its ts untouched.
+	bool Publish(int32_t& slot, int32_t sec_id, const char* symbol, int64_t price_shift, int64_t tick_size,
+			int64_t ts, const CmeSide* const sides[NUM_SHM_SIDES]);
+
+	uint32_t Used() const { return header ? header->used.load(std::memory_order_relaxed) : 0; }
+
+private:
+	static bool Unchanged(const ShmBook& book, const CmeSide* const sides[NUM_SHM_SIDES]);
+
+	std::string name;
+	void* region;
+	size_t region_size;
+	ShmBookHeader* header;
+	ShmBookSlot* slots;
+	bool full_reported;
+};
+
+// Attaches to a region created by BookPublisher, read-only.
+class BookSubscriber
+{
+public:
+	BookSubscriber();
+	~BookSubscriber();
+
+	bool Open(const char* name);
+	void Close();
+
+	// Slot of sec_id, or -1 if it has not been published yet.
+	int Find(int32_t sec_id);
+
+	uint32_t Used() const { return header->used.load(std::memory_order_acquire); }
+
+	// Copies a consistent snapshot of slot in one attempt; false if the
+	// writer was updating it. Never waits.
+	bool TryRead(int slot, ShmBook& book, uint32_t& seq) const
+	{
+		const ShmBookSlot& source = slots[slot];
+		uint32_t before = source.seq.load(std::memory_order_acquire);
+		if( before & 1 )
+			return false;
+
+		book = source.book;
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		seq = source.seq.load(std::memory_order_relaxed);
+		return seq == before;
+	}
+
+	// Retries TryRead until it succeeds; returns the attempts taken.
+	int Read(int slot, ShmBook& book, uint32_t& seq) const
+	{
+		int attempts = 1;
+		while( !TryRead(slot, book, seq) )
+			++attempts;
+		return attempts;
+	}
+
+	// Sequence number of slot; it changes with every update.
+	uint32_t Seq(int slot) const { return slots[slot].seq.load(std::memory_order_acquire); }
+
+	int64_t HeartbeatNs() const { return header->heartbeat_ns.load(std::memory_order_relaxed); }
+
+private:
+	void Refresh();
+
+	void* region;
+	size_t region_size;
+	const ShmBookHeader* header;
+	const ShmBookSlot* slots;
+	uint32_t known;
+	std::unordered_map<int32_t, int> index;
+};
+
+#endif // _BOOK_PUBLISHER_H_
@@ -0,0 +1,330 @@
+#include "book_sampler.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+static uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static char* put_varint(char* out, uint64_t value)
+{
+	while( value >= 0x80 )
+	{
+		*out++ = (char)(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (char)value;
+	return out;
+}
+
+BookSampler::BookSampler()
+	: f(0)
+	, depth(0)
+	, interval_ns(0)
+	, every_events(0)
+	, buffer(0)
+	, pos(0)
+	, frames(0)
+	, rows(0)
+	, bytes(0)
+{
+	Reset();
+}
+
+BookSampler::~BookSampler()
+{
+	Close();
+}
+
+bool BookSampler::Open(const char* path, int64_t interval_ns, uint32_t every_events, int depth)
+{
+	Close();
+
+	f = fopen(path, "wb");
+	if( !f )
+		return false;
+
+	this->depth = std::max(1, std::min(depth, MAX_LEVELS));
+	this->interval_ns = interval_ns;
+	this->every_events = interval_ns ? 0 : every_events;
+
+	buffer = new char[BUFFER_SIZE];
+	pos = 0;
+	frames = rows = bytes = 0;
+	Reset();
+
+	BookSampleHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BOOK_SAMPLE_MAGIC, sizeof(header.magic));
+	header.depth = this->depth;
+	header.every_events = this->every_events;
+	header.interval_ns = this->interval_ns;
+	memcpy(buffer, &header, sizeof(header));
+	pos = sizeof(header);
+	return true;
+}
+
+void BookSampler::Close()
+{
+	if( !f )
+		return;
+
+	Sample(last_ts);
+	Flush();
+	fclose(f);
+	f = 0;
+
+	delete[] buffer;
+	buffer = 0;
+}
+
+void BookSampler::Reset()
+{
+	for(const Pending& entry : pending)
+		entry.sampled->queued = false;
+	pending.clear();
+
+	// Interval sampling waits for the first packet to align its ticks.
+	next_tick = interval_ns ? 0 : INT64_MAX;
+	last_ts = 0;
+	frame_ts = 0;
+	events = 0;
+}
+
+void BookSampler::Tick(int64_t ts)
+{
+	int64_t boundary = ts - ts % interval_ns;
+	if( next_tick != 0 )
+		Sample(boundary);
+	next_tick = boundary + interval_ns;
+}
+
+void BookSampler::Sample(int64_t ts)
+{
+	bool frame_open = false;
+	for(const Pending& entry : pending)
+	{
+		entry.sampled->queued = false;
+
+		if( pos + MAX_ROW_BYTES + 11 > BUFFER_SIZE )
+			Flush();
+
+		size_t frame_start = pos;
+		if( !frame_open )
+			pos = put_varint(buffer + pos, zigzag(ts - frame_ts)) - buffer;
+
+		if( WriteRow(entry) )
+			frame_open = true;
+		else
+			pos = frame_start;
+	}
+	pending.clear();
+
+	if( frame_open )
+	{
+		buffer[pos++] = 0;
+		frame_ts = ts;
+		++frames;
+	}
+}
+
+bool BookSampler::WriteRow(const Pending& entry)
+{
+	SampledBook& sampled = *entry.sampled;
+	const CmeSide* sides[NUM_SAMPLE_SIDES] = { entry.bids, entry.asks };
+
+	// Encoded in place; dropped again if nothing changed.
+	bool changed = false;
+	char* out = put_varint(buffer + pos, (uint32_t)entry.sec_id);
+	for(int s = 0; s < NUM_SAMPLE_SIDES; ++s)
+	{
+		int count = std::min(depth, (int)sides[s]->levels.size());
+		changed |= count != sampled.count[s];
+		out = put_varint(out, count);
+
+		for(int i = 0; i < count; ++i)
+		{
+			const CmeLevel& level = sides[s]->levels[i];
+			CmeLevel& sent = sampled.levels[s][i];
+
+			// Only divide to clean prices that moved.
+			int64_t price = level.price == sent.price ? 0 : entry.scale->Clean(WirePrice(level.price)).value - entry.scale->Clean(WirePrice(sent.price)).value;
+			int64_t quantity = (int64_t)level.quantity - sent.quantity;
+			int64_t orders = (int64_t)level.orders - sent.orders;
+			changed |= (price | quantity | orders) != 0;
+
+			out = put_varint(out, zigzag(price));
+			out = put_varint(out, zigzag(quantity));
+			out = put_varint(out, zigzag(orders));
+			sent = level;
+		}
+		sampled.count[s] = count;
+	}
+
+	if( !changed )
+		return false;
+
+	pos = out - buffer;
+	++rows;
+	return true;
+}
+
+void BookSampler::Flush()
+{
+	if( pos )
+		fwrite(buffer, 1, pos, f);
+	bytes += pos;
+	pos = 0;
+}
+
+BookSampleReader::BookSampleReader()
+	: f(0)
+	, pos(0)
+	, length(0)
+	, in_frame(false)
+	, ts(0)
+	, failed(false)
+{
+}
+
+BookSampleReader::~BookSampleReader()
+{
+	Close();
+}
+
+bool BookSampleReader::Open(const char* path)
+{
+	Close();
+
+	f = fopen(path, "rb");
+	if( !f )
+		return false;
+
+	if( fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, BOOK_SAMPLE_MAGIC, sizeof(header.magic)) != 0 )
+	{
+		fprintf(stderr, "%s: not a book sample file\n", path);
+		Close();
+		return false;
+	}
+
+	pos = length = 0;
+	in_frame = false;
+	ts = 0;
+	failed = false;
+	books.clear();
+	return true;
+}
+
+void BookSampleReader::Close()
+{
+	if( f )
+		fclose(f);
+	f = 0;
+}
+
+bool BookSampleReader::ReadByte(uint8_t& value)
+{
+	if( pos == length )
+	{
+		length = fread(buffer, 1, sizeof(buffer), f);
+		pos = 0;
+		if( length == 0 )
+			return false;
+	}
+	value = (uint8_t)buffer[pos++];
+	return true;
+}
+
+bool BookSampleReader::ReadVarint(uint64_t& value)
+{
+	value = 0;
+	for(int shift = 0; shift < 64; shift += 7)
+	{
+		uint8_t byte;
+		if( !ReadByte(byte) )
+			return false;
+
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if( !(byte & 0x80) )
+			return true;
+	}
+	return false;
+}
+
+bool BookSampleReader::ReadSigned(int64_t& value)
+{
+	uint64_t raw;
+	if( !ReadVarint(raw) )
+		return false;
+	value = unzigzag(raw);
+	return true;
+}
+
+bool BookSampleReader::Next(BookSampleRow& row)
+{
+	if( !f || failed )
+		return false;
+
+	uint64_t sec_id;
+	for(;;)
+	{
+		if( !in_frame )
+		{
+			int64_t delta;
+			if( !ReadSigned(delta) )
+				return false;	// clean end of file
+			ts += delta;
+			in_frame = true;
+		}
+
+		if( !ReadVarint(sec_id) )
+		{
+			failed = true;
+			return false;
+		}
+
+		if( sec_id != 0 )
+			break;
+		in_frame = false;
+	}
+
+	SampledBook& book = books[(int32_t)sec_id];
+	for(int s = 0; s < NUM_SAMPLE_SIDES; ++s)
+	{
+		uint64_t count;
+		if( !ReadVarint(count) || count > MAX_LEVELS )
+		{
+			failed = true;
+			return false;
+		}
+
+		for(uint64_t i = 0; i < count; ++i)
+		{
+			int64_t price, quantity, orders;
+			if( !ReadSigned(price) || !ReadSigned(quantity) || !ReadSigned(orders) )
+			{
+				failed = true;
+				return false;
+			}
+
+			CmeLevel& level = book.levels[s][i];
+			level.price += price;
+			level.quantity += (int)quantity;
+			level.orders += (int)orders;
+		}
+		book.count[s] = (uint8_t)count;
+	}
+
+	row.ts = ts;
+	row.sec_id = (int32_t)sec_id;
+	row.book = &book;
+	return true;
+}
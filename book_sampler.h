@@ -0,0 +1,200 @@
+#pragma once
+
+#ifndef _BOOK_SAMPLER_H_
+#define _BOOK_SAMPLER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "cme_book.h"
+#include "price_scale.h"
+
+// Book sample file layout: a BookSampleHeader, then frames of
+//
+//   zigzag varint   sample time - previous frame's time (the first is from 0)
+//   rows            uvarint sec_id (never 0), then for bids and asks:
+//                   uvarint level count, and per level the zigzag varint
+//                   deltas of price, quantity and orders from the same
+//                   level last written for that security
+//   0               end of frame
+//
+// A security only has a row in frames where its top levels changed since
+// its previous row. Levels past the count keep their last values, which are
+// the base of the next deltas. Prices are clean prices.
+
+static constexpr const char BOOK_SAMPLE_MAGIC[8] = { 'C', 'M', 'E', 'B', 'O', 'O', 'K', '1' };
+
+struct BookSampleHeader
+{
+	char magic[8];
+	uint32_t depth;
+	uint32_t every_events;
+	int64_t interval_ns;
+};
+
+enum BookSampleSide
+{
+	SAMPLE_BIDS,
+	SAMPLE_ASKS,
+	NUM_SAMPLE_SIDES
+};
+
+// Top levels of one security as last written, kept by the writer in
+// SecurityInfo (wire prices) and by the reader per sec_id (clean prices).
+struct SampledBook
+{
+	CmeLevel levels[NUM_SAMPLE_SIDES][MAX_LEVELS];
+	uint8_t count[NUM_SAMPLE_SIDES];
+	bool queued;
+
+	SampledBook()
+		: queued(false)
+	{
+		count[SAMPLE_BIDS] = 0;
+		count[SAMPLE_ASKS] = 0;
+	}
+};
+
+// Samples the top levels of every book that changed, every interval_ns of
+// capture time or every every_events book events. Securities are queued
+// when their book changes, so a sample only walks those, and the encoded
+// rows go to a large buffer written out with one fwrite per megabyte.
+class BookSampler
+{
+public:
+	BookSampler();
+	~BookSampler();
+
+	// One of interval_ns and every_events is non-zero.
+	bool Open(const char* path, int64_t interval_ns, uint32_t every_events, int depth);
+
+	// Writes what changed since the last sample, then closes the file.
+	void Close();
+
+	bool Enabled() const { return f != 0; }
+
+	// Call with each packet's time before parsing it; takes a sample when
+	// an interval boundary was crossed, of the books as they were before
+	// the packet.
+	void Advance(int64_t ts)
+	{
+		last_ts = ts;
+		if( ts >= next_tick )
+			Tick(ts);
+	}
+
+	// The book of sec_id changed in the current event.
+	void Changed(int32_t sec_id, SampledBook& sampled, const CmeSide& bids, const CmeSide& asks, const PriceScale& scale)
+	{
+		if( sampled.queued )
+			return;
+
+		sampled.queued = true;
+		Pending entry = { sec_id, &sampled, &bids, &asks, &scale };
+		pending.push_back(entry);
+	}
+
+	// Call at the end of each book event.
+	void EndOfEvent(int64_t ts)
+	{
+		if( every_events && ++events >= every_events )
+		{
+			events = 0;
+			Sample(ts);
+		}
+	}
+
+	// Forgets queued securities, for a new capture on this thread.
+	void Reset();
+
+	uint64_t Frames() const { return frames; }
+	uint64_t Rows() const { return rows; }
+	uint64_t Bytes() const { return bytes + pos; }
+
+private:
+	static constexpr const size_t BUFFER_SIZE = 1 << 20;
+	// sec_id, two counts and three 10 byte varints per level and side.
+	static constexpr const size_t MAX_ROW_BYTES = 5 + NUM_SAMPLE_SIDES * (1 + MAX_LEVELS * 30);
+
+	struct Pending
+	{
+		int32_t sec_id;
+		SampledBook* sampled;
+		const CmeSide* bids;
+		const CmeSide* asks;
+		const PriceScale* scale;
+	};
+
+	void Tick(int64_t ts);
+	void Sample(int64_t ts);
+	bool WriteRow(const Pending& entry);
+	void Flush();
+
+	FILE* f;
+	int depth;
+	int64_t interval_ns;
+	uint32_t every_events;
+
+	int64_t next_tick;
+	int64_t last_ts;
+	int64_t frame_ts;	// time of the previous frame
+	uint32_t events;
+
+	std::vector<Pending> pending;
+
+	char* buffer;
+	size_t pos;
+
+	uint64_t frames;
+	uint64_t rows;
+	uint64_t bytes;
+};
+
+struct BookSampleRow
+{
+	int64_t ts;
+	int32_t sec_id;
+	const SampledBook* book;	// the security's top levels after this row
+};
+
+// Reads a book sample file back into full top-level snapshots.
+class BookSampleReader
+{
+public:
+	BookSampleReader();
+	~BookSampleReader();
+
+	bool Open(const char* path);
+	void Close();
+
+	const BookSampleHeader& Header() const { return header; }
+
+	// The next row, or false at the end of the file or on corrupt data.
+	bool Next(BookSampleRow& row);
+
+	// False if the file was corrupt or truncated.
+	bool Ok() const { return !failed; }
+
+private:
+	bool ReadByte(uint8_t& value);
+	bool ReadVarint(uint64_t& value);
+	bool ReadSigned(int64_t& value);
+
+	FILE* f;
+	BookSampleHeader header;
+
+	char buffer[1 << 16];
+	size_t pos;
+	size_t length;
+
+	bool in_frame;
+	int64_t ts;
+	bool failed;
+
+	std::unordered_map<int32_t, SampledBook> books;
+};
+
+#endif // _BOOK_SAMPLER_H_
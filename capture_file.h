@@ -0,0 +1,441 @@
+#pragma once
+
+#ifndef _CAPTURE_FILE_H_
+#define _CAPTURE_FILE_H_
+
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <endian.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cme_parser.h"
+#include "decompress_stream.h"
+#include "uring_reader.h"
+
+struct PcapFileHeader
+{
+    uint32_t magic_number;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t gmt_correction;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} PACKED;
+
+struct PcapPacketHeader
+{
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} PACKED;
+
+struct ErfPacketHeader
+{
+    uint32_t ts_nanos;
+    uint32_t ts_seconds;
+    char type;
+    char flags;
+    uint16_t rlen;
+    uint16_t color;
+    uint16_t wlen;
+} PACKED;
+
+struct IpHeader
+{
+    ether_header eth;
+    iphdr ip;
+    udphdr udp;
+} PACKED;
+
+// ERF Ethernet records carry two bytes of padding ahead of the frame.
+static constexpr const int ERF_ETH_PAD = 2;
+static constexpr const int MAX_FRAME_SIZE = 2048;
+
+static constexpr const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+static constexpr const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+static constexpr const uint32_t PCAP_LINKTYPE_ETHERNET = 1;
+static constexpr const char ERF_TYPE_ETH = 2;
+
+// How CaptureReader reads an uncompressed capture.
+enum CaptureIo
+{
+	CAPTURE_IO_STDIO,		// fread into a frame buffer
+	CAPTURE_IO_MMAP,		// frames read in place from a mapping of the file
+	CAPTURE_IO_URING,		// read ahead through io_uring; see UringReader
+	NUM_CAPTURE_IOS
+};
+
+static const char* const CAPTURE_IO_NAMES[NUM_CAPTURE_IOS] = { "stdio", "mmap", "uring" };
+
+inline bool ParseCaptureIo(const char* text, CaptureIo& io)
+{
+	for(int i = 0; i < NUM_CAPTURE_IOS; ++i)
+	{
+		if( strcmp(text, CAPTURE_IO_NAMES[i]) == 0 )
+		{
+			io = (CaptureIo)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline const char* CaptureIoName(CaptureIo io)
+{
+	return io < NUM_CAPTURE_IOS ? CAPTURE_IO_NAMES[io] : "?";
+}
+
+// Sequential reader over an ERF or pcap capture, handing out one Ethernet
+// frame at a time. The format is detected from the pcap magic number; files
+// without one are read as ERF. gzip and zstd compressed captures are
+// decoded on a background thread and frames point into the decoded data;
+// uncompressed ones are read as io says. The frame pointer stays valid
+// until the next call to Next().
+class CaptureReader
+{
+public:
+	CaptureReader()
+		: f(0)
+		, stream(0)
+		, uring(0)
+		, map(0)
+		, map_length(0)
+		, map_pos(0)
+		, pcap(false)
+		, pcap_nanos(false)
+	{
+	}
+
+	~CaptureReader()
+	{
+		Close();
+	}
+
+	bool Open(const char* path, CaptureIo io = CAPTURE_IO_STDIO)
+	{
+		f = fopen(path, "rb");
+		if( !f )
+			return false;
+
+		DecompressStream::Codec codec = DecompressStream::Detect(f);
+		if( codec != DecompressStream::CODEC_NONE )
+		{
+			stream = new DecompressStream();
+			bool opened = stream->Open(f, codec);
+			f = 0;
+			if( !opened )
+				return false;
+
+			size_t head_length;
+			const char* head = stream->Head(head_length);
+			PcapFileHeader file_header;
+			if( head && head_length >= sizeof(file_header) )
+			{
+				memcpy(&file_header, head, sizeof(file_header));
+				if( file_header.magic_number == PCAP_MAGIC_USEC || file_header.magic_number == PCAP_MAGIC_NSEC )
+				{
+					pcap = true;
+					pcap_nanos = file_header.magic_number == PCAP_MAGIC_NSEC;
+					stream->Read(sizeof(file_header));
+				}
+			}
+			return true;
+		}
+
+		if( io != CAPTURE_IO_STDIO )
+		{
+			fclose(f);
+			f = 0;
+			if( !(io == CAPTURE_IO_MMAP ? OpenMap(path) : OpenUring(path)) )
+				return false;
+
+			size_t head_length = map_length;
+			const char* head = uring ? uring->Head(head_length) : map;
+
+			PcapFileHeader file_header;
+			if( head && head_length >= sizeof(file_header) )
+			{
+				memcpy(&file_header, head, sizeof(file_header));
+				if( file_header.magic_number == PCAP_MAGIC_USEC || file_header.magic_number == PCAP_MAGIC_NSEC )
+				{
+					pcap = true;
+					pcap_nanos = file_header.magic_number == PCAP_MAGIC_NSEC;
+					ReadBytes(sizeof(file_header));
+				}
+			}
+			return true;
+		}
+
+		PcapFileHeader file_header;
+		if( fread(&file_header, sizeof(file_header), 1, f) == 1
+		 && (file_header.magic_number == PCAP_MAGIC_USEC || file_header.magic_number == PCAP_MAGIC_NSEC) )
+		{
+			pcap = true;
+			pcap_nanos = file_header.magic_number == PCAP_MAGIC_NSEC;
+		}
+		else
+			rewind(f);
+
+		return true;
+	}
+
+	void Close()
+	{
+		if( f )
+			fclose(f);
+		f = 0;
+
+		delete stream;
+		stream = 0;
+
+		delete uring;
+		uring = 0;
+
+		if( map_length )
+			munmap((void*)map, map_length);
+		map = 0;
+		map_length = map_pos = 0;
+	}
+
+	bool Next(int64_t& ts, const char*& frame, int& length)
+	{
+		if( pcap ? NextPcap(ts, frame, length) : NextErf(ts, frame, length) )
+			return true;
+
+		if( stream && !stream->Ok() )
+			fprintf(stderr, "compressed capture is corrupt or truncated\n");
+		if( uring && !uring->Ok() )
+			perror("capture read");
+		return false;
+	}
+
+	// The io_uring reader, 0 unless reading with CAPTURE_IO_URING.
+	const UringReader* Uring() const
+	{
+		return uring;
+	}
+
+	// The decoding thread's CPU time, 0 for uncompressed captures.
+	double DecodeSeconds() const
+	{
+		return stream ? stream->DecodeSeconds() : 0.0;
+	}
+
+private:
+	// The next length bytes of the capture: read into packet from a file, or
+	// pointing into the decoded stream.
+	const char* ReadBytes(int length)
+	{
+		if( stream )
+			return stream->Read(length);
+		if( uring )
+			return uring->Read(length);
+		if( map )
+		{
+			if( map_length - map_pos < (size_t)length )
+				return 0;
+			const char* data = map + map_pos;
+			map_pos += length;
+			return data;
+		}
+
+		if( fread(packet, length, 1, f) != 1 )
+			return 0;
+		return packet;
+	}
+
+	bool OpenMap(const char* path)
+	{
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if( fd < 0 )
+			return false;
+
+		struct stat st;
+		if( fstat(fd, &st) != 0 )
+		{
+			close(fd);
+			return false;
+		}
+
+		// An empty capture maps nothing but still reads as one.
+		static const char empty = 0;
+		map = &empty;
+		if( st.st_size > 0 )
+		{
+			void* mapped = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if( mapped == MAP_FAILED )
+			{
+				map = 0;
+				close(fd);
+				return false;
+			}
+			madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+			map = (const char*)mapped;
+			map_length = st.st_size;
+		}
+		close(fd);
+		return true;
+	}
+
+	bool OpenUring(const char* path)
+	{
+		uring = new UringReader();
+		if( uring->Open(path) )
+			return true;
+
+		delete uring;
+		uring = 0;
+		return false;
+	}
+
+	template<typename T>
+	bool ReadHeader(T& header)
+	{
+		const char* data = ReadBytes(sizeof(header));
+		if( !data )
+			return false;
+		memcpy(&header, data, sizeof(header));
+		return true;
+	}
+
+	bool NextErf(int64_t& ts, const char*& frame, int& length)
+	{
+		ErfPacketHeader pkt_header;
+		if( !ReadHeader(pkt_header) )
+			return false;
+
+		int packet_length = be16toh(pkt_header.rlen) - sizeof(pkt_header);
+		if( packet_length <= ERF_ETH_PAD || packet_length > (int)sizeof(packet) )
+			return false;
+
+		const char* data = ReadBytes(packet_length);
+		if( !data )
+			return false;
+
+		ts = ((int64_t)pkt_header.ts_seconds * 1000000000LL) + (int64_t)pkt_header.ts_nanos;
+		frame = data + ERF_ETH_PAD;
+		length = packet_length - ERF_ETH_PAD;
+		return true;
+	}
+
+	bool NextPcap(int64_t& ts, const char*& frame, int& length)
+	{
+		PcapPacketHeader pkt_header;
+		if( !ReadHeader(pkt_header) )
+			return false;
+
+		if( pkt_header.incl_len == 0 || pkt_header.incl_len > sizeof(packet) )
+			return false;
+
+		const char* data = ReadBytes(pkt_header.incl_len);
+		if( !data )
+			return false;
+
+		ts = (int64_t)pkt_header.ts_sec * 1000000000LL + (int64_t)pkt_header.ts_nsec * (pcap_nanos ? 1 : 1000);
+		frame = data;
+		length = (int)pkt_header.incl_len;
+		return true;
+	}
+
+	FILE* f;
+	DecompressStream* stream;
+	UringReader* uring;
+	const char* map;
+	size_t map_length;
+	size_t map_pos;
+	bool pcap;
+	bool pcap_nanos;
+	char packet[MAX_FRAME_SIZE];
+};
+
+// Writes Ethernet frames as an ERF (the layout CaptureReader expects) or a
+// nanosecond pcap capture.
+class CaptureWriter
+{
+public:
+	CaptureWriter()
+		: f(0)
+		, pcap(false)
+	{
+	}
+
+	~CaptureWriter()
+	{
+		Close();
+	}
+
+	bool Open(const char* path, bool pcap_format)
+	{
+		f = fopen(path, "wb");
+		if( !f )
+			return false;
+
+		pcap = pcap_format;
+		if( pcap )
+		{
+			PcapFileHeader file_header;
+			file_header.magic_number = PCAP_MAGIC_NSEC;
+			file_header.version_major = 2;
+			file_header.version_minor = 4;
+			file_header.gmt_correction = 0;
+			file_header.sigfigs = 0;
+			file_header.snaplen = MAX_FRAME_SIZE;
+			file_header.network = PCAP_LINKTYPE_ETHERNET;
+			fwrite(&file_header, sizeof(file_header), 1, f);
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		if( f )
+			fclose(f);
+		f = 0;
+	}
+
+	void Write(int64_t ts, const char* frame, int length)
+	{
+		if( pcap )
+		{
+			PcapPacketHeader pkt_header;
+			pkt_header.ts_sec = (uint32_t)(ts / 1000000000LL);
+			pkt_header.ts_nsec = (uint32_t)(ts % 1000000000LL);
+			pkt_header.incl_len = length;
+			pkt_header.orig_len = length;
+			fwrite(&pkt_header, sizeof(pkt_header), 1, f);
+		}
+		else
+		{
+			static const char pad[ERF_ETH_PAD] = { 0 };
+
+			ErfPacketHeader pkt_header;
+			pkt_header.ts_nanos = (uint32_t)(ts % 1000000000LL);
+			pkt_header.ts_seconds = (uint32_t)(ts / 1000000000LL);
+			pkt_header.type = ERF_TYPE_ETH;
+			pkt_header.flags = 0;
+			pkt_header.rlen = htobe16((uint16_t)(sizeof(pkt_header) + ERF_ETH_PAD + length));
+			pkt_header.color = 0;
+			pkt_header.wlen = htobe16((uint16_t)length);
+			fwrite(&pkt_header, sizeof(pkt_header), 1, f);
+			fwrite(pad, sizeof(pad), 1, f);
+		}
+
+		fwrite(frame, length, 1, f);
+	}
+
+private:
+	FILE* f;
+	bool pcap;
+};
+
+#endif // _CAPTURE_FILE_H_
@@ -6,6 +6,8 @@
 #include <vector>
 #include <functional>
 
+#include "arena.h"
+
 static constexpr const int MAX_LEVELS = 10;
 
 struct CmeLevel
@@ -25,7 +27,7 @@ struct CmeLevel
 
 struct CmeSide
 {
-	std::vector<CmeLevel> levels;
+	ArenaVector<CmeLevel> levels;
 
 	void AddLevel(int index, int64_t price, int quantity, int orders)
 	{
@@ -128,4 +130,12 @@ struct CmeBook
 	}
 };
 
+template<>
+struct ArenaResettable<CmeSide> : ArenaMembers<CmeSide, decltype(CmeSide::levels)> {};
+
+template<>
+struct ArenaResettable<CmeBook> : ArenaMembers<CmeBook,
+	decltype(CmeBook::bids), decltype(CmeBook::impliedBids), decltype(CmeBook::asks), decltype(CmeBook::impliedAsks),
+	decltype(CmeBook::combinedBids), decltype(CmeBook::combinedAsks)> {};
+
 #endif // _CME_BOOK_H_
@@ -1,10 +1,8 @@
-#include <net/ethernet.h>
-#include <netinet/ip.h>
-#include <netinet/udp.h>
-
 #include "cme_parser.h"
+#include "capture_file.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include <iostream>
@@ -12,120 +10,242 @@
 #include <functional>
 #include <algorithm>
 #include <map>
+#include <memory>
 
 #include "cme_book.h"
 #include "security_info.h"
+#include "latency_histogram.h"
+#include "latency_monitor.h"
+#include "perf_profiler.h"
+#include "instrument_registry.h"
+#include "bar_aggregator.h"
+#include "book_sampler.h"
+#include "book_publisher.h"
+#include "implied_engine.h"
+#include "event_journal.h"
+#include "arena.h"
 
 static constexpr const char* SWEEPS_HEADERS = "ts,symbol,start_price,end_price,total_traded,aggr_side";
 static constexpr const char* ICEBERGS_HEADERS = "ts,symbol,price,show_size,traded_size,side";
-static constexpr const char* STOPS_HEADERS = "ts,exchange_ts,symbol,order_id,trigger_price,order_size,traded_size,side";
+static constexpr const char* STOPS_HEADERS = "ts,exchange_ts,symbol,order_id,trigger_price,fill_price,order_size,traded_size,side";
 
-struct PcapFileHeader
-{
-    uint32_t magic_number;
-    uint16_t version_major;
-    uint16_t version_minor;
-    int32_t gmt_correction;
-    uint32_t sigfigs;
-    uint32_t snaplen;
-    uint32_t network;
-} PACKED;
+using namespace std;
 
-struct PcapPacketHeader
+// Parser state is per thread so batch workers can each run a capture with
+// their own books and outputs. The security universe is loaded once and
+// shared; instrument definitions parsed on a thread go into it too, unless
+// IsolateDefinitions() gave the thread an overlay of its own.
+thread_local std::ofstream sweeps_file;
+thread_local std::ofstream icebergs_file;
+thread_local std::ofstream stops_file;
+thread_local BarAggregator bar_aggregator;
+thread_local BookSampler book_sampler;
+thread_local ImpliedEngine implied_engine;
+thread_local JournalWriter journal;
+thread_local JournalReader journal_reader;
+
+InstrumentRegistry instruments;
+
+// Instruments defined on the wire on this thread, with isolated definitions;
+// dropped by ResetState().
+thread_local std::unique_ptr<InstrumentRegistry> local_instruments;
+
+// Every isolated definition, for SaveSecInfo() only: parsing never looks here.
+InstrumentRegistry isolated_definitions;
+
+// SecurityInfo by InstrumentDef::index, and every one created, on this thread.
+// They and their containers are allocated from ThreadArena().
+thread_local std::vector<SecurityInfo*> info_table;
+thread_local std::vector<SecurityInfo*> info_list;
+
+thread_local std::vector<SecurityInfo*> packet_infos;
+
+// SecurityInfo by dense index of the journal being replayed.
+thread_local std::vector<SecurityInfo*> journal_infos;
+
+// A book or trade entry of the frames given to parse_packets(), resolved a
+// step per pass to the SecurityInfo it updates.
+struct PrefetchRef
 {
-    uint32_t ts_sec;
-    uint32_t ts_nsec;
-    uint32_t incl_len;
-    uint32_t orig_len;
-} PACKED;
+	int32_t sec_id;
+	char entry_type;		// book side of a template 32 entry, 0 for a trade
+	const InstrumentDef* def;
+	SecurityInfo* info;
+};
 
-struct ErfPacketHeader
+thread_local std::vector<PrefetchRef> prefetch_refs;
+
+// Stream buffers of the sweeps, icebergs and stops files, mapped like the
+// arena's chunks; none with ARENA_MALLOC, when the streams keep their own.
+// Mapped once per thread: a stream keeps its buffer across close and open.
+struct OutputBuffers
 {
-    uint32_t ts_nanos;
-    uint32_t ts_seconds;
-    char type;
-    char flags;
-    uint16_t rlen;
-    uint16_t color;
-    uint16_t wlen;
-} PACKED;
+	static constexpr const size_t SIZE = 1 << 20;
+
+	char* base;
+	ArenaBacking backing;
+
+	OutputBuffers()
+		: base(0)
+		, backing(ARENA_MALLOC)
+	{
+	}
+
+	~OutputBuffers()
+	{
+		Arena::UnmapPages(base, 3 * SIZE, backing);
+	}
+};
 
-struct IpHeader
+static thread_local OutputBuffers output_buffers;
+
+bool echo_icebergs = true;
+
+LatencyHistogram* signal_latency = 0;
+LatencyMonitor* latency_monitor = 0;
+PerfProfiler* perf_profiler = 0;
+BookPublisher* book_publisher = 0;
+
+// Wall time parsing of the current packet began, used to time signals when
+// the capture clock is not the local receive clock.
+static thread_local int64_t packet_start = 0;
+
+static int64_t wall_clock_ns()
 {
-    ether_header eth;
-    iphdr ip;
-    udphdr udp;
-} PACKED;
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
 
-using namespace std;
+static void perf_enter(PerfStage stage, uint16_t template_id)
+{
+	if( perf_profiler )
+		perf_profiler->Enter(stage, template_id);
+}
 
-std::ofstream sweeps_file;
-std::ofstream icebergs_file;
-std::ofstream stops_file;
+static void perf_exit()
+{
+	if( perf_profiler )
+		perf_profiler->Exit();
+}
 
-struct SymbolInfo
+// Receive-to-signal latency. signal_latency is only meaningful when pktts
+// comes from the local receive clock (live sources), so it is set only then.
+static void signal_emitted(int64_t pktts, uint16_t channel, uint16_t template_id)
 {
-	std::string symbol;
-	int64_t tick_size;
-	int64_t price_shift;
-};
+	if( !signal_latency && !latency_monitor )
+		return;
 
-std::map<int, SymbolInfo> symbol_map;
-std::map<int, SecurityInfo*> info_map;
+	int64_t now = wall_clock_ns();
+	if( signal_latency )
+		signal_latency->Record(now - pktts);
 
-std::vector<SecurityInfo*> packet_infos;
+	if( latency_monitor )
+		latency_monitor->Record(channel, template_id, CAPTURE_TO_SIGNAL, now - (latency_monitor->LiveClock() ? pktts : packet_start));
+}
 
 void LoadSecInfo()
 {
-	std::ifstream id_file("cme_ids.txt");
+	instruments.LoadCache("cme_ids.txt");
+}
+
+bool SaveSecInfo(const char* path)
+{
+	std::vector<const InstrumentDef*> defs;
+	isolated_definitions.Entries(defs);
+	for(const InstrumentDef* def : defs)
+		instruments.Register(*def, true);
+
+	return instruments.SaveCache(path);
+}
 
-	string line;
-	while(getline(id_file, line))
+void IsolateDefinitions()
+{
+	if( !local_instruments )
 	{
-		string::size_type symbol_idx = line.find(',');
-		string::size_type exchange_id_idx = line.find(',', symbol_idx + 1);
-		string::size_type tick_size_idx = line.find(',', exchange_id_idx + 1);
+		local_instruments.reset(new InstrumentRegistry());
+		local_instruments->SetBase(&instruments);
+	}
+}
 
-		if( symbol_idx == string::npos || exchange_id_idx == string::npos || tick_size_idx == string::npos )
-			continue;
+static const InstrumentDef* find_instrument(int32_t sec_id)
+{
+	if( local_instruments )
+	{
+		const InstrumentDef* def = local_instruments->Find(sec_id);
+		if( def )
+			return def;
+	}
+	return instruments.Find(sec_id);
+}
+
+static const InstrumentDef* register_definition(const InstrumentDef& def)
+{
+	if( !local_instruments )
+		return instruments.Register(def, true);
 
-		int exchange_id = stoi(line.substr(symbol_idx + 1, exchange_id_idx - symbol_idx));
-		int64_t price_shift = stoll(line.substr(exchange_id_idx + 1, tick_size_idx - exchange_id_idx));
-		int64_t tick_size = stoll(line.substr(tick_size_idx + 1));
+	isolated_definitions.Register(def, true);
+	return local_instruments->Register(def, true);
+}
 
-		SymbolInfo info;
-		info.symbol = line.substr(0, symbol_idx);
-		info.tick_size = tick_size;
-		info.price_shift = price_shift;
+// The SecurityInfo of a registered instrument, created on first use.
+static SecurityInfo* info_of(const InstrumentDef* def)
+{
+	if( def->index >= info_table.size() )
+		info_table.resize(std::max<size_t>(def->index + 1, info_table.size() * 2), 0);
 
-		symbol_map.insert( make_pair(exchange_id, info) );
+	SecurityInfo* info = info_table[def->index];
+	if( !info )
+	{
+		info = new (ThreadArena().Allocate(sizeof(SecurityInfo))) SecurityInfo();
+		info->scale.Set(def->price_shift, def->tick_size);
+		info->symbol = def->symbol;
+		info->sec_id = def->sec_id;
+		info->index = def->index;
+
+		info_table[def->index] = info;
+		info_list.push_back(info);
 	}
+	return info;
 }
 
-SecurityInfo* GetInfo(int32_t sec_id)
+// Adds info to the securities the current event updates.
+static SecurityInfo* touch(SecurityInfo* info)
 {
-	auto found = info_map.find(sec_id);
-	if( found == info_map.end() )
+	if( !info->dirty )
 	{
-		auto symbol_found = symbol_map.find(sec_id);
-		if( symbol_found == symbol_map.end() )
-			return 0;
-		SecurityInfo* new_info = new SecurityInfo();
-		new_info->tick_size = symbol_found->second.tick_size;
-		new_info->price_shift = symbol_found->second.price_shift;
-		new_info->symbol = symbol_found->second.symbol;
-		new_info->sec_id = sec_id;
-
-		found = info_map.insert( make_pair(sec_id, new_info) ).first;
+		info->dirty = true;
+		packet_infos.push_back(info);
 	}
 
-	if( !found->second->dirty )
+	return info;
+}
+
+SecurityInfo* GetInfo(int32_t sec_id)
+{
+	const InstrumentDef* def = find_instrument(sec_id);
+	if( !def )
+		return 0;
+
+	return touch(info_of(def));
+}
+
+static uint32_t journal_index(SecurityInfo* info)
+{
+	if( info->journal_index < 0 )
+		info->journal_index = (int32_t)journal.AddSecurity(*find_instrument(info->sec_id));
+	return (uint32_t)info->journal_index;
+}
+
+static ImpliedQuote top_of(const CmeSide& side)
+{
+	ImpliedQuote top = { 0, 0 };
+	if( !side.levels.empty() )
 	{
-		found->second->dirty = true;
-		packet_infos.push_back(found->second);
+		top.price = side.levels[0].price;
+		top.quantity = side.levels[0].quantity;
 	}
-
-	return found->second;
+	return top;
 }
 
 std::string time_to_str(int64_t ts)
@@ -167,9 +287,78 @@ void CmeSideUpdate(CmeSide& side, const CmeBookEntry* entry, const char* sideNam
 	}
 }
 
-char parse_32(int64_t ts, const char* buffer)
+// Applies a template 32 entry to the book of sec_info.
+static void book_entry(SecurityInfo* sec_info, const CmeBookEntry* entry)
+{
+	switch(entry->entry_type)
+	{
+	case '0': 
+		CmeSideUpdate(sec_info->buy_icebergs.outrights, entry, "Bid");
+		break;
+	case '1':
+		CmeSideUpdate(sec_info->sell_icebergs.outrights, entry, "Ask");
+		break;
+	case 'E':
+		CmeSideUpdate(sec_info->buy_icebergs.implieds, entry, "Bid");
+		break;
+	case 'F':
+		CmeSideUpdate(sec_info->sell_icebergs.implieds, entry, "Ask");
+		break;
+	default:
+		break;
+	} 
+
+	sec_info->inside_change |= entry->price_level == 1;
+	if( entry->action_type == 0 && sec_info->stops_info.trades.size() > 1 )
+	{
+		// The unfilled rest of a stop limit order joins the book at the
+		// price the stop traded to.
+		int index = sec_info->stop_prices.Find(sec_info->scale.Clean(WirePrice(entry->price)));
+		if( index >= 0 )
+		{
+			StopsTrade& trade = sec_info->stops_info.trades[index];
+			if( (trade.is_buy && entry->entry_type == '0')
+			 || (!trade.is_buy && entry->entry_type == '1')
+			 )
+			{
+				trade.size += entry->size;
+			}
+		}
+	}
+}
+
+// Whether count entries of entry_size bytes, each at least entry_min, fit
+// between buffer and end.
+static bool group_fits(const char* buffer, const char* end, uint16_t entry_size, size_t count, size_t entry_min)
+{
+	return count == 0 || (entry_size >= entry_min && (size_t)(end - buffer) >= entry_size * count);
+}
+
+// Whether a root block or group header of size bytes fits between buffer and end.
+static bool block_fits(const char* buffer, const char* end, size_t size)
 {
+	return (size_t)(end - buffer) >= size;
+}
+
+// Whether the message at buffer has a header, advances past it, and ends
+// within the packet.
+static bool message_fits(const char* buffer, const char* end)
+{
+	if( !block_fits(buffer, end, sizeof(CmeMessage)) )
+		return false;
+
+	uint16_t msg_length = ((const CmeMessage*)buffer)->msg_length;
+	return msg_length >= sizeof(CmeMessage) && block_fits(buffer, end, msg_length);
+}
+
+char parse_32(int64_t ts, const char* buffer, const char* end)
+{
+	if( !block_fits(buffer, end, sizeof(CmeBookRefresh)) )
+		return 0;
+
     const CmeBookRefresh* refresh = pop_as<CmeBookRefresh>(buffer);
+	if( !group_fits(buffer, end, refresh->entry_size, refresh->num_in_group, sizeof(CmeBookEntry)) )
+		return 0;
 
     for(uint8_t i = 0; i < refresh->num_in_group; ++i)
     {
@@ -179,65 +368,17 @@ char parse_32(int64_t ts, const char* buffer)
 		if( !sec_info )
 			continue;
 
-		const char* action = "";
-		switch(entry->action_type)
-		{
-		case 0: action = "Add"; break;
-		case 1: action = "Update"; break;
-		case 2: action = "Delete"; break;
-		case 3: action = "DeleteThru"; break;
-		case 4: action = "DeleteFrom"; break;
-		default: break;
-		}
-
-		const char* side = "";
-		switch(entry->entry_type)
-		{
-		case '0': 
-			CmeSideUpdate(sec_info->buy_icebergs.outrights, entry, "Bid");
-			side = "Bid";
-			break;
-		case '1':
-			CmeSideUpdate(sec_info->sell_icebergs.outrights, entry, "Ask");
-			side = "Ask";
-			break;
-		case 'E':
-			CmeSideUpdate(sec_info->buy_icebergs.implieds, entry, "Bid");
-			side = "ImpliedBid";
-			break;
-		case 'F':
-			CmeSideUpdate(sec_info->sell_icebergs.implieds, entry, "Ask");
-			side = "ImpliedAsk";
-			break;
-		default:
-			break;
-		} 
+		if( journal.Enabled() )
+			journal.Book(journal_index(sec_info), entry);
 
-		sec_info->inside_change |= entry->price_level == 1;
-		if( entry->action_type == 0 && sec_info->stops_info.trades.size() > 1 )
-		{
-			for(int i = 0; i < sec_info->stops_info.trades.size(); ++i)
-			{
-				if( entry->price == sec_info->stops_info.trades[i].highest_price )
-				{
-					const StopsTrade& trade = sec_info->stops_info.trades[i];
-					if( (trade.is_buy && entry->entry_type == '0')
-					 || (!trade.is_buy && entry->entry_type == '1')
-					 )
-					{
-						sec_info->stops_info.trades[i].size += entry->size;
-						break;
-					}
-				}
-			}
-		}
+		book_entry(sec_info, entry);
     }
 
 	return refresh->indicator;
 
 }
 
-void print_sweep(std::ostream& out, const std::string& symbol, const SweepInfo& info)
+void print_sweep(std::ostream& out, const char* symbol, const SweepInfo& info)
 {
 	sweeps_file  << time_to_str(info.startTime)
 		 << ',' << symbol
@@ -249,16 +390,137 @@ void print_sweep(std::ostream& out, const std::string& symbol, const SweepInfo&
 
 }
 
-char parse_42(int64_t packetTs, const char* buffer)
+// State of a trade summary (42) message carried across its entries.
+struct TradeSummary
+{
+	uint64_t transact_time;
+	bool is_buy;
+	CleanPrice last_price;
+	uint32_t order_total;
+};
+
+static void trade_entry(int64_t packetTs, TradeSummary& summary, SecurityInfo* sec_info, const CmeTradeEntry* entry)
+{
+	/*
+	cout << time_to_str(packetTs) 
+		 << " Trade" 
+		 << " " << sec_info->symbol
+		 << " price:" << sec_info->CleanPrice(entry->price)
+		 << " qty:" << entry->qty 
+		 << " aggr_side:" << (int)entry->aggressor_side
+		 << endl;
+		 */
+
+	sec_info->inside_change = true;
+
+	if( entry->aggressor_side == 0 )
+	{
+		sec_info->sweep_info.ignoreTrades = true;
+	}
+
+	sec_info->traded_locally = true;
+	CleanPrice price = sec_info->scale.Clean(WirePrice(entry->price));
+
+	if( sec_info->sweep_info.firstAggressor )
+	{
+		sec_info->sweep_info.startTime = packetTs;
+		sec_info->sweep_info.exchangeTime = summary.transact_time;
+		sec_info->sweep_info.startTime = packetTs;
+		sec_info->sweep_info.startPrice = price.value;
+		sec_info->sweep_info.firstAggressor = false;
+		sec_info->sweep_info.isBuy = entry->aggressor_side == 1;
+	}
+
+	if( sec_info->stops_info.first_price == 0 )
+		sec_info->stops_info.first_price = price.value;
+
+	sec_info->sweep_info.totalVolume += entry->qty;
+	sec_info->sweep_info.endPrice = price.value;
+
+	if( bar_aggregator.Enabled() )
+		bar_aggregator.Trade(sec_info->bars, sec_info->symbol, summary.transact_time, price, sec_info->scale, entry->qty, entry->aggressor_side);
+
+	switch(entry->aggressor_side)
+	{
+	case 1:
+		sec_info->sell_icebergs.AddTrade(entry->price, entry->qty, true);
+		summary.is_buy = true;
+		break;
+	case 2:
+		sec_info->buy_icebergs.AddTrade(entry->price, entry->qty, false);
+		summary.is_buy = false;
+		break;
+	}
+	summary.last_price = price;
+}
+
+// An order entry of the message, of the last security it traded.
+static void order_entry(int64_t packetTs, TradeSummary& summary, SecurityInfo* sec_info, const CmeOrderEntry* orders)
+{
+	/*
+	if( i == 0 )
+		cout << "\tAggressor id " << orders->order_id << " " << orders->qty << "\n";
+	else
+		cout << "\tPassive id " << orders->order_id << " " << orders->qty << "\n";
+		*/
+	bool aggressor = orders->qty > summary.order_total;
+	if( aggressor )
+		summary.order_total = orders->qty;
+	else
+		summary.order_total -= orders->qty;
+
+	OrderFill& fill = sec_info->order_fills.Fill(orders->order_id, aggressor, orders->qty, summary.last_price, summary.transact_time);
+	if( aggressor )
+	{
+		// An aggressor older than the event's first one was resting
+		// until the trade elected it: a stop.
+		StopsInfo& stops_info = sec_info->stops_info;
+		if( fill.stop_index < 0 && (stops_info.trades.empty() || stops_info.trades[0].order_id > orders->order_id) )
+		{
+			if( stops_info.trades.empty() )
+			{
+				stops_info.ts = packetTs;
+			}
+
+			fill.stop_index = (int32_t)stops_info.trades.size();
+			stops_info.trades.emplace_back();
+			StopsTrade& trade = stops_info.trades.back();
+
+			trade.start_price = stops_info.first_price;
+			trade.order_id = orders->order_id;
+			trade.size = 0;
+			trade.traded_size = 0;
+		}
+
+		if( fill.stop_index >= 0 )
+		{
+			StopsTrade& stops_trade = stops_info.trades[fill.stop_index];
+			stops_trade.exchange_time = summary.transact_time;
+			stops_trade.size += orders->qty;
+			stops_trade.traded_size += orders->qty;
+			stops_trade.is_buy = summary.is_buy;
+			stops_trade.highest_price = summary.last_price.value;
+			sec_info->stop_prices.Insert(summary.last_price, fill.stop_index);
+		}
+	}
+}
+
+char parse_42(int64_t packetTs, const char* buffer, const char* end)
 {
+	if( !block_fits(buffer, end, sizeof(CmeTradeSummary)) )
+		return 0;
+
 	const CmeTradeSummary* refresh = pop_as<CmeTradeSummary>(buffer);
+	if( !group_fits(buffer, end, refresh->entry_size, refresh->num_in_group, sizeof(CmeTradeEntry)) )
+		return 0;
+
+	TradeSummary summary = { refresh->transact_time, false, CleanPrice(), 0 };
 
-	bool securityFound = false;
-	bool tradedLocally = false;
-	bool is_buy = false;
+	if( journal.Enabled() )
+		journal.Trades(refresh->transact_time);
 
-	int64_t firstPrice = 0;
-	int64_t lastPrice = 0;
+	if( bar_aggregator.Enabled() )
+		bar_aggregator.Advance(refresh->transact_time);
 
 	for(uint8_t i = 0; i < refresh->num_in_group; ++i)
 	{
@@ -268,271 +530,735 @@ char parse_42(int64_t packetTs, const char* buffer)
 		if( !sec_info )
 			continue;
 
-		securityFound = true;
+		if( journal.Enabled() )
+			journal.Trade(journal_index(sec_info), entry);
+
+		trade_entry(packetTs, summary, sec_info, entry);
+	}
+
+	if( !packet_infos.empty() && block_fits(buffer, end, sizeof(GroupSize8Bytes)) )
+	{
+		SecurityInfo* sec_info = packet_infos.back();
+		const GroupSize8Bytes* numOrders = pop_as<GroupSize8Bytes>(buffer);
 
-		const char* aggressor;
-		switch(entry->aggressor_side)
+		// Order entries are read at their schema size, whatever entry_size says.
+		if( sec_info->traded_locally && block_fits(buffer, end, numOrders->num_in_group * sizeof(CmeOrderEntry)) )
 		{
-		case 0: aggressor = "None"; break;
-		case 1: aggressor = "Buy"; break;
-		case 2: aggressor = "Sell"; break;
-		default: aggressor = "Uknown"; break;
+			for(int i = 0; i < numOrders->num_in_group; ++i)
+			{
+				const CmeOrderEntry* orders = pop_as<CmeOrderEntry>(buffer);
+
+				if( journal.Enabled() )
+					journal.Order(orders);
+
+				order_entry(packetTs, summary, sec_info, orders);
+			}
 		}
+	}
 
-		/*
-		cout << time_to_str(packetTs) 
-			 << " Trade" 
-			 << " " << sec_info->symbol
-			 << " price:" << sec_info->CleanPrice(entry->price)
-			 << " qty:" << entry->qty 
-			 << " aggr_side:" << aggressor
-			 << endl;
-			 */
-
-		sec_info->inside_change = true;
-
-		if( entry->aggressor_side == 0 )
+	return refresh->indicator;
+}
+
+// Order book (MBO) entries are not used by the detectors, but the message
+// can carry the end-of-event flag.
+char parse_43(int64_t ts, const char* buffer, const char* end)
+{
+	if( !block_fits(buffer, end, sizeof(CmeOrderRefresh)) )
+		return 0;
+
+	const CmeOrderRefresh* refresh = pop_as<CmeOrderRefresh>(buffer);
+	return refresh->indicator;
+}
+
+// Registers the instrument from a definition's root block; scale follows
+// an existing entry so prices stay comparable with earlier output.
+template<typename Definition>
+static InstrumentDef definition_entry(const Definition* definition)
+{
+	InstrumentDef def;
+	memset(&def, 0, sizeof(def));
+	def.sec_id = definition->sec_id;
+	memcpy(def.symbol, definition->symbol, sizeof(definition->symbol));
+	def.min_price_increment = definition->min_price_increment;
+	def.display_factor = definition->display_factor;
+	def.from_definition = true;
+	DeriveScale(def.min_price_increment, def.display_factor, def.price_shift, def.tick_size);
+	return def;
+}
+
+static_assert(offsetof(CmeInstrumentDefFuture, min_price_increment) == 91, "template 54 layout");
+static_assert(offsetof(CmeInstrumentDefSpread, min_price_increment) == 94, "template 56 layout");
+static_assert(sizeof(CmeLegEntry) == 18, "template 56 leg layout");
+
+// MDInstrumentDefinitionFuture
+char parse_54(int64_t ts, const char* buffer, const char* end)
+{
+	if( !block_fits(buffer, end, sizeof(CmeInstrumentDefFuture)) )
+		return 0;
+
+	const CmeInstrumentDefFuture* definition = (const CmeInstrumentDefFuture*)buffer;
+	if( definition->update_action != 'D' )
+	{
+		const InstrumentDef* entry = register_definition(definition_entry(definition));
+		if( entry && journal.Enabled() )
+			journal.Definition(*entry, 54);
+	}
+	return definition->indicator;
+}
+
+// MDInstrumentDefinitionSpread; the legs follow four other repeating groups.
+char parse_56(int64_t ts, const char* buffer, const char* end, uint16_t block_length)
+{
+	if( block_length < sizeof(CmeInstrumentDefSpread) || !block_fits(buffer, end, block_length) )
+		return 0;
+
+	const CmeInstrumentDefSpread* definition = (const CmeInstrumentDefSpread*)buffer;
+	if( definition->update_action == 'D' )
+		return definition->indicator;
+
+	InstrumentDef def = definition_entry(definition);
+
+	buffer += block_length;
+	for(int group = 0; group < 4; ++group)
+	{
+		if( !block_fits(buffer, end, sizeof(GroupSize)) )
+			return 0;
+
+		const GroupSize* size = pop_as<GroupSize>(buffer);
+		if( !group_fits(buffer, end, size->entry_size, size->num_in_group, 0) )
+			return 0;
+		buffer += size->entry_size * size->num_in_group;
+	}
+
+	if( !block_fits(buffer, end, sizeof(GroupSize)) )
+		return 0;
+
+	const GroupSize* legs = pop_as<GroupSize>(buffer);
+	if( !group_fits(buffer, end, legs->entry_size, legs->num_in_group, sizeof(CmeLegEntry)) )
+		return 0;
+
+	for(uint8_t i = 0; i < legs->num_in_group; ++i)
+	{
+		const CmeLegEntry* leg = pop_as<CmeLegEntry>(buffer, legs->entry_size);
+		if( def.num_legs == MAX_LEGS )
+			continue;
+
+		InstrumentLeg& out = def.legs[def.num_legs++];
+		out.sec_id = leg->leg_sec_id;
+		out.ratio = leg->leg_side == 2 ? -leg->leg_ratio_qty : leg->leg_ratio_qty;
+		out.price = leg->leg_price == INT64_MAX ? 0 : leg->leg_price;
+	}
+
+	const InstrumentDef* entry = register_definition(def);
+	if( entry && implied_engine.Enabled() )
+		implied_engine.Define(entry);
+	if( entry && journal.Enabled() )
+		journal.Definition(*entry, 56);
+	return definition->indicator;
+}
+
+// The UDP payload length of a frame of length bytes, or -1 if the frame is
+// not IPv4 or is shorter than its headers say.
+static int udp_payload_length(const char* buffer, int length)
+{
+	const IpHeader* pkt_header = (const IpHeader*)buffer;
+	if( length < (int)sizeof(IpHeader) || pkt_header->eth.ether_type != 8 )
+		return -1;
+
+	int payload = (int)be16toh(pkt_header->udp.len) - (int)sizeof(pkt_header->udp);
+	if( payload < 0 || payload > length - (int)sizeof(IpHeader) )
+		return -1;
+	return payload;
+}
+
+void parse_packet(int64_t pktts, const char* buffer, int length)
+{
+	if( length < (int)sizeof(IpHeader) )
+		return;
+
+    const IpHeader* pkt_header = (const IpHeader*)buffer;
+	parse_packet(pktts, buffer, length, be16toh(pkt_header->udp.dest));
+}
+
+void parse_packet(int64_t pktts, const char* buffer, int length, uint16_t channel)
+{
+	int payload = udp_payload_length(buffer, length);
+	if( payload < 0 )
+		return;
+
+    buffer += sizeof(IpHeader);
+    parse_mdp_packet(pktts, buffer, payload, channel);
+}
+
+// Adds the book (32) and trade (42) entries of a frame to prefetch_refs.
+static void collect_prefetch_refs(const char* buffer, int length)
+{
+	int payload = udp_payload_length(buffer, length);
+	if( payload < (int)sizeof(CmeMsgHeader) )
+		return;
+
+	buffer += sizeof(IpHeader);
+	const char* buffer_end = buffer + payload;
+	buffer += sizeof(CmeMsgHeader);
+
+	for(const CmeMessage* msg = (const CmeMessage*)buffer; buffer < buffer_end; buffer += msg->msg_length, msg = (const CmeMessage*)buffer)
+	{
+		if( !message_fits(buffer, buffer_end) )
+			break;
+
+		const char* body = buffer + sizeof(*msg);
+		const char* end = buffer + msg->msg_length;
+		if( msg->template_id == 32 && block_fits(body, end, sizeof(CmeBookRefresh)) )
 		{
-			sec_info->sweep_info.ignoreTrades = true;
+			const CmeBookRefresh* refresh = pop_as<CmeBookRefresh>(body);
+			if( !group_fits(body, end, refresh->entry_size, refresh->num_in_group, sizeof(CmeBookEntry)) )
+				continue;
+			for(uint8_t i = 0; i < refresh->num_in_group; ++i)
+			{
+				const CmeBookEntry* entry = pop_as<CmeBookEntry>(body, refresh->entry_size);
+				PrefetchRef ref = { entry->sec_id, entry->entry_type, 0, 0 };
+				prefetch_refs.push_back(ref);
+			}
 		}
+		else if( msg->template_id == 42 && block_fits(body, end, sizeof(CmeTradeSummary)) )
+		{
+			const CmeTradeSummary* refresh = pop_as<CmeTradeSummary>(body);
+			if( !group_fits(body, end, refresh->entry_size, refresh->num_in_group, sizeof(CmeTradeEntry)) )
+				continue;
+			for(uint8_t i = 0; i < refresh->num_in_group; ++i)
+			{
+				const CmeTradeEntry* entry = pop_as<CmeTradeEntry>(body, refresh->entry_size);
+				PrefetchRef ref = { entry->sec_id, 0, 0, 0 };
+				prefetch_refs.push_back(ref);
+			}
+		}
+	}
+}
+
+static const CmeSide* book_side(const SecurityInfo* info, char entry_type)
+{
+	switch(entry_type)
+	{
+	case '0': return &info->buy_icebergs.outrights;
+	case '1': return &info->sell_icebergs.outrights;
+	case 'E': return &info->buy_icebergs.implieds;
+	case 'F': return &info->sell_icebergs.implieds;
+	default: return 0;
+	}
+}
+
+static void prefetch_levels(const CmeSide& side)
+{
+	// MAX_LEVELS levels are 160 bytes.
+	const char* levels = (const char*)side.levels.data();
+	if( levels )
+	{
+		__builtin_prefetch(levels, 1);
+		__builtin_prefetch(levels + 64, 1);
+		__builtin_prefetch(levels + 128, 1);
+	}
+}
+
+void parse_packets(const PacketRef* packets, int count)
+{
+	prefetch_refs.clear();
+	for(int i = 0; i < count; ++i)
+		collect_prefetch_refs(packets[i].buffer, packets[i].length);
+
+	// Each pass loads what the next one reads, for all entries at once.
+	for(const PrefetchRef& ref : prefetch_refs)
+		instruments.Prefetch(ref.sec_id);
+
+	for(PrefetchRef& ref : prefetch_refs)
+	{
+		ref.def = find_instrument(ref.sec_id);
+		if( ref.def )
+			__builtin_prefetch(&ref.def->index);
+	}
 
-		sec_info->traded_locally = true;
-		int64_t price = sec_info->CleanPrice(entry->price);
+	for(const PrefetchRef& ref : prefetch_refs)
+	{
+		if( ref.def && ref.def->index < info_table.size() )
+			__builtin_prefetch(&info_table[ref.def->index]);
+	}
 
-		if( sec_info->sweep_info.firstAggressor )
+	for(PrefetchRef& ref : prefetch_refs)
+	{
+		if( !ref.def || ref.def->index >= info_table.size() || !(ref.info = info_table[ref.def->index]) )
+			continue;
+
+		SecurityInfo* info = ref.info;
+		__builtin_prefetch(info, 1);
+		__builtin_prefetch(&info->inside_change, 1);
+		if( ref.entry_type )
+		{
+			__builtin_prefetch(book_side(info, ref.entry_type), 1);
+			__builtin_prefetch(&info->stops_info, 1);
+		}
+		else
 		{
-			sec_info->sweep_info.startTime = packetTs;
-			sec_info->sweep_info.exchangeTime = refresh->transact_time;
-			sec_info->sweep_info.startTime = packetTs;
-			sec_info->sweep_info.startPrice = price;
-			sec_info->sweep_info.firstAggressor = false;
-			sec_info->sweep_info.isBuy = entry->aggressor_side == 1;
+			__builtin_prefetch(&info->buy_icebergs.outrights, 1);
+			__builtin_prefetch(&info->sell_icebergs.outrights, 1);
+			__builtin_prefetch(&info->buy_icebergs.highestTrade, 1);
+			__builtin_prefetch(&info->sell_icebergs.highestTrade, 1);
+			__builtin_prefetch(&info->sweep_info, 1);
+			__builtin_prefetch(&info->order_fills, 1);
 		}
+	}
+
+	for(const PrefetchRef& ref : prefetch_refs)
+	{
+		if( !ref.info )
+			continue;
 
-		if( sec_info->stops_info.first_price == 0 )
-			sec_info->stops_info.first_price = price;
+		if( ref.entry_type )
+		{
+			const CmeSide* side = book_side(ref.info, ref.entry_type);
+			if( side )
+				prefetch_levels(*side);
+		}
+		else
+		{
+			prefetch_levels(ref.info->buy_icebergs.outrights);
+			prefetch_levels(ref.info->sell_icebergs.outrights);
+		}
+	}
 
-		sec_info->sweep_info.totalVolume += entry->qty;
-		sec_info->sweep_info.endPrice = price;
+	for(int i = 0; i < count; ++i)
+		parse_packet(packets[i].ts, packets[i].buffer, packets[i].length);
+}
 
-		switch(entry->aggressor_side)
+// Exchange-side latency of messages that start with a TransactTime.
+static void record_exchange_latency(uint16_t channel, const CmeMsgHeader* msg_header, const CmeMessage* msg)
+{
+	switch(msg->template_id)
+	{
+	case 32:
+	case 42:
+	case 43:
+		if( msg->msg_length >= sizeof(*msg) + sizeof(uint64_t) )
 		{
-		case 1:
-			sec_info->sell_icebergs.AddTrade(entry->price, entry->qty, true);
-			is_buy = true;
-			break;
-		case 2:
-			sec_info->buy_icebergs.AddTrade(entry->price, entry->qty, false);
-			is_buy = false;
-			break;
+			uint64_t transact_time = *(const uint64_t*)((const char*)msg + sizeof(*msg));
+			latency_monitor->Record(channel, msg->template_id, EXCHANGE_TO_SEND, (int64_t)(msg_header->send_time - transact_time));
 		}
-		lastPrice = sec_info->CleanPrice(entry->price);
+		break;
+	default:
+		break;
 	}
+}
+
+// Runs the detectors over the securities of the event for the end-of-trades,
+// end-of-quotes and end-of-event flags of a message's indicator.
+static void end_of_event(int64_t pktts, uint16_t channel, uint16_t template_id, char indicator)
+{
+	if( !(indicator & (LAST_TRADE | LAST_QUOTE | LAST_MSG)) )
+		return;
+
+	perf_enter(STAGE_DETECTORS, template_id);
 
-	if( !packet_infos.empty() )
+	if( indicator & LAST_TRADE )
 	{
-		SecurityInfo* sec_info = packet_infos.back();
-		const GroupSize8Bytes* numOrders = pop_as<GroupSize8Bytes>(buffer);
+		for(SecurityInfo* sec_info : packet_infos)
+		{
+			if( (sec_info->sweep_info.isBuy && sec_info->sweep_info.endPrice - sec_info->sweep_info.startPrice > sec_info->sweep_info.minDepth)
+					||  (!sec_info->sweep_info.isBuy && sec_info->sweep_info.startPrice - sec_info->sweep_info.endPrice > sec_info->sweep_info.minDepth) )
+			{
+				perf_enter(STAGE_OUTPUT, template_id);
+				print_sweep(sweeps_file, sec_info->symbol, sec_info->sweep_info);
+				perf_exit();
+				signal_emitted(pktts, channel, template_id);
+			}
 
-		int32_t total_qty = 0;
+			sec_info->sweep_info.Clear();
 
-		uint32_t order_total = 0;
-		if( sec_info->traded_locally )
+			if( sec_info->stops_info.trades.size() > 1 )
+			{
+				sec_info->all_stops.push_back(sec_info->stops_info);
+				signal_emitted(pktts, channel, template_id);
+			}
+			sec_info->stops_info.trades.clear();
+			sec_info->stops_info.ts = 0;
+			sec_info->stops_info.first_price = 0;
+			sec_info->stop_prices.Clear();
+			sec_info->order_fills.NextEpoch();
+		}
+		//cout << "END OF TRADES\n";
+	}
+
+	if( indicator & LAST_QUOTE )
+	{
+		bool using_quote = false;
+		for(SecurityInfo* sec_info : packet_infos)
 		{
-			for(int i = 0; i < numOrders->num_in_group; ++i)
+			Iceberg sell_iceberg, buy_iceberg;
+			bool is_sell_iceberg = sec_info->sell_icebergs.CheckIceberg(pktts, &sell_iceberg);
+			bool is_buy_iceberg = sec_info->buy_icebergs.CheckIceberg(pktts, &buy_iceberg);
+
+			if( (sec_info->inside_change || is_sell_iceberg || is_buy_iceberg)
+			 && !sec_info->buy_icebergs.outrights.levels.empty()
+			 && !sec_info->sell_icebergs.outrights.levels.empty()
+		
+			 )
 			{
-				const CmeOrderEntry* orders = pop_as<CmeOrderEntry>(buffer);
 				/*
-				if( i == 0 )
-					cout << "\tAggressor id " << orders->order_id << " " << orders->qty << "\n";
-				else
-					cout << "\tPassive id " << orders->order_id << " " << orders->qty << "\n";
-					*/
-				if( orders->qty > order_total )
-				{
-					if( sec_info->stops_info.trades.empty() || (
-								sec_info->stops_info.trades.back().order_id != orders->order_id
-							&&  sec_info->stops_info.trades[0].order_id > orders->order_id
-							)
-								)
-					{
-						if( sec_info->stops_info.trades.empty() )
-						{
-							sec_info->stops_info.ts = packetTs;
-						}
-
-						sec_info->stops_info.trades.emplace_back();
-						StopsTrade& trade = sec_info->stops_info.trades.back();
-
-						trade.start_price = sec_info->stops_info.first_price;
-						trade.order_id = orders->order_id;
-						trade.size = 0;
-						trade.traded_size = 0;
-					}
-
-					StopsTrade& stops_trade = sec_info->stops_info.trades.back();
-					stops_trade.exchange_time = refresh->transact_time;
-					stops_trade.size += orders->qty;
-					stops_trade.traded_size += orders->qty;
-					stops_trade.is_buy = is_buy;
-					stops_trade.highest_price = lastPrice;
-
-					order_total = orders->qty;
-				}
-				else
-				{
-					order_total -= orders->qty;
-				}
-
-				total_qty += orders->qty;
+				cout << time_to_str(pktts) << " Book update bids " << sec_info->CleanPrice(sec_info->buy_icebergs.outrights[0].price)
+									   << ":" << sec_info->buy_icebergs.outrights[0].quantity
+									   << " x offers " << sec_info->CleanPrice(sec_info->sell_icebergs.outrights[0].price)
+									   << ":" << sec_info->sell_icebergs.outrights[0].quantity
+									   << "\n";
+									   */
+			}
+
+			if( is_sell_iceberg || is_buy_iceberg )
+				signal_emitted(pktts, channel, template_id);
+
+			if( book_sampler.Enabled() )
+				book_sampler.Changed(sec_info->sec_id, sec_info->sampled_book, sec_info->buy_icebergs.outrights, sec_info->sell_icebergs.outrights, sec_info->scale);
+
+			if( book_publisher )
+			{
+				const CmeSide* sides[NUM_SHM_SIDES] = { &sec_info->buy_icebergs.outrights, &sec_info->sell_icebergs.outrights,
+														&sec_info->buy_icebergs.implieds, &sec_info->sell_icebergs.implieds };
+				book_publisher->Publish(sec_info->shm_slot, sec_info->sec_id, sec_info->symbol, sec_info->scale.PriceShift(), sec_info->scale.TickSize(), pktts, sides);
+			}
+
+			if( implied_engine.Enabled() && sec_info->inside_change )
+				implied_engine.Update(sec_info->index, top_of(sec_info->buy_icebergs.outrights), top_of(sec_info->sell_icebergs.outrights));
+
+			using_quote |= sec_info->inside_change;
+			sec_info->inside_change = false;
+
+			if( is_sell_iceberg || is_buy_iceberg )
+				perf_enter(STAGE_OUTPUT, template_id);
+
+			if( is_sell_iceberg && echo_icebergs )
+			{
+				cout << time_to_str(pktts) << " SELL ICEBERG ==> ";
+				cout << "price:" << sec_info->CleanPrice(sell_iceberg.price) << " show_size:" << sell_iceberg.show_quantity << " total_traded:" << sell_iceberg.total_traded << endl;
 			}
+
+			if( is_buy_iceberg && echo_icebergs )
+			{
+				cout << time_to_str(pktts) << " BUY ICEBERG ==> ";
+				cout << "price:" << sec_info->CleanPrice(buy_iceberg.price) << " show_size:" << buy_iceberg.show_quantity << " total_traded:" << buy_iceberg.total_traded << endl;
+			}
+
+			if( is_sell_iceberg || is_buy_iceberg )
+				perf_exit();
+
+			sec_info->sell_icebergs.ClearTrade();
+			sec_info->buy_icebergs.ClearTrade();
 		}
+
+		/*
+		if( using_quote )
+			cout << "END OF QUOTES\n";
+			*/
+
+		if( book_sampler.Enabled() )
+			book_sampler.EndOfEvent(pktts);
+
+		if( implied_engine.Enabled() )
+			implied_engine.Flush(pktts);
 	}
 
-	return refresh->indicator;
-}
+	if( indicator & LAST_MSG )
+	{
 
-char parse_43(int64_t ts, const char* buffer)
-{
-	return 0;
+		for(SecurityInfo* info : packet_infos)
+			info->dirty = false;
+		packet_infos.clear();
+	}
+
+	perf_exit();
 }
 
-void parse_packet(int64_t pktts, const char* buffer, int length)
+void parse_mdp_packet(int64_t pktts, const char* buffer, int length, uint16_t channel)
 {
-    const IpHeader* pkt_header = (const IpHeader*)buffer;
+	if( length < (int)(sizeof(CmeMsgHeader) + sizeof(CmeMessage)) )
+		return;
 
-    if( pkt_header->eth.ether_type != 8 )
-        return;
-
-    buffer += sizeof(IpHeader);
-    const char* buffer_end = buffer + be16toh(pkt_header->udp.len) - sizeof(pkt_header->udp);
+    const char* buffer_end = buffer + length;
 
     const CmeMsgHeader* msg_header = (const CmeMsgHeader*)buffer;
     buffer += sizeof(*msg_header);
 
     const CmeMessage* msg = (const CmeMessage*)buffer;
 
+	if( latency_monitor )
+	{
+		if( !latency_monitor->LiveClock() )
+			packet_start = wall_clock_ns();
+
+		latency_monitor->SetCaptureTime(pktts);
+		latency_monitor->Record(channel, msg->template_id, SEND_TO_CAPTURE, pktts - (int64_t)msg_header->send_time);
+	}
+
+	if( journal.Enabled() )
+		journal.Packet(pktts, channel);
+
+	if( book_sampler.Enabled() )
+		book_sampler.Advance(pktts);
+
     for(; buffer < buffer_end; buffer += msg->msg_length, msg = (const CmeMessage*)buffer)
     {
+		// A message that overruns the packet, or would not advance, ends it.
+		if( !message_fits(buffer, buffer_end) )
+			break;
+
+		const char* msg_end = buffer + msg->msg_length;
+		perf_enter(STAGE_DISPATCH, msg->template_id);
+
+		if( latency_monitor )
+			record_exchange_latency(channel, msg_header, msg);
+
 		char indicator = 0;
         switch(msg->template_id)
         {
-        case 32: indicator = parse_32(pktts, buffer + sizeof(*msg)); break;
-        case 42: indicator = parse_42(pktts, buffer + sizeof(*msg)); break;
-        case 43: indicator = parse_43(pktts, buffer + sizeof(*msg)); break;
+        case 32:
+			perf_enter(STAGE_PARSE_32, 32);
+			indicator = parse_32(pktts, buffer + sizeof(*msg), msg_end);
+			perf_exit();
+			break;
+        case 42:
+			perf_enter(STAGE_PARSE_42, 42);
+			indicator = parse_42(pktts, buffer + sizeof(*msg), msg_end);
+			perf_exit();
+			break;
+        case 43:
+			perf_enter(STAGE_PARSE_43, 43);
+			indicator = parse_43(pktts, buffer + sizeof(*msg), msg_end);
+			perf_exit();
+			break;
+        case 54: indicator = parse_54(pktts, buffer + sizeof(*msg), msg_end); break;
+        case 56: indicator = parse_56(pktts, buffer + sizeof(*msg), msg_end, msg->block_length); break;
         case 12: break;
         default: break;
         }
 
-		if( indicator & LAST_TRADE )
+		if( journal.Enabled() && (indicator & (LAST_TRADE | LAST_QUOTE | LAST_MSG)) )
+			journal.End(indicator, msg->template_id);
+
+		end_of_event(pktts, channel, msg->template_id, indicator);
+
+		perf_exit();
+    }
+}
+
+void OpenOutputs(const char* sweeps_path, const char* icebergs_path, const char* stops_path)
+{
+	// A buffer must be set before the file is opened.
+	ArenaBacking backing = ThreadArena().Backing();
+	if( backing != ARENA_MALLOC && !output_buffers.base )
+	{
+		output_buffers.base = (char*)Arena::MapPages(3 * OutputBuffers::SIZE, backing, ThreadArena().NumaNode());
+		output_buffers.backing = backing;
+		if( output_buffers.base )
 		{
-			for(SecurityInfo* sec_info : packet_infos)
-			{
-				if( (sec_info->sweep_info.isBuy && sec_info->sweep_info.endPrice - sec_info->sweep_info.startPrice > sec_info->sweep_info.minDepth)
-						||  (!sec_info->sweep_info.isBuy && sec_info->sweep_info.startPrice - sec_info->sweep_info.endPrice > sec_info->sweep_info.minDepth) )
-				{
-					print_sweep(sweeps_file, sec_info->symbol, sec_info->sweep_info);
-				}
-
-				sec_info->sweep_info.Clear();
-
-				if( sec_info->stops_info.trades.size() > 1 )
-				{
-					sec_info->all_stops.push_back(sec_info->stops_info);
-				}
-				sec_info->stops_info.trades.clear();
-				sec_info->stops_info.ts = 0;
-			}
-			//cout << "END OF TRADES\n";
+			sweeps_file.rdbuf()->pubsetbuf(output_buffers.base, OutputBuffers::SIZE);
+			icebergs_file.rdbuf()->pubsetbuf(output_buffers.base + OutputBuffers::SIZE, OutputBuffers::SIZE);
+			stops_file.rdbuf()->pubsetbuf(output_buffers.base + 2 * OutputBuffers::SIZE, OutputBuffers::SIZE);
 		}
+	}
 
-		if( indicator & LAST_QUOTE )
-		{
-			bool using_quote = false;
-			for(SecurityInfo* sec_info : packet_infos)
-			{
-				Iceberg sell_iceberg, buy_iceberg;
-				bool is_sell_iceberg = sec_info->sell_icebergs.CheckIceberg(pktts, &sell_iceberg);
-				bool is_buy_iceberg = sec_info->buy_icebergs.CheckIceberg(pktts, &buy_iceberg);
-
-				if( (sec_info->inside_change || is_sell_iceberg || is_buy_iceberg)
-				 && !sec_info->buy_icebergs.outrights.levels.empty()
-				 && !sec_info->sell_icebergs.outrights.levels.empty()
-				
-				 )
-				{
-					/*
-					cout << time_to_str(pktts) << " Book update bids " << sec_info->CleanPrice(sec_info->buy_icebergs.outrights[0].price)
-										   << ":" << sec_info->buy_icebergs.outrights[0].quantity
-										   << " x offers " << sec_info->CleanPrice(sec_info->sell_icebergs.outrights[0].price)
-										   << ":" << sec_info->sell_icebergs.outrights[0].quantity
-										   << "\n";
-										   */
-				}
-
-				using_quote |= sec_info->inside_change;
-				sec_info->inside_change = false;
-
-				if( is_sell_iceberg )
-				{
-					cout << time_to_str(pktts) << " SELL ICEBERG ==> ";
-					cout << "price:" << sec_info->CleanPrice(sell_iceberg.price) << " show_size:" << sell_iceberg.show_quantity << " total_traded:" << sell_iceberg.total_traded << endl;
-				}
-
-				if( is_buy_iceberg )
-				{
-					cout << time_to_str(pktts) << " BUY ICEBERG ==> ";
-					cout << "price:" << sec_info->CleanPrice(buy_iceberg.price) << " show_size:" << buy_iceberg.show_quantity << " total_traded:" << buy_iceberg.total_traded << endl;
-				}
-
-				sec_info->sell_icebergs.ClearTrade();
-				sec_info->buy_icebergs.ClearTrade();
-			}
+	sweeps_file.open(sweeps_path);
+	icebergs_file.open(icebergs_path);
+	stops_file.open(stops_path);
+
+	sweeps_file << SWEEPS_HEADERS << "\n";
+	icebergs_file << ICEBERGS_HEADERS << "\n";
+	stops_file << STOPS_HEADERS << "\n";
+}
+
+void OpenBarOutputs(const char* bars_path, const char* vap_path)
+{
+	bar_aggregator.Open(bars_path, vap_path);
+}
+
+bool OpenBookSamples(const char* path, int64_t interval_ns, uint32_t every_events, int depth)
+{
+	return book_sampler.Open(path, interval_ns, every_events, depth);
+}
+
+bool OpenImpliedOutput(const char* path)
+{
+	return implied_engine.Open(path, instruments);
+}
+
+bool OpenJournal(const char* path)
+{
+	return journal.Open(path);
+}
+
+bool LoadJournal(const char* path)
+{
+	if( !journal_reader.Open(path) )
+		return false;
+
+	for(uint32_t i = 0; i < journal_reader.Indexed(); ++i)
+	{
+		const JournalSecurity& security = journal_reader.Securities()[i];
+		if( security.preload )
+			instruments.Register(JournalInstrument(security), false);
+	}
+	return true;
+}
+
+// The SecurityInfo of a journal security, or null if it is not registered.
+static SecurityInfo* journal_info(uint32_t id)
+{
+	if( id >= journal_infos.size() )
+		return 0;
+
+	SecurityInfo* info = journal_infos[id];
+	if( !info )
+	{
+		const InstrumentDef* def = find_instrument(journal_reader.Securities()[id].sec_id);
+		if( def )
+			info = journal_infos[id] = info_of(def);
+	}
+	return info;
+}
+
+// Registers a definition record's instrument as parse_54 and parse_56 did.
+static void replay_definition(const JournalRecord& record)
+{
+	uint64_t row = journal_reader.Indexed() + (uint64_t)record.value;
+	if( record.value < 0 || row >= journal_reader.SecurityCount() )
+		return;
+
+	const InstrumentDef* entry = register_definition(JournalInstrument(journal_reader.Securities()[row]));
+	if( entry && record.id == 56 && implied_engine.Enabled() )
+		implied_engine.Define(entry);
+}
 
-			/*
-			if( using_quote )
-				cout << "END OF QUOTES\n";
-				*/
+bool ReplayJournal(uint16_t channel)
+{
+	if( !journal_reader.IsOpen() )
+		return false;
+
+	// Dense indices resolve once, not a registry lookup per record; those
+	// of securities registered by definition records when first used.
+	journal_infos.assign(journal_reader.Indexed(), 0);
+	for(uint32_t i = 0; i < journal_reader.Indexed(); ++i)
+	{
+		const InstrumentDef* def = journal_reader.Securities()[i].preload ? find_instrument(journal_reader.Securities()[i].sec_id) : 0;
+		if( def )
+			journal_infos[i] = info_of(def);
+	}
+
+	int64_t pktts = 0;
+	uint16_t packet_channel = 0;
+	bool selected = false;
+	TradeSummary summary = { 0, false, CleanPrice(), 0 };
+
+	const JournalRecord* record = journal_reader.Records();
+	const JournalRecord* end = record + journal_reader.RecordCount();
+	for(; record < end; ++record)
+	{
+		if( record->type == JOURNAL_PACKET )
+		{
+			pktts += record->value;
+			packet_channel = (uint16_t)record->id;
+			selected = channel == 0 || packet_channel == channel;
+			if( selected && book_sampler.Enabled() )
+				book_sampler.Advance(pktts);
+			continue;
 		}
 
-		if( indicator & LAST_MSG )
+		// Definitions apply on every channel, as instruments a parse of the
+		// selected channels alone would know from the cache.
+		if( record->type == JOURNAL_DEFINITION )
 		{
+			replay_definition(*record);
+			continue;
+		}
+
+		if( !selected )
+			continue;
 
-			for(SecurityInfo* info : packet_infos)
-				info->dirty = false;
-			packet_infos.clear();
+		switch(record->type)
+		{
+		case JOURNAL_BOOK:
+			if( journal_info(record->id) )
+			{
+				CmeBookEntry entry;
+				memset(&entry, 0, sizeof(entry));
+				entry.price = record->value;
+				entry.size = record->size;
+				entry.num_orders = record->orders;
+				entry.price_level = record->level;
+				entry.action_type = record->action;
+				entry.entry_type = record->code;
+				book_entry(touch(journal_infos[record->id]), &entry);
+			}
+			break;
+		case JOURNAL_TRADES:
+			summary.transact_time = (uint64_t)(pktts + record->value);
+			summary.is_buy = false;
+			summary.last_price = CleanPrice();
+			summary.order_total = 0;
+			if( bar_aggregator.Enabled() )
+				bar_aggregator.Advance(summary.transact_time);
+			break;
+		case JOURNAL_TRADE:
+			if( journal_info(record->id) )
+			{
+				CmeTradeEntry entry;
+				memset(&entry, 0, sizeof(entry));
+				entry.price = record->value;
+				entry.qty = record->size;
+				entry.aggressor_side = record->code;
+				trade_entry(pktts, summary, touch(journal_infos[record->id]), &entry);
+			}
+			break;
+		case JOURNAL_ORDER:
+			if( !packet_infos.empty() )
+			{
+				CmeOrderEntry order;
+				memset(&order, 0, sizeof(order));
+				order.order_id = (uint64_t)record->value;
+				order.qty = record->size;
+				order_entry(pktts, summary, packet_infos.back(), &order);
+			}
+			break;
+		case JOURNAL_END:
+			end_of_event(pktts, packet_channel, (uint16_t)record->id, record->code);
+			break;
+		default:
+			break;
 		}
-    }
+	}
+
+	return true;
 }
 
-int main(int, char** argv)
+void CloseOutputs()
 {
-	LoadSecInfo();
-
-	sweeps_file.open(argv[2]);
-	icebergs_file.open(argv[3]);
-	stops_file.open(argv[4]);
-
-	sweeps_file << SWEEPS_HEADERS << "\n";
-	icebergs_file << ICEBERGS_HEADERS << "\n";
-	stops_file << STOPS_HEADERS << "\n";
+	sweeps_file.close();
+	icebergs_file.close();
+	stops_file.close();
+	bar_aggregator.Close();
+	book_sampler.Close();
+	implied_engine.Close();
+	journal.Close();
+}
 
-    FILE* f = fopen(argv[1], "rb");
+void WriteResults()
+{
+	perf_enter(STAGE_OUTPUT, 0);
 
-    ErfPacketHeader pkt_header;
-    int ret = fread(&pkt_header, sizeof(pkt_header), 1, f);
+	// Securities in sec_id order.
+	std::map<int, SecurityInfo*> info_map;
+	for(SecurityInfo* info : info_list)
+		info_map[info->sec_id] = info;
 
-    while(ret == 1)
-    {
-        int packet_length = be16toh(pkt_header.rlen) - sizeof(pkt_header);
-        char packet[2048];
-        int ret = fread(&packet, packet_length, 1, f);
-        if( ret < 1 )
-            break;
-		int64_t ts = ((int64_t)pkt_header.ts_seconds * 1000000000LL) + (int64_t)pkt_header.ts_nanos;;
-        parse_packet(ts, packet + 2, packet_length - 2);
-        ret = fread(&pkt_header, sizeof(pkt_header), 1, f);
-    }
+	if( bar_aggregator.Enabled() )
+	{
+		bar_aggregator.FlushAll();
+		for(auto it : info_map)
+			bar_aggregator.WriteVolumeAtPrice(it.second->symbol, it.second->bars, it.second->scale);
+	}
 
 	for(auto it : info_map)
 	{
@@ -549,15 +1275,21 @@ int main(int, char** argv)
 						   << ',' << trade.highest_price
 						   << ',' << trade.size
 						   << ',' << trade.traded_size
-						   << ',' << trade.is_buy ? 'B' : 'S'
+						   << ',' << (trade.is_buy ? 'B' : 'S')
 						   << '\n';
 			}
 		}
 
-		std::vector<Iceberg> icebergs(it.second->buy_icebergs.icebergs);
+		std::vector<Iceberg> icebergs(it.second->buy_icebergs.icebergs.begin(), it.second->buy_icebergs.icebergs.end());
 
 		icebergs.insert(icebergs.end(), it.second->sell_icebergs.icebergs.begin(), it.second->sell_icebergs.icebergs.end());
 
+		// Icebergs the price never traded through are still open at the end.
+		for(auto& open : it.second->buy_icebergs.open_icebergs)
+			icebergs.push_back(open.second);
+		for(auto& open : it.second->sell_icebergs.open_icebergs)
+			icebergs.push_back(open.second);
+
 		std::sort(icebergs.begin(), icebergs.end(), [](const Iceberg& lhs, const Iceberg& rhs){ return lhs.ts < rhs.ts; });
 		for(const Iceberg& iceberg : icebergs)
 		{
@@ -568,12 +1300,40 @@ int main(int, char** argv)
 							  << ',' << it.second->CleanPrice(iceberg.price)
 							  << ',' << iceberg.show_quantity
 							  << ',' << iceberg.total_traded
-							  << ',' << iceberg.is_bid ? 'B' : 'S'
+							  << ',' << (iceberg.is_bid ? 'B' : 'S')
 							  << '\n'
 							  ;
 			}
 		}
 	}
 
-    return 0;
+	perf_exit();
+}
+
+void ResetState()
+{
+	bar_aggregator.Reset();
+	book_sampler.Reset();
+	implied_engine.Reset();
+
+	// With an arena nothing in it needs destroying (see SecurityInfo), so
+	// dropping the state of the run does not depend on its size.
+	Arena& arena = ThreadArena();
+	if( arena.Backing() == ARENA_MALLOC )
+	{
+		for(SecurityInfo* info : info_list)
+		{
+			info->~SecurityInfo();
+			arena.Free(info, sizeof(SecurityInfo));
+		}
+	}
+	arena.Reset();
+
+	info_list.clear();
+	info_table.clear();
+	packet_infos.clear();
+
+	// After the SecurityInfos, which point at its symbols.
+	if( local_instruments )
+		local_instruments->Clear();
 }
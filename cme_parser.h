@@ -4,6 +4,9 @@
 #define _CME_PARSER_H_
 
 #include <stdint.h>
+#include <stddef.h>
+
+#include <string>
 
 #define PACKED __attribute__((packed))
 
@@ -57,7 +60,9 @@ struct CmeOrderRefresh
 {
     uint64_t transact_time;
     char indicator;
-    
+
+	char padding[2];
+
     uint16_t entry_size;
     uint8_t num_in_group;
 } PACKED;
@@ -117,6 +122,72 @@ struct CmeOrderEntry
 	int32_t padding;
 } PACKED;
 
+// Root block of MDInstrumentDefinitionFuture (54), up to the fields used.
+struct CmeInstrumentDefFuture
+{
+    char indicator;
+    uint32_t tot_num_reports;
+    char update_action;
+    uint64_t last_update_time;
+    uint8_t trading_status;
+    int16_t appl_id;
+    uint8_t market_segment_id;
+    uint8_t underlying_product;
+    char security_exchange[4];
+    char security_group[6];
+    char asset[6];
+    char symbol[20];
+    int32_t sec_id;
+    char security_type[6];
+    char cfi_code[6];
+    uint8_t maturity_month_year[5];
+    char currency[3];
+    char settl_currency[3];
+    char match_algorithm;
+    uint32_t min_trade_vol;
+    uint32_t max_trade_vol;
+    int64_t min_price_increment;
+    int64_t display_factor;
+} PACKED;
+
+// Root block of MDInstrumentDefinitionSpread (56), up to the fields used.
+struct CmeInstrumentDefSpread
+{
+    char indicator;
+    uint32_t tot_num_reports;
+    char update_action;
+    uint64_t last_update_time;
+    uint8_t trading_status;
+    int16_t appl_id;
+    uint8_t market_segment_id;
+    uint8_t underlying_product;
+    char security_exchange[4];
+    char security_group[6];
+    char asset[6];
+    char symbol[20];
+    int32_t sec_id;
+    char security_type[6];
+    char cfi_code[6];
+    uint8_t maturity_month_year[5];
+    char currency[3];
+    char security_sub_type[5];
+    char user_defined;
+    char match_algorithm;
+    uint32_t min_trade_vol;
+    uint32_t max_trade_vol;
+    int64_t min_price_increment;
+    int64_t display_factor;
+} PACKED;
+
+struct CmeLegEntry
+{
+    int32_t leg_sec_id;
+    uint8_t leg_side;
+    int8_t leg_ratio_qty;
+    int64_t leg_price;
+    int32_t leg_option_delta;
+} PACKED;
+
 template<typename T>
 const T* pop_as(const char*& ptr, size_t size = sizeof(T))
 {
@@ -125,4 +196,100 @@ const T* pop_as(const char*& ptr, size_t size = sizeof(T))
     return ret;
 
 }
+
+// Formats a nanosecond epoch timestamp as local "YYYY-mm-dd HH:MM:SS.nnnnnnnnn".
+std::string time_to_str(int64_t ts);
+
+// Warm-starts the security registry from cme_ids.txt, if present. Instrument
+// definitions (templates 54 and 56) in the parsed data add to it.
+void LoadSecInfo();
+
+// Writes the registry in the cme_ids.txt format, with the instruments of
+// isolated definitions added.
+bool SaveSecInfo(const char* path);
+
+// Instrument definitions parsed on the calling thread from now on go to an
+// overlay of the registry that only this thread sees and ResetState() drops,
+// so each capture a batch worker parses knows only the instruments of the
+// cache and its own definitions. The shared registry must not change while
+// threads parse with isolated definitions.
+void IsolateDefinitions();
+
+void OpenOutputs(const char* sweeps_path, const char* icebergs_path, const char* stops_path);
+
+// Also builds 1s/1m/5m OHLCV bars and volume-at-price from trades; either
+// path may be null. Bars are written as they complete, volume-at-price by
+// WriteResults(). Closed by CloseOutputs().
+void OpenBarOutputs(const char* bars_path, const char* vap_path);
+
+// Also samples the top depth levels of the books that changed, every
+// interval_ns of capture time or, if 0, every every_events book events,
+// into a binary file read by BookSampleReader. Closed by CloseOutputs().
+bool OpenBookSamples(const char* path, int64_t interval_ns, uint32_t every_events, int depth);
+
+// Also derives implied prices for spreads and their legs from the outright
+// books (see ImpliedEngine) and writes implied inside changes to path.
+// Closed by CloseOutputs().
+bool OpenImpliedOutput(const char* path);
+
+// Also writes the normalized events the detectors consume to a journal
+// (see event_journal.h), which ReplayJournal() runs through them again to
+// reproduce a run's output without the capture. A replay skips only the
+// decoding, not the detectors, so it is not much faster than parsing (see
+// bench/journal_bench); writing the journal adds to every parse it is on
+// for. Closed by CloseOutputs().
+bool OpenJournal(const char* path);
+
+// Maps a journal written by OpenJournal() and registers the securities the
+// parse knew before the capture defined them, with the scales they were
+// parsed with. Call before opening the outputs.
+bool LoadJournal(const char* path);
+
+// Runs the events of the loaded journal through the detectors, with the
+// same results as parsing the capture it was written from: instruments
+// defined in the capture are registered, and spreads given to the implied
+// engine, where their definitions were parsed. With a channel other than 0,
+// only the packets received on that UDP port, but the definitions of every
+// channel. Latency is not measured: the journal has no wire times.
+bool ReplayJournal(uint16_t channel);
+
+void CloseOutputs();
+
+// Writes the stops and icebergs collected over the run, the bars still
+// open and volume-at-price.
+void WriteResults();
+
+// Drops the books, detector state and isolated instrument definitions of
+// the calling thread so the next capture parsed on it starts empty.
+void ResetState();
+
+// Parses one Ethernet/IPv4/UDP frame carrying an MDP3 packet.
+void parse_packet(int64_t pktts, const char* buffer, int length);
+
+// As above, for a frame of channel (see parse_mdp_packet()) rather than of
+// its UDP destination port.
+void parse_packet(int64_t pktts, const char* buffer, int length, uint16_t channel);
+
+// A captured frame for parse_packets().
+struct PacketRef
+{
+	int64_t ts;
+	const char* buffer;
+	int length;
+};
+
+// Parses count frames in order, with the same results as parse_packet() on
+// each. The book and trade entries of all of them are first resolved to the
+// securities they update in passes of one dependent load each (registry
+// slot, registry entry, SecurityInfo, book levels), prefetching what the
+// next pass reads, so the cache misses of a batch overlap instead of
+// stalling every entry in turn.
+void parse_packets(const PacketRef* packets, int count);
+
+// Parses one MDP3 packet (the UDP payload, starting at CmeMsgHeader) received
+// on channel: the UDP destination port of a captured frame, or for the
+// arbitrated feeds of a live channel the port of its first feed, so the A
+// and B copies count as one channel in latency histograms and journals.
+void parse_mdp_packet(int64_t pktts, const char* buffer, int length, uint16_t channel);
+
 #endif // _CME_PARSER_H_
@@ -0,0 +1,361 @@
+#include "decompress_stream.h"
+
+#include <string.h>
+#include <time.h>
+
+#ifdef CME_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef CME_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static constexpr const size_t INPUT_SIZE = 256 * 1024;
+
+static double thread_cpu_seconds()
+{
+	timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+DecompressStream::Codec DecompressStream::Detect(FILE* f)
+{
+	unsigned char magic[4] = { 0 };
+	size_t n = fread(magic, 1, sizeof(magic), f);
+	rewind(f);
+
+	if( n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b )
+		return CODEC_GZIP;
+	if( n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd )
+		return CODEC_ZSTD;
+	return CODEC_NONE;
+}
+
+bool DecompressStream::Supported(Codec codec)
+{
+	switch(codec)
+	{
+#ifdef CME_HAVE_ZLIB
+	case CODEC_GZIP: return true;
+#endif
+#ifdef CME_HAVE_ZSTD
+	case CODEC_ZSTD: return true;
+#endif
+	default: return false;
+	}
+}
+
+DecompressStream::DecompressStream()
+	: f(0)
+	, codec(CODEC_NONE)
+	, decoder(0)
+	, input(0)
+	, input_length(0)
+	, input_pos(0)
+	, input_eof(false)
+	, decode_done(false)
+	, frame_open(false)
+	, finished(false)
+	, stopping(false)
+	, failed(false)
+	, decode_seconds(0)
+	, current(0)
+	, pos(0)
+{
+	for(int i = 0; i < NUM_BLOCKS; ++i)
+	{
+		blocks[i].data = 0;
+		blocks[i].length = 0;
+	}
+}
+
+DecompressStream::~DecompressStream()
+{
+	Close();
+}
+
+bool DecompressStream::Open(FILE* file, Codec c)
+{
+	if( !Supported(c) )
+	{
+		fprintf(stderr, "%s captures are not supported by this build\n", c == CODEC_GZIP ? "gzip" : "zstd");
+		fclose(file);
+		return false;
+	}
+
+	f = file;
+	codec = c;
+
+#ifdef CME_HAVE_ZLIB
+	if( codec == CODEC_GZIP )
+	{
+		z_stream* z = new z_stream();
+		memset(z, 0, sizeof(*z));
+		// 15 window bits, +32 to accept both gzip and zlib headers.
+		if( inflateInit2(z, 15 + 32) != Z_OK )
+		{
+			delete z;
+			return false;
+		}
+		decoder = z;
+	}
+#endif
+#ifdef CME_HAVE_ZSTD
+	if( codec == CODEC_ZSTD )
+		decoder = ZSTD_createDStream();
+#endif
+
+	input = new char[INPUT_SIZE];
+	for(int i = 0; i < NUM_BLOCKS; ++i)
+	{
+		blocks[i].data = new char[BLOCK_SIZE];
+		free_blocks.push_back(&blocks[i]);
+	}
+
+	decode_thread = std::thread(&DecompressStream::DecodeLoop, this);
+	return true;
+}
+
+void DecompressStream::Close()
+{
+	if( decode_thread.joinable() )
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		block_freed.notify_one();
+		decode_thread.join();
+	}
+
+#ifdef CME_HAVE_ZLIB
+	if( codec == CODEC_GZIP && decoder )
+	{
+		inflateEnd((z_stream*)decoder);
+		delete (z_stream*)decoder;
+	}
+#endif
+#ifdef CME_HAVE_ZSTD
+	if( codec == CODEC_ZSTD && decoder )
+		ZSTD_freeDStream((ZSTD_DStream*)decoder);
+#endif
+	decoder = 0;
+
+	for(int i = 0; i < NUM_BLOCKS; ++i)
+	{
+		delete[] blocks[i].data;
+		blocks[i].data = 0;
+	}
+	free_blocks.clear();
+	filled_blocks.clear();
+	current = 0;
+
+	delete[] input;
+	input = 0;
+
+	if( f )
+		fclose(f);
+	f = 0;
+}
+
+bool DecompressStream::NextBlock()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	if( current )
+	{
+		free_blocks.push_back(current);
+		current = 0;
+		block_freed.notify_one();
+	}
+
+	block_ready.wait(lock, [this]{ return !filled_blocks.empty() || finished; });
+	if( filled_blocks.empty() )
+		return false;
+
+	current = filled_blocks.front();
+	filled_blocks.pop_front();
+	pos = 0;
+	return true;
+}
+
+const char* DecompressStream::Read(size_t n)
+{
+	if( (!current || pos == current->length) && !NextBlock() )
+		return 0;
+
+	if( current->length - pos >= n )
+	{
+		const char* data = current->data + pos;
+		pos += n;
+		return data;
+	}
+
+	// The record straddles the end of the block: gather it in scratch.
+	if( n > sizeof(scratch) )
+		return 0;
+
+	size_t have = 0;
+	for(;;)
+	{
+		size_t take = current->length - pos;
+		if( take > n - have )
+			take = n - have;
+		memcpy(scratch + have, current->data + pos, take);
+		have += take;
+		pos += take;
+
+		if( have == n )
+			return scratch;
+		if( !NextBlock() )
+			return 0;
+	}
+}
+
+const char* DecompressStream::Head(size_t& length)
+{
+	if( !current && !NextBlock() )
+	{
+		length = 0;
+		return 0;
+	}
+
+	length = current->length - pos;
+	return current->data + pos;
+}
+
+bool DecompressStream::ReadInput()
+{
+	if( input_eof )
+		return false;
+
+	input_length = fread(input, 1, INPUT_SIZE, f);
+	input_pos = 0;
+	input_eof = input_length == 0;
+	return !input_eof;
+}
+
+// Decodes up to capacity bytes into out. Sets decode_done at the end of the
+// input, and failed as well if the data was corrupt or cut short. The
+// decoder is called before more input is read so output it still holds is
+// flushed first.
+size_t DecompressStream::Fill(char* out, size_t capacity)
+{
+	size_t produced = 0;
+
+#ifdef CME_HAVE_ZLIB
+	if( codec == CODEC_GZIP )
+	{
+		z_stream* z = (z_stream*)decoder;
+		while( produced < capacity )
+		{
+			z->next_in = (Bytef*)input + input_pos;
+			z->avail_in = (uInt)(input_length - input_pos);
+			z->next_out = (Bytef*)out + produced;
+			z->avail_out = (uInt)(capacity - produced);
+
+			int ret = inflate(z, Z_NO_FLUSH);
+			size_t made = (capacity - produced) - z->avail_out;
+			produced += made;
+			input_pos = input_length - z->avail_in;
+
+			if( ret == Z_STREAM_END )
+			{
+				// Concatenated members, as written by parallel gzip tools.
+				frame_open = false;
+				inflateReset(z);
+				continue;
+			}
+			if( ret != Z_OK && ret != Z_BUF_ERROR )
+			{
+				failed = true;
+				decode_done = true;
+				break;
+			}
+			if( ret == Z_OK )
+				frame_open = true;
+
+			if( made == 0 && input_pos == input_length && !ReadInput() )
+			{
+				failed |= frame_open;
+				decode_done = true;
+				break;
+			}
+		}
+	}
+#endif
+
+#ifdef CME_HAVE_ZSTD
+	if( codec == CODEC_ZSTD )
+	{
+		ZSTD_DStream* ds = (ZSTD_DStream*)decoder;
+		ZSTD_outBuffer out_buffer = { out, capacity, 0 };
+		while( out_buffer.pos < capacity )
+		{
+			ZSTD_inBuffer in_buffer = { input, input_length, input_pos };
+			size_t before = out_buffer.pos;
+
+			size_t ret = ZSTD_decompressStream(ds, &out_buffer, &in_buffer);
+			if( ZSTD_isError(ret) )
+			{
+				failed = true;
+				decode_done = true;
+				break;
+			}
+
+			// Without input or output the return value is only the header
+			// size of a next frame, which says nothing about this one.
+			bool progress = out_buffer.pos != before || in_buffer.pos != input_pos;
+			input_pos = in_buffer.pos;
+			if( progress )
+				frame_open = ret != 0;
+
+			if( !progress && input_pos == input_length && !ReadInput() )
+			{
+				failed |= frame_open;
+				decode_done = true;
+				break;
+			}
+		}
+		produced = out_buffer.pos;
+	}
+#endif
+
+	return produced;
+}
+
+void DecompressStream::DecodeLoop()
+{
+	double start = thread_cpu_seconds();
+
+	for(;;)
+	{
+		Block* block;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			block_freed.wait(lock, [this]{ return stopping || !free_blocks.empty(); });
+			if( stopping )
+				break;
+			block = free_blocks.front();
+			free_blocks.pop_front();
+		}
+
+		block->length = Fill(block->data, BLOCK_SIZE);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if( block->length )
+			filled_blocks.push_back(block);
+		else
+			free_blocks.push_back(block);
+
+		if( decode_done )
+			break;
+		block_ready.notify_one();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	decode_seconds = thread_cpu_seconds() - start;
+	finished = true;
+	block_ready.notify_one();
+}
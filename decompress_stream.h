@@ -0,0 +1,103 @@
+#pragma once
+
+#ifndef _DECOMPRESS_STREAM_H_
+#define _DECOMPRESS_STREAM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Decodes a gzip or zstd compressed file on a background thread into a ring
+// of fixed-size blocks, which the reading thread consumes record by record.
+//
+// Read() hands out pointers straight into the current block. Only a record
+// that straddles two blocks is copied, into a small scratch buffer, so the
+// bulk of the stream is never copied after decompression. A pointer stays
+// valid until the next call to Read().
+class DecompressStream
+{
+public:
+	enum Codec
+	{
+		CODEC_NONE,
+		CODEC_GZIP,
+		CODEC_ZSTD
+	};
+
+	static constexpr const size_t BLOCK_SIZE = 1 << 20;
+	static constexpr const int NUM_BLOCKS = 4;
+	static constexpr const size_t MAX_RECORD = 4096;
+
+	// Identifies the codec from the magic number and rewinds the file.
+	static Codec Detect(FILE* f);
+
+	// Whether the codec was compiled in.
+	static bool Supported(Codec codec);
+
+	DecompressStream();
+	~DecompressStream();
+
+	// Takes ownership of f and starts decoding.
+	bool Open(FILE* f, Codec codec);
+	void Close();
+
+	// The next n bytes (n <= MAX_RECORD) of decompressed data, or 0 at the
+	// end of the stream.
+	const char* Read(size_t n);
+
+	// The decoded bytes available before the first Read(), without
+	// consuming them; used to tell pcap from ERF.
+	const char* Head(size_t& length);
+
+	// False if the compressed data was corrupt or truncated.
+	bool Ok() const { return !failed; }
+
+	// CPU time spent by the decoding thread.
+	double DecodeSeconds() const { return decode_seconds; }
+
+private:
+	struct Block
+	{
+		char* data;
+		size_t length;
+	};
+
+	bool NextBlock();
+	void DecodeLoop();
+	size_t Fill(char* out, size_t capacity);
+	bool ReadInput();
+
+	FILE* f;
+	Codec codec;
+	void* decoder;
+
+	char* input;
+	size_t input_length;
+	size_t input_pos;
+	bool input_eof;
+	bool decode_done;
+	bool frame_open;	// inside a gzip member or zstd frame
+
+	Block blocks[NUM_BLOCKS];
+	std::deque<Block*> free_blocks;
+	std::deque<Block*> filled_blocks;
+	std::mutex mutex;
+	std::condition_variable block_ready;
+	std::condition_variable block_freed;
+	bool finished;
+	bool stopping;
+	bool failed;
+	double decode_seconds;
+	std::thread decode_thread;
+
+	Block* current;
+	size_t pos;
+	char scratch[MAX_RECORD];
+};
+
+#endif // _DECOMPRESS_STREAM_H_
@@ -0,0 +1,229 @@
+#include "event_journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+JournalWriter::JournalWriter()
+	: f(0)
+	, buffer(0)
+	, count(0)
+	, records(0)
+	, last_ts(0)
+{
+}
+
+JournalWriter::~JournalWriter()
+{
+	if( f )
+	{
+		fclose(f);
+		delete[] buffer;
+	}
+}
+
+bool JournalWriter::Open(const char* path)
+{
+	f = fopen(path, "wb");
+	if( !f )
+		return false;
+
+	buffer = new JournalRecord[BUFFER_RECORDS];
+	count = 0;
+	records = 0;
+	last_ts = 0;
+	indexed.clear();
+	definitions.clear();
+	defined.clear();
+
+	// Rewritten with the counts at Close().
+	JournalHeader header;
+	memset(&header, 0, sizeof(header));
+	fwrite(&header, sizeof(header), 1, f);
+	return true;
+}
+
+void JournalWriter::Flush()
+{
+	fwrite(buffer, sizeof(JournalRecord), count, f);
+	records += count;
+	count = 0;
+}
+
+static JournalSecurity journal_security(const InstrumentDef& def)
+{
+	JournalSecurity security;
+	memset(&security, 0, sizeof(security));
+	security.sec_id = def.sec_id;
+	memcpy(security.symbol, def.symbol, sizeof(security.symbol));
+	security.price_shift = def.price_shift;
+	security.tick_size = def.tick_size;
+	security.min_price_increment = def.min_price_increment;
+	security.display_factor = def.display_factor;
+	security.from_definition = def.from_definition;
+	security.num_legs = def.num_legs;
+	for(int i = 0; i < def.num_legs; ++i)
+	{
+		security.legs[i].sec_id = def.legs[i].sec_id;
+		security.legs[i].ratio = def.legs[i].ratio;
+		security.legs[i].price = def.legs[i].price;
+	}
+	return security;
+}
+
+uint32_t JournalWriter::AddSecurity(const InstrumentDef& def)
+{
+	JournalSecurity security = journal_security(def);
+	security.preload = !defined.count(def.sec_id);
+	indexed.push_back(security);
+	return (uint32_t)indexed.size() - 1;
+}
+
+void JournalWriter::Definition(const InstrumentDef& def, uint16_t template_id)
+{
+	JournalRecord& record = Append(JOURNAL_DEFINITION);
+	record.id = template_id;
+	record.value = (int64_t)definitions.size();
+
+	definitions.push_back(journal_security(def));
+	defined.insert(def.sec_id);
+}
+
+void JournalWriter::Close()
+{
+	if( !f )
+		return;
+
+	Flush();
+
+	if( !indexed.empty() )
+		fwrite(&indexed[0], sizeof(JournalSecurity), indexed.size(), f);
+	if( !definitions.empty() )
+		fwrite(&definitions[0], sizeof(JournalSecurity), definitions.size(), f);
+
+	JournalHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	header.record_size = sizeof(JournalRecord);
+	header.security_size = sizeof(JournalSecurity);
+	header.records = records;
+	header.securities_offset = sizeof(header) + records * sizeof(JournalRecord);
+	header.securities = (uint32_t)(indexed.size() + definitions.size());
+	header.indexed = (uint32_t)indexed.size();
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, f);
+
+	fclose(f);
+	f = 0;
+
+	delete[] buffer;
+	buffer = 0;
+}
+
+JournalReader::JournalReader()
+	: data(0)
+	, length(0)
+	, records(0)
+	, securities(0)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+JournalReader::~JournalReader()
+{
+	Close();
+}
+
+bool JournalReader::Open(const char* path)
+{
+	Close();
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat(fd, &st) != 0 )
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return false;
+	}
+
+	if( (size_t)st.st_size < sizeof(header) )
+	{
+		close(fd);
+		errno = EINVAL;
+		return false;
+	}
+
+	void* mapped = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	int error = errno;
+	close(fd);
+	if( mapped == MAP_FAILED )
+	{
+		errno = error;
+		return false;
+	}
+	madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+	data = (const char*)mapped;
+	length = st.st_size;
+	memcpy(&header, data, sizeof(header));
+
+	// A journal whose writer did not close it has no counts.
+	uint64_t records_end = sizeof(header) + header.records * sizeof(JournalRecord);
+	if( memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0
+	 || header.record_size != sizeof(JournalRecord)
+	 || header.security_size != sizeof(JournalSecurity)
+	 || header.records > length / sizeof(JournalRecord)
+	 || header.securities_offset != records_end
+	 || header.indexed > header.securities
+	 || length - records_end < (uint64_t)header.securities * sizeof(JournalSecurity)
+	 )
+	{
+		Close();
+		errno = EINVAL;
+		return false;
+	}
+
+	records = (const JournalRecord*)(data + sizeof(header));
+	securities = (const JournalSecurity*)(data + header.securities_offset);
+	return true;
+}
+
+void JournalReader::Close()
+{
+	if( data )
+		munmap((void*)data, length);
+	data = 0;
+	length = 0;
+	records = 0;
+	securities = 0;
+	memset(&header, 0, sizeof(header));
+}
+
+InstrumentDef JournalInstrument(const JournalSecurity& security)
+{
+	InstrumentDef def;
+	memset(&def, 0, sizeof(def));
+	def.sec_id = security.sec_id;
+	memcpy(def.symbol, security.symbol, sizeof(def.symbol));
+	def.price_shift = security.price_shift;
+	def.tick_size = security.tick_size;
+	def.min_price_increment = security.min_price_increment;
+	def.display_factor = security.display_factor;
+	def.from_definition = security.from_definition != 0;
+	def.num_legs = security.num_legs > MAX_LEGS ? MAX_LEGS : security.num_legs;
+	for(int i = 0; i < def.num_legs; ++i)
+	{
+		def.legs[i].sec_id = security.legs[i].sec_id;
+		def.legs[i].ratio = security.legs[i].ratio;
+		def.legs[i].price = security.legs[i].price;
+	}
+	return def;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#ifndef _EVENT_JOURNAL_H_
+#define _EVENT_JOURNAL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unordered_set>
+#include <vector>
+
+#include "cme_parser.h"
+#include "instrument_registry.h"
+
+// Event journal layout: a JournalHeader, the records, then the security
+// table. Records are the normalized events the detectors consume, in the
+// order they were parsed:
+//
+//   JOURNAL_PACKET   start of an MDP3 packet received on a channel
+//   JOURNAL_BOOK     a template 32 entry of a known security
+//   JOURNAL_TRADES   start of a template 42 message
+//   JOURNAL_TRADE    a trade entry of it, of a known security
+//   JOURNAL_ORDER    an order entry of it, as applied to the last security
+//   JOURNAL_END      a message whose indicator ends trades, quotes or the event
+//   JOURNAL_DEFINITION  an instrument definition (template 54 or 56)
+//
+// Securities are dense indices into the first Indexed() rows of the table,
+// in order of their first record; each row is the security as it was
+// registered at that record. Rows marked preload were known before any
+// definition of them in the journal, from the cache or an earlier capture,
+// and are registered before a replay; the others are registered by their
+// definition records, as the parse registered them. The rows after the
+// indexed ones are the definitions, in the order of their records, as they
+// were registered. Packet times are deltas from the previous packet (the
+// first from 0), trade times deltas from their packet's time.
+
+static constexpr const char JOURNAL_MAGIC[8] = { 'C', 'M', 'E', 'J', 'R', 'N', 'L', '2' };
+
+enum JournalRecordType
+{
+	JOURNAL_PACKET = 1,
+	JOURNAL_BOOK,
+	JOURNAL_TRADES,
+	JOURNAL_TRADE,
+	JOURNAL_ORDER,
+	JOURNAL_END,
+	JOURNAL_DEFINITION
+};
+
+struct JournalHeader
+{
+	char magic[8];
+	uint32_t record_size;
+	uint32_t security_size;
+	uint64_t records;
+	uint64_t securities_offset;
+	uint32_t securities;
+	uint32_t indexed;
+};
+
+struct JournalRecord
+{
+	uint8_t type;
+	char code;			// book: entry type; trade: aggressor side; end: indicator
+	uint8_t action;		// book: action type
+	uint8_t level;		// book: price level
+	uint32_t id;		// book, trade: security; packet: channel; end, definition: template id
+	int64_t value;		// book, trade: wire price; packet, trades: time delta; order: order id;
+						// definition: its row after the indexed ones
+	int32_t size;		// book size, trade or order quantity
+	int32_t orders;		// book order count
+};
+
+static_assert(sizeof(JournalRecord) == 24, "journal record layout");
+
+struct JournalLeg
+{
+	int32_t sec_id;
+	int8_t ratio;
+	int64_t price;
+} PACKED;
+
+struct JournalSecurity
+{
+	int32_t sec_id;
+	char symbol[24];
+	int64_t price_shift;
+	int64_t tick_size;
+	int64_t min_price_increment;
+	int64_t display_factor;
+	uint8_t from_definition;
+	uint8_t num_legs;
+	JournalLeg legs[MAX_LEGS];
+	uint8_t preload;		// indexed rows: registered before a replay
+} PACKED;
+
+// Writes the journal through a large buffer, with one fwrite per buffer
+// full; the header is written again with the counts at Close().
+class JournalWriter
+{
+public:
+	JournalWriter();
+	~JournalWriter();
+
+	bool Open(const char* path);
+
+	// Writes the security table and the header, then closes the file.
+	void Close();
+
+	bool Enabled() const { return f != 0; }
+
+	// The dense index of a security not written before, registered as def.
+	uint32_t AddSecurity(const InstrumentDef& def);
+
+	// A definition message of template_id that registered def.
+	void Definition(const InstrumentDef& def, uint16_t template_id);
+
+	void Packet(int64_t ts, uint16_t channel)
+	{
+		JournalRecord& record = Append(JOURNAL_PACKET);
+		record.id = channel;
+		record.value = ts - last_ts;
+		last_ts = ts;
+	}
+
+	void Book(uint32_t security, const CmeBookEntry* entry)
+	{
+		JournalRecord& record = Append(JOURNAL_BOOK);
+		record.code = entry->entry_type;
+		record.action = entry->action_type;
+		record.level = entry->price_level;
+		record.id = security;
+		record.value = entry->price;
+		record.size = entry->size;
+		record.orders = entry->num_orders;
+	}
+
+	void Trades(uint64_t transact_time)
+	{
+		JournalRecord& record = Append(JOURNAL_TRADES);
+		record.value = (int64_t)transact_time - last_ts;
+	}
+
+	void Trade(uint32_t security, const CmeTradeEntry* entry)
+	{
+		JournalRecord& record = Append(JOURNAL_TRADE);
+		record.code = entry->aggressor_side;
+		record.id = security;
+		record.value = entry->price;
+		record.size = entry->qty;
+	}
+
+	void Order(const CmeOrderEntry* order)
+	{
+		JournalRecord& record = Append(JOURNAL_ORDER);
+		record.value = (int64_t)order->order_id;
+		record.size = order->qty;
+	}
+
+	void End(char indicator, uint16_t template_id)
+	{
+		JournalRecord& record = Append(JOURNAL_END);
+		record.code = indicator;
+		record.id = template_id;
+	}
+
+	uint64_t Records() const { return records + count; }
+
+private:
+	static constexpr const size_t BUFFER_RECORDS = 1 << 16;
+
+	JournalRecord& Append(uint8_t type)
+	{
+		if( count == BUFFER_RECORDS )
+			Flush();
+
+		JournalRecord& record = buffer[count++];
+		record = JournalRecord();
+		record.type = type;
+		return record;
+	}
+
+	void Flush();
+
+	FILE* f;
+	JournalRecord* buffer;
+	size_t count;
+	uint64_t records;
+	int64_t last_ts;
+	std::vector<JournalSecurity> indexed;		// by dense index
+	std::vector<JournalSecurity> definitions;	// in order of their records
+	std::unordered_set<int32_t> defined;
+};
+
+// Maps a journal for replay.
+class JournalReader
+{
+public:
+	JournalReader();
+	~JournalReader();
+
+	// False, with errno set, if the file cannot be mapped or is not a
+	// complete journal.
+	bool Open(const char* path);
+	void Close();
+
+	bool IsOpen() const { return data != 0; }
+
+	const JournalRecord* Records() const { return records; }
+	uint64_t RecordCount() const { return header.records; }
+
+	const JournalSecurity* Securities() const { return securities; }
+	uint32_t SecurityCount() const { return header.securities; }
+	uint32_t Indexed() const { return header.indexed; }
+
+private:
+	const char* data;
+	size_t length;
+	JournalHeader header;
+	const JournalRecord* records;
+	const JournalSecurity* securities;
+};
+
+// The registry entry of a journal security; index is left 0.
+InstrumentDef JournalInstrument(const JournalSecurity& security);
+
+#endif // _EVENT_JOURNAL_H_
@@ -0,0 +1,386 @@
+#include "implied_engine.h"
+#include "cme_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+static constexpr const char* IMPLIED_HEADERS = "ts,symbol,implied_bid,implied_bid_qty,implied_ask,implied_ask_qty";
+
+static const ImpliedQuote NO_QUOTE = { 0, 0 };
+
+// What a relation implies is stored with these prices when it is empty, so
+// finding the best is a plain min or max.
+static const ImpliedQuote NO_BID = { INT64_MIN, 0 };
+static const ImpliedQuote NO_ASK = { INT64_MAX, 0 };
+
+static bool better(bool bids, int64_t price, int64_t than)
+{
+	return bids ? price > than : price < than;
+}
+
+ImpliedEngine::ImpliedEngine()
+	: enabled(false)
+	, registry(0)
+	, updates(0)
+	, recomputes(0)
+{
+}
+
+bool ImpliedEngine::Open(const char* path, const InstrumentRegistry& registry)
+{
+	file.open(path);
+	if( !file )
+		return false;
+
+	file << IMPLIED_HEADERS << "\n";
+	Build(registry);
+	enabled = true;
+	return true;
+}
+
+void ImpliedEngine::Close()
+{
+	file.close();
+	enabled = false;
+}
+
+void ImpliedEngine::Build(const InstrumentRegistry& registry)
+{
+	this->registry = &registry;
+
+	std::vector<const InstrumentDef*> defs;
+	registry.Entries(defs);
+
+	// Outrights by symbol, for spreads only known from the cache.
+	std::unordered_map<std::string, const InstrumentDef*> by_symbol;
+	for(const InstrumentDef* def : defs)
+	{
+		if( !strchr(def->symbol, '-') )
+			by_symbol[def->symbol] = def;
+	}
+
+	for(const InstrumentDef* def : defs)
+	{
+		if( def->num_legs )
+		{
+			Define(def);
+			continue;
+		}
+
+		const char* dash = strchr(def->symbol, '-');
+		if( !dash || strchr(dash + 1, '-') )
+			continue;
+
+		auto front = by_symbol.find(std::string(def->symbol, dash - def->symbol));
+		auto back = by_symbol.find(dash + 1);
+		if( front == by_symbol.end() || back == by_symbol.end() )
+			continue;
+
+		const InstrumentDef* legs[2] = { front->second, back->second };
+		static const int32_t ratios[2] = { 1, -1 };
+		AddRelation(def, legs, ratios, 2);
+	}
+}
+
+void ImpliedEngine::Define(const InstrumentDef* def)
+{
+	if( !registry || def->num_legs == 0 )
+		return;
+
+	if( def->index < node_of.size() && node_of[def->index] >= 0 && nodes[node_of[def->index]].spread )
+		return;
+
+	const InstrumentDef* legs[MAX_LEGS];
+	int32_t ratios[MAX_LEGS];
+	for(int i = 0; i < def->num_legs; ++i)
+	{
+		legs[i] = registry->Find(def->legs[i].sec_id);
+		ratios[i] = def->legs[i].ratio;
+		if( !legs[i] || ratios[i] == 0 )
+			return;
+	}
+
+	AddRelation(def, legs, ratios, def->num_legs);
+}
+
+int32_t ImpliedEngine::NodeOf(const InstrumentDef* def)
+{
+	if( def->index >= node_of.size() )
+		node_of.resize(std::max<size_t>(def->index + 1, node_of.size() * 2), -1);
+
+	int32_t& node = node_of[def->index];
+	if( node < 0 )
+	{
+		node = (int32_t)nodes.size();
+		nodes.push_back(Node());
+		Node& added = nodes.back();
+		added.def = def;
+		added.scale.Set(def->price_shift, def->tick_size);
+		added.bid = added.ask = NO_QUOTE;
+		added.implied_bid = NO_BID;
+		added.implied_ask = NO_ASK;
+		added.stale_bid = added.stale_ask = false;
+		added.written_bid = added.written_ask = NO_QUOTE;
+		added.queued = false;
+		added.spread = false;
+	}
+	return node;
+}
+
+void ImpliedEngine::AddRelation(const InstrumentDef* spread, const InstrumentDef* const* legs, const int32_t* ratios, int count)
+{
+	Relation relation;
+	relation.first = (uint32_t)members.size();
+	relation.count = count + 1;
+	uint32_t id = (uint32_t)relations.size();
+
+	for(int i = 0; i <= count; ++i)
+	{
+		Member member;
+		member.node = NodeOf(i == 0 ? spread : legs[i - 1]);
+		member.ratio = i == 0 ? 1 : ratios[i - 1];
+
+		Node& node = nodes[member.node];
+		member.slot = (uint32_t)node.relations.size();
+		node.relations.push_back(id);
+		node.implied.push_back(Contribution{ NO_BID, NO_ASK });
+		members.push_back(member);
+	}
+
+	nodes[members[relation.first].node].spread = true;
+	relations.push_back(relation);
+}
+
+// The spread's side from bought legs' side and sold legs' other side,
+// skipping leg skip; false if a book it needs is empty. quantity is in
+// spreads.
+static bool leg_sum(const ImpliedQuote* bids, const ImpliedQuote* asks, const int32_t* ratios, int count, int skip,
+		bool bid_side, int64_t& price, int32_t& quantity)
+{
+	price = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		if( i == skip )
+			continue;
+
+		int32_t ratio = ratios[i];
+		const ImpliedQuote& quote = (ratio > 0) == bid_side ? bids[i] : asks[i];
+		int32_t lots = quote.quantity / std::abs(ratio);
+		if( lots == 0 )
+			return false;
+
+		price += ratio * quote.price;
+		quantity = std::min(quantity, lots);
+	}
+	return true;
+}
+
+void ImpliedEngine::Recompute(uint32_t id)
+{
+	++recomputes;
+
+	const Relation& relation = relations[id];
+	const Member* relation_members = &members[relation.first];
+	const Node& spread = nodes[relation_members[0].node];
+
+	int legs = relation.count - 1;
+	ImpliedQuote bids[MAX_LEGS], asks[MAX_LEGS];
+	int32_t ratios[MAX_LEGS];
+	for(int i = 0; i < legs; ++i)
+	{
+		const Member& member = relation_members[i + 1];
+		bids[i] = nodes[member.node].bid;
+		asks[i] = nodes[member.node].ask;
+		ratios[i] = member.ratio;
+	}
+
+	// Implied in: selling the spread is selling its bought legs into their
+	// bids and buying its sold legs from their asks.
+	ImpliedQuote in_bid = NO_QUOTE, in_ask = NO_QUOTE;
+	int32_t quantity = INT32_MAX;
+	if( leg_sum(bids, asks, ratios, legs, -1, true, in_bid.price, quantity) )
+		in_bid.quantity = quantity;
+	quantity = INT32_MAX;
+	if( leg_sum(bids, asks, ratios, legs, -1, false, in_ask.price, quantity) )
+		in_ask.quantity = quantity;
+	Replace(relation_members[0], in_bid, in_ask);
+
+	// Implied out: a resting spread bid takes the other legs at the prices
+	// a spread buyer trades them at, leaving a bid (bought leg) or an offer
+	// (sold leg) for the remaining one, and a resting spread offer the
+	// other way round.
+	for(int j = 0; j < legs; ++j)
+	{
+		ImpliedQuote out_bid = NO_QUOTE, out_ask = NO_QUOTE;
+		int32_t ratio = ratios[j];
+		int32_t lots = std::abs(ratio);
+
+		for(int side = 0; side < 2; ++side)
+		{
+			bool from_bid = side == 0;
+			const ImpliedQuote& resting = from_bid ? spread.bid : spread.ask;
+			if( resting.quantity == 0 )
+				continue;
+
+			// The other legs trade on the far side for the spread's
+			// counterparty, so they are summed as for the opposite side.
+			int64_t others;
+			quantity = resting.quantity;
+			if( !leg_sum(bids, asks, ratios, legs, j, !from_bid, others, quantity) )
+				continue;
+
+			int64_t remainder = resting.price - others;
+			if( remainder % ratio != 0 )
+				continue;
+
+			ImpliedQuote& out = (ratio > 0) == from_bid ? out_bid : out_ask;
+			out.price = remainder / ratio;
+			out.quantity = quantity * lots;
+		}
+		Replace(relation_members[j + 1], out_bid, out_ask);
+	}
+}
+
+void ImpliedEngine::Replace(const Member& member, const ImpliedQuote& bid, const ImpliedQuote& ask)
+{
+	Node& node = nodes[member.node];
+	Contribution& implied = node.implied[member.slot];
+	if( bid == implied.bid && ask == implied.ask )
+		return;
+
+	ImpliedQuote old_bid = implied.bid, old_ask = implied.ask;
+	implied.bid = bid.quantity ? bid : NO_BID;
+	implied.ask = ask.quantity ? ask : NO_ASK;
+	Track(node.implied_bid, node.stale_bid, old_bid, implied.bid, true);
+	Track(node.implied_ask, node.stale_ask, old_ask, implied.ask, false);
+
+	if( !node.queued )
+	{
+		node.queued = true;
+		changed.push_back((uint32_t)member.node);
+	}
+}
+
+// Keeps best up to date with one relation's quote replaced, unless that
+// took all the quantity at the best price: then only a scan finds the new
+// best, and it is left stale until the end of the event.
+void ImpliedEngine::Track(ImpliedQuote& best, bool& stale, const ImpliedQuote& old, const ImpliedQuote& now, bool bids)
+{
+	if( stale )
+		return;
+
+	if( old.quantity && old.price == best.price )
+	{
+		best.quantity -= old.quantity;
+		if( best.quantity == 0 )
+		{
+			if( now.quantity && !better(bids, best.price, now.price) )
+				best = now;
+			else
+				stale = true;
+			return;
+		}
+	}
+
+	if( now.quantity )
+	{
+		if( better(bids, now.price, best.price) )
+			best = now;
+		else if( now.price == best.price )
+			best.quantity += now.quantity;
+	}
+}
+
+void ImpliedEngine::Best(const Node& node, ImpliedQuote& bid, ImpliedQuote& ask) const
+{
+	bid = NO_BID;
+	ask = NO_ASK;
+	for(const Contribution& implied : node.implied)
+	{
+		bid.price = std::max(bid.price, implied.bid.price);
+		ask.price = std::min(ask.price, implied.ask.price);
+	}
+
+	for(const Contribution& implied : node.implied)
+	{
+		bid.quantity += implied.bid.price == bid.price ? implied.bid.quantity : 0;
+		ask.quantity += implied.ask.price == ask.price ? implied.ask.quantity : 0;
+	}
+}
+
+static void write_quote(std::ofstream& file, const ImpliedQuote& quote, const PriceScale& scale)
+{
+	if( quote.quantity )
+		file << ',' << scale.Clean(WirePrice(quote.price)).value << ',' << quote.quantity;
+	else
+		file << ",,";
+}
+
+void ImpliedEngine::Flush(int64_t ts)
+{
+	for(uint32_t index : changed)
+	{
+		Node& node = nodes[index];
+		node.queued = false;
+		if( node.stale_bid || node.stale_ask )
+		{
+			Best(node, node.implied_bid, node.implied_ask);
+			node.stale_bid = node.stale_ask = false;
+		}
+		if( node.implied_bid == node.written_bid && node.implied_ask == node.written_ask )
+			continue;
+
+		node.written_bid = node.implied_bid;
+		node.written_ask = node.implied_ask;
+		if( !enabled )
+			continue;
+
+		file << time_to_str(ts) << ',' << node.def->symbol;
+		write_quote(file, node.implied_bid, node.scale);
+		write_quote(file, node.implied_ask, node.scale);
+		file << '\n';
+	}
+	changed.clear();
+}
+
+bool ImpliedEngine::Implied(uint32_t index, ImpliedQuote& bid, ImpliedQuote& ask) const
+{
+	if( index >= node_of.size() || node_of[index] < 0 )
+		return false;
+
+	const Node& node = nodes[node_of[index]];
+	if( node.stale_bid || node.stale_ask )
+		Best(node, bid, ask);
+	else
+	{
+		bid = node.implied_bid;
+		ask = node.implied_ask;
+	}
+	return true;
+}
+
+void ImpliedEngine::Reset()
+{
+	for(Node& node : nodes)
+	{
+		node.bid = node.ask = NO_QUOTE;
+		node.implied_bid = NO_BID;
+		node.implied_ask = NO_ASK;
+		node.stale_bid = node.stale_ask = false;
+		node.written_bid = node.written_ask = NO_QUOTE;
+		node.queued = false;
+		for(Contribution& implied : node.implied)
+		{
+			implied.bid = NO_BID;
+			implied.ask = NO_ASK;
+		}
+	}
+	changed.clear();
+
+	updates = 0;
+	recomputes = 0;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#ifndef _IMPLIED_ENGINE_H_
+#define _IMPLIED_ENGINE_H_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <vector>
+
+#include "instrument_registry.h"
+#include "price_scale.h"
+
+// Best price and quantity on one side; quantity 0 when there is none.
+struct ImpliedQuote
+{
+	int64_t price;		// wire units
+	int32_t quantity;
+
+	bool operator==(const ImpliedQuote& other) const
+	{
+		return quantity == other.quantity && (quantity == 0 || price == other.price);
+	}
+	bool operator!=(const ImpliedQuote& other) const { return !(*this == other); }
+};
+
+// Derives first-generation implied prices from the outright books of the
+// instruments of each spread relation, a spread priced as the sum of its
+// legs' prices times their ratios:
+//
+//   implied in    spread bid from the legs' bids (bought legs) and asks
+//                 (sold legs), and the ask the other way round
+//   implied out   a leg's bid or ask from the spread's bid or ask and the
+//                 other legs' books
+//
+// Relations come from the legs of spread definitions (template 56), or for
+// cache-only calendar spreads from the symbol: A-B buys A and sells B.
+//
+// Every instrument in a relation is a node listing the relations it is in,
+// so an inside change only recomputes those relations. What a relation
+// implies for a node is stored in the node, next to what its other
+// relations imply. A node's implied inside is the best of these, with
+// quantities at the same price added. It is kept up to date as relations
+// change, except when the only quote at the best price gets worse; the
+// node is then scanned once, at the end of the event. Implieds are derived
+// from exchange books only, never from other implieds, so an update
+// touches each relation of the changed node once.
+class ImpliedEngine
+{
+public:
+	ImpliedEngine();
+
+	// Builds the relations of the spreads in registry and writes implied
+	// inside changes to path as CSV.
+	bool Open(const char* path, const InstrumentRegistry& registry);
+	void Close();
+
+	bool Enabled() const { return enabled; }
+
+	// Builds the relations only, for measuring without output.
+	void Build(const InstrumentRegistry& registry);
+
+	// Adds the relation of a spread defined after Build.
+	void Define(const InstrumentDef* def);
+
+	// The exchange inside of the instrument with registry index index.
+	void Update(uint32_t index, const ImpliedQuote& bid, const ImpliedQuote& ask)
+	{
+		if( index >= node_of.size() || node_of[index] < 0 )
+			return;
+
+		Node& node = nodes[node_of[index]];
+		if( node.bid == bid && node.ask == ask )
+			return;
+
+		node.bid = bid;
+		node.ask = ask;
+		++updates;
+		for(uint32_t relation : node.relations)
+			Recompute(relation);
+	}
+
+	// Finds the implied insides of the nodes changed since the last call
+	// and writes those that moved.
+	void Flush(int64_t ts);
+
+	// Implied inside of the instrument with registry index index.
+	bool Implied(uint32_t index, ImpliedQuote& bid, ImpliedQuote& ask) const;
+
+	// Forgets all books, keeping the relations.
+	void Reset();
+
+	size_t Nodes() const { return nodes.size(); }
+	size_t Relations() const { return relations.size(); }
+	uint64_t Updates() const { return updates; }
+	uint64_t Recomputes() const { return recomputes; }
+
+private:
+	struct Member
+	{
+		int32_t node;
+		int32_t ratio;		// negative when the leg is sold; 1 for the spread
+		uint32_t slot;		// in the node's implied
+	};
+
+	struct Contribution
+	{
+		ImpliedQuote bid;
+		ImpliedQuote ask;
+	};
+
+	struct Relation
+	{
+		uint32_t first;		// into members; the spread, then its legs
+		uint32_t count;
+	};
+
+	struct Node
+	{
+		const InstrumentDef* def;
+		PriceScale scale;
+		ImpliedQuote bid;		// exchange inside
+		ImpliedQuote ask;
+		ImpliedQuote implied_bid;	// best of implied, unless stale
+		ImpliedQuote implied_ask;
+		bool stale_bid;
+		bool stale_ask;
+		ImpliedQuote written_bid;
+		ImpliedQuote written_ask;
+		bool queued;
+		bool spread;			// its own relation is built
+		std::vector<uint32_t> relations;
+		std::vector<Contribution> implied;	// by each of relations
+	};
+
+	int32_t NodeOf(const InstrumentDef* def);
+	void AddRelation(const InstrumentDef* spread, const InstrumentDef* const* legs, const int32_t* ratios, int count);
+	void Recompute(uint32_t relation);
+	void Replace(const Member& member, const ImpliedQuote& bid, const ImpliedQuote& ask);
+	void Track(ImpliedQuote& best, bool& stale, const ImpliedQuote& old, const ImpliedQuote& now, bool bids);
+	void Best(const Node& node, ImpliedQuote& bid, ImpliedQuote& ask) const;
+
+	bool enabled;
+	std::ofstream file;
+	const InstrumentRegistry* registry;
+
+	std::vector<Node> nodes;
+	std::vector<int32_t> node_of;		// registry index -> node, -1 if none
+	std::vector<Relation> relations;
+	std::vector<Member> members;
+	std::vector<uint32_t> changed;
+
+	uint64_t updates;
+	uint64_t recomputes;
+};
+
+#endif // _IMPLIED_ENGINE_H_
@@ -0,0 +1,310 @@
+#include "instrument_registry.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static constexpr const size_t MIN_SEGMENT_SIZE = 1 << 16;
+
+// The display factor the cache's increments are relative to: 0.01, in
+// 1e-9 units.
+static constexpr const int64_t CACHE_DISPLAY_FACTOR = 10000000;
+
+void DeriveScale(int64_t min_price_increment, int64_t display_factor, int64_t& price_shift, int64_t& tick_size)
+{
+	price_shift = 1;
+	if( min_price_increment <= 0 )
+	{
+		tick_size = 1;
+		return;
+	}
+
+	// The increment in display units, scaled by 10^7. Without a display
+	// factor, or one the increment is not a whole multiple of in those
+	// units, the increment is taken as already scaled.
+	int64_t increment = min_price_increment;
+	if( display_factor > 0 )
+	{
+		__int128 scaled = (__int128)min_price_increment * CACHE_DISPLAY_FACTOR;
+		if( scaled % display_factor == 0 && scaled / display_factor > 0 && scaled / display_factor <= INT64_MAX )
+			increment = (int64_t)(scaled / display_factor);
+	}
+
+	while( increment % (price_shift * 10) == 0 )
+		price_shift *= 10;
+	tick_size = increment / price_shift;
+}
+
+// Whether registering def over previous would publish the same entry.
+static bool same_definition(const InstrumentDef& def, const InstrumentDef& previous, bool keep_scale)
+{
+	if( def.sec_id != previous.sec_id
+	 || memcmp(def.symbol, previous.symbol, sizeof(def.symbol)) != 0
+	 || def.min_price_increment != previous.min_price_increment
+	 || def.display_factor != previous.display_factor
+	 || def.from_definition != previous.from_definition
+	 || def.num_legs != previous.num_legs
+	 )
+		return false;
+
+	if( !keep_scale && (def.price_shift != previous.price_shift || def.tick_size != previous.tick_size) )
+		return false;
+
+	for(int i = 0; i < def.num_legs; ++i)
+	{
+		if( def.legs[i].sec_id != previous.legs[i].sec_id
+		 || def.legs[i].ratio != previous.legs[i].ratio
+		 || def.legs[i].price != previous.legs[i].price
+		 )
+			return false;
+	}
+	return true;
+}
+
+InstrumentRegistry::InstrumentRegistry()
+	: base(0)
+	, segment_count(0)
+	, first_capacity(MIN_SEGMENT_SIZE)
+	, allocated(0)
+	, entry_count(0)
+	, full_reported(false)
+{
+	for(int s = 0; s < MAX_SEGMENTS; ++s)
+		segments[s] = 0;
+	for(int c = 0; c < MAX_CHUNKS; ++c)
+		chunks[c] = 0;
+}
+
+InstrumentRegistry::~InstrumentRegistry()
+{
+	Free();
+}
+
+void InstrumentRegistry::Free()
+{
+	for(int s = 0; s < MAX_SEGMENTS; ++s)
+	{
+		if( segments[s] )
+		{
+			free(segments[s]->slots);
+			delete segments[s];
+		}
+		segments[s] = 0;
+	}
+	for(int c = 0; c < MAX_CHUNKS; ++c)
+	{
+		delete chunks[c];
+		chunks[c] = 0;
+	}
+}
+
+void InstrumentRegistry::SetBase(const InstrumentRegistry* base)
+{
+	std::lock_guard<std::mutex> lock(write_mutex);
+	this->base = base;
+}
+
+void InstrumentRegistry::Clear()
+{
+	std::lock_guard<std::mutex> lock(write_mutex);
+	Free();
+	segment_count.store(0, std::memory_order_release);
+	first_capacity = MIN_SEGMENT_SIZE;
+	allocated = 0;
+	entry_count.store(0, std::memory_order_release);
+	full_reported = false;
+}
+
+void InstrumentRegistry::Reserve(size_t count)
+{
+	std::lock_guard<std::mutex> lock(write_mutex);
+	if( segment_count.load(std::memory_order_relaxed) != 0 )
+		return;
+
+	// At most half full, so probe sequences stay short.
+	first_capacity = MIN_SEGMENT_SIZE;
+	while( first_capacity < count * 2 )
+		first_capacity *= 2;
+}
+
+InstrumentRegistry::Slot* InstrumentRegistry::FindSlot(int32_t sec_id)
+{
+	for(int s = segment_count.load(std::memory_order_relaxed) - 1; s >= 0; --s)
+	{
+		Segment* segment = segments[s];
+		for(uint32_t i = Hash(sec_id, segment->mask); ; i = (i + 1) & segment->mask)
+		{
+			int32_t key = segment->slots[i].key.load(std::memory_order_relaxed);
+			if( key == sec_id )
+				return &segment->slots[i];
+			if( key == EMPTY )
+				break;
+		}
+	}
+	return 0;
+}
+
+InstrumentRegistry::Slot* InstrumentRegistry::NewSlot(int32_t sec_id)
+{
+	int count = segment_count.load(std::memory_order_relaxed);
+	Segment* segment = count ? segments[count - 1] : 0;
+
+	if( !segment || (segment->count + 1) * 2 > segment->mask + 1 )
+	{
+		if( count == MAX_SEGMENTS )
+			return 0;
+
+		size_t capacity = segment ? (size_t)(segment->mask + 1) * 2 : first_capacity;
+		segment = new Segment();
+		segment->mask = (uint32_t)(capacity - 1);
+		segment->count = 0;
+		// Zeroed slots are empty; calloc leaves untouched pages unmapped.
+		segment->slots = (Slot*)calloc(capacity, sizeof(Slot));
+
+		segments[count] = segment;
+		segment_count.store(count + 1, std::memory_order_release);
+	}
+
+	uint32_t i = Hash(sec_id, segment->mask);
+	while( segment->slots[i].key.load(std::memory_order_relaxed) != EMPTY )
+		i = (i + 1) & segment->mask;
+
+	++segment->count;
+	segment->slots[i].key.store(sec_id, std::memory_order_release);
+	return &segment->slots[i];
+}
+
+InstrumentDef* InstrumentRegistry::Allocate()
+{
+	uint32_t chunk = allocated >> CHUNK_SHIFT;
+	if( chunk >= MAX_CHUNKS )
+		return 0;
+
+	if( !chunks[chunk] )
+		chunks[chunk] = new Chunk();
+
+	return &chunks[chunk]->defs[allocated++ & ((1 << CHUNK_SHIFT) - 1)];
+}
+
+const InstrumentDef* InstrumentRegistry::Register(const InstrumentDef& def, bool keep_scale)
+{
+	if( def.sec_id == EMPTY )
+		return 0;
+
+	std::lock_guard<std::mutex> lock(write_mutex);
+
+	Slot* slot = FindSlot(def.sec_id);
+	const InstrumentDef* previous = slot ? slot->def.load(std::memory_order_relaxed) : 0;
+	if( !previous && base )
+		previous = base->Find(def.sec_id);
+
+	// CME repeats the definitions of a channel all session; entries are
+	// never reclaimed, so an unchanged one must not take a new entry.
+	if( previous && same_definition(def, *previous, keep_scale) )
+		return previous;
+
+	if( !slot )
+		slot = NewSlot(def.sec_id);
+
+	InstrumentDef* entry = slot ? Allocate() : 0;
+	if( !entry )
+	{
+		if( !full_reported )
+			fprintf(stderr, "instrument registry full, dropping new definitions from sec_id %d on\n", def.sec_id);
+		full_reported = true;
+		return previous;
+	}
+
+	*entry = def;
+	if( previous )
+	{
+		entry->index = previous->index;
+		if( keep_scale )
+		{
+			entry->price_shift = previous->price_shift;
+			entry->tick_size = previous->tick_size;
+		}
+	}
+	else
+	{
+		uint32_t count = entry_count.load(std::memory_order_relaxed);
+		entry->index = (base ? (uint32_t)base->Size() : 0) + count;
+		entry_count.store(count + 1, std::memory_order_release);
+	}
+
+	slot->def.store(entry, std::memory_order_release);
+	return entry;
+}
+
+bool InstrumentRegistry::LoadCache(const char* path)
+{
+	std::ifstream id_file(path);
+	if( !id_file )
+		return false;
+
+	std::vector<InstrumentDef> rows;
+
+	std::string line;
+	while(getline(id_file, line))
+	{
+		std::string::size_type symbol_idx = line.find(',');
+		std::string::size_type exchange_id_idx = line.find(',', symbol_idx + 1);
+		std::string::size_type tick_size_idx = line.find(',', exchange_id_idx + 1);
+
+		if( symbol_idx == std::string::npos || exchange_id_idx == std::string::npos || tick_size_idx == std::string::npos )
+			continue;
+
+		InstrumentDef def;
+		memset(&def, 0, sizeof(def));
+		def.sec_id = atoi(line.c_str() + symbol_idx + 1);
+		def.price_shift = atoll(line.c_str() + exchange_id_idx + 1);
+		def.tick_size = atoll(line.c_str() + tick_size_idx + 1);
+		strncpy(def.symbol, line.c_str(), std::min(symbol_idx, sizeof(def.symbol) - 1));
+
+		rows.push_back(def);
+	}
+
+	Reserve(rows.size());
+	for(const InstrumentDef& def : rows)
+		Register(def, false);
+	return true;
+}
+
+void InstrumentRegistry::Entries(std::vector<const InstrumentDef*>& defs) const
+{
+	std::lock_guard<std::mutex> lock(write_mutex);
+
+	defs.clear();
+	for(int s = 0; s < segment_count.load(std::memory_order_relaxed); ++s)
+	{
+		for(uint32_t i = 0; i <= segments[s]->mask; ++i)
+		{
+			const InstrumentDef* def = segments[s]->slots[i].def.load(std::memory_order_relaxed);
+			if( def )
+				defs.push_back(def);
+		}
+	}
+	std::sort(defs.begin(), defs.end(), [](const InstrumentDef* lhs, const InstrumentDef* rhs){ return lhs->index < rhs->index; });
+}
+
+bool InstrumentRegistry::SaveCache(const char* path)
+{
+	std::vector<const InstrumentDef*> defs;
+	Entries(defs);
+
+	FILE* out = fopen(path, "w");
+	if( !out )
+		return false;
+
+	for(const InstrumentDef* def : defs)
+		fprintf(out, "%s,%d,%lld,%lld\n", def->symbol, def->sec_id, (long long)def->price_shift, (long long)def->tick_size);
+
+	fclose(out);
+	return true;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#ifndef _INSTRUMENT_REGISTRY_H_
+#define _INSTRUMENT_REGISTRY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+static constexpr const int MAX_LEGS = 8;
+
+struct InstrumentLeg
+{
+	int32_t sec_id;
+	int8_t ratio;		// negative when the leg is sold
+	int64_t price;		// wire units, 0 if not given
+};
+
+// One security as known from cme_ids.txt and/or its on-wire definition.
+// Entries are immutable once registered; an update publishes a new entry.
+struct InstrumentDef
+{
+	int32_t sec_id;
+	uint32_t index;				// dense, in order of first registration
+	char symbol[24];
+
+	int64_t price_shift;		// wire price / price_shift = clean price
+	int64_t tick_size;			// in clean units
+	int64_t min_price_increment;	// wire units, 0 if only known from the cache
+	int64_t display_factor;		// 1e-9 units, 0 if only known from the cache
+
+	bool from_definition;
+	uint8_t num_legs;
+	InstrumentLeg legs[MAX_LEGS];
+};
+
+// Security registry keyed by sec_id, filled from the cme_ids.txt warm-start
+// cache and from instrument definition messages (templates 54 and 56) as
+// they are parsed.
+//
+// Lookups never lock and registration never moves existing data: slots
+// live in open-addressed segments that are never rehashed; when the newest
+// segment is half full a segment twice its size is added and new
+// instruments go there. Entries are allocated from fixed chunks and
+// published with a release store, so a parser thread looking up a sec_id
+// sees either nothing or a complete entry, and pointers handed out stay
+// valid for the life of the registry. Registrations, which only come from
+// definition messages and the cache, are serialised among themselves.
+class InstrumentRegistry
+{
+public:
+	InstrumentRegistry();
+	~InstrumentRegistry();
+
+	// Sizes the first segment for count instruments. Call before any insert.
+	void Reserve(size_t count);
+
+	// Makes this registry an overlay of base: a sec_id registered in base
+	// but not here is registered with its index (and, with keep_scale, its
+	// scale), and other instruments are indexed after base's, so indices
+	// stay unique across both. Find() does not look in base. base must not
+	// grow while the overlay is in use.
+	void SetBase(const InstrumentRegistry* base);
+
+	// Drops every entry. Only for a registry no other thread reads, such as
+	// a thread's overlay.
+	void Clear();
+
+	const InstrumentDef* Find(int32_t sec_id) const
+	{
+		for(int s = segment_count.load(std::memory_order_acquire) - 1; s >= 0; --s)
+		{
+			const Segment* segment = segments[s];
+			for(uint32_t i = Hash(sec_id, segment->mask); ; i = (i + 1) & segment->mask)
+			{
+				int32_t key = segment->slots[i].key.load(std::memory_order_acquire);
+				if( key == sec_id )
+				{
+					const InstrumentDef* def = segment->slots[i].def.load(std::memory_order_acquire);
+					if( def )
+						return def;
+				}
+				if( key == EMPTY )
+					break;
+			}
+		}
+		return 0;
+	}
+
+	// Starts loading the slots Find(sec_id) probes first.
+	void Prefetch(int32_t sec_id) const
+	{
+		for(int s = segment_count.load(std::memory_order_acquire) - 1; s >= 0; --s)
+			__builtin_prefetch(&segments[s]->slots[Hash(sec_id, segments[s]->mask)]);
+	}
+
+	// Registers def, or replaces the entry of an already registered sec_id.
+	// With keep_scale an existing entry's price_shift and tick_size are
+	// kept, so prices stay comparable with what was already emitted. A def
+	// that would not change the existing entry returns it as is.
+	const InstrumentDef* Register(const InstrumentDef& def, bool keep_scale);
+
+	// The current entry of every registered instrument, in index order.
+	void Entries(std::vector<const InstrumentDef*>& defs) const;
+
+	// Rows of symbol,sec_id,price_shift,tick_size.
+	bool LoadCache(const char* path);
+	bool SaveCache(const char* path);
+
+	size_t Size() const { return entry_count.load(std::memory_order_acquire); }
+
+private:
+	static constexpr const int32_t EMPTY = 0;
+	static constexpr const int MAX_SEGMENTS = 16;
+	static constexpr const int CHUNK_SHIFT = 12;
+	static constexpr const int MAX_CHUNKS = 4096;
+
+	struct Slot
+	{
+		std::atomic<int32_t> key;
+		std::atomic<const InstrumentDef*> def;
+	};
+
+	struct Segment
+	{
+		uint32_t mask;
+		uint32_t count;
+		Slot* slots;
+	};
+
+	struct Chunk
+	{
+		InstrumentDef defs[1 << CHUNK_SHIFT];
+	};
+
+	static uint32_t Hash(int32_t sec_id, uint32_t mask)
+	{
+		return (uint32_t)(((uint32_t)sec_id * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+	}
+
+	Slot* FindSlot(int32_t sec_id);
+	Slot* NewSlot(int32_t sec_id);
+	InstrumentDef* Allocate();
+
+	void Free();
+
+	const InstrumentRegistry* base;
+
+	Segment* segments[MAX_SEGMENTS];
+	std::atomic<int> segment_count;
+	size_t first_capacity;
+
+	Chunk* chunks[MAX_CHUNKS];
+	uint32_t allocated;
+	std::atomic<uint32_t> entry_count;
+	bool full_reported;
+
+	mutable std::mutex write_mutex;
+};
+
+// Derives price_shift and tick_size from a definition's MinPriceIncrement
+// and DisplayFactor (both in 1e-9 units) the way the cme_ids.txt columns
+// were built: their product is the increment in display units times 10^7,
+// and the shift is the largest power of ten dividing it. GC's increment of
+// 0.1 at display factor 0.1 gives 10000000,1; 6E's 0.00005 at 0.0001 gives
+// 1000000,5; ZB's 1/32 at 1 gives 100,3125.
+void DeriveScale(int64_t min_price_increment, int64_t display_factor, int64_t& price_shift, int64_t& tick_size);
+
+#endif // _INSTRUMENT_REGISTRY_H_
@@ -0,0 +1,136 @@
+#pragma once
+
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Log-linear (HDR style) histogram of nanosecond latencies. Every power of two
+// is split into SUB_BUCKETS linear sub-buckets, so any recorded value is
+// reported within 1/SUB_BUCKETS of its true value. Recording is a couple of
+// shifts and an increment, with no allocation.
+//
+// Counters are relaxed atomics written by a single thread, so other threads
+// can read (but not record into) a histogram while it is being updated.
+class LatencyHistogram
+{
+public:
+	static constexpr const int SUB_BUCKET_BITS = 5;
+	static constexpr const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static constexpr const int MAX_VALUE_BITS = 40; // ~18 minutes
+	static constexpr const int NUM_COUNTS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	LatencyHistogram()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		for(int i = 0; i < NUM_COUNTS; ++i)
+			counts[i].store(0, std::memory_order_relaxed);
+		total.store(0, std::memory_order_relaxed);
+		negative.store(0, std::memory_order_relaxed);
+		max_value.store(0, std::memory_order_relaxed);
+	}
+
+	// Negative values (clock skew between hosts) are counted and recorded as 0.
+	void Record(int64_t value)
+	{
+		if( value < 0 )
+		{
+			Increment(negative);
+			value = 0;
+		}
+
+		Increment(counts[Index(value)]);
+		Increment(total);
+		if( value > max_value.load(std::memory_order_relaxed) )
+			max_value.store(value, std::memory_order_relaxed);
+	}
+
+	uint64_t Count() const { return total.load(std::memory_order_relaxed); }
+	uint64_t Negative() const { return negative.load(std::memory_order_relaxed); }
+	int64_t Max() const { return max_value.load(std::memory_order_relaxed); }
+
+	// Copies the bucket counts, e.g. to diff against a later snapshot.
+	void Snapshot(uint64_t* out) const
+	{
+		for(int i = 0; i < NUM_COUNTS; ++i)
+			out[i] = counts[i].load(std::memory_order_relaxed);
+	}
+
+	// Smallest bucket edge at or above the given fraction (0..1) of samples.
+	int64_t Percentile(double fraction) const
+	{
+		uint64_t snapshot[NUM_COUNTS];
+		Snapshot(snapshot);
+		return Percentile(snapshot, fraction, Max());
+	}
+
+	static int64_t Percentile(const uint64_t* counts, double fraction, int64_t max_value)
+	{
+		uint64_t total = 0;
+		for(int i = 0; i < NUM_COUNTS; ++i)
+			total += counts[i];
+
+		if( total == 0 )
+			return 0;
+
+		uint64_t target = (uint64_t)(fraction * total);
+		if( target >= total )
+			target = total - 1;
+
+		uint64_t seen = 0;
+		for(int i = 0; i < NUM_COUNTS; ++i)
+		{
+			seen += counts[i];
+			if( seen > target )
+			{
+				int64_t upper = UpperEdge(i);
+				return upper < max_value ? upper : max_value;
+			}
+		}
+
+		return max_value;
+	}
+
+	static int Index(int64_t value)
+	{
+		if( value < SUB_BUCKETS )
+			return (int)value;
+
+		int exponent = 63 - __builtin_clzll((uint64_t)value);
+		if( exponent >= MAX_VALUE_BITS )
+			return NUM_COUNTS - 1;
+
+		int bucket = exponent - SUB_BUCKET_BITS + 1;
+		int sub = (int)(value >> (bucket - 1)) & (SUB_BUCKETS - 1);
+		return bucket * SUB_BUCKETS + sub;
+	}
+
+	static int64_t UpperEdge(int index)
+	{
+		int bucket = index / SUB_BUCKETS;
+		int sub = index % SUB_BUCKETS;
+		if( bucket == 0 )
+			return sub;
+
+		return ((int64_t)(SUB_BUCKETS + sub + 1) << (bucket - 1)) - 1;
+	}
+
+private:
+	static void Increment(std::atomic<uint64_t>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> counts[NUM_COUNTS];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> negative;
+	std::atomic<int64_t> max_value;
+};
+
+#endif // _LATENCY_HISTOGRAM_H_
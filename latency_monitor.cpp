@@ -0,0 +1,166 @@
+#include "latency_monitor.h"
+
+#include <time.h>
+
+#include <chrono>
+#include <limits>
+
+static const char* KIND_NAMES[NUM_LATENCY_KINDS] = { "exchange_to_send", "send_to_capture", "capture_to_signal" };
+
+static int64_t wall_clock_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+LatencyMonitor::LatencyMonitor()
+	: channel_count(0)
+	, last_capture(0)
+	, live_clock(false)
+	, interval_ms(0)
+	, out(0)
+	, stopping(false)
+{
+	for(int i = 0; i < 65536; ++i)
+		channel_index[i].store(0, std::memory_order_relaxed);
+
+	for(int c = 0; c < MAX_CHANNELS; ++c)
+	{
+		channels[c].port = 0;
+		for(int t = 0; t < MAX_TEMPLATES; ++t)
+			channels[c].templates[t].store(0, std::memory_order_relaxed);
+	}
+}
+
+LatencyMonitor::~LatencyMonitor()
+{
+	Stop();
+
+	for(int c = 0; c < MAX_CHANNELS; ++c)
+	{
+		for(int t = 0; t < MAX_TEMPLATES; ++t)
+			delete channels[c].templates[t].load(std::memory_order_relaxed);
+	}
+}
+
+bool LatencyMonitor::Start(const char* path, int interval_ms, bool live_clock)
+{
+	out = fopen(path, "w");
+	if( !out )
+	{
+		perror(path);
+		return false;
+	}
+
+	this->interval_ms = interval_ms;
+	this->live_clock = live_clock;
+	dump_thread = std::thread(&LatencyMonitor::DumpLoop, this);
+	return true;
+}
+
+void LatencyMonitor::Stop()
+{
+	if( !dump_thread.joinable() )
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	dump_thread.join();
+
+	fclose(out);
+	out = 0;
+}
+
+LatencyMonitor::Channel* LatencyMonitor::AddChannel(uint16_t port)
+{
+	int count = channel_count.load(std::memory_order_relaxed);
+	if( count >= MAX_CHANNELS )
+		return 0;
+
+	channels[count].port = port;
+	channel_count.store(count + 1, std::memory_order_release);
+	channel_index[port].store((uint8_t)(count + 1), std::memory_order_relaxed);
+	return &channels[count];
+}
+
+LatencyMonitor::TemplateLatency* LatencyMonitor::AddTemplate(Channel* channel, uint16_t template_id)
+{
+	TemplateLatency* latency = new TemplateLatency();
+	for(int k = 0; k < NUM_LATENCY_KINDS; ++k)
+	{
+		for(int i = 0; i < LatencyHistogram::NUM_COUNTS; ++i)
+			latency->previous[k][i] = 0;
+	}
+
+	channel->templates[template_id].store(latency, std::memory_order_release);
+	return latency;
+}
+
+void LatencyMonitor::DumpLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for(;;)
+	{
+		bool stop = wakeup.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]{ return stopping; });
+		Dump();
+		if( stop )
+			break;
+	}
+}
+
+void LatencyMonitor::Dump()
+{
+	int64_t now = wall_clock_ns();
+	int64_t capture = last_capture.load(std::memory_order_relaxed);
+
+	uint64_t current[LatencyHistogram::NUM_COUNTS];
+	uint64_t delta[LatencyHistogram::NUM_COUNTS];
+
+	int count = channel_count.load(std::memory_order_acquire);
+	for(int c = 0; c < count; ++c)
+	{
+		Channel& channel = channels[c];
+		for(int t = 0; t < MAX_TEMPLATES; ++t)
+		{
+			TemplateLatency* latency = channel.templates[t].load(std::memory_order_acquire);
+			if( !latency )
+				continue;
+
+			for(int k = 0; k < NUM_LATENCY_KINDS; ++k)
+			{
+				latency->kinds[k].Snapshot(current);
+
+				uint64_t interval_count = 0;
+				int highest = -1;
+				for(int i = 0; i < LatencyHistogram::NUM_COUNTS; ++i)
+				{
+					delta[i] = current[i] - latency->previous[k][i];
+					latency->previous[k][i] = current[i];
+					interval_count += delta[i];
+					if( delta[i] )
+						highest = i;
+				}
+
+				if( interval_count == 0 )
+					continue;
+
+				const int64_t no_max = std::numeric_limits<int64_t>::max();
+				fprintf(out, "{\"ts\":%lld,\"capture_ts\":%lld,\"channel\":%u,\"template\":%d,\"kind\":\"%s\","
+							 "\"count\":%llu,\"negative_total\":%llu,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,\"max\":%lld}\n",
+						(long long)now, (long long)capture, (unsigned)channel.port, t, KIND_NAMES[k],
+						(unsigned long long)interval_count, (unsigned long long)latency->kinds[k].Negative(),
+						(long long)LatencyHistogram::Percentile(delta, 0.50, no_max),
+						(long long)LatencyHistogram::Percentile(delta, 0.90, no_max),
+						(long long)LatencyHistogram::Percentile(delta, 0.99, no_max),
+						(long long)LatencyHistogram::Percentile(delta, 0.999, no_max),
+						(long long)LatencyHistogram::UpperEdge(highest));
+			}
+		}
+	}
+
+	fflush(out);
+}
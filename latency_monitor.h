@@ -0,0 +1,113 @@
+#pragma once
+
+#ifndef _LATENCY_MONITOR_H_
+#define _LATENCY_MONITOR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "latency_histogram.h"
+
+enum LatencyKind
+{
+	EXCHANGE_TO_SEND,	// CmeMsgHeader::send_time - transact_time
+	SEND_TO_CAPTURE,	// capture timestamp - CmeMsgHeader::send_time
+	CAPTURE_TO_SIGNAL,	// detector signal - capture (live) or packet start (replay)
+	NUM_LATENCY_KINDS
+};
+
+// Per-channel, per-template latency histograms of the three clocks available
+// in the feed. The parser thread records into them without locks; a
+// background thread periodically writes what was recorded over the interval
+// as JSON lines, one object per channel/template/kind.
+//
+// Channels are keyed by port as parse_mdp_packet() gets it: the UDP
+// destination port, or a live channel's first feed port for both its A and
+// B feeds. Histograms for a channel and
+// template are allocated the first time that pair is seen.
+class LatencyMonitor
+{
+public:
+	static constexpr const int MAX_CHANNELS = 64;
+	static constexpr const int MAX_TEMPLATES = 64;
+
+	LatencyMonitor();
+	~LatencyMonitor();
+
+	// Starts dumping to path every interval_ms. With live_clock the capture
+	// timestamp is the local receive time and capture-to-signal compares it
+	// with the clock; otherwise signals are timed from when parsing began.
+	bool Start(const char* path, int interval_ms, bool live_clock);
+
+	// Stops the dump thread after writing the final interval.
+	void Stop();
+
+	void Record(uint16_t channel, uint16_t template_id, LatencyKind kind, int64_t ns)
+	{
+		if( template_id >= MAX_TEMPLATES )
+			return;
+
+		Channel* slot = GetChannel(channel);
+		if( !slot )
+			return;
+
+		TemplateLatency* latency = slot->templates[template_id].load(std::memory_order_acquire);
+		if( !latency )
+			latency = AddTemplate(slot, template_id);
+
+		latency->kinds[kind].Record(ns);
+	}
+
+	bool LiveClock() const { return live_clock; }
+
+	void SetCaptureTime(int64_t pktts) { last_capture.store(pktts, std::memory_order_relaxed); }
+
+private:
+	struct TemplateLatency
+	{
+		LatencyHistogram kinds[NUM_LATENCY_KINDS];
+		uint64_t previous[NUM_LATENCY_KINDS][LatencyHistogram::NUM_COUNTS];
+	};
+
+	struct Channel
+	{
+		uint16_t port;
+		std::atomic<TemplateLatency*> templates[MAX_TEMPLATES];
+	};
+
+	Channel* GetChannel(uint16_t port)
+	{
+		uint8_t index = channel_index[port].load(std::memory_order_relaxed);
+		if( index != 0 )
+			return &channels[index - 1];
+
+		return AddChannel(port);
+	}
+
+	Channel* AddChannel(uint16_t port);
+	TemplateLatency* AddTemplate(Channel* channel, uint16_t template_id);
+
+	void DumpLoop();
+	void Dump();
+
+	std::atomic<uint8_t> channel_index[65536];
+	Channel channels[MAX_CHANNELS];
+	std::atomic<int> channel_count;
+	std::atomic<int64_t> last_capture;
+
+	bool live_clock;
+	int interval_ms;
+	FILE* out;
+
+	std::thread dump_thread;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopping;
+};
+
+#endif // _LATENCY_MONITOR_H_
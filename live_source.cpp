@@ -0,0 +1,304 @@
+#include "live_source.h"
+#include "cme_parser.h"
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+static constexpr const int SLOT_SIZE = 2048;
+static constexpr const int CONTROL_SIZE = CMSG_SPACE(sizeof(timespec));
+static constexpr const int MAX_EVENTS = 16;
+
+static int64_t wall_clock_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static bool ParseFeed(const std::string& text, FeedSpec& feed)
+{
+	std::string::size_type colon = text.find(':');
+	if( colon == std::string::npos )
+		return false;
+
+	if( inet_pton(AF_INET, text.substr(0, colon).c_str(), &feed.group) != 1 )
+		return false;
+
+	int port = atoi(text.c_str() + colon + 1);
+	if( port <= 0 || port > 65535 )
+		return false;
+
+	feed.port = (uint16_t)port;
+	return true;
+}
+
+bool ParseChannelSpecs(const char* text, std::vector<ChannelSpec>& channels)
+{
+	std::string specs(text);
+	std::string::size_type start = 0;
+	while( start <= specs.size() )
+	{
+		std::string::size_type end = specs.find(',', start);
+		if( end == std::string::npos )
+			end = specs.size();
+
+		ChannelSpec channel;
+		std::string::size_type feed_start = start;
+		while( feed_start < end )
+		{
+			std::string::size_type feed_end = specs.find('/', feed_start);
+			if( feed_end == std::string::npos || feed_end > end )
+				feed_end = end;
+
+			FeedSpec feed;
+			if( !ParseFeed(specs.substr(feed_start, feed_end - feed_start), feed) )
+				return false;
+
+			channel.feeds.push_back(feed);
+			feed_start = feed_end + 1;
+		}
+
+		if( channel.feeds.empty() )
+			return false;
+
+		channels.push_back(channel);
+		start = end + 1;
+	}
+
+	return !channels.empty();
+}
+
+LiveSource::LiveSource(int batch_size, int ring_size)
+	: batch_size(batch_size)
+	, ring_size(ring_size)
+	, ring_head(0)
+	, epoll_fd(-1)
+	, ring(0)
+	, control(0)
+	, packets(0)
+	, batches(0)
+	, bytes(0)
+	, truncated(0)
+	, untimed(0)
+{
+}
+
+LiveSource::~LiveSource()
+{
+	for(const Socket& sock : sockets)
+		close(sock.fd);
+
+	if( epoll_fd >= 0 )
+		close(epoll_fd);
+
+	free(ring);
+	free(control);
+}
+
+bool LiveSource::Open(const char* iface_addr, const std::vector<ChannelSpec>& channels)
+{
+	in_addr iface;
+	iface.s_addr = htonl(INADDR_ANY);
+	if( iface_addr && inet_pton(AF_INET, iface_addr, &iface) != 1 )
+	{
+		fprintf(stderr, "invalid interface address %s\n", iface_addr);
+		return false;
+	}
+
+	epoll_fd = epoll_create1(0);
+	if( epoll_fd < 0 )
+	{
+		perror("epoll_create1");
+		return false;
+	}
+
+	arbiters.resize(channels.size());
+	for(size_t c = 0; c < channels.size(); ++c)
+	{
+		for(const FeedSpec& feed : channels[c].feeds)
+		{
+			int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+			if( fd < 0 )
+			{
+				perror("socket");
+				return false;
+			}
+
+			Socket sock;
+			sock.fd = fd;
+			sock.channel = (int)c;
+			sock.channel_port = channels[c].feeds[0].port;
+			sockets.push_back(sock);
+
+			int one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+
+			int rcvbuf = 64 << 20;
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+			// Binding to the group address keeps feeds sharing a port apart.
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr = feed.group;
+			addr.sin_port = htons(feed.port);
+			if( bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 )
+			{
+				perror("bind");
+				return false;
+			}
+
+			ip_mreq mreq;
+			mreq.imr_multiaddr = feed.group;
+			mreq.imr_interface = iface;
+			if( setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 )
+			{
+				perror("IP_ADD_MEMBERSHIP");
+				return false;
+			}
+
+			epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.u32 = (uint32_t)(sockets.size() - 1);
+			if( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 )
+			{
+				perror("epoll_ctl");
+				return false;
+			}
+		}
+	}
+
+	ring = (char*)calloc(ring_size, SLOT_SIZE);
+	control = (char*)calloc(ring_size, CONTROL_SIZE);
+	msgs.resize(ring_size);
+	iovecs.resize(ring_size);
+
+	for(int i = 0; i < ring_size; ++i)
+	{
+		iovecs[i].iov_base = ring + (size_t)i * SLOT_SIZE;
+		iovecs[i].iov_len = SLOT_SIZE;
+	}
+
+	return ring && control;
+}
+
+int LiveSource::ReceiveBatch(const Socket& sock)
+{
+	int count = batch_size;
+	if( count > ring_size - ring_head )
+		count = ring_size - ring_head;
+
+	mmsghdr* batch = &msgs[ring_head];
+	for(int i = 0; i < count; ++i)
+	{
+		msghdr& hdr = batch[i].msg_hdr;
+		hdr.msg_name = 0;
+		hdr.msg_namelen = 0;
+		hdr.msg_iov = &iovecs[ring_head + i];
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = control + (size_t)(ring_head + i) * CONTROL_SIZE;
+		hdr.msg_controllen = CONTROL_SIZE;
+		hdr.msg_flags = 0;
+	}
+
+	int received = recvmmsg(sock.fd, batch, count, MSG_DONTWAIT, 0);
+	if( received <= 0 )
+		return received;
+
+	++batches;
+	FeedArbiter& arbiter = arbiters[sock.channel];
+	for(int i = 0; i < received; ++i)
+	{
+		const char* data = (const char*)iovecs[ring_head + i].iov_base;
+		int length = (int)batch[i].msg_len;
+		if( length < (int)(sizeof(CmeMsgHeader) + sizeof(CmeMessage)) )
+			continue;
+
+		// The rest did not fit the slot; its messages would run past it.
+		if( batch[i].msg_hdr.msg_flags & MSG_TRUNC )
+		{
+			++truncated;
+			continue;
+		}
+
+		int64_t ts = 0;
+		for(cmsghdr* cmsg = CMSG_FIRSTHDR(&batch[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&batch[i].msg_hdr, cmsg))
+		{
+			if( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPNS )
+			{
+				timespec rx;
+				memcpy(&rx, CMSG_DATA(cmsg), sizeof(rx));
+				ts = (int64_t)rx.tv_sec * 1000000000LL + rx.tv_nsec;
+			}
+		}
+
+		if( ts == 0 )
+		{
+			ts = wall_clock_ns();
+			++untimed;
+		}
+
+		const CmeMsgHeader* msg_header = (const CmeMsgHeader*)data;
+		if( !arbiter.Accept(msg_header->seq_num) )
+			continue;
+
+		++packets;
+		bytes += length;
+		parse_mdp_packet(ts, data, length, sock.channel_port);
+	}
+
+	ring_head += received;
+	if( ring_head >= ring_size )
+		ring_head = 0;
+
+	return received;
+}
+
+void LiveSource::Run(volatile sig_atomic_t& stop)
+{
+	epoll_event events[MAX_EVENTS];
+	while( !stop )
+	{
+		int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
+		if( ready < 0 )
+		{
+			if( errno == EINTR )
+				continue;
+			perror("epoll_wait");
+			return;
+		}
+
+		for(int i = 0; i < ready; ++i)
+		{
+			const Socket& sock = sockets[events[i].data.u32];
+			while( ReceiveBatch(sock) > 0 )
+				;
+		}
+	}
+}
+
+void LiveSource::PrintStats() const
+{
+	uint64_t duplicates = 0, gaps = 0, resyncs = 0;
+	for(const FeedArbiter& arbiter : arbiters)
+	{
+		duplicates += arbiter.duplicates;
+		gaps += arbiter.gaps;
+		resyncs += arbiter.resyncs;
+	}
+
+	fprintf(stderr, "live: %llu packets, %llu bytes, %llu batches (%.1f packets/batch), %llu duplicates, %llu gaps, %llu resyncs, %llu truncated, %llu untimed\n",
+			(unsigned long long)packets, (unsigned long long)bytes, (unsigned long long)batches,
+			batches ? (double)(packets + duplicates) / batches : 0.0,
+			(unsigned long long)duplicates, (unsigned long long)gaps, (unsigned long long)resyncs,
+			(unsigned long long)truncated, (unsigned long long)untimed);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef _LIVE_SOURCE_H_
+#define _LIVE_SOURCE_H_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <signal.h>
+
+#include <vector>
+
+struct FeedSpec
+{
+	in_addr group;
+	uint16_t port;
+};
+
+// A channel is published on one or more redundant feeds (CME A/B); packets
+// are arbitrated on CmeMsgHeader::seq_num so each one is parsed once.
+struct ChannelSpec
+{
+	std::vector<FeedSpec> feeds;
+};
+
+// Parses "group:port[/group:port],..." - channels separated by commas, the
+// redundant feeds of one channel separated by slashes.
+bool ParseChannelSpecs(const char* text, std::vector<ChannelSpec>& channels);
+
+// Sequence number arbitration across the redundant feeds of a channel.
+struct FeedArbiter
+{
+	// A feed's copy of a packet trails the other feed's by a few packets at
+	// most. A sequence number further back than this is the channel starting
+	// over (a sequence reset, a restart, a replay loop), not a duplicate.
+	static constexpr const uint32_t RESYNC_DISTANCE = 1024;
+
+	uint32_t last_seq;
+	uint64_t duplicates;
+	uint64_t gaps;
+	uint64_t resyncs;
+
+	FeedArbiter()
+		: last_seq(0)
+		, duplicates(0)
+		, gaps(0)
+		, resyncs(0)
+	{
+	}
+
+	bool Accept(uint32_t seq_num)
+	{
+		if( last_seq != 0 && seq_num <= last_seq )
+		{
+			if( last_seq - seq_num < RESYNC_DISTANCE )
+			{
+				++duplicates;
+				return false;
+			}
+
+			++resyncs;
+			last_seq = seq_num;
+			return true;
+		}
+
+		if( last_seq != 0 && seq_num != last_seq + 1 )
+			++gaps;
+
+		last_seq = seq_num;
+		return true;
+	}
+};
+
+// Joins the channel multicast groups and feeds every received datagram to
+// parse_mdp_packet(), stamped with its SO_TIMESTAMPNS kernel receive time,
+// or the wall clock when the kernel gave none. Datagrams larger than a slot
+// are dropped and counted.
+// Datagrams are received with recvmmsg in batches of up to batch_size into a
+// ring of ring_size preallocated slots, so the receive path never allocates.
+class LiveSource
+{
+public:
+	LiveSource(int batch_size = 64, int ring_size = 1024);
+	~LiveSource();
+
+	bool Open(const char* iface_addr, const std::vector<ChannelSpec>& channels);
+
+	// Receives until stop becomes non-zero.
+	void Run(volatile sig_atomic_t& stop);
+
+	void PrintStats() const;
+
+	uint64_t Packets() const { return packets; }
+	uint64_t Batches() const { return batches; }
+
+private:
+	struct Socket
+	{
+		int fd;
+		int channel;
+		uint16_t channel_port;	// the channel's first feed's, for the parser
+	};
+
+	int ReceiveBatch(const Socket& sock);
+
+	int batch_size;
+	int ring_size;
+	int ring_head;
+
+	int epoll_fd;
+	std::vector<Socket> sockets;
+	std::vector<FeedArbiter> arbiters;
+
+	char* ring;
+	char* control;
+	std::vector<mmsghdr> msgs;
+	std::vector<iovec> iovecs;
+
+	uint64_t packets;
+	uint64_t batches;
+	uint64_t bytes;
+	uint64_t truncated;
+	uint64_t untimed;
+};
+
+#endif // _LIVE_SOURCE_H_
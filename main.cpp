@@ -0,0 +1,415 @@
+#include "batch_runner.h"
+#include "cme_parser.h"
+#include "capture_file.h"
+#include "latency_histogram.h"
+#include "latency_monitor.h"
+#include "live_source.h"
+#include "packet_ring_source.h"
+#include "perf_profiler.h"
+#include "book_publisher.h"
+#include "arena.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+extern LatencyHistogram* signal_latency;
+extern LatencyMonitor* latency_monitor;
+extern PerfProfiler* perf_profiler;
+extern BookPublisher* book_publisher;
+extern bool echo_icebergs;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+	stop_requested = 1;
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+			"usage: %s [options] <capture> <sweeps.csv> <icebergs.csv> <stops.csv>\n"
+			"       %s [options] --live <group:port[/group:port],...> [--iface <addr> | --ring <ifname>] <sweeps.csv> <icebergs.csv> <stops.csv>\n"
+			"       %s [options] --replay <journal> [--replay-channel <port>] <sweeps.csv> <icebergs.csv> <stops.csv>\n"
+			"       %s --batch <dir|manifest> --out <dir> [--jobs <n>] [--bars <name>] [--vap <name>]\n"
+			"\n"
+			"  --live              receive the channels with recvmmsg on UDP sockets\n"
+			"  --iface             local address of the interface to join the groups on\n"
+			"  --ring              read the channels from an AF_PACKET ring on the named interface\n"
+			"  --latency <file>    write per-channel/template latency histograms as JSON lines\n"
+			"  --latency-interval  milliseconds between latency dumps (default 10000)\n"
+			"  --perf              report hardware counters per pipeline stage and template at exit\n"
+			"  --batch             parse every capture in a directory or listed in a manifest\n"
+			"  --out               batch output directory, one subdirectory per capture\n"
+			"  --jobs              batch worker threads (default: number of cores)\n"
+			"  --save-ids <file>   write the security registry, including instruments defined on the wire, at exit\n"
+			"  --bars <file>       write 1s/1m/5m OHLCV bars as they complete (batch mode: a file name in each capture's directory)\n"
+			"  --vap <file>        write buy/sell volume-at-price per security at exit (batch mode: likewise)\n"
+			"  --book <file>       sample the top book levels of changed securities into a binary file\n"
+			"  --book-interval     milliseconds of capture time between book samples (default 100)\n"
+			"  --book-events <n>   sample every n book events instead\n"
+			"  --book-depth <n>    levels per side in book samples (default 5, at most 10)\n"
+			"  --implied <file>    derive implied prices of spreads and their legs from the outright books\n"
+			"  --shm <name>        mirror books into the POSIX shared-memory region /name for local readers\n"
+			"  --shm-slots <n>     securities the region holds (default 16384)\n"
+			"  --arena <backing>   per-thread parser state from malloc, pages or huge (2MB) pages (default malloc)\n"
+			"  --numa <node>       bind parser state to a NUMA node and run on its CPUs\n"
+			"  --prefetch <n>      parse a capture n packets at a time, prefetching the books they update\n"
+			"  --io <method>       read uncompressed captures with stdio, mmap or uring (io_uring read-ahead) (default stdio)\n"
+			"  --journal <file>    also write the normalized events the detectors consume to an event journal\n"
+			"  --replay            run the detectors over an event journal instead of a capture\n"
+			"  --replay-channel    replay only the packets of this channel (UDP port; a live channel's first feed port)\n",
+			prog, prog, prog, prog);
+}
+
+static void print_latency(const char* name, const LatencyHistogram& hist)
+{
+	fprintf(stderr, "%s: count=%llu p50=%lldns p90=%lldns p99=%lldns p99.9=%lldns max=%lldns\n",
+			name, (unsigned long long)hist.Count(),
+			(long long)hist.Percentile(0.50), (long long)hist.Percentile(0.90),
+			(long long)hist.Percentile(0.99), (long long)hist.Percentile(0.999),
+			(long long)hist.Max());
+}
+
+// Reads batch frames at a time and hands them to parse_packets(). Frames are
+// copied out, as the reader's pointer only lasts until its next call.
+static void run_batched(CaptureReader& reader, int batch)
+{
+	std::vector<char> data((size_t)batch * MAX_FRAME_SIZE);
+	std::vector<PacketRef> packets(batch);
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	for(bool more = true; more; )
+	{
+		int count = 0;
+		while( count < batch )
+		{
+			if( perf_profiler )
+				perf_profiler->Enter(STAGE_READ, 0);
+			more = reader.Next(ts, frame, length);
+			if( perf_profiler )
+				perf_profiler->Exit();
+
+			if( !more )
+				break;
+
+			if( length > MAX_FRAME_SIZE )
+			{
+				parse_packets(&packets[0], count);
+				count = 0;
+				parse_packet(ts, frame, length);
+				continue;
+			}
+
+			PacketRef& packet = packets[count];
+			char* copy = &data[(size_t)count * MAX_FRAME_SIZE];
+			memcpy(copy, frame, length);
+			packet.ts = ts;
+			packet.buffer = copy;
+			packet.length = length;
+			++count;
+		}
+
+		parse_packets(&packets[0], count);
+	}
+}
+
+static int run_capture(const char* path, int prefetch_batch, CaptureIo io)
+{
+	CaptureReader reader;
+	if( !reader.Open(path, io) )
+	{
+		perror(path);
+		return 1;
+	}
+
+	if( prefetch_batch > 1 )
+	{
+		run_batched(reader, prefetch_batch);
+		return 0;
+	}
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	for(;;)
+	{
+		if( perf_profiler )
+			perf_profiler->Enter(STAGE_READ, 0);
+		bool more = reader.Next(ts, frame, length);
+		if( perf_profiler )
+			perf_profiler->Exit();
+
+		if( !more )
+			break;
+		parse_packet(ts, frame, length);
+	}
+
+	return 0;
+}
+
+static int run_batch(const char* input, const char* out_dir, int jobs, CaptureIo io, const char* bars_name, const char* vap_name)
+{
+	// Icebergs are in each capture's icebergs.csv; echoing them from every
+	// worker would interleave on stdout.
+	echo_icebergs = false;
+
+	BatchRunner runner(out_dir, jobs > 0 ? jobs : (int)std::thread::hardware_concurrency(), io);
+	if( !runner.AddInput(input) )
+		return 1;
+	runner.SetBarOutputs(bars_name, vap_name);
+
+	bool ok = runner.Run();
+	runner.PrintSummary(stderr);
+	return ok ? 0 : 1;
+}
+
+static int run_live(const char* channels_spec, const char* iface, const char* ring_ifname)
+{
+	std::vector<ChannelSpec> channels;
+	if( !ParseChannelSpecs(channels_spec, channels) )
+	{
+		fprintf(stderr, "invalid channel list %s\n", channels_spec);
+		return 1;
+	}
+
+	static LatencyHistogram latency;
+	signal_latency = &latency;
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if( ring_ifname )
+	{
+		PacketRingSource source;
+		if( !source.Open(ring_ifname, channels) )
+			return 1;
+
+		source.Run(stop_requested);
+		source.PrintStats();
+	}
+	else
+	{
+		LiveSource source;
+		if( !source.Open(iface, channels) )
+			return 1;
+
+		source.Run(stop_requested);
+		source.PrintStats();
+	}
+
+	print_latency("receive-to-signal", latency);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* live_channels = 0;
+	const char* iface = 0;
+	const char* ring_ifname = 0;
+	const char* latency_path = 0;
+	int latency_interval = 10000;
+	bool perf = false;
+	const char* batch_input = 0;
+	const char* batch_out = 0;
+	int batch_jobs = 0;
+	const char* save_ids = 0;
+	const char* bars_path = 0;
+	const char* vap_path = 0;
+	const char* book_path = 0;
+	int book_interval = 100;
+	int book_events = 0;
+	int book_depth = 5;
+	const char* shm_name = 0;
+	const char* implied_path = 0;
+	int shm_slots = 16384;
+	ArenaBacking arena_backing = ARENA_MALLOC;
+	int numa_node = -1;
+	int prefetch_batch = 0;
+	CaptureIo capture_io = CAPTURE_IO_STDIO;
+	const char* journal_path = 0;
+	const char* replay_path = 0;
+	int replay_channel = 0;
+
+	int argi = 1;
+	for(; argi < argc && strncmp(argv[argi], "--", 2) == 0; ++argi)
+	{
+		if( strcmp(argv[argi], "--live") == 0 && argi + 1 < argc )
+			live_channels = argv[++argi];
+		else if( strcmp(argv[argi], "--iface") == 0 && argi + 1 < argc )
+			iface = argv[++argi];
+		else if( strcmp(argv[argi], "--ring") == 0 && argi + 1 < argc )
+			ring_ifname = argv[++argi];
+		else if( strcmp(argv[argi], "--latency") == 0 && argi + 1 < argc )
+			latency_path = argv[++argi];
+		else if( strcmp(argv[argi], "--latency-interval") == 0 && argi + 1 < argc )
+			latency_interval = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--perf") == 0 )
+			perf = true;
+		else if( strcmp(argv[argi], "--batch") == 0 && argi + 1 < argc )
+			batch_input = argv[++argi];
+		else if( strcmp(argv[argi], "--out") == 0 && argi + 1 < argc )
+			batch_out = argv[++argi];
+		else if( strcmp(argv[argi], "--jobs") == 0 && argi + 1 < argc )
+			batch_jobs = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--save-ids") == 0 && argi + 1 < argc )
+			save_ids = argv[++argi];
+		else if( strcmp(argv[argi], "--bars") == 0 && argi + 1 < argc )
+			bars_path = argv[++argi];
+		else if( strcmp(argv[argi], "--vap") == 0 && argi + 1 < argc )
+			vap_path = argv[++argi];
+		else if( strcmp(argv[argi], "--book") == 0 && argi + 1 < argc )
+			book_path = argv[++argi];
+		else if( strcmp(argv[argi], "--book-interval") == 0 && argi + 1 < argc )
+			book_interval = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--book-events") == 0 && argi + 1 < argc )
+			book_events = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--book-depth") == 0 && argi + 1 < argc )
+			book_depth = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--implied") == 0 && argi + 1 < argc )
+			implied_path = argv[++argi];
+		else if( strcmp(argv[argi], "--shm") == 0 && argi + 1 < argc )
+			shm_name = argv[++argi];
+		else if( strcmp(argv[argi], "--shm-slots") == 0 && argi + 1 < argc )
+			shm_slots = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--arena") == 0 && argi + 1 < argc && ParseArenaBacking(argv[argi + 1], arena_backing) )
+			++argi;
+		else if( strcmp(argv[argi], "--numa") == 0 && argi + 1 < argc )
+			numa_node = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--prefetch") == 0 && argi + 1 < argc )
+			prefetch_batch = atoi(argv[++argi]);
+		else if( strcmp(argv[argi], "--io") == 0 && argi + 1 < argc && ParseCaptureIo(argv[argi + 1], capture_io) )
+			++argi;
+		else if( strcmp(argv[argi], "--journal") == 0 && argi + 1 < argc )
+			journal_path = argv[++argi];
+		else if( strcmp(argv[argi], "--replay") == 0 && argi + 1 < argc )
+			replay_path = argv[++argi];
+		else if( strcmp(argv[argi], "--replay-channel") == 0 && argi + 1 < argc )
+			replay_channel = atoi(argv[++argi]);
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Before any parser state exists; batch workers inherit the CPU binding.
+	ConfigureArenas(arena_backing, numa_node);
+	if( numa_node >= 0 && !BindThreadToNode(numa_node) )
+		return 1;
+
+	if( batch_input )
+	{
+		if( !batch_out || argi != argc || live_channels || latency_path || perf || book_path || implied_path || shm_name || prefetch_batch
+		 || journal_path || replay_path )
+		{
+			usage(argv[0]);
+			return 1;
+		}
+
+		LoadSecInfo();
+		int ret = run_batch(batch_input, batch_out, batch_jobs, capture_io, bars_path, vap_path);
+		if( save_ids && !SaveSecInfo(save_ids) )
+			perror(save_ids);
+		return ret;
+	}
+
+	// A journal has no wire times to measure latency from, and is not
+	// written again.
+	int outputs = live_channels || replay_path ? argi : argi + 1;
+	if( argc - outputs != 3 || (book_path && book_interval <= 0 && book_events <= 0)
+	 || (replay_path && (live_channels || latency_path || journal_path))
+	 || replay_channel < 0 || replay_channel > 65535 )
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	LoadSecInfo();
+
+	// Securities from the journal before any output builds on the registry.
+	if( replay_path && !LoadJournal(replay_path) )
+	{
+		perror(replay_path);
+		return 1;
+	}
+
+	OpenOutputs(argv[outputs], argv[outputs + 1], argv[outputs + 2]);
+	if( bars_path || vap_path )
+		OpenBarOutputs(bars_path, vap_path);
+
+	// --book-events replaces time based sampling.
+	if( book_path && !OpenBookSamples(book_path, book_events > 0 ? 0 : book_interval * 1000000LL, book_events, book_depth) )
+	{
+		perror(book_path);
+		return 1;
+	}
+
+	if( latency_path )
+	{
+		latency_monitor = new LatencyMonitor();
+		if( !latency_monitor->Start(latency_path, latency_interval, live_channels != 0) )
+			return 1;
+	}
+
+	if( implied_path && !OpenImpliedOutput(implied_path) )
+	{
+		perror(implied_path);
+		return 1;
+	}
+
+	if( journal_path && !OpenJournal(journal_path) )
+	{
+		perror(journal_path);
+		return 1;
+	}
+
+	if( shm_name )
+	{
+		book_publisher = new BookPublisher();
+		if( shm_slots <= 0 || !book_publisher->Open(shm_name, shm_slots) )
+			return 1;
+	}
+
+	if( perf )
+	{
+		perf_profiler = new PerfProfiler();
+		if( !perf_profiler->Start() )
+			return 1;
+	}
+
+	int ret;
+	if( live_channels )
+		ret = run_live(live_channels, iface, ring_ifname);
+	else if( replay_path )
+		ret = ReplayJournal((uint16_t)replay_channel) ? 0 : 1;
+	else
+		ret = run_capture(argv[argi], prefetch_batch, capture_io);
+
+	if( latency_monitor )
+		latency_monitor->Stop();
+
+	WriteResults();
+	CloseOutputs();
+
+	if( book_publisher )
+	{
+		delete book_publisher;
+		book_publisher = 0;
+	}
+
+	if( save_ids && !SaveSecInfo(save_ids) )
+		perror(save_ids);
+
+	if( perf_profiler )
+		perf_profiler->Report(stderr);
+
+	return ret;
+}
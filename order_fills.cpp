@@ -0,0 +1,86 @@
+#include "order_fills.h"
+
+#include <algorithm>
+
+static constexpr const size_t MIN_SLOTS = 64;
+
+OrderFillIndex::OrderFillIndex()
+	: current(0)
+	, epoch(0)
+	, generation_start(0)
+{
+}
+
+void OrderFillIndex::Table::Grow()
+{
+	ArenaVector<OrderFill> old;
+	old.swap(slots);
+
+	OrderFill empty = OrderFill();
+	slots.assign(old.empty() ? MIN_SLOTS : old.size() * 2, empty);
+	mask = slots.size() - 1;
+
+	for(const OrderFill& fill : old)
+	{
+		if( fill.order_id != 0 )
+			Probe(fill.order_id) = fill;
+	}
+}
+
+void OrderFillIndex::Table::Clear()
+{
+	if( count == 0 )
+		return;
+
+	OrderFill empty = OrderFill();
+	std::fill(slots.begin(), slots.end(), empty);
+	count = 0;
+}
+
+OrderFillIndex::Table& OrderFillIndex::Rotate()
+{
+	current = !current;
+	tables[current].Clear();
+	generation_start = epoch;
+	return tables[current];
+}
+
+StopPriceIndex::StopPriceIndex()
+	: mask(0)
+	, count(0)
+	, epoch(1)
+{
+}
+
+void StopPriceIndex::Insert(CleanPrice price, int index)
+{
+	if( (count + 1) * 2 > slots.size() )
+	{
+		// Grow, keeping the current event's entries.
+		ArenaVector<Entry> old;
+		old.swap(slots);
+
+		Entry empty = Entry();
+		slots.assign(old.empty() ? MIN_SLOTS : old.size() * 2, empty);
+		mask = slots.size() - 1;
+		count = 0;
+
+		for(const Entry& entry : old)
+		{
+			if( entry.epoch == epoch )
+				Insert(entry.price, entry.index);
+		}
+	}
+
+	size_t i = Hash(price);
+	for(; slots[i].epoch == epoch; i = (i + 1) & mask)
+	{
+		if( slots[i].price == price )
+			return;
+	}
+
+	slots[i].price = price;
+	slots[i].epoch = epoch;
+	slots[i].index = index;
+	++count;
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#ifndef _ORDER_FILLS_H_
+#define _ORDER_FILLS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "arena.h"
+#include "price_scale.h"
+
+// Fills of one order_id in a security, from the order-id group of trade
+// summaries (template 42).
+struct OrderFill
+{
+	uint64_t order_id;		// 0 for an empty slot
+	uint32_t epoch;			// trade event of the security it was last filled in
+	int32_t stop_index;		// into StopsInfo::trades in that event, -1 if not a stop
+	int32_t aggressor_qty;
+	int32_t passive_qty;
+	CleanPrice first_price;
+	CleanPrice last_price;
+	int64_t first_ts;		// transact times
+	int64_t last_ts;
+};
+
+// order_id -> OrderFill index of one security.
+//
+// Epochs count the security's trade events. Fills are kept in two
+// generations of open-addressed tables: new orders go into the current one,
+// and an order found only in the previous one is copied forward when it
+// fills again. When the current generation holds MAX_GENERATION orders or
+// is KEEP_EPOCHS events old, the previous table is cleared and becomes the
+// current one. An order is therefore kept while it fills at least once a
+// generation, and cleanup is a sequential clear rather than a rehash. Tables
+// start small and double up to the generation limit, so quiet securities
+// stay small.
+class OrderFillIndex
+{
+public:
+	static constexpr const uint32_t KEEP_EPOCHS = 1024;
+	static constexpr const size_t MAX_GENERATION = 4096;
+
+	OrderFillIndex();
+
+	const OrderFill* Find(uint64_t order_id) const
+	{
+		const OrderFill* fill = tables[current].Find(order_id);
+		return fill ? fill : tables[!current].Find(order_id);
+	}
+
+	// Adds a fill of order_id in the current trade event. A fill in a new
+	// event starts with stop_index -1.
+	OrderFill& Fill(uint64_t order_id, bool aggressor, int32_t qty, CleanPrice price, int64_t ts)
+	{
+		OrderFill& fill = Slot(order_id, price, ts);
+		if( fill.epoch != epoch )
+		{
+			fill.epoch = epoch;
+			fill.stop_index = -1;
+		}
+
+		if( aggressor )
+			fill.aggressor_qty += qty;
+		else
+			fill.passive_qty += qty;
+		fill.last_price = price;
+		fill.last_ts = ts;
+		return fill;
+	}
+
+	// Starts the security's next trade event.
+	void NextEpoch() { ++epoch; }
+
+	uint32_t Epoch() const { return epoch; }
+	size_t Size() const { return tables[0].count + tables[1].count; }
+
+private:
+	struct Table
+	{
+		ArenaVector<OrderFill> slots;
+		size_t mask;
+		size_t count;
+
+		Table()
+			: mask(0)
+			, count(0)
+		{
+		}
+
+		size_t Hash(uint64_t order_id) const
+		{
+			return (size_t)((order_id * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+		}
+
+		const OrderFill* Find(uint64_t order_id) const
+		{
+			if( count == 0 )
+				return 0;
+
+			for(size_t i = Hash(order_id); ; i = (i + 1) & mask)
+			{
+				if( slots[i].order_id == order_id )
+					return &slots[i];
+				if( slots[i].order_id == 0 )
+					return 0;
+			}
+		}
+
+		// The slot of order_id, or the empty slot it would go in.
+		OrderFill& Probe(uint64_t order_id)
+		{
+			size_t i = Hash(order_id);
+			while( slots[i].order_id != 0 && slots[i].order_id != order_id )
+				i = (i + 1) & mask;
+			return slots[i];
+		}
+
+		void Grow();
+		void Clear();
+	};
+	friend struct ArenaResettable<OrderFillIndex>;
+	friend struct ArenaResettable<Table>;
+
+	OrderFill& Slot(uint64_t order_id, CleanPrice price, int64_t ts)
+	{
+		Table* table = &tables[current];
+		if( table->count != 0 )
+		{
+			OrderFill& fill = table->Probe(order_id);
+			if( fill.order_id == order_id )
+				return fill;
+		}
+
+		if( table->count >= MAX_GENERATION || epoch - generation_start >= KEEP_EPOCHS )
+			table = &Rotate();
+		if( (table->count + 1) * 2 > table->slots.size() )
+			table->Grow();
+
+		OrderFill& fill = table->Probe(order_id);
+		const OrderFill* previous = tables[!current].Find(order_id);
+		if( previous )
+		{
+			fill = *previous;
+		}
+		else
+		{
+			fill.order_id = order_id;
+			fill.epoch = epoch - 1;
+			fill.aggressor_qty = 0;
+			fill.passive_qty = 0;
+			fill.first_price = price;
+			fill.first_ts = ts;
+		}
+		++table->count;
+		return fill;
+	}
+
+	Table& Rotate();
+
+	Table tables[2];
+	int current;
+	uint32_t epoch;
+	uint32_t generation_start;
+};
+
+// Index of the current trade event's stop trades by price, so book adds can
+// find the stop whose residual rests at their price without a scan. Slots of
+// earlier events read as empty, so Clear() does not touch the table.
+class StopPriceIndex
+{
+public:
+	StopPriceIndex();
+
+	void Clear()
+	{
+		++epoch;
+		count = 0;
+	}
+
+	// Keeps the first stop trade recorded at a price.
+	void Insert(CleanPrice price, int index);
+
+	// The stop trade at price, or -1.
+	int Find(CleanPrice price) const
+	{
+		if( count == 0 )
+			return -1;
+
+		for(size_t i = Hash(price); ; i = (i + 1) & mask)
+		{
+			if( slots[i].epoch != epoch )
+				return -1;
+			if( slots[i].price == price )
+				return slots[i].index;
+		}
+	}
+
+private:
+	struct Entry
+	{
+		CleanPrice price;
+		uint32_t epoch;
+		int32_t index;
+	};
+
+	size_t Hash(CleanPrice price) const
+	{
+		return (size_t)(((uint64_t)price.value * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+	}
+
+	ArenaVector<Entry> slots;
+	size_t mask;
+	size_t count;
+	uint32_t epoch;
+
+	friend struct ArenaResettable<StopPriceIndex>;
+};
+
+template<>
+struct ArenaResettable<OrderFillIndex::Table> : ArenaMembers<OrderFillIndex::Table,
+	decltype(OrderFillIndex::Table::slots), decltype(OrderFillIndex::Table::mask), decltype(OrderFillIndex::Table::count)> {};
+
+template<>
+struct ArenaResettable<OrderFillIndex> : ArenaMembers<OrderFillIndex,
+	decltype(OrderFillIndex::tables), decltype(OrderFillIndex::current), decltype(OrderFillIndex::epoch),
+	decltype(OrderFillIndex::generation_start)> {};
+
+template<>
+struct ArenaResettable<StopPriceIndex> : ArenaMembers<StopPriceIndex,
+	decltype(StopPriceIndex::slots), decltype(StopPriceIndex::mask), decltype(StopPriceIndex::count),
+	decltype(StopPriceIndex::epoch)> {};
+
+#endif // _ORDER_FILLS_H_
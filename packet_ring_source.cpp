@@ -0,0 +1,308 @@
+#include "packet_ring_source.h"
+#include "capture_file.h"
+#include "cme_parser.h"
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+static constexpr const int FRAME_SIZE = 2048;
+static constexpr const int MAX_FILTER_PORTS = 200;
+
+static sock_filter bpf_stmt(uint16_t code, uint32_t k)
+{
+	sock_filter insn = { code, 0, 0, k };
+	return insn;
+}
+
+static sock_filter bpf_jump(uint16_t code, uint32_t k, int jt, int jf)
+{
+	sock_filter insn = { code, (uint8_t)jt, (uint8_t)jf, k };
+	return insn;
+}
+
+PacketRingSource::PacketRingSource(int block_size, int block_count, int block_timeout_ms)
+	: block_size(block_size)
+	, block_count(block_count)
+	, block_timeout_ms(block_timeout_ms)
+	, fd(-1)
+	, ring(0)
+	, ring_bytes(0)
+	, current_block(0)
+	, packets(0)
+	, truncated(0)
+	, malformed(0)
+	, blocks(0)
+	, polls(0)
+	, kernel_drops(0)
+{
+}
+
+PacketRingSource::~PacketRingSource()
+{
+	if( ring )
+		munmap(ring, ring_bytes);
+
+	if( fd >= 0 )
+		close(fd);
+
+	for(int join_fd : join_fds)
+		close(join_fd);
+}
+
+bool PacketRingSource::Open(const char* ifname, const std::vector<ChannelSpec>& channels)
+{
+	int ifindex = if_nametoindex(ifname);
+	if( ifindex == 0 )
+	{
+		fprintf(stderr, "unknown interface %s\n", ifname);
+		return false;
+	}
+
+	arbiters.resize(channels.size());
+	for(size_t c = 0; c < channels.size(); ++c)
+	{
+		for(const FeedSpec& spec : channels[c].feeds)
+		{
+			Feed feed;
+			feed.group = spec.group.s_addr;
+			feed.port = htons(spec.port);
+			feed.channel = (int)c;
+			feed.channel_port = channels[c].feeds[0].port;
+			feeds.push_back(feed);
+		}
+	}
+
+	// ETH_P_IP rather than ETH_P_ALL: only the receive path is tapped, so
+	// frames looped back on lo are not seen a second time as outgoing.
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+	if( fd < 0 )
+	{
+		perror("socket(AF_PACKET)");
+		return false;
+	}
+
+	int version = TPACKET_V3;
+	if( setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 )
+	{
+		perror("PACKET_VERSION");
+		return false;
+	}
+
+	// The filter goes on before the ring is bound so nothing else gets in.
+	if( !AttachFilter() )
+		return false;
+
+	tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = block_size;
+	req.tp_block_nr = block_count;
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_frame_nr = (block_size / FRAME_SIZE) * block_count;
+	req.tp_retire_blk_tov = block_timeout_ms;
+	if( setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0 )
+	{
+		perror("PACKET_RX_RING");
+		return false;
+	}
+
+	ring_bytes = (size_t)block_size * block_count;
+	ring = (char*)mmap(0, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd, 0);
+	if( ring == MAP_FAILED )
+		ring = (char*)mmap(0, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if( ring == MAP_FAILED )
+	{
+		ring = 0;
+		perror("mmap");
+		return false;
+	}
+
+	sockaddr_ll addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_IP);
+	addr.sll_ifindex = ifindex;
+	if( bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 )
+	{
+		perror("bind(AF_PACKET)");
+		return false;
+	}
+
+	return JoinGroups(ifindex);
+}
+
+// ether_type == IPv4, protocol == UDP, not a trailing fragment, and the UDP
+// destination port is one of the channel ports.
+bool PacketRingSource::AttachFilter()
+{
+	std::vector<uint16_t> ports;
+	for(const Feed& feed : feeds)
+		ports.push_back(ntohs(feed.port));
+	std::sort(ports.begin(), ports.end());
+	ports.erase(std::unique(ports.begin(), ports.end()), ports.end());
+
+	if( ports.empty() || ports.size() > MAX_FILTER_PORTS )
+	{
+		fprintf(stderr, "ring source needs 1..%d distinct ports\n", MAX_FILTER_PORTS);
+		return false;
+	}
+
+	const int n = (int)ports.size();
+	// Instruction indexes of the two return statements at the end.
+	const int drop = 8 + n;
+	const int accept = drop + 1;
+
+	std::vector<sock_filter> code;
+	code.push_back(bpf_stmt(BPF_LD | BPF_H | BPF_ABS, 12));
+	code.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, drop - 2));
+	code.push_back(bpf_stmt(BPF_LD | BPF_B | BPF_ABS, 23));
+	code.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, drop - 4));
+	code.push_back(bpf_stmt(BPF_LD | BPF_H | BPF_ABS, 20));
+	code.push_back(bpf_jump(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, drop - 6, 0));
+	code.push_back(bpf_stmt(BPF_LDX | BPF_B | BPF_MSH, 14));
+	code.push_back(bpf_stmt(BPF_LD | BPF_H | BPF_IND, 16));
+	for(int i = 0; i < n; ++i)
+		code.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, ports[i], accept - (8 + i) - 1, 0));
+	code.push_back(bpf_stmt(BPF_RET | BPF_K, 0));
+	code.push_back(bpf_stmt(BPF_RET | BPF_K, 0x40000));
+
+	sock_fprog prog;
+	prog.len = (unsigned short)code.size();
+	prog.filter = &code[0];
+	if( setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0 )
+	{
+		perror("SO_ATTACH_FILTER");
+		return false;
+	}
+
+	return true;
+}
+
+// The ring sees traffic only if the interface is subscribed to the groups.
+// Membership is held by plain UDP sockets carrying a drop-everything filter,
+// so the kernel never queues the datagrams a second time for them.
+bool PacketRingSource::JoinGroups(int ifindex)
+{
+	sock_filter drop_all = bpf_stmt(BPF_RET | BPF_K, 0);
+	sock_fprog drop_prog;
+	drop_prog.len = 1;
+	drop_prog.filter = &drop_all;
+
+	for(const Feed& feed : feeds)
+	{
+		int join_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if( join_fd < 0 )
+		{
+			perror("socket");
+			return false;
+		}
+		join_fds.push_back(join_fd);
+
+		setsockopt(join_fd, SOL_SOCKET, SO_ATTACH_FILTER, &drop_prog, sizeof(drop_prog));
+
+		ip_mreqn mreq;
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.imr_multiaddr.s_addr = feed.group;
+		mreq.imr_ifindex = ifindex;
+		if( setsockopt(join_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 && errno != EADDRINUSE )
+		{
+			perror("IP_ADD_MEMBERSHIP");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void PacketRingSource::WalkBlock(tpacket_block_desc* block)
+{
+	uint32_t count = block->hdr.bh1.num_pkts;
+	const tpacket3_hdr* hdr = (const tpacket3_hdr*)((char*)block + block->hdr.bh1.offset_to_first_pkt);
+
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		const char* frame = (const char*)hdr + hdr->tp_mac;
+		int length = (int)hdr->tp_snaplen;
+		const IpHeader* ip_header = (const IpHeader*)frame;
+
+		if( hdr->tp_snaplen != hdr->tp_len )
+			++truncated;
+		else if( length < (int)(sizeof(IpHeader) + sizeof(CmeMsgHeader)) || ip_header->eth.ether_type != htons(ETHERTYPE_IP) || ip_header->ip.ihl != 5 )
+			++malformed;
+		else
+		{
+			for(const Feed& feed : feeds)
+			{
+				if( feed.port != ip_header->udp.dest || feed.group != ip_header->ip.daddr )
+					continue;
+
+				const CmeMsgHeader* msg_header = (const CmeMsgHeader*)(frame + sizeof(IpHeader));
+				if( arbiters[feed.channel].Accept(msg_header->seq_num) )
+				{
+					++packets;
+					parse_packet((int64_t)hdr->tp_sec * 1000000000LL + hdr->tp_nsec, frame, length, feed.channel_port);
+				}
+				break;
+			}
+		}
+
+		hdr = (const tpacket3_hdr*)((const char*)hdr + hdr->tp_next_offset);
+	}
+}
+
+void PacketRingSource::Run(volatile sig_atomic_t& stop)
+{
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLERR;
+
+	while( !stop )
+	{
+		tpacket_block_desc* block = (tpacket_block_desc*)(ring + (size_t)current_block * block_size);
+		if( (__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0 )
+		{
+			++polls;
+			pfd.revents = 0;
+			poll(&pfd, 1, 100);
+			continue;
+		}
+
+		WalkBlock(block);
+		++blocks;
+
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		current_block = (current_block + 1) % block_count;
+	}
+}
+
+void PacketRingSource::PrintStats()
+{
+	tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+	if( getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0 )
+		kernel_drops += stats.tp_drops;
+
+	uint64_t duplicates = 0, gaps = 0, resyncs = 0;
+	for(const FeedArbiter& arbiter : arbiters)
+	{
+		duplicates += arbiter.duplicates;
+		gaps += arbiter.gaps;
+		resyncs += arbiter.resyncs;
+	}
+
+	fprintf(stderr, "ring: %llu packets, %llu truncated, %llu malformed, %llu blocks, %llu polls, %llu kernel drops, %llu duplicates, %llu gaps, %llu resyncs\n",
+			(unsigned long long)packets, (unsigned long long)truncated, (unsigned long long)malformed,
+			(unsigned long long)blocks, (unsigned long long)polls,
+			(unsigned long long)kernel_drops, (unsigned long long)duplicates, (unsigned long long)gaps,
+			(unsigned long long)resyncs);
+}
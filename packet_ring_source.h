@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef _PACKET_RING_SOURCE_H_
+#define _PACKET_RING_SOURCE_H_
+
+#include <linux/if_packet.h>
+#include <signal.h>
+
+#include <vector>
+
+#include "live_source.h"
+
+// Reads raw frames from a memory-mapped AF_PACKET TPACKET_V3 ring and passes
+// them to parse_packet() in place, without copying. A classic BPF program on
+// the socket keeps everything but IPv4/UDP to the channel ports out of the
+// ring, and the kernel retires blocks of many frames at once, so the reader
+// makes one poll() per block rather than one syscall per datagram.
+class PacketRingSource
+{
+public:
+	PacketRingSource(int block_size = 1 << 20, int block_count = 64, int block_timeout_ms = 1);
+	~PacketRingSource();
+
+	bool Open(const char* ifname, const std::vector<ChannelSpec>& channels);
+
+	// Receives until stop becomes non-zero.
+	void Run(volatile sig_atomic_t& stop);
+
+	void PrintStats();
+
+	uint64_t Packets() const { return packets; }
+	uint64_t Polls() const { return polls; }
+
+private:
+	struct Feed
+	{
+		uint32_t group;
+		uint16_t port;
+		int channel;
+		uint16_t channel_port;	// host order, the channel's first feed's
+	};
+
+	bool AttachFilter();
+	bool JoinGroups(int ifindex);
+	void WalkBlock(tpacket_block_desc* block);
+
+	int block_size;
+	int block_count;
+	int block_timeout_ms;
+
+	int fd;
+	char* ring;
+	size_t ring_bytes;
+	int current_block;
+
+	std::vector<Feed> feeds;
+	std::vector<FeedArbiter> arbiters;
+	std::vector<int> join_fds;
+
+	uint64_t packets;
+	// Frames the ring cut short of their wire length.
+	uint64_t truncated;
+	// Frames too short for the headers, or not plain IPv4: another or
+	// VLAN-tagged ethertype, or IP options, which IpHeader does not allow for.
+	uint64_t malformed;
+	uint64_t blocks;
+	uint64_t polls;
+	uint64_t kernel_drops;
+};
+
+#endif // _PACKET_RING_SOURCE_H_
@@ -0,0 +1,257 @@
+#include "perf_profiler.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+
+static const char* STAGE_NAMES[NUM_PERF_STAGES] = { "read", "dispatch", "parse_32", "parse_42", "parse_43", "detectors", "output" };
+static const char* EVENT_NAMES[NUM_PERF_EVENTS] = { "task_ns", "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses" };
+
+static int perf_event_open(perf_event_attr* attr, int group_fd)
+{
+	return (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static void event_attr(PerfEvent event, perf_event_attr& attr)
+{
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	switch(event)
+	{
+	case EVENT_TASK_CLOCK:
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_TASK_CLOCK;
+		break;
+	case EVENT_CYCLES:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case EVENT_INSTRUCTIONS:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case EVENT_L1D_MISSES:
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_L1D
+					| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+					| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	case EVENT_LLC_MISSES:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case EVENT_BRANCH_MISSES:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	case EVENT_DTLB_MISSES:
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB
+					| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+					| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	default:
+		break;
+	}
+}
+
+PerfProfiler::PerfProfiler()
+	: open_count(0)
+	, time_enabled(0)
+	, time_running(0)
+	, depth(0)
+{
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+	{
+		fds[e] = -1;
+		slot[e] = -1;
+		last[e] = 0;
+	}
+	memset(cells, 0, sizeof(cells));
+}
+
+PerfProfiler::~PerfProfiler()
+{
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+	{
+		if( fds[e] >= 0 )
+			close(fds[e]);
+	}
+}
+
+bool PerfProfiler::Start()
+{
+	// The task clock leads the group so there is a group even without a PMU;
+	// the kernel moves it to the hardware context once a hardware event joins.
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+	{
+		perf_event_attr attr;
+		event_attr((PerfEvent)e, attr);
+		if( e == EVENT_TASK_CLOCK )
+		{
+			attr.disabled = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		}
+
+		fds[e] = perf_event_open(&attr, e == EVENT_TASK_CLOCK ? -1 : fds[EVENT_TASK_CLOCK]);
+		if( fds[e] < 0 )
+		{
+			if( e == EVENT_TASK_CLOCK )
+			{
+				perror("perf_event_open");
+				return false;
+			}
+			fprintf(stderr, "perf: %s unavailable\n", EVENT_NAMES[e]);
+			continue;
+		}
+
+		slot[e] = open_count++;
+	}
+
+	ioctl(fds[EVENT_TASK_CLOCK], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fds[EVENT_TASK_CLOCK], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	ReadGroup(last);
+	return true;
+}
+
+bool PerfProfiler::ReadGroup(uint64_t* values)
+{
+	uint64_t buffer[3 + NUM_PERF_EVENTS];
+	ssize_t expected = (3 + open_count) * sizeof(uint64_t);
+	if( read(fds[EVENT_TASK_CLOCK], buffer, sizeof(buffer)) != expected )
+		return false;
+
+	time_enabled = buffer[1];
+	time_running = buffer[2];
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+		values[e] = slot[e] >= 0 ? buffer[3 + slot[e]] : 0;
+	return true;
+}
+
+void PerfProfiler::Charge()
+{
+	uint64_t now[NUM_PERF_EVENTS];
+	if( fds[EVENT_TASK_CLOCK] < 0 || !ReadGroup(now) )
+		return;
+
+	if( depth > 0 && depth <= MAX_DEPTH )
+	{
+		Cell& cell = cells[stack[depth - 1].stage][stack[depth - 1].template_id];
+		for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+			cell.values[e] += now[e] - last[e];
+	}
+
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+		last[e] = now[e];
+}
+
+void PerfProfiler::PrintRow(FILE* out, const char* stage, const char* template_name, const Cell& cell) const
+{
+	fprintf(out, "%-10s %-8s %12llu", stage, template_name, (unsigned long long)cell.calls);
+
+	double calls = cell.calls ? (double)cell.calls : 1.0;
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+	{
+		if( slot[e] < 0 )
+			fprintf(out, " %13s", "-");
+		else
+			fprintf(out, " %13.1f", cell.values[e] / calls);
+	}
+
+	if( slot[EVENT_CYCLES] >= 0 && slot[EVENT_INSTRUCTIONS] >= 0 && cell.values[EVENT_CYCLES] )
+		fprintf(out, " %6.2f", (double)cell.values[EVENT_INSTRUCTIONS] / cell.values[EVENT_CYCLES]);
+	else
+		fprintf(out, " %6s", "-");
+
+	fprintf(out, "\n");
+}
+
+void PerfProfiler::Report(FILE* out) const
+{
+	if( fds[EVENT_TASK_CLOCK] < 0 )
+		return;
+
+	fprintf(out, "\nperf counters, user space, per call (counters running %.1f%% of enabled time)\n",
+			time_enabled ? 100.0 * time_running / time_enabled : 0.0);
+	fprintf(out, "%-10s %-8s %12s", "stage", "template", "calls");
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+		fprintf(out, " %13s", EVENT_NAMES[e]);
+	fprintf(out, " %6s\n", "ipc");
+
+	Cell total;
+	memset(&total, 0, sizeof(total));
+
+	for(int s = 0; s < NUM_PERF_STAGES; ++s)
+	{
+		Cell stage_total;
+		memset(&stage_total, 0, sizeof(stage_total));
+
+		for(int t = 0; t < MAX_TEMPLATES; ++t)
+		{
+			const Cell& cell = cells[s][t];
+			stage_total.calls += cell.calls;
+			for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+				stage_total.values[e] += cell.values[e];
+		}
+
+		if( stage_total.calls == 0 )
+			continue;
+
+		PrintRow(out, STAGE_NAMES[s], "all", stage_total);
+
+		for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+			total.values[e] += stage_total.values[e];
+	}
+
+	fprintf(out, "\n");
+	for(int s = 0; s < NUM_PERF_STAGES; ++s)
+	{
+		for(int t = 0; t < MAX_TEMPLATES; ++t)
+		{
+			if( cells[s][t].calls == 0 )
+				continue;
+
+			char template_name[16];
+			if( t == 0 )
+				snprintf(template_name, sizeof(template_name), "-");
+			else
+				snprintf(template_name, sizeof(template_name), "%d", t);
+			PrintRow(out, STAGE_NAMES[s], template_name, cells[s][t]);
+		}
+	}
+
+	// Totals per template across stages, per message dispatched.
+	fprintf(out, "\n");
+	for(int t = 1; t < MAX_TEMPLATES; ++t)
+	{
+		Cell template_total;
+		memset(&template_total, 0, sizeof(template_total));
+		template_total.calls = cells[STAGE_DISPATCH][t].calls;
+
+		for(int s = 0; s < NUM_PERF_STAGES; ++s)
+		{
+			for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+				template_total.values[e] += cells[s][t].values[e];
+		}
+
+		if( template_total.calls == 0 )
+			continue;
+
+		char template_name[16];
+		snprintf(template_name, sizeof(template_name), "%d", t);
+		PrintRow(out, "template", template_name, template_total);
+	}
+
+	fprintf(out, "\ntotal");
+	for(int e = 0; e < NUM_PERF_EVENTS; ++e)
+	{
+		if( slot[e] >= 0 )
+			fprintf(out, " %s=%llu", EVENT_NAMES[e], (unsigned long long)total.values[e]);
+	}
+	fprintf(out, "\n");
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef _PERF_PROFILER_H_
+#define _PERF_PROFILER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum PerfStage
+{
+	STAGE_READ,			// capture reader, per frame
+	STAGE_DISPATCH,		// message framing and template switch
+	STAGE_PARSE_32,
+	STAGE_PARSE_42,
+	STAGE_PARSE_43,
+	STAGE_DETECTORS,	// end-of-event sweep, stop and iceberg checks
+	STAGE_OUTPUT,		// writing signals and results
+	NUM_PERF_STAGES
+};
+
+enum PerfEvent
+{
+	EVENT_TASK_CLOCK,
+	EVENT_CYCLES,
+	EVENT_INSTRUCTIONS,
+	EVENT_L1D_MISSES,
+	EVENT_LLC_MISSES,
+	EVENT_BRANCH_MISSES,
+	EVENT_DTLB_MISSES,
+	NUM_PERF_EVENTS
+};
+
+// Hardware counter profile of the parse pipeline, collected with
+// perf_event_open on the calling thread (user space only).
+//
+// Stages nest: Enter() and Exit() each read the counter group once and
+// charge what accumulated since the previous read to the innermost open
+// stage, so every stage reports its own cost excluding the stages it calls.
+// Costs are kept per stage and per template id of the message being
+// processed.
+//
+// Counters the kernel or hardware does not provide (e.g. in VMs without a
+// virtual PMU) are reported as unavailable; the task clock is a software
+// event and is always present. Every transition is a read() system call, so
+// the profile is for comparing stages against each other rather than for
+// absolute throughput.
+class PerfProfiler
+{
+public:
+	static constexpr const int MAX_TEMPLATES = 64;
+	static constexpr const int MAX_DEPTH = 8;
+
+	PerfProfiler();
+	~PerfProfiler();
+
+	// Opens the counter group and starts counting.
+	bool Start();
+
+	void Enter(PerfStage stage, uint16_t template_id)
+	{
+		Charge();
+		if( depth < MAX_DEPTH )
+		{
+			stack[depth].stage = stage;
+			stack[depth].template_id = template_id < MAX_TEMPLATES ? template_id : 0;
+			++cells[stage][stack[depth].template_id].calls;
+		}
+		++depth;
+	}
+
+	void Exit()
+	{
+		Charge();
+		--depth;
+	}
+
+	// Writes the per-stage and per-stage/template tables.
+	void Report(FILE* out) const;
+
+private:
+	struct Cell
+	{
+		uint64_t calls;
+		uint64_t values[NUM_PERF_EVENTS];
+	};
+
+	struct Frame
+	{
+		PerfStage stage;
+		uint16_t template_id;
+	};
+
+	void Charge();
+	bool ReadGroup(uint64_t* values);
+	void PrintRow(FILE* out, const char* stage, const char* template_name, const Cell& cell) const;
+
+	int fds[NUM_PERF_EVENTS];
+	int slot[NUM_PERF_EVENTS];	// position in the group read, -1 if not opened
+	int open_count;
+
+	uint64_t last[NUM_PERF_EVENTS];
+	uint64_t time_enabled;
+	uint64_t time_running;
+
+	Frame stack[MAX_DEPTH];
+	int depth;
+
+	Cell cells[NUM_PERF_STAGES][MAX_TEMPLATES];
+};
+
+#endif // _PERF_PROFILER_H_
@@ -0,0 +1,160 @@
+#pragma once
+
+#ifndef _PRICE_SCALE_H_
+#define _PRICE_SCALE_H_
+
+#include <stdint.h>
+
+// Signed division by a positive divisor known only at run time, as a
+// multiply and shift (Granlund and Montgomery): with l = ceil(log2 d) and
+// magic = floor(2^(63 + l) / d) + 1, which fits in 64 bits,
+//
+//   n / d == (magic * n) >> (63 + l) == high64(magic * 2n) >> l
+//
+// for 0 <= n < 2^63, so one multiply and one shift of under 64 bits, also
+// for d = 1. The quotient of |x| takes x's sign back, so results truncate
+// toward zero like the / operator for every int64_t but INT64_MIN.
+class Divider
+{
+public:
+	Divider()
+	{
+		Set(1);
+	}
+
+	explicit Divider(int64_t divisor)
+	{
+		Set(divisor);
+	}
+
+	// Divisors below 1 divide by 1.
+	void Set(int64_t divisor)
+	{
+		this->divisor = divisor > 0 ? divisor : 1;
+
+		int l = 0;
+		while( l < 63 && ((int64_t)1 << l) < this->divisor )
+			++l;
+
+		shift = l;
+		magic = (uint64_t)(((unsigned __int128)1 << (63 + l)) / (uint64_t)this->divisor) + 1;
+	}
+
+	int64_t Divide(int64_t x) const
+	{
+		uint64_t sign = (uint64_t)(x >> 63);
+		uint64_t n = ((uint64_t)x ^ sign) - sign;
+		uint64_t q = (uint64_t)(((unsigned __int128)magic * (n << 1)) >> 64) >> shift;
+		return (int64_t)((q ^ sign) - sign);
+	}
+
+	int64_t Divisor() const { return divisor; }
+
+private:
+	uint64_t magic;
+	int shift;
+	int64_t divisor;
+};
+
+// Division by a divisor known at compile time; the compiler emits its own
+// multiply and shift.
+template<int64_t D>
+struct ConstDivider
+{
+	static_assert(D > 0, "divisor must be positive");
+
+	static constexpr int64_t Divide(int64_t x) { return x / D; }
+	static constexpr int64_t Divisor() { return D; }
+};
+
+// A price of one instrument as sent on the wire, and the same price in the
+// exchange's units (see PriceScale). The conversions and the indexes keyed
+// by price take these, so the two cannot be passed for each other; the
+// value is read out where a price is stored or printed.
+struct WirePrice
+{
+	int64_t value;
+
+	constexpr WirePrice() : value(0) {}
+	constexpr explicit WirePrice(int64_t value) : value(value) {}
+
+	constexpr bool operator==(WirePrice other) const { return value == other.value; }
+	constexpr bool operator!=(WirePrice other) const { return value != other.value; }
+};
+
+struct CleanPrice
+{
+	int64_t value;
+
+	constexpr CleanPrice() : value(0) {}
+	constexpr explicit CleanPrice(int64_t value) : value(value) {}
+
+	constexpr bool operator==(CleanPrice other) const { return value == other.value; }
+	constexpr bool operator!=(CleanPrice other) const { return value != other.value; }
+};
+
+// Price units of one instrument:
+//
+//   wire    prices as sent, clean * price_shift
+//   clean   the exchange's price; what the CSV outputs print
+//   tick    clean / tick_size, the index of volume-at-price
+//
+// Conversions down the list divide, by multiplying with reciprocals
+// computed once per instrument. Instruments without a tick size have their
+// clean prices as tick index.
+//
+// Every conversion takes the same instructions whatever the scale: the
+// trades of a feed alternate between instruments of different scales, and
+// picking a constant-divisor path per price mispredicts more than the
+// multiply costs (see bench/price_scale_bench). FixedPriceScale is for code
+// that knows its product's scale at compile time.
+class PriceScale
+{
+public:
+	PriceScale()
+	{
+		Set(1, 1);
+	}
+
+	PriceScale(int64_t price_shift, int64_t tick_size)
+	{
+		Set(price_shift, tick_size);
+	}
+
+	void Set(int64_t price_shift, int64_t tick_size)
+	{
+		shift_divider.Set(price_shift);
+		tick_divider.Set(tick_size);
+		this->tick_size = tick_size;
+	}
+
+	CleanPrice Clean(WirePrice wire) const { return CleanPrice(shift_divider.Divide(wire.value)); }
+	WirePrice Wire(CleanPrice clean) const { return WirePrice(clean.value * shift_divider.Divisor()); }
+
+	int64_t Tick(CleanPrice clean) const { return tick_divider.Divide(clean.value); }
+	CleanPrice FromTick(int64_t tick) const { return CleanPrice(tick * tick_divider.Divisor()); }
+
+	int64_t PriceShift() const { return shift_divider.Divisor(); }
+	int64_t TickSize() const { return tick_size; }		// as defined, 0 if none
+
+private:
+	Divider shift_divider;
+	Divider tick_divider;
+	int64_t tick_size;
+};
+
+// PriceScale of a product whose scale is known at compile time, such as the
+// 10^7 of most futures and spreads.
+template<int64_t PriceShift, int64_t TickSize = 1>
+struct FixedPriceScale
+{
+	static constexpr CleanPrice Clean(WirePrice wire) { return CleanPrice(ConstDivider<PriceShift>::Divide(wire.value)); }
+	static constexpr WirePrice Wire(CleanPrice clean) { return WirePrice(clean.value * PriceShift); }
+
+	static constexpr int64_t Tick(CleanPrice clean) { return ConstDivider<TickSize>::Divide(clean.value); }
+	static constexpr CleanPrice FromTick(int64_t tick) { return CleanPrice(tick * TickSize); }
+};
+
+static_assert(FixedPriceScale<10000000, 25>::Tick(FixedPriceScale<10000000, 25>::Clean(WirePrice(-12345670000000))) == -49382, "truncates toward zero");
+
+#endif // _PRICE_SCALE_H_
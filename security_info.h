@@ -3,7 +3,12 @@
 #ifndef _SECURITY_INFO_H_
 #define _SECURITY_INFO_H_
 
+#include "arena.h"
 #include "cme_book.h"
+#include "bar_aggregator.h"
+#include "book_sampler.h"
+#include "order_fills.h"
+#include "price_scale.h"
 #include <map>
 #include <utility>
 
@@ -47,9 +52,14 @@ struct Iceberg
 
 	bool is_bid;
 
-	std::map<uint64_t, int> order_ids;
+	ArenaMap<uint64_t, int> order_ids;
 };
 
+template<>
+struct ArenaResettable<Iceberg> : ArenaMembers<Iceberg,
+	decltype(Iceberg::ts), decltype(Iceberg::price), decltype(Iceberg::total_traded), decltype(Iceberg::show_quantity),
+	decltype(Iceberg::is_bid), decltype(Iceberg::order_ids)> {};
+
 struct bid_side
 {
 	typedef std::greater<int64_t> PriceCmp;
@@ -70,8 +80,8 @@ struct IcebergInfo
 
 	Trade highestTrade;
 
-	std::vector<Iceberg> icebergs;
-	std::map<int64_t, Iceberg, typename SideType::PriceCmp> open_icebergs;
+	ArenaVector<Iceberg> icebergs;
+	ArenaMap<int64_t, Iceberg, typename SideType::PriceCmp> open_icebergs;
 
 	bool in_iceberg;
 	bool is_buy;
@@ -84,6 +94,9 @@ struct IcebergInfo
 
 	bool CheckIceberg(int64_t ts, Iceberg* currentIceberg)
 	{
+		if( outrights.levels.empty() )
+			return false;
+
 		bool is_iceberg = (highestTrade.quantity != 0)
 						& (highestTrade.price == prevTopLevel.price)
 						& (highestTrade.quantity >= prevTopLevel.quantity)
@@ -161,9 +174,26 @@ struct StopsInfo
 	int64_t ts;
 
 	int64_t first_price;
-	std::vector<StopsTrade> trades;	
+	ArenaVector<StopsTrade> trades;
+
+	StopsInfo()
+		: ts(0)
+		, first_price(0)
+	{
+	}
 };
 
+template<typename SideType>
+struct ArenaResettable<IcebergInfo<SideType> > : ArenaMembers<IcebergInfo<SideType>,
+	decltype(IcebergInfo<SideType>::implieds), decltype(IcebergInfo<SideType>::outrights),
+	decltype(IcebergInfo<SideType>::prevTopLevel), decltype(IcebergInfo<SideType>::highestTrade),
+	decltype(IcebergInfo<SideType>::icebergs), decltype(IcebergInfo<SideType>::open_icebergs),
+	decltype(IcebergInfo<SideType>::in_iceberg), decltype(IcebergInfo<SideType>::is_buy)> {};
+
+template<>
+struct ArenaResettable<StopsInfo> : ArenaMembers<StopsInfo,
+	decltype(StopsInfo::ts), decltype(StopsInfo::first_price), decltype(StopsInfo::trades)> {};
+
 struct SweepInfo
 {
 	int64_t exchangeTime;
@@ -185,6 +215,7 @@ struct SweepInfo
 	int minDepth;
 
 	SweepInfo()
+		: minDepth(0)
 	{
 		Clear();
 	}
@@ -206,16 +237,27 @@ struct SweepInfo
 };
 
 
+// Everything a SecurityInfo owns is held inline or allocated from the
+// thread's arena (ArenaVector, ArenaMap and the indexes built on them).
+// With a page-backed arena ResetState() drops SecurityInfos without running
+// their destructors, so a member owning heap memory of its own (std::vector,
+// std::string, a pointer to something newed) would leak at every reset. The
+// static_assert below holds this: a new member goes in its ArenaResettable
+// list, and one that is not trivially destructible or arena-allocated fails
+// to compile.
 struct SecurityInfo
 {
 	CmeBook book;
 	bool dirty;
 	int32_t sec_id;
-	std::string symbol;
+	uint32_t index;		// dense registry index
+	const char* symbol;	// the registry entry's
 
 	// Stops
 	StopsInfo stops_info;
-	std::vector<StopsInfo> all_stops;
+	ArenaVector<StopsInfo> all_stops;
+	OrderFillIndex order_fills;
+	StopPriceIndex stop_prices;
 
 	// Icebergs
 	IcebergInfo<bid_side> buy_icebergs;
@@ -223,18 +265,32 @@ struct SecurityInfo
 
 	SweepInfo sweep_info;
 
-	int64_t tick_size;
-	int64_t price_shift;
+	// OHLCV bars and volume-at-price
+	SecurityBars bars;
+
+	// Top levels as last written by the book sampler
+	SampledBook sampled_book;
+
+	// Slot in the shared-memory book region, -1 until first published
+	int32_t shm_slot;
+
+	// Dense index in the event journal, -1 until first written
+	int32_t journal_index;
+
+	// Wire, clean and tick price conversions
+	PriceScale scale;
 	bool traded_locally;
 	bool inside_change;
 
-	int64_t CleanPrice(int64_t packet_price)
+	int64_t CleanPrice(int64_t packet_price) const
 	{
-		return packet_price /= price_shift;
+		return scale.Clean(WirePrice(packet_price)).value;
 	}
 
 	SecurityInfo()
 		: dirty(false)
+		, shm_slot(-1)
+		, journal_index(-1)
 		, traded_locally(false)
 		, inside_change(false)
 		, buy_icebergs(true)
@@ -243,4 +299,17 @@ struct SecurityInfo
 	}
 };
 
+template<>
+struct ArenaResettable<SecurityInfo> : ArenaMembers<SecurityInfo,
+	decltype(SecurityInfo::book), decltype(SecurityInfo::dirty), decltype(SecurityInfo::sec_id),
+	decltype(SecurityInfo::index), decltype(SecurityInfo::symbol),
+	decltype(SecurityInfo::stops_info), decltype(SecurityInfo::all_stops), decltype(SecurityInfo::order_fills),
+	decltype(SecurityInfo::stop_prices),
+	decltype(SecurityInfo::buy_icebergs), decltype(SecurityInfo::sell_icebergs),
+	decltype(SecurityInfo::sweep_info), decltype(SecurityInfo::bars), decltype(SecurityInfo::sampled_book),
+	decltype(SecurityInfo::shm_slot), decltype(SecurityInfo::journal_index), decltype(SecurityInfo::scale),
+	decltype(SecurityInfo::traded_locally), decltype(SecurityInfo::inside_change)> {};
+
+static_assert(ArenaResettable<SecurityInfo>::value, "SecurityInfo must not own memory outside the arena");
+
 #endif // _SECURITY_INFO_H_
@@ -0,0 +1,147 @@
+// Parses a capture written by cme_capgen and checks the sweeps, icebergs and
+// stops CSV files against its ground truth: every row is complete and ends
+// its line with as many fields as its header, the side column is B or S,
+// and each file reports exactly the events the generator embedded.
+
+#include "cme_parser.h"
+#include "capture_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void fail(const std::string& what)
+{
+	if( failures++ < 20 )
+		fprintf(stderr, "FAIL: %s\n", what.c_str());
+}
+
+static std::vector<std::string> split_csv(const std::string& line)
+{
+	std::vector<std::string> fields;
+	std::stringstream ss(line);
+	std::string field;
+	while( getline(ss, field, ',') )
+		fields.push_back(field);
+	return fields;
+}
+
+// Reads the data rows of path, checking each has columns fields and, if
+// side_column >= 0, a side of B or S there.
+static std::vector<std::vector<std::string> > read_rows(const std::string& path, size_t columns, int side_column)
+{
+	std::vector<std::vector<std::string> > rows;
+	std::ifstream in(path.c_str());
+	std::string line;
+	if( !getline(in, line) )
+	{
+		fail(path + ": no header");
+		return rows;
+	}
+	if( split_csv(line).size() != columns )
+		fail(path + ": header has " + std::to_string(split_csv(line).size()) + " columns, expected " + std::to_string(columns));
+
+	while( getline(in, line) )
+	{
+		std::vector<std::string> fields = split_csv(line);
+		if( fields.size() != columns )
+		{
+			fail(path + ": row with " + std::to_string(fields.size()) + " fields: " + line.substr(0, 120));
+			continue;
+		}
+		if( side_column >= 0 && fields[side_column] != "B" && fields[side_column] != "S" )
+		{
+			fail(path + ": bad side '" + fields[side_column] + "'");
+			continue;
+		}
+		rows.push_back(fields);
+	}
+	return rows;
+}
+
+static void compare(const char* name, const std::set<std::string>& truth, const std::set<std::string>& detected)
+{
+	for(const std::string& key : truth)
+	{
+		if( !detected.count(key) )
+			fail(std::string(name) + " missed: " + key);
+	}
+	for(const std::string& key : detected)
+	{
+		if( !truth.count(key) )
+			fail(std::string(name) + " not in the truth: " + key);
+	}
+	printf("%-8s truth=%zu detected=%zu\n", name, truth.size(), detected.size());
+}
+
+int main(int argc, char** argv)
+{
+	if( argc != 4 )
+	{
+		fprintf(stderr, "usage: %s <capture> <truth.csv> <out dir>\n", argv[0]);
+		return 2;
+	}
+
+	std::cout.rdbuf(0);
+	LoadSecInfo();
+
+	std::string out_dir = argv[3];
+	std::string sweeps_path = out_dir + "/test_sweeps.csv";
+	std::string icebergs_path = out_dir + "/test_icebergs.csv";
+	std::string stops_path = out_dir + "/test_stops.csv";
+	OpenOutputs(sweeps_path.c_str(), icebergs_path.c_str(), stops_path.c_str());
+
+	CaptureReader reader;
+	if( !reader.Open(argv[1]) )
+	{
+		perror(argv[1]);
+		return 2;
+	}
+
+	int64_t ts;
+	const char* frame;
+	int length;
+	while( reader.Next(ts, frame, length) )
+		parse_packet(ts, frame, length);
+
+	WriteResults();
+	CloseOutputs();
+
+	std::set<std::string> sweeps_truth, icebergs_truth, stops_truth;
+	for(const std::vector<std::string>& f : read_rows(argv[2], 6, 4))
+	{
+		if( f[0] == "sweep" )
+			sweeps_truth.insert(time_to_str(atoll(f[1].c_str())) + "|" + f[2]);
+		else if( f[0] == "iceberg" )
+			icebergs_truth.insert(f[2] + "|" + f[3] + "|" + f[4]);
+		else if( f[0] == "stop" )
+			stops_truth.insert(f[2] + "|" + f[5] + "|" + f[3] + "|" + f[4]);
+	}
+
+	std::set<std::string> sweeps, icebergs, stops;
+	for(const std::vector<std::string>& f : read_rows(sweeps_path, 6, -1))
+		sweeps.insert(f[0] + "|" + f[1]);
+	for(const std::vector<std::string>& f : read_rows(icebergs_path, 6, 5))
+		icebergs.insert(f[1] + "|" + f[2] + "|" + f[5]);
+	for(const std::vector<std::string>& f : read_rows(stops_path, 9, 8))
+		stops.insert(f[2] + "|" + f[3] + "|" + f[4] + "|" + f[8]);
+
+	compare("sweeps", sweeps_truth, sweeps);
+	compare("icebergs", icebergs_truth, icebergs);
+	compare("stops", stops_truth, stops);
+
+	if( failures )
+	{
+		fprintf(stderr, "%d failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
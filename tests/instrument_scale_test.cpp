@@ -0,0 +1,81 @@
+// Checks DeriveScale() against rows of cme_ids.txt: the scale derived from
+// an instrument's definition must be the one the cache has for it, or prices
+// of the same instrument would differ with and without the cache.
+
+#include "instrument_registry.h"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+struct DefinitionScale
+{
+	const char* symbol;
+	int32_t sec_id;
+	int64_t min_price_increment;	// 1e-9 units, as on the wire
+	int64_t display_factor;			// 1e-9 units, as on the wire
+};
+
+// MinPriceIncrement and DisplayFactor of the instruments' CME definitions.
+static const DefinitionScale definitions[] =
+{
+	{ "GCJ9", 14651, 100000000, 100000000 },		// 0.1 at 0.1
+	{ "6EH9", 1191, 50000, 100000 },				// 0.00005 at 0.0001
+	{ "CLH9", 79323, 10000000, 10000000 },			// 0.01 at 0.01
+	{ "ZBH8", 333069, 31250000, 1000000000 },		// 1/32 at 1
+	{ "ZCN8", 750748, 250000000, 1000000000 },		// 0.25 at 1
+};
+
+static void check(const char* what, int64_t price_shift, int64_t tick_size, int64_t expected_shift, int64_t expected_tick)
+{
+	if( price_shift != expected_shift || tick_size != expected_tick )
+	{
+		++failures;
+		fprintf(stderr, "FAIL: %s derived %lld,%lld, expected %lld,%lld\n", what,
+				(long long)price_shift, (long long)tick_size, (long long)expected_shift, (long long)expected_tick);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* ids = argc > 1 ? argv[1] : "cme_ids.txt";
+
+	InstrumentRegistry registry;
+	if( !registry.LoadCache(ids) )
+	{
+		fprintf(stderr, "cannot load %s\n", ids);
+		return 1;
+	}
+
+	for(const DefinitionScale& definition : definitions)
+	{
+		const InstrumentDef* cached = registry.Find(definition.sec_id);
+		if( !cached )
+		{
+			++failures;
+			fprintf(stderr, "FAIL: %s (%d) not in %s\n", definition.symbol, definition.sec_id, ids);
+			continue;
+		}
+
+		int64_t price_shift, tick_size;
+		DeriveScale(definition.min_price_increment, definition.display_factor, price_shift, tick_size);
+		check(definition.symbol, price_shift, tick_size, cached->price_shift, cached->tick_size);
+	}
+
+	// Without a display factor the increment is split as it is.
+	int64_t price_shift, tick_size;
+	DeriveScale(250000000, 0, price_shift, tick_size);
+	check("no display factor", price_shift, tick_size, 10000000, 25);
+
+	DeriveScale(0, 10000000, price_shift, tick_size);
+	check("no increment", price_shift, tick_size, 1, 1);
+
+	if( failures )
+	{
+		fprintf(stderr, "%d failures\n", failures);
+		return 1;
+	}
+
+	printf("%zu cache rows match\n", sizeof(definitions) / sizeof(definitions[0]));
+	return 0;
+}
@@ -0,0 +1,69 @@
+// Checks that VolumeAtPrice keeps its arrays bounded when a trade prints far
+// from the others, and still reports every tick's volume once, in order.
+
+#include "bar_aggregator.h"
+
+#include <stdio.h>
+
+#include <map>
+#include <utility>
+
+static int failures = 0;
+
+static void fail(const char* what)
+{
+	++failures;
+	fprintf(stderr, "FAIL: %s\n", what);
+}
+
+int main()
+{
+	VolumeAtPrice vap;
+	std::map<int64_t, std::pair<int64_t, int64_t> > expected;
+
+	auto add = [&](int64_t tick, int32_t qty, int side)
+	{
+		vap.Add(tick, qty, side);
+		if( side == 1 )
+			expected[tick].first += qty;
+		else
+			expected[tick].second += qty;
+	};
+
+	// Trading around 100000, a bad print at a billion and one far below,
+	// then the range widens until it takes in ticks once out of reach.
+	for(int64_t i = 0; i < 1000; ++i)
+		add(100000 + i % 200, 1 + i % 3, 1 + i % 2);
+	add(1000000000, 5, 1);
+	add(-1000000000, 7, 2);
+	add(100000 + VolumeAtPrice::MAX_TICKS, 3, 1);
+	add(100000 - VolumeAtPrice::MAX_TICKS / 4, 2, 2);
+	add(INT64_MAX / 2, 1, 1);
+
+	if( (int64_t)vap.buy.size() > VolumeAtPrice::MAX_TICKS || vap.sell.size() != vap.buy.size() )
+		fail("arrays grew past MAX_TICKS");
+	if( vap.outliers.empty() )
+		fail("no trade went to the outliers");
+
+	std::map<int64_t, std::pair<int64_t, int64_t> > seen;
+	int64_t previous = INT64_MIN;
+	bool ordered = true;
+	vap.ForEach([&](int64_t tick, int64_t buy, int64_t sell)
+	{
+		if( tick <= previous )
+			ordered = false;
+		previous = tick;
+		seen[tick] = std::make_pair(buy, sell);
+	});
+
+	if( !ordered )
+		fail("ticks not visited once each in order");
+	if( seen != expected )
+		fail("volumes differ from the trades added");
+
+	if( failures )
+		return 1;
+
+	printf("%zu ticks, %zu outliers, %zu array ticks\n", seen.size(), vap.outliers.size(), vap.buy.size());
+	return 0;
+}
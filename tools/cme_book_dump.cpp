@@ -0,0 +1,63 @@
+// Prints a book sample file written by cme_parser --book as CSV, one line
+// per sampled security with its bid and ask levels, best first.
+
+#include "cme_parser.h"
+#include "book_sampler.h"
+
+#include <stdio.h>
+
+#include <string>
+
+int main(int argc, char** argv)
+{
+	if( argc != 2 )
+	{
+		fprintf(stderr, "usage: %s <book samples>\n", argv[0]);
+		return 1;
+	}
+
+	BookSampleReader reader;
+	if( !reader.Open(argv[1]) )
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	int depth = reader.Header().depth;
+
+	printf("ts,sec_id");
+	for(int s = 0; s < NUM_SAMPLE_SIDES; ++s)
+	{
+		const char* side = s == SAMPLE_BIDS ? "bid" : "ask";
+		for(int i = 1; i <= depth; ++i)
+			printf(",%s_price_%d,%s_qty_%d,%s_orders_%d", side, i, side, i, side, i);
+	}
+	printf("\n");
+
+	BookSampleRow row;
+	while( reader.Next(row) )
+	{
+		printf("%s,%d", time_to_str(row.ts).c_str(), row.sec_id);
+		for(int s = 0; s < NUM_SAMPLE_SIDES; ++s)
+		{
+			for(int i = 0; i < depth; ++i)
+			{
+				if( i < row.book->count[s] )
+				{
+					const CmeLevel& level = row.book->levels[s][i];
+					printf(",%lld,%d,%d", (long long)level.price, level.quantity, level.orders);
+				}
+				else
+					printf(",,,");
+			}
+		}
+		printf("\n");
+	}
+
+	if( !reader.Ok() )
+	{
+		fprintf(stderr, "%s: corrupt or truncated\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,897 @@
+// Generates synthetic MDP3 captures for benchmarks and detector checks.
+//
+// Instruments are sampled from cme_ids.txt. Every instrument starts with a
+// ten level book on each side and then receives a random mix of book updates
+// (template 32 with matching order book entries in template 43) and trades
+// (template 42 with the order-id group). Sweeps, iceberg refills and stop
+// cascades are embedded at configurable rates, and each one is written to a
+// ground truth CSV:
+//
+//     type,ts,symbol,price,side,order_id
+//
+// with ts the capture time of the event's first packet, price in clean units
+// (wire price / price_shift) and side the aggressor side for sweeps and the
+// resting side for icebergs.
+//
+// With --definitions 1 the capture starts with an instrument definition
+// (template 54, or 56 with its legs for spreads) for every instrument, so
+// it can be parsed without cme_ids.txt.
+
+#include "capture_file.h"
+#include "cme_book.h"
+#include "cme_parser.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static constexpr const int BOOK_DEPTH = 10;
+static constexpr const int MAX_PAYLOAD = 1400;
+static constexpr const uint16_t BLOCK_LENGTH = 11;
+static constexpr const uint16_t SCHEMA_ID = 1;
+static constexpr const uint16_t SCHEMA_VERSION = 9;
+static constexpr const int BOOK_ENTRY_SIZE = 32;
+static constexpr const int TRADE_ENTRY_SIZE = 32;
+static constexpr const int ORDER_ENTRY_SIZE = 16;
+static constexpr const int BOOK_ORDER_ENTRY_SIZE = 40;
+static constexpr const uint16_t FUTURE_DEFINITION_LENGTH = 224;
+static constexpr const uint16_t SPREAD_DEFINITION_LENGTH = 195;
+static constexpr const int LEG_ENTRY_SIZE = 18;
+
+enum BurstProfile
+{
+	PROFILE_STEADY,
+	PROFILE_OPEN,
+	PROFILE_BURSTY
+};
+
+struct Instrument
+{
+	std::string symbol;
+	int32_t sec_id;
+	int64_t price_shift;
+	int64_t tick;
+
+	// Clean prices, best first.
+	std::vector<CmeLevel> bids;
+	std::vector<CmeLevel> asks;
+
+	uint32_t rpt_seq;
+
+	// Spread legs from the symbol, e.g. ESZ7-ESZ8 buys ESZ7 and sells ESZ8;
+	// empty for outrights or legs missing from the universe.
+	std::vector<int32_t> legs;
+};
+
+struct Options
+{
+	const char* out_path;
+	const char* truth_path;
+	const char* ids_path;
+	bool pcap;
+	bool definitions;
+	int instruments;
+	uint64_t events;
+	uint64_t seed;
+	double rate;
+	BurstProfile profile;
+	double sweep_rate;
+	double iceberg_rate;
+	double stop_rate;
+	double trade_rate;
+	int64_t start_time;
+	uint32_t group;
+	uint16_t port;
+
+	Options()
+		: out_path(0)
+		, truth_path(0)
+		, ids_path("cme_ids.txt")
+		, pcap(false)
+		, definitions(false)
+		, instruments(100)
+		, events(1000000)
+		, seed(1)
+		, rate(20000)
+		, profile(PROFILE_STEADY)
+		, sweep_rate(0.01)
+		, iceberg_rate(0.005)
+		, stop_rate(0.003)
+		, trade_rate(0.15)
+		, start_time(1546435800LL * 1000000000LL)
+		, group(0)
+		, port(14310)
+	{
+	}
+};
+
+class Generator
+{
+public:
+	Generator(const Options& options)
+		: options(options)
+		, rng(options.seed)
+		, seq_num(0)
+		, next_order_id(1000000000ULL)
+		, clock(options.start_time)
+		, burst_left(0)
+		, event_index(0)
+	{
+	}
+
+	bool Open()
+	{
+		if( !LoadInstruments() )
+			return false;
+
+		if( !writer.Open(options.out_path, options.pcap) )
+		{
+			perror(options.out_path);
+			return false;
+		}
+
+		if( options.truth_path )
+		{
+			truth.open(options.truth_path);
+			truth << "type,ts,symbol,price,side,order_id\n";
+		}
+
+		return true;
+	}
+
+	void Run()
+	{
+		if( options.definitions )
+		{
+			for(const Instrument& inst : instruments)
+				Definition(inst);
+		}
+
+		for(Instrument& inst : instruments)
+			InitialBook(inst);
+
+		for(event_index = 0; event_index < options.events; ++event_index)
+		{
+			Advance();
+
+			Instrument& inst = instruments[Uniform(0, (int)instruments.size() - 1)];
+			double r = Real();
+			if( r < options.stop_rate )
+				StopCascade(inst);
+			else if( (r -= options.stop_rate) < options.iceberg_rate )
+				IcebergHits(inst);
+			else if( (r -= options.iceberg_rate) < options.sweep_rate )
+				Trade(inst, Uniform(2, 4), 0);
+			else if( (r -= options.sweep_rate) < options.trade_rate )
+				Trade(inst, 1, 0);
+			else
+				QuoteUpdate(inst);
+		}
+
+		fprintf(stderr, "%llu events, %u packets, %d instruments\n",
+				(unsigned long long)options.events, seq_num, (int)instruments.size());
+	}
+
+private:
+	int Uniform(int lo, int hi)
+	{
+		return std::uniform_int_distribution<int>(lo, hi)(rng);
+	}
+
+	double Real()
+	{
+		return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+	}
+
+	bool LoadInstruments()
+	{
+		std::ifstream id_file(options.ids_path);
+		if( !id_file )
+		{
+			perror(options.ids_path);
+			return false;
+		}
+
+		std::vector<Instrument> all;
+		std::string line;
+		while( getline(id_file, line) )
+		{
+			std::string::size_type symbol_idx = line.find(',');
+			std::string::size_type exchange_id_idx = line.find(',', symbol_idx + 1);
+			std::string::size_type tick_size_idx = line.find(',', exchange_id_idx + 1);
+			if( symbol_idx == std::string::npos || exchange_id_idx == std::string::npos || tick_size_idx == std::string::npos )
+				continue;
+
+			Instrument inst;
+			inst.symbol = line.substr(0, symbol_idx);
+			inst.sec_id = atoi(line.c_str() + symbol_idx + 1);
+			inst.price_shift = atoll(line.c_str() + exchange_id_idx + 1);
+			inst.tick = atoll(line.c_str() + tick_size_idx + 1);
+			inst.rpt_seq = 0;
+			if( inst.tick <= 0 || inst.price_shift <= 0 )
+				continue;
+			all.push_back(inst);
+		}
+
+		std::map<std::string, int32_t> by_symbol;
+		for(const Instrument& inst : all)
+			by_symbol[inst.symbol] = inst.sec_id;
+
+		for(Instrument& inst : all)
+		{
+			std::string::size_type dash = inst.symbol.find('-');
+			if( dash == std::string::npos )
+				continue;
+
+			auto buy_leg = by_symbol.find(inst.symbol.substr(0, dash));
+			auto sell_leg = by_symbol.find(inst.symbol.substr(dash + 1));
+			if( buy_leg != by_symbol.end() && sell_leg != by_symbol.end() )
+			{
+				inst.legs.push_back(buy_leg->second);
+				inst.legs.push_back(sell_leg->second);
+			}
+		}
+
+		std::shuffle(all.begin(), all.end(), rng);
+		std::vector<int32_t> seen;
+		for(const Instrument& inst : all)
+		{
+			if( (int)instruments.size() >= options.instruments )
+				break;
+			if( std::find(seen.begin(), seen.end(), inst.sec_id) != seen.end() )
+				continue;
+			seen.push_back(inst.sec_id);
+			instruments.push_back(inst);
+		}
+
+		return !instruments.empty();
+	}
+
+	// Moves the exchange clock on by one event gap of the burst profile.
+	void Advance()
+	{
+		double rate = options.rate;
+		switch( options.profile )
+		{
+		case PROFILE_OPEN:
+			// Ten times the base rate at the open, decaying over the first fifth.
+			rate *= 1.0 + 9.0 * std::max(0.0, 1.0 - 5.0 * event_index / (double)options.events);
+			break;
+		case PROFILE_BURSTY:
+			if( burst_left == 0 && Real() < 0.002 )
+				burst_left = Uniform(50, 500);
+			if( burst_left > 0 )
+			{
+				--burst_left;
+				rate *= 500;
+			}
+			break;
+		default:
+			break;
+		}
+
+		clock += 1 + (int64_t)(std::exponential_distribution<double>(rate)(rng) * 1e9);
+	}
+
+	// Messages
+
+	static void AppendMessage(std::vector<std::string>& messages, uint16_t template_id, const std::string& body, uint16_t block_length = BLOCK_LENGTH)
+	{
+		CmeMessage msg;
+		msg.msg_length = (uint16_t)(sizeof(msg) + body.size());
+		msg.block_length = block_length;
+		msg.template_id = template_id;
+		msg.schema_id = SCHEMA_ID;
+		msg.version_id = SCHEMA_VERSION;
+
+		std::string message((const char*)&msg, sizeof(msg));
+		message += body;
+		messages.push_back(message);
+	}
+
+	template<typename T>
+	static void AppendEntry(std::string& body, const T& entry, int entry_size)
+	{
+		std::string slot(entry_size, '\0');
+		memcpy(&slot[0], &entry, sizeof(entry));
+		body += slot;
+	}
+
+	static std::string BookMessage(uint64_t transact_time, char indicator, const std::vector<CmeBookEntry>& entries)
+	{
+		CmeBookRefresh refresh;
+		memset(&refresh, 0, sizeof(refresh));
+		refresh.transact_time = transact_time;
+		refresh.indicator = indicator;
+		refresh.entry_size = BOOK_ENTRY_SIZE;
+		refresh.num_in_group = (uint8_t)entries.size();
+
+		std::string body((const char*)&refresh, sizeof(refresh));
+		for(const CmeBookEntry& entry : entries)
+			AppendEntry(body, entry, BOOK_ENTRY_SIZE);
+		return body;
+	}
+
+	static std::string OrderBookMessage(uint64_t transact_time, char indicator, const std::vector<CmeBookOrderEntry>& entries)
+	{
+		CmeOrderRefresh refresh;
+		memset(&refresh, 0, sizeof(refresh));
+		refresh.transact_time = transact_time;
+		refresh.indicator = indicator;
+		refresh.entry_size = BOOK_ORDER_ENTRY_SIZE;
+		refresh.num_in_group = (uint8_t)entries.size();
+
+		std::string body((const char*)&refresh, sizeof(refresh));
+		for(const CmeBookOrderEntry& entry : entries)
+			AppendEntry(body, entry, BOOK_ORDER_ENTRY_SIZE);
+		return body;
+	}
+
+	static std::string TradeMessage(uint64_t transact_time, char indicator, const std::vector<CmeTradeEntry>& trades, const std::vector<CmeOrderEntry>& orders)
+	{
+		CmeTradeSummary summary;
+		memset(&summary, 0, sizeof(summary));
+		summary.transact_time = transact_time;
+		summary.indicator = indicator;
+		summary.entry_size = TRADE_ENTRY_SIZE;
+		summary.num_in_group = (uint8_t)trades.size();
+
+		std::string body((const char*)&summary, sizeof(summary));
+		for(const CmeTradeEntry& trade : trades)
+			AppendEntry(body, trade, TRADE_ENTRY_SIZE);
+
+		GroupSize8Bytes group;
+		memset(&group, 0, sizeof(group));
+		group.entry_size = ORDER_ENTRY_SIZE;
+		group.num_in_group = (uint8_t)orders.size();
+		body.append((const char*)&group, sizeof(group));
+		for(const CmeOrderEntry& order : orders)
+			AppendEntry(body, order, ORDER_ENTRY_SIZE);
+		return body;
+	}
+
+	// Splits the event's messages into packets and writes them as frames.
+	// Returns the capture time of the first packet.
+	int64_t EmitEvent(const std::vector<std::string>& messages)
+	{
+		int64_t send_time = clock + Uniform(2000, 20000);
+		int64_t capture = send_time + Uniform(50000, 150000);
+		int64_t first_capture = capture;
+
+		size_t m = 0;
+		while( m < messages.size() )
+		{
+			CmeMsgHeader header;
+			header.seq_num = ++seq_num;
+			header.send_time = send_time;
+
+			std::string payload((const char*)&header, sizeof(header));
+			do
+			{
+				payload += messages[m++];
+			}
+			while( m < messages.size() && payload.size() + messages[m].size() <= MAX_PAYLOAD );
+
+			WriteFrame(capture, payload);
+			capture += Uniform(50, 500);
+		}
+
+		return first_capture;
+	}
+
+	void WriteFrame(int64_t ts, const std::string& payload)
+	{
+		char frame[MAX_FRAME_SIZE];
+		memset(frame, 0, sizeof(IpHeader));
+
+		IpHeader* header = (IpHeader*)frame;
+		uint32_t group = ntohl(options.group);
+		const uint8_t dst_mac[ETH_ALEN] = { 0x01, 0x00, 0x5e, (uint8_t)((group >> 16) & 0x7f), (uint8_t)(group >> 8), (uint8_t)group };
+		const uint8_t src_mac[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+		memcpy(header->eth.ether_dhost, dst_mac, ETH_ALEN);
+		memcpy(header->eth.ether_shost, src_mac, ETH_ALEN);
+		header->eth.ether_type = htons(ETHERTYPE_IP);
+
+		header->ip.version = 4;
+		header->ip.ihl = 5;
+		header->ip.ttl = 16;
+		header->ip.protocol = IPPROTO_UDP;
+		header->ip.tot_len = htons((uint16_t)(sizeof(iphdr) + sizeof(udphdr) + payload.size()));
+		header->ip.id = htons((uint16_t)seq_num);
+		header->ip.saddr = htonl(0x0a000001);
+		header->ip.daddr = options.group;
+		header->ip.check = IpChecksum((const char*)header + offsetof(IpHeader, ip));
+
+		header->udp.source = htons(options.port);
+		header->udp.dest = htons(options.port);
+		header->udp.len = htons((uint16_t)(sizeof(udphdr) + payload.size()));
+
+		memcpy(frame + sizeof(IpHeader), payload.data(), payload.size());
+		writer.Write(ts, frame, (int)(sizeof(IpHeader) + payload.size()));
+	}
+
+	// The header sits unaligned in the packed IpHeader.
+	static uint16_t IpChecksum(const void* ip)
+	{
+		const char* bytes = (const char*)ip;
+		uint32_t sum = 0;
+		for(size_t i = 0; i < sizeof(iphdr); i += 2)
+		{
+			uint16_t word;
+			memcpy(&word, bytes + i, sizeof(word));
+			sum += word;
+		}
+		while( sum >> 16 )
+			sum = (sum & 0xffff) + (sum >> 16);
+		return (uint16_t)~sum;
+	}
+
+	// Entries
+
+	CmeBookEntry BookEntry(Instrument& inst, bool bid, int level, uint8_t action, const CmeLevel& data)
+	{
+		CmeBookEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.price = data.price * inst.price_shift;
+		entry.size = data.quantity;
+		entry.sec_id = inst.sec_id;
+		entry.rpt_seq_num = ++inst.rpt_seq;
+		entry.num_orders = data.orders;
+		entry.price_level = (uint8_t)(level + 1);
+		entry.action_type = action;
+		entry.entry_type = bid ? '0' : '1';
+		return entry;
+	}
+
+	CmeBookOrderEntry OrderEntry(const Instrument& inst, bool bid, uint64_t order_id, int64_t price, int qty, uint8_t action)
+	{
+		CmeBookOrderEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.order_id = order_id;
+		entry.priority = order_id;
+		entry.price = price * inst.price_shift;
+		entry.qty = qty;
+		entry.sec_id = inst.sec_id;
+		entry.update_action = (char)action;
+		entry.entry_type = bid ? '0' : '1';
+		return entry;
+	}
+
+	CmeLevel NewLevel(int64_t price)
+	{
+		CmeLevel level;
+		level.price = price;
+		level.quantity = Uniform(5, 100);
+		level.orders = Uniform(1, 10);
+		return level;
+	}
+
+	// An order id from well before the current one: a resting order.
+	uint64_t RestingOrderId()
+	{
+		return next_order_id - Uniform(1000, 1000000);
+	}
+
+	// Appends a repeating group header followed by its entries.
+	static void AppendGroup(std::string& body, uint16_t entry_size, uint8_t count, const std::string& entries = std::string())
+	{
+		GroupSize size;
+		size.entry_size = entry_size;
+		size.num_in_group = count;
+		body.append((const char*)&size, sizeof(size));
+		body += entries;
+	}
+
+	template<typename Definition>
+	static void FillDefinition(Definition& definition, const Instrument& inst)
+	{
+		memset(&definition, 0, sizeof(definition));
+		definition.indicator = LAST_MSG;
+		definition.update_action = 'A';
+		strncpy(definition.symbol, inst.symbol.c_str(), sizeof(definition.symbol));
+		definition.sec_id = inst.sec_id;
+		// At a display factor of 0.01 the increment is the cache's product of
+		// price_shift and tick, which DeriveScale() splits back into them.
+		definition.min_price_increment = inst.tick * inst.price_shift;
+		definition.display_factor = 10000000LL;
+	}
+
+	void Definition(const Instrument& inst)
+	{
+		std::string body;
+		uint16_t template_id;
+		uint16_t block_length;
+		if( inst.legs.empty() )
+		{
+			CmeInstrumentDefFuture definition;
+			FillDefinition(definition, inst);
+			template_id = 54;
+			block_length = FUTURE_DEFINITION_LENGTH;
+			body.assign((const char*)&definition, sizeof(definition));
+		}
+		else
+		{
+			CmeInstrumentDefSpread definition;
+			FillDefinition(definition, inst);
+			template_id = 56;
+			block_length = SPREAD_DEFINITION_LENGTH;
+			body.assign((const char*)&definition, sizeof(definition));
+		}
+		body.resize(block_length, '\0');
+
+		// Events, feed types, attributes and lot rules: empty.
+		AppendGroup(body, 9, 0);
+		AppendGroup(body, 4, 0);
+		AppendGroup(body, 4, 0);
+		AppendGroup(body, 5, 0);
+
+		if( template_id == 56 )
+		{
+			std::string legs;
+			for(size_t i = 0; i < inst.legs.size(); ++i)
+			{
+				CmeLegEntry leg;
+				memset(&leg, 0, sizeof(leg));
+				leg.leg_sec_id = inst.legs[i];
+				leg.leg_side = i == 0 ? 1 : 2;
+				leg.leg_ratio_qty = 1;
+				leg.leg_price = INT64_MAX;
+				leg.leg_option_delta = INT32_MAX;
+				AppendEntry(legs, leg, LEG_ENTRY_SIZE);
+			}
+			AppendGroup(body, LEG_ENTRY_SIZE, (uint8_t)inst.legs.size(), legs);
+		}
+
+		Advance();
+		std::vector<std::string> messages;
+		AppendMessage(messages, template_id, body, block_length);
+		EmitEvent(messages);
+	}
+
+	void InitialBook(Instrument& inst)
+	{
+		int64_t mid = inst.tick * Uniform(1000, 20000);
+		std::vector<CmeBookEntry> entries;
+		for(int i = 0; i < BOOK_DEPTH; ++i)
+		{
+			inst.bids.push_back(NewLevel(mid - (i + 1) * inst.tick));
+			entries.push_back(BookEntry(inst, true, i, 0, inst.bids.back()));
+			inst.asks.push_back(NewLevel(mid + (i + 1) * inst.tick));
+			entries.push_back(BookEntry(inst, false, i, 0, inst.asks.back()));
+		}
+
+		Advance();
+		std::vector<std::string> messages;
+		AppendMessage(messages, 32, BookMessage(clock, LAST_QUOTE | LAST_MSG, entries));
+		EmitEvent(messages);
+	}
+
+	// Refills a side back to BOOK_DEPTH levels after levels were removed.
+	void Refill(Instrument& inst, bool bid, std::vector<CmeBookEntry>& entries)
+	{
+		std::vector<CmeLevel>& side = bid ? inst.bids : inst.asks;
+		while( (int)side.size() < BOOK_DEPTH )
+		{
+			int64_t last = side.empty() ? (bid ? inst.asks[0].price - inst.tick : inst.bids[0].price + inst.tick) : side.back().price;
+			side.push_back(NewLevel(bid ? last - inst.tick : last + inst.tick));
+			entries.push_back(BookEntry(inst, bid, (int)side.size() - 1, 0, side.back()));
+		}
+	}
+
+	void QuoteUpdate(Instrument& inst)
+	{
+		bool bid = Uniform(0, 1) == 0;
+		std::vector<CmeLevel>& side = bid ? inst.bids : inst.asks;
+		std::vector<CmeBookEntry> entries;
+		std::vector<CmeBookOrderEntry> orders;
+
+		double r = Real();
+		bool can_improve = inst.asks[0].price - inst.bids[0].price > inst.tick;
+		if( r < 0.75 || (r < 0.9 && !can_improve) )
+		{
+			int level = Uniform(0, (int)side.size() - 1);
+			int old_qty = side[level].quantity;
+			side[level].quantity = std::max(1, old_qty + Uniform(-old_qty / 2, 20));
+			side[level].orders = std::max(1, side[level].orders + Uniform(-1, 1));
+			entries.push_back(BookEntry(inst, bid, level, 1, side[level]));
+			orders.push_back(OrderEntry(inst, bid, next_order_id++, side[level].price, std::abs(side[level].quantity - old_qty), side[level].quantity > old_qty ? 0 : 1));
+		}
+		else if( r < 0.9 )
+		{
+			CmeLevel level = NewLevel(bid ? side[0].price + inst.tick : side[0].price - inst.tick);
+			level.quantity = Uniform(1, 20);
+			level.orders = 1;
+			side.insert(side.begin(), level);
+			side.pop_back();
+			entries.push_back(BookEntry(inst, bid, 0, 0, level));
+			orders.push_back(OrderEntry(inst, bid, next_order_id++, level.price, level.quantity, 0));
+		}
+		else
+		{
+			orders.push_back(OrderEntry(inst, bid, RestingOrderId(), side[0].price, side[0].quantity, 2));
+			entries.push_back(BookEntry(inst, bid, 0, 2, side[0]));
+			side.erase(side.begin());
+			Refill(inst, bid, entries);
+		}
+
+		std::vector<std::string> messages;
+		AppendMessage(messages, 32, BookMessage(clock, LAST_QUOTE, entries));
+		AppendMessage(messages, 43, OrderBookMessage(clock, LAST_MSG, orders));
+		EmitEvent(messages);
+	}
+
+	CmeTradeEntry TradeEntry(Instrument& inst, int64_t price, int qty, bool buy, uint32_t entry_id)
+	{
+		CmeTradeEntry trade;
+		memset(&trade, 0, sizeof(trade));
+		trade.price = price * inst.price_shift;
+		trade.qty = qty;
+		trade.sec_id = inst.sec_id;
+		trade.rpt_seq = ++inst.rpt_seq;
+		trade.num_orders = 2;
+		trade.aggressor_side = buy ? 1 : 2;
+		trade.update_action = 0;
+		trade.entry_type = '2';
+		trade.entry_id = entry_id;
+		return trade;
+	}
+
+	// Passive fills for qty, split over up to three resting orders.
+	void PassiveFills(int qty, std::vector<CmeOrderEntry>& orders)
+	{
+		while( qty > 0 )
+		{
+			int fill = orders.size() % 3 == 2 ? qty : Uniform(1, qty);
+			CmeOrderEntry order;
+			order.order_id = RestingOrderId();
+			order.qty = fill;
+			order.padding = 0;
+			orders.push_back(order);
+			qty -= fill;
+		}
+	}
+
+	// A trade event where one aggressor takes `levels` price levels, the last
+	// of them only partially. Aggressors after the first, if stops > 0, are
+	// elected stop orders that each take one of the levels after the first.
+	void Trade(Instrument& inst, int levels, int stops)
+	{
+		bool buy = Uniform(0, 1) == 0;
+		std::vector<CmeLevel>& side = buy ? inst.asks : inst.bids;
+		if( side[levels - 1].quantity < 2 )
+		{
+			// Too small to fill partially: top it up in an event of its own.
+			side[levels - 1].quantity += Uniform(5, 20);
+
+			std::vector<CmeBookEntry> entries;
+			entries.push_back(BookEntry(inst, !buy, levels - 1, 1, side[levels - 1]));
+			std::vector<std::string> messages;
+			AppendMessage(messages, 32, BookMessage(clock, LAST_QUOTE | LAST_MSG, entries));
+			EmitEvent(messages);
+			Advance();
+		}
+
+		std::vector<CmeTradeEntry> trades;
+		std::vector<CmeOrderEntry> orders;
+		std::vector<uint64_t> stop_ids;
+
+		uint64_t aggressor_id = next_order_id++;
+		int aggressor_qty = 0;
+		std::vector<CmeOrderEntry> passives;
+		for(int l = 0; l < levels; ++l)
+		{
+			int qty = l == levels - 1 ? Uniform(1, side[l].quantity - 1) : side[l].quantity;
+			trades.push_back(TradeEntry(inst, side[l].price, qty, buy, (uint32_t)(trades.size() + 1)));
+
+			if( stops > 0 && l > 0 )
+			{
+				// Each elected stop is its own aggressor, older than the first.
+				CmeOrderEntry aggressor = { aggressor_id, aggressor_qty, 0 };
+				orders.push_back(aggressor);
+				orders.insert(orders.end(), passives.begin(), passives.end());
+				passives.clear();
+
+				aggressor_id = RestingOrderId();
+				stop_ids.push_back(aggressor_id);
+				aggressor_qty = 0;
+			}
+
+			aggressor_qty += qty;
+			PassiveFills(qty, passives);
+		}
+
+		CmeOrderEntry aggressor = { aggressor_id, aggressor_qty, 0 };
+		orders.push_back(aggressor);
+		orders.insert(orders.end(), passives.begin(), passives.end());
+
+		std::vector<CmeBookEntry> entries;
+		for(int l = 0; l < levels - 1; ++l)
+		{
+			entries.push_back(BookEntry(inst, !buy, 0, 2, side[0]));
+			side.erase(side.begin());
+		}
+		side[0].quantity -= trades.back().qty;
+		entries.push_back(BookEntry(inst, !buy, 0, 1, side[0]));
+		Refill(inst, !buy, entries);
+
+		std::vector<CmeBookOrderEntry> book_orders;
+		for(const CmeOrderEntry& order : passives)
+			book_orders.push_back(OrderEntry(inst, !buy, order.order_id, side[0].price, 0, 2));
+
+		std::vector<std::string> messages;
+		AppendMessage(messages, 42, TradeMessage(clock, LAST_TRADE, trades, orders));
+		AppendMessage(messages, 32, BookMessage(clock, LAST_QUOTE, entries));
+		AppendMessage(messages, 43, OrderBookMessage(clock, LAST_MSG, book_orders));
+		int64_t ts = EmitEvent(messages);
+
+		if( levels > 1 && truth.is_open() )
+		{
+			truth << "sweep," << ts << ',' << inst.symbol << ',' << trades[0].price / inst.price_shift << ',' << (buy ? 'B' : 'S') << ",0\n";
+			for(uint64_t stop_id : stop_ids)
+				truth << "stop," << ts << ',' << inst.symbol << ',' << trades[0].price / inst.price_shift << ',' << (buy ? 'B' : 'S') << ',' << stop_id << '\n';
+		}
+	}
+
+	void StopCascade(Instrument& inst)
+	{
+		Trade(inst, Uniform(3, 5), 1);
+	}
+
+	// An aggressor takes more than the displayed size at the top of one side,
+	// and the level is refilled at the same price; repeated a few times.
+	void IcebergHits(Instrument& inst)
+	{
+		bool buy = Uniform(0, 1) == 0;
+		std::vector<CmeLevel>& side = buy ? inst.asks : inst.bids;
+		int64_t price = side[0].price;
+		int show = side[0].quantity;
+		uint64_t iceberg_id = RestingOrderId();
+
+		int hits = Uniform(1, 3);
+		int64_t first_ts = 0;
+		for(int h = 0; h < hits; ++h)
+		{
+			if( h > 0 )
+				Advance();
+
+			int qty = show + Uniform(1, 3 * show);
+
+			std::vector<CmeTradeEntry> trades;
+			trades.push_back(TradeEntry(inst, price, qty, buy, 1));
+
+			std::vector<CmeOrderEntry> orders;
+			CmeOrderEntry aggressor = { next_order_id++, qty, 0 };
+			CmeOrderEntry passive = { iceberg_id, qty, 0 };
+			orders.push_back(aggressor);
+			orders.push_back(passive);
+
+			std::vector<CmeBookEntry> entries;
+			entries.push_back(BookEntry(inst, !buy, 0, 1, side[0]));
+
+			std::vector<CmeBookOrderEntry> book_orders;
+			book_orders.push_back(OrderEntry(inst, !buy, iceberg_id, price, show, 1));
+
+			std::vector<std::string> messages;
+			AppendMessage(messages, 42, TradeMessage(clock, LAST_TRADE, trades, orders));
+			AppendMessage(messages, 32, BookMessage(clock, LAST_QUOTE, entries));
+			AppendMessage(messages, 43, OrderBookMessage(clock, LAST_MSG, book_orders));
+			int64_t ts = EmitEvent(messages);
+			if( h == 0 )
+				first_ts = ts;
+		}
+
+		if( truth.is_open() )
+			truth << "iceberg," << first_ts << ',' << inst.symbol << ',' << price << ',' << (buy ? 'S' : 'B') << ",0\n";
+	}
+
+	const Options& options;
+	std::mt19937_64 rng;
+	std::vector<Instrument> instruments;
+
+	CaptureWriter writer;
+	std::ofstream truth;
+
+	uint32_t seq_num;
+	uint64_t next_order_id;
+	int64_t clock;
+	int burst_left;
+	uint64_t event_index;
+};
+
+static void usage(const char* prog)
+{
+	fprintf(stderr,
+			"usage: %s --out <capture> [options]\n"
+			"  --format erf|pcap       capture format (default erf)\n"
+			"  --truth <file>          ground truth CSV of embedded sweeps, icebergs and stops\n"
+			"  --ids <file>            instrument universe (default cme_ids.txt)\n"
+			"  --instruments <n>       instruments sampled from the universe (default 100)\n"
+			"  --events <n>            events to generate (default 1000000)\n"
+			"  --rate <n>              mean events per second (default 20000)\n"
+			"  --profile steady|open|bursty\n"
+			"  --sweeps <p>            probability an event is a sweep (default 0.01)\n"
+			"  --icebergs <p>          probability an event is an iceberg (default 0.005)\n"
+			"  --stops <p>             probability an event is a stop cascade (default 0.003)\n"
+			"  --trades <p>            probability an event is a plain trade (default 0.15)\n"
+			"  --definitions 0|1       start with instrument definitions (templates 54/56)\n"
+			"  --seed <n>\n"
+			"  --group <addr> --port <n>\n",
+			prog);
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	inet_pton(AF_INET, "224.0.31.1", &options.group);
+
+	for(int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : 0;
+		if( !value )
+		{
+			usage(argv[0]);
+			return 1;
+		}
+		++i;
+
+		if( strcmp(arg, "--out") == 0 )
+			options.out_path = value;
+		else if( strcmp(arg, "--format") == 0 )
+			options.pcap = strcmp(value, "pcap") == 0;
+		else if( strcmp(arg, "--truth") == 0 )
+			options.truth_path = value;
+		else if( strcmp(arg, "--ids") == 0 )
+			options.ids_path = value;
+		else if( strcmp(arg, "--instruments") == 0 )
+			options.instruments = atoi(value);
+		else if( strcmp(arg, "--events") == 0 )
+			options.events = strtoull(value, 0, 10);
+		else if( strcmp(arg, "--rate") == 0 )
+			options.rate = atof(value);
+		else if( strcmp(arg, "--profile") == 0 )
+			options.profile = strcmp(value, "open") == 0 ? PROFILE_OPEN : strcmp(value, "bursty") == 0 ? PROFILE_BURSTY : PROFILE_STEADY;
+		else if( strcmp(arg, "--sweeps") == 0 )
+			options.sweep_rate = atof(value);
+		else if( strcmp(arg, "--icebergs") == 0 )
+			options.iceberg_rate = atof(value);
+		else if( strcmp(arg, "--stops") == 0 )
+			options.stop_rate = atof(value);
+		else if( strcmp(arg, "--trades") == 0 )
+			options.trade_rate = atof(value);
+		else if( strcmp(arg, "--definitions") == 0 )
+			options.definitions = atoi(value) != 0;
+		else if( strcmp(arg, "--seed") == 0 )
+			options.seed = strtoull(value, 0, 10);
+		else if( strcmp(arg, "--group") == 0 )
+			inet_pton(AF_INET, value, &options.group);
+		else if( strcmp(arg, "--port") == 0 )
+			options.port = (uint16_t)atoi(value);
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if( !options.out_path || options.instruments <= 0 )
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	Generator generator(options);
+	if( !generator.Open() )
+		return 1;
+
+	generator.Run();
+	return 0;
+}
@@ -0,0 +1,152 @@
+// Replays the UDP payloads of an ERF capture to their original multicast
+// groups, by default over loopback, so the live ingest path can be exercised
+// locally. Pacing follows the capture timestamps divided by --speed; a speed
+// of 0 sends as fast as possible.
+
+#include "capture_file.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int64_t now_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void wait_until(int64_t deadline)
+{
+	int64_t remaining = deadline - now_ns();
+	if( remaining > 200000 )
+	{
+		timespec sleep_time;
+		sleep_time.tv_sec = (remaining - 100000) / 1000000000LL;
+		sleep_time.tv_nsec = (remaining - 100000) % 1000000000LL;
+		nanosleep(&sleep_time, 0);
+	}
+
+	while( now_ns() < deadline )
+		;
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr, "usage: %s <capture> [--speed <factor>] [--iface <addr>] [--group <addr>] [--ttl <n>] [--loops <n>]\n", prog);
+}
+
+int main(int argc, char** argv)
+{
+	if( argc < 2 )
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	double speed = 1.0;
+	const char* iface = "127.0.0.1";
+	const char* group_override = 0;
+	int ttl = 0;
+	int loops = 1;
+
+	for(int i = 2; i < argc; ++i)
+	{
+		if( strcmp(argv[i], "--speed") == 0 && i + 1 < argc )
+			speed = atof(argv[++i]);
+		else if( strcmp(argv[i], "--iface") == 0 && i + 1 < argc )
+			iface = argv[++i];
+		else if( strcmp(argv[i], "--group") == 0 && i + 1 < argc )
+			group_override = argv[++i];
+		else if( strcmp(argv[i], "--ttl") == 0 && i + 1 < argc )
+			ttl = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--loops") == 0 && i + 1 < argc )
+			loops = atoi(argv[++i]);
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if( fd < 0 )
+	{
+		perror("socket");
+		return 1;
+	}
+
+	in_addr iface_addr;
+	if( inet_pton(AF_INET, iface, &iface_addr) != 1 )
+	{
+		fprintf(stderr, "invalid interface address %s\n", iface);
+		return 1;
+	}
+
+	unsigned char loop = 1;
+	unsigned char mttl = (unsigned char)ttl;
+	setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface_addr, sizeof(iface_addr));
+	setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+	setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl));
+
+	sockaddr_in dest;
+	memset(&dest, 0, sizeof(dest));
+	dest.sin_family = AF_INET;
+	if( group_override && inet_pton(AF_INET, group_override, &dest.sin_addr) != 1 )
+	{
+		fprintf(stderr, "invalid group address %s\n", group_override);
+		return 1;
+	}
+
+	uint64_t sent = 0;
+	int64_t start = now_ns();
+	for(int l = 0; l < loops; ++l)
+	{
+		CaptureReader reader;
+		if( !reader.Open(argv[1]) )
+		{
+			perror(argv[1]);
+			return 1;
+		}
+
+		int64_t first_ts = 0;
+		int64_t wall_base = now_ns();
+
+		int64_t ts;
+		const char* frame;
+		int length;
+		while( reader.Next(ts, frame, length) )
+		{
+			const IpHeader* pkt_header = (const IpHeader*)frame;
+			if( length < (int)sizeof(IpHeader) || pkt_header->eth.ether_type != 8 || pkt_header->ip.protocol != IPPROTO_UDP )
+				continue;
+
+			if( first_ts == 0 )
+				first_ts = ts;
+
+			if( speed > 0 )
+				wait_until(wall_base + (int64_t)((ts - first_ts) / speed));
+
+			if( !group_override )
+				dest.sin_addr.s_addr = pkt_header->ip.daddr;
+			dest.sin_port = pkt_header->udp.dest;
+
+			int payload = be16toh(pkt_header->udp.len) - sizeof(pkt_header->udp);
+			if( sendto(fd, frame + sizeof(IpHeader), payload, 0, (sockaddr*)&dest, sizeof(dest)) < 0 )
+				perror("sendto");
+			else
+				++sent;
+		}
+	}
+
+	double elapsed = (now_ns() - start) / 1e9;
+	fprintf(stderr, "sent %llu packets in %.3fs (%.0f packets/s)\n",
+			(unsigned long long)sent, elapsed, elapsed > 0 ? sent / elapsed : 0.0);
+
+	close(fd);
+	return 0;
+}
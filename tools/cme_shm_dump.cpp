@@ -0,0 +1,84 @@
+// Prints the books in a shared-memory region written by cme_parser --shm as
+// CSV, one line per security with its bid and ask levels, best first. With
+// sec_ids only those are printed.
+
+#include "cme_parser.h"
+#include "book_publisher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+static void print_book(const ShmBook& book, uint32_t seq, int depth)
+{
+	printf("%s,%d,%s,%llu,%u", time_to_str(book.ts).c_str(), book.sec_id, book.symbol, (unsigned long long)book.updates, seq);
+	for(int s = 0; s < NUM_SHM_SIDES; ++s)
+	{
+		for(int i = 0; i < depth; ++i)
+		{
+			if( i < book.count[s] )
+			{
+				const ShmLevel& level = book.levels[s][i];
+				printf(",%lld,%d,%d", (long long)(level.price / book.price_shift), level.quantity, level.orders);
+			}
+			else
+				printf(",,,");
+		}
+	}
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	if( argc < 2 )
+	{
+		fprintf(stderr, "usage: %s <name> [sec_id...]\n", argv[0]);
+		return 1;
+	}
+
+	BookSubscriber subscriber;
+	if( !subscriber.Open(argv[1]) )
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	int depth = MAX_LEVELS;
+
+	printf("ts,sec_id,symbol,updates,seq");
+	static const char* sides[NUM_SHM_SIDES] = { "bid", "ask", "implied_bid", "implied_ask" };
+	for(int s = 0; s < NUM_SHM_SIDES; ++s)
+	{
+		for(int i = 1; i <= depth; ++i)
+			printf(",%s_price_%d,%s_qty_%d,%s_orders_%d", sides[s], i, sides[s], i, sides[s], i);
+	}
+	printf("\n");
+
+	std::vector<int> slots;
+	if( argc > 2 )
+	{
+		for(int i = 2; i < argc; ++i)
+		{
+			int slot = subscriber.Find(atoi(argv[i]));
+			if( slot < 0 )
+				fprintf(stderr, "%s: not published\n", argv[i]);
+			else
+				slots.push_back(slot);
+		}
+	}
+	else
+	{
+		for(uint32_t slot = 0; slot < subscriber.Used(); ++slot)
+			slots.push_back(slot);
+	}
+
+	ShmBook book;
+	uint32_t seq;
+	for(int slot : slots)
+	{
+		subscriber.Read(slot, book, seq);
+		print_book(book, seq, depth);
+	}
+	return 0;
+}
@@ -0,0 +1,413 @@
+#include "uring_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#define __NR_io_uring_enter 426
+#define __NR_io_uring_register 427
+#endif
+
+// O_DIRECT wants buffers, offsets and lengths aligned to the logical block
+// size of the device; blocks are page aligned and READ_SIZE long.
+static constexpr const size_t DIRECT_ALIGN = 4096;
+
+static int io_uring_setup(unsigned entries, io_uring_params* params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, 0, 0);
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+UringReader::UringReader()
+	: fd(-1)
+	, ring_fd(-1)
+	, direct(false)
+	, registered(false)
+	, failed(false)
+	, file_size(0)
+	, next_offset(0)
+	, stalls(0)
+	, sq_ring(0)
+	, sq_ring_size(0)
+	, cq_ring(0)
+	, cq_ring_size(0)
+	, sqes(0)
+	, sqes_size(0)
+	, to_submit(0)
+	, in_flight(0)
+	, buffers(0)
+	, depth(0)
+	, current(-1)
+	, pos(0)
+{
+}
+
+UringReader::~UringReader()
+{
+	Close();
+}
+
+bool UringReader::Open(const char* path, int depth)
+{
+	Close();
+	failed = false;
+	stalls = 0;
+	this->depth = depth < 1 ? 1 : depth > MAX_DEPTH ? MAX_DEPTH : depth;
+
+	fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+	direct = fd >= 0;
+	if( fd < 0 && errno == EINVAL )
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+	if( fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat(fd, &st) != 0 )
+	{
+		int error = errno;
+		Close();
+		errno = error;
+		return false;
+	}
+	file_size = (uint64_t)st.st_size;
+
+	void* mapped = mmap(0, (size_t)this->depth * READ_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if( mapped == MAP_FAILED )
+	{
+		int error = errno;
+		Close();
+		errno = error;
+		return false;
+	}
+	buffers = (char*)mapped;
+
+	// Some filesystems accept O_DIRECT at open and only refuse the reads.
+	if( direct && file_size && pread(fd, buffers, DIRECT_ALIGN, 0) < 0 && errno == EINVAL )
+	{
+		close(fd);
+		direct = false;
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if( fd < 0 )
+		{
+			int error = errno;
+			Close();
+			errno = error;
+			return false;
+		}
+	}
+	if( !direct )
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if( !SetupRing(this->depth) )
+	{
+		int error = errno;
+		Close();
+		errno = error;
+		return false;
+	}
+
+	iovec iov[MAX_DEPTH];
+	for(int i = 0; i < this->depth; ++i)
+	{
+		blocks[i].data = buffers + (size_t)i * READ_SIZE;
+		iov[i].iov_base = blocks[i].data;
+		iov[i].iov_len = READ_SIZE;
+	}
+	// Pinning needs RLIMIT_MEMLOCK headroom on older kernels.
+	registered = io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iov, this->depth) == 0;
+
+	for(int i = 0; i < this->depth; ++i)
+		Queue(i, (uint64_t)i * READ_SIZE);
+	next_offset = (uint64_t)this->depth * READ_SIZE;
+	current = -1;
+	pos = 0;
+
+	Flush();
+	return !failed;
+}
+
+bool UringReader::SetupRing(int entries)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring_fd = io_uring_setup(entries, &params);
+	if( ring_fd < 0 )
+		return false;
+
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if( single_mmap )
+		sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+	void* mapped = mmap(0, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if( mapped == MAP_FAILED )
+		return false;
+	sq_ring = mapped;
+
+	if( single_mmap )
+		cq_ring = sq_ring;
+	else
+	{
+		mapped = mmap(0, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if( mapped == MAP_FAILED )
+			return false;
+		cq_ring = mapped;
+	}
+
+	sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	mapped = mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if( mapped == MAP_FAILED )
+		return false;
+	sqes = (io_uring_sqe*)mapped;
+
+	char* sq = (char*)sq_ring;
+	sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+	sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	char* cq = (char*)cq_ring;
+	cq_head = (unsigned*)(cq + params.cq_off.head);
+	cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+	cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	to_submit = 0;
+	in_flight = 0;
+	return true;
+}
+
+void UringReader::Close()
+{
+	// The kernel writes into the blocks until their reads complete.
+	while( in_flight > 0 && Complete(true) )
+		;
+
+	bool quiesced = in_flight == 0;
+	if( sqes )
+		munmap(sqes, sqes_size);
+	if( cq_ring && cq_ring != sq_ring )
+		munmap(cq_ring, cq_ring_size);
+	if( sq_ring )
+		munmap(sq_ring, sq_ring_size);
+	sqes = 0;
+	cq_ring = sq_ring = 0;
+
+	if( ring_fd >= 0 )
+		close(ring_fd);
+	ring_fd = -1;
+
+	if( buffers && quiesced )
+		munmap(buffers, (size_t)depth * READ_SIZE);
+	buffers = 0;
+
+	if( fd >= 0 )
+		close(fd);
+	fd = -1;
+
+	registered = false;
+	to_submit = 0;
+	in_flight = 0;
+	current = -1;
+	pos = 0;
+}
+
+void UringReader::Queue(int block, uint64_t offset)
+{
+	Block& b = blocks[block];
+	b.offset = offset;
+	b.wanted = offset >= file_size ? 0 : file_size - offset < READ_SIZE ? (size_t)(file_size - offset) : READ_SIZE;
+	b.length = 0;
+	b.pending = b.wanted > 0;
+	if( b.pending )
+		Submit(block);
+}
+
+// Reads the rest of the block; a short read is continued from where it
+// stopped.
+void UringReader::Submit(int block)
+{
+	Block& b = blocks[block];
+	unsigned tail = *sq_tail;
+	unsigned index = tail & sq_mask;
+
+	io_uring_sqe* sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)(b.data + b.length);
+	sqe->len = (uint32_t)(READ_SIZE - b.length);
+	sqe->off = b.offset + b.length;
+	sqe->buf_index = registered ? (uint16_t)block : 0;
+	sqe->user_data = (uint64_t)block;
+
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++to_submit;
+	++in_flight;
+}
+
+void UringReader::Flush()
+{
+	while( to_submit > 0 )
+	{
+		int submitted = io_uring_enter(ring_fd, to_submit, 0, 0);
+		if( submitted < 0 )
+		{
+			if( errno == EINTR || errno == EAGAIN || errno == EBUSY )
+				continue;
+			// Left in the ring, never to complete.
+			in_flight -= (int)to_submit;
+			to_submit = 0;
+			failed = true;
+			return;
+		}
+		to_submit -= (unsigned)submitted;
+	}
+}
+
+// Reaps the completions there are, or with wait blocks for at least one.
+// False if there were none.
+bool UringReader::Complete(bool wait)
+{
+	Flush();
+
+	unsigned head = *cq_head;
+	unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	while( head == tail )
+	{
+		if( !wait )
+			return false;
+
+		if( io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR )
+		{
+			failed = true;
+			return false;
+		}
+		tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	for(; head != tail; ++head)
+	{
+		const io_uring_cqe& cqe = cqes[head & cq_mask];
+		int block = (int)cqe.user_data;
+		Block& b = blocks[block];
+		--in_flight;
+
+		if( cqe.res < 0 )
+		{
+			if( cqe.res == -EAGAIN || cqe.res == -EINTR )
+				Submit(block);
+			else
+			{
+				failed = true;
+				errno = -cqe.res;
+				b.pending = false;
+			}
+			continue;
+		}
+
+		b.length += (size_t)cqe.res;
+		if( cqe.res == 0 || b.length >= b.wanted )
+		{
+			// Nothing more when the file was cut short under us.
+			b.wanted = std::min(b.wanted, b.length);
+			b.length = b.wanted;
+			b.pending = false;
+		}
+		else
+			Submit(block);
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool UringReader::NextBlock()
+{
+	if( ring_fd < 0 )
+		return false;
+
+	if( current >= 0 )
+	{
+		Queue(current, next_offset);
+		next_offset += READ_SIZE;
+	}
+	current = (current + 1) % depth;
+	pos = 0;
+
+	Block& b = blocks[current];
+	if( b.pending )
+	{
+		Complete(false);
+		if( b.pending )
+			++stalls;
+		while( b.pending && !failed )
+			Complete(true);
+	}
+
+	return !failed && b.length > 0;
+}
+
+const char* UringReader::Read(size_t n)
+{
+	if( (current < 0 || pos == blocks[current].length) && !NextBlock() )
+		return 0;
+
+	Block* b = &blocks[current];
+	if( b->length - pos >= n )
+	{
+		const char* data = b->data + pos;
+		pos += n;
+		return data;
+	}
+
+	// The record straddles the end of the block: gather it in scratch.
+	if( n > sizeof(scratch) )
+		return 0;
+
+	size_t have = 0;
+	for(;;)
+	{
+		size_t take = std::min(b->length - pos, n - have);
+		memcpy(scratch + have, b->data + pos, take);
+		have += take;
+		pos += take;
+
+		if( have == n )
+			return scratch;
+		if( !NextBlock() )
+			return 0;
+		b = &blocks[current];
+	}
+}
+
+const char* UringReader::Head(size_t& length)
+{
+	if( current < 0 && !NextBlock() )
+	{
+		length = 0;
+		return 0;
+	}
+
+	length = blocks[current].length - pos;
+	return blocks[current].data + pos;
+}
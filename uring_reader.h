@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef _URING_READER_H_
+#define _URING_READER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Reads a file front to back through io_uring, keeping a read of every block
+// of a ring in flight, so the storage works ahead of the parser instead of
+// the parser waiting on each page cache miss in turn.
+//
+// The file is opened with O_DIRECT where the filesystem allows it, so large
+// captures neither go through nor evict the page cache, and the blocks are
+// registered with the ring as fixed buffers. Both fall back quietly: to
+// buffered reads, and to unregistered buffers. The ring is driven with the
+// raw system calls, without liburing.
+//
+// Read() hands out pointers into a block as soon as its read has landed;
+// once the reader moves past a block it is queued again for the next part
+// of the file. A record that straddles two blocks is copied into a scratch
+// buffer. A pointer stays valid until the next call to Read().
+class UringReader
+{
+public:
+	static constexpr const size_t READ_SIZE = 1 << 20;
+	static constexpr const int DEFAULT_DEPTH = 8;
+	static constexpr const int MAX_DEPTH = 64;
+	static constexpr const size_t MAX_RECORD = 4096;
+
+	UringReader();
+	~UringReader();
+
+	// Starts depth block reads. False, with errno set, if the file cannot
+	// be opened or io_uring is unavailable.
+	bool Open(const char* path, int depth = DEFAULT_DEPTH);
+	void Close();
+
+	// The next n bytes (n <= MAX_RECORD) of the file, or 0 at its end.
+	const char* Read(size_t n);
+
+	// The bytes available before the first Read(), without consuming them.
+	const char* Head(size_t& length);
+
+	// False if a read failed.
+	bool Ok() const { return !failed; }
+
+	bool Direct() const { return direct; }
+	bool Registered() const { return registered; }
+
+	// Times Read() had to wait for a block to land.
+	uint64_t Stalls() const { return stalls; }
+
+private:
+	struct Block
+	{
+		char* data;
+		uint64_t offset;	// in the file
+		size_t wanted;		// bytes of the file it holds once read
+		size_t length;		// read so far
+		bool pending;
+	};
+
+	bool SetupRing(int depth);
+	void Queue(int block, uint64_t offset);
+	void Submit(int block);
+	void Flush();
+	bool Complete(bool wait);
+	bool NextBlock();
+
+	int fd;
+	int ring_fd;
+	bool direct;
+	bool registered;
+	bool failed;
+	uint64_t file_size;
+	uint64_t next_offset;
+	uint64_t stalls;
+
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	io_uring_sqe* sqes;
+	size_t sqes_size;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	io_uring_cqe* cqes;
+	unsigned to_submit;
+	int in_flight;
+
+	char* buffers;
+	int depth;
+	Block blocks[MAX_DEPTH];
+	int current;
+	size_t pos;
+	char scratch[MAX_RECORD];
+};
+
+#endif // _URING_READER_H_